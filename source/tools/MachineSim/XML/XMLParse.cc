@@ -49,12 +49,27 @@ using namespace std;
   }                                                                         \
 } while(0);
 
+#define PARSE_CHILD_STRING(X, Y)                                      do {  \
+  unsigned int NumofCom = xNode.nChildNode("param");                        \
+  for (unsigned int k=0; k <NumofCom; ++k)                                  \
+  {                                                                         \
+    if (!strcmp(xNode.getChildNode("param",k).getAttribute("name"),X))      \
+    {                                                                       \
+         strncpy(Y, xNode.getChildNode("param",k).getAttribute("value"),    \
+                 sizeof(Y)-1);                                              \
+         Y[sizeof(Y)-1] = 0;                                                \
+    }                                                                       \
+  }                                                                         \
+} while(0);
+
 void ParseXML::parse_cache_params(const XMLNode &xNode, cache_systemcore *cache)
 {
    PARSE_CHILD_PARAMS("cache_enable"  , cache->cache_enable); 
    PARSE_CHILD_PARAMS("number_entries", cache->number_entries); 
    PARSE_CHILD_PARAMS("cache_linesize", cache->cache_linesize); 
    PARSE_CHILD_PARAMS("associativity" , cache->associativity); 
+   PARSE_CHILD_PARAMS("non_inclusive" , cache->non_inclusive); 
+   PARSE_CHILD_STRING("replacement_policy", cache->replacement_policy); 
 }
 
 void ParseXML::parse(const char* filepath)
@@ -95,6 +110,10 @@ void ParseXML::print_cache_params(FILE *out, const char *cache_name, cache_syste
    PARSEXML_PRINT_FIELD(out, cache_name, "number_entries", cache->number_entries);
    PARSEXML_PRINT_FIELD(out, cache_name, "cache_linesize", cache->cache_linesize);
    PARSEXML_PRINT_FIELD(out, cache_name, "associativity" , cache->associativity);
+   if (cache->non_inclusive) 
+      PARSEXML_PRINT_FIELD(out, cache_name, "non_inclusive" , cache->non_inclusive);
+   if (cache->replacement_policy[0]) 
+      MY_FPRINTF(out, "%s.%s:%s\n", cache_name, "replacement_policy", cache->replacement_policy);
 }
 
 void ParseXML::print(FILE *out)
@@ -43,6 +43,8 @@ typedef struct {
   int cache_linesize;
   int number_entries;
   int associativity;
+  int non_inclusive;
+  char replacement_policy[16];
 } cache_systemcore;
 
 typedef struct{
@@ -38,19 +38,138 @@ END_LEGAL */
 #include "pin.H"
 #include "utils.hh"
 
-/* DoBasicBlockCount - count # of basicblocks executed */
-LOCALFUN void DoBasicBlockCount(void) 
+#include <map>
+#include <algorithm>
+
+/* ===================================================================== */
+/* Globals variables */
+/* ===================================================================== */
+/* the static counts of all the instrumented basicblocks, by their address */
+/* and instructions. a basicblock instrumented again after the simulation */
+/* was switched off and on, or in another trace, reuses the counts when   */
+/* they are the same. jitted code put at the address of older code gets  */
+/* counts of its own.                                                    */
+typedef std::multimap<std::pair<ADDRINT, UINT32>, SimInsCount::BBLCOUNT*> BBLCOUNT_MAP;
+static BBLCOUNT_MAP BblCounts;
+/* the last million instructions the simulation speed was reported at */
+static UINT64 LastReportedMega = 0;
+
+/* =============================================== */
+/* Instruction Count.                              */
+/* =============================================== */
+
+/* EstimateMIPS - estimate the million instruction per second */
+LOCALFUN VOID EstimateMIPS(UINT64 icount)
+{
+    /* calculate elapsed time. */
+    clock_gettime(CLOCK_MONOTONIC, SimTheOne->get_time_fini());
+    double seconds = ((double)SimTheOne->get_time_fini()->tv_sec + 
+                     NANO*SimTheOne->get_time_fini()->tv_nsec) -
+                     ((double)SimTheOne->get_time_init()->tv_sec + 
+                     NANO*SimTheOne->get_time_init()->tv_nsec);
+
+    MACHINESIM_PRINT("Simulated %lluM instructions %lf MIPS\n", 
+                    (unsigned long long) icount/MEGA, 
+                    (double) icount/MEGA/seconds);
+    return;
+}
+
+/* MaxInstructionExecuted - check whether to exit due to max inst count */
+LOCALFUN VOID MaxInstructionExecuted(UINT64 icount)
+{
+    if (icount > SimOpts->get_maxsiminst())
+    {
+        MACHINESIM_PRINT("PIN_ExitApplication due to reaching max sim count\n");
+        PIN_ExitApplication(0);
+    }
+    return;
+}
+
+/* CheckInstructionCount - called when a thread has counted past its next */
+/* check point. sums up all the threads and decides when to check again.  */
+LOCALFUN VOID CheckInstructionCount(SimInsCount *count)
+{
+    UINT64 icount  = 0;
+    UINT64 threads = 0;
+    for (THREADID tid=0; tid<MAX_CACHE_THREAD; ++tid)
+    {
+        UINT64 tcount = SimTheOne->get_thread_icount(tid)->icount;
+        icount  += tcount;
+        threads += (tcount != 0);
+    }
+
+    if (icount/MEGA != LastReportedMega) 
+    {
+        LastReportedMega = icount/MEGA;
+        EstimateMIPS(icount);
+    }
+
+    MaxInstructionExecuted(icount);
+    CacheCheckpointAt(icount, threads);
+
+    /* check again in a million instructions, or sooner once all */
+    /* the threads together get close to the max sim count.      */
+    UINT64 left = (SimOpts->get_maxsiminst() - icount) / std::max<UINT64>(threads, 1);
+    count->nextcheck = count->icount + std::max<UINT64>(std::min<UINT64>(left, MEGA), 1);
+    return;
+}
+
+/* DoBasicBlockICount - This function is called before every basicblock is executed */
+LOCALFUN VOID DoBasicBlockICount(const SimInsCount::BBLCOUNT *bbl, THREADID tid) 
 {
-    SimTheOne->IncBasicBlock();
+    if (!SimWait->dosim()) return;
+    /* instructions run to warm the caches are not counted either */
+    if (!SimWait->dostats()) return;
+
+    /* the whole basicblock is counted into this thread's slot */
+    SimInsCount *count = SimTheOne->get_thread_icount(tid);
+    count->Add(bbl);
+
+    if (CACHESIM_unlikely(count->icount >= count->nextcheck)) CheckInstructionCount(count);
+
+    /* done */
+    return;
 }
 
+/* SimpleBasicBlockCount - count instructions and their types once per basicblock */
 LOCALFUN VOID SimpleBasicBlockCount(TRACE trace, VOID *v)
 {
     // Visit every basic block  in the trace
     for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
     {
-        // Insert a call to docount before every bbl, passing the number of instructions
-        BBL_InsertCall(bbl, IPOINT_BEFORE, DoBasicBlockCount, IARG_END);
+        // Count the instructions of the basicblock by type.
+        SimInsCount::BBLCOUNT counted;
+        memset(&counted, 0, sizeof(counted));
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            ++ counted.icount;
+            if (INS_IsMemoryRead(ins))  ++ counted.type[SimInsCount::INS_LOAD];
+            if (INS_IsMemoryWrite(ins)) ++ counted.type[SimInsCount::INS_STORE];
+            if (INS_IsBranch(ins))      ++ counted.type[SimInsCount::INS_BRANCH];
+            if (INS_IsCall(ins))        ++ counted.type[SimInsCount::INS_CALL];
+            if (INS_IsRet(ins))         ++ counted.type[SimInsCount::INS_RET];
+        }
+
+        // Reuse the counts of the basicblock seen at the address, if they are the same.
+        const std::pair<ADDRINT, UINT32> key(BBL_Address(bbl), BBL_NumIns(bbl));
+        SimInsCount::BBLCOUNT *count = NULL;
+        for (std::pair<BBLCOUNT_MAP::iterator, BBLCOUNT_MAP::iterator> R = BblCounts.equal_range(key); 
+             R.first != R.second && !count; ++R.first)
+        {
+            if (!memcmp(R.first->second, &counted, sizeof(counted))) count = R.first->second;
+        }
+        if (!count)
+        {
+            count = new SimInsCount::BBLCOUNT(counted);
+            BblCounts.insert(std::make_pair(key, count));
+        }
+
+        // Insert a call to DoBasicBlockICount before every bbl, passing its counts
+        BBL_InsertCall(bbl, IPOINT_BEFORE, 
+                       (AFUNPTR)DoBasicBlockICount, 
+                       IARG_PTR, count, 
+                       IARG_THREAD_ID, 
+                       IARG_END);
     }
 }
  
@@ -58,7 +177,8 @@ LOCALFUN VOID SimpleBasicBlockCount(TRACE trace, VOID *v)
 /* TraceInstrument - setup call to do basicblock level instrumentation */
 VOID TraceInstrument(TRACE trace, VOID *v)
 {
-    if (SimOpts->get_ins_count()) SimpleBasicBlockCount(trace, v);
+    /* nothing is counted while fast-forwarding. */
+    if (SimOpts->get_ins_count() && SimWait->instrument()) SimpleBasicBlockCount(trace, v);
     return;
 }
 
@@ -69,6 +189,7 @@ void MachineSimBasicBlockModuleInit(void)
 
 void MachineSimBasicBlockModuleFini(void)
 {
-    /* do nothing right now */
+    for (BBLCOUNT_MAP::iterator I=BblCounts.begin(), E=BblCounts.end(); I!=E; ++I) delete I->second;
+    BblCounts.clear();
 }
 
@@ -42,10 +42,17 @@ END_LEGAL */
 #include "predictor.hh"
 
 #include <pthread.h>
+#if defined(TARGET_IA32E)
+#include <immintrin.h>
+#endif
 #include <map>
 #include <set>
 #include <vector>
 #include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 
 /* ===================================================================== */
@@ -67,6 +74,15 @@ CACHE* utlb2 =  NULL;
 // Coherence.
 COHERENCE *tlbc = NULL;
 
+/// CACHE_HIERARCHY - the caches and tlbs of one configuration. the globals
+/// above are the hierarchy of config.xml, -sweep builds one more for every
+/// configuration it names.
+struct CACHE_HIERARCHY
+{
+   CACHE *il1, *dl1, *ul2, *ul3;
+   CACHE *itlbm, *dtlbm, *itlb1, *dtlb1, *utlb2;
+};
+
 // micro tlb hit prediction.
 TLBM_PREDICTOR *mptlbm_1k = NULL;
 TLBM_PREDICTOR *mptlbm_2k = NULL;
@@ -81,6 +97,41 @@ UINT64 elided_mfence;
 UINT64 executed_mfence;
 
 
+// L3 accesses deferred to the worker pool.
+UL3_DEFER_ROUTINE Ul3Defer = NULL;
+
+/// BACK_INVAL - the back-invalidations of L3 evictions for the private 
+/// caches of a thread, queued by the other threads. the application 
+/// threads simulate their private caches at the same time, a thread only
+/// touches its own and applies the queue on its next icache access.
+class BACK_INVAL
+{
+public:
+   PIN_MUTEX Lock;
+   std::vector<ADDRINT> Addrs;
+   volatile BOOL Pending;
+public:
+   BACK_INVAL() : Pending(false) { PIN_MutexInit(&Lock); }
+   ~BACK_INVAL() { PIN_MutexFini(&Lock); }
+};
+BACK_INVAL *BackInvals = NULL;
+
+// the last L1 lines of every thread, for the same line filter.
+/// LINE_FILTER - the last L1 icache and dcache lines a thread accessed, 
+/// ~0 unless they are known to still be in its L1, and the hits on them 
+/// that the filter kept from reaching the caches. one cache line each.
+typedef struct
+{
+   ADDRINT iline;
+   ADDRINT dline;
+   UINT64  ihits;
+   UINT64  dhits[CACHE_BASE::ACCESS_TYPE_NUM];
+   UINT8   pad[CACHELINE_SIZE - 5*sizeof(UINT64)];
+} LINE_FILTER;
+LINE_FILTER *LineFilters = NULL;
+// whether the filter runs on the icache [0] and the dcache [1] side.
+BOOL LineFilterOn[2] = { false, false };
+
 // track the page that misses tlb and required a pagetable walk.
 std::vector<ADDRINT> PTWalkTrace;
 
@@ -100,92 +151,253 @@ VOID (*INVOKE_MEM_REF_PROC)
 /* ===================================================================== */
 
 /* ===================================================================== */
-/* Cache Simulation Routines */
+/* Set Lookup Routines */
 /* ===================================================================== */
-bool CACHE::Access(ADDRINT iaddr, ADDRINT addr, UINT32 size, ACCESS_TYPE type, THREADID tid)
+LOCALFUN UINT32 CacheFindWayScalar(const CACHE_TAG *tags, CACHE_TAG tag, UINT32 assoc)
 {
-    const ADDRINT highAddr = addr + size;
-    bool allHit = true;
+    for (UINT32 way=0; way<assoc; ++way) if (tags[way] == tag) return way;
+    return assoc;
+}
 
-    const ADDRINT lineSize = GetLineSize();
-    const ADDRINT notLineMask = ~(lineSize - 1);
-    do
+#if defined(TARGET_IA32E)
+/// the SIMD lookups compare 64-bit tags. up to 32 ways are compared before
+/// the hit mask is checked, which covers every set of the configured caches.
+__attribute__((target("sse4.2")))
+LOCALFUN UINT32 CacheFindWaySSE42(const CACHE_TAG *tags, CACHE_TAG tag, UINT32 assoc)
+{
+    const __m128i key = _mm_set1_epi64x(tag.CacheTag);
+    UINT32 base = 0;
+    for (; base + 2 <= assoc; base += 32)
     {
-    CACHE_TAG tag;
-    UINT32 setindex;
-
-    SplitAddress(addr, tag, setindex);
-
-    CacheImpl *cache = GetCache(tid);
-    CACHE_SET_BASE *set = cache->CacheSets[setindex];
-
-    bool localHit = set->Find(tag);
-
-    allHit &= localHit;
+        UINT32 mask = 0;
+        for (UINT32 way = 0; way < 32 && base + way + 2 <= assoc; way += 2)
+        {
+            const __m128i line = _mm_loadu_si128((const __m128i*)(tags + base + way));
+            mask |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(line, key))) << way;
+        }
+        if (mask) return base + __builtin_ctz(mask);
+    }
+    /* odd associativity, check the last way */
+    if ((assoc & 1) && tags[assoc-1] == tag) return assoc-1;
+    return assoc;
+}
 
-    // on miss, loads always allocate, stores optionally
-    if (!localHit && (type == ACCESS_TYPE_LOAD || CacheStoreAlloc == CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE))
+__attribute__((target("avx2")))
+LOCALFUN UINT32 CacheFindWayAVX2(const CACHE_TAG *tags, CACHE_TAG tag, UINT32 assoc)
+{
+    const __m256i key = _mm256_set1_epi64x(tag.CacheTag);
+    UINT32 base = 0;
+    for (; base + 4 <= assoc; base += 32)
     {
-        CACHE_TAG etag;
-        set->Replace(tag, etag, iaddr);
-        EvictPrev(etag.CacheTag, tid);
+        UINT32 mask = 0;
+        for (UINT32 way = 0; way < 32 && base + way + 4 <= assoc; way += 4)
+        {
+            const __m256i line = _mm256_loadu_si256((const __m256i*)(tags + base + way));
+            mask |= _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(line, key))) << way;
+        }
+        if (mask) return base + __builtin_ctz(mask);
     }
-    addr = (addr & notLineMask) + lineSize; // start of next cache line
-    } while (addr < highAddr);
+    /* associativity not a multiple of 4, check the remaining ways */
+    for (UINT32 way = assoc & ~3U; way < assoc; ++way) if (tags[way] == tag) return way;
+    return assoc;
+}
+#endif
 
-    GetCache(tid)->CacheAccess[type][allHit]++;
+CACHE_FIND_WAY CacheFindWay = CacheFindWayScalar;
 
-    return allHit;
+/// CacheFindWayInit - pick the widest set lookup the host supports.
+LOCALFUN VOID CacheFindWayInit()
+{
+#if defined(TARGET_IA32E)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))        CacheFindWay = CacheFindWayAVX2;
+    else if (__builtin_cpu_supports("sse4.2")) CacheFindWay = CacheFindWaySSE42;
+#endif
+    return;
 }
 
-bool CACHE::AccessSingleLine(ADDRINT iaddr, ADDRINT addr, ACCESS_TYPE type, THREADID tid)
+/* ===================================================================== */
+/* Cache Simulation Routines */
+/* ===================================================================== */
+template <UINT32 ASSOC, UINT32 LINESHIFT, class POLICY>
+class CACHE_ENGINE
 {
-    CACHE_TAG tag;
-    UINT32 setindex;
+private:
+    /// the line shift of the cache, constant when the engine is specialized.
+    static UINT32 LineShift(const CACHE *cache) 
+    {
+        return LINESHIFT ? LINESHIFT : cache->CacheLineShift;
+    }
+    /// on miss, loads always allocate, stores optionally
+    static BOOL Allocate(const CACHE *cache, CACHE_BASE::ACCESS_TYPE type)
+    {
+        return type == CACHE_BASE::ACCESS_TYPE_LOAD || 
+               cache->CacheStoreAlloc == CACHE_BASE::CACHE_STORE_ALLOCATE;
+    }
+    /// map a set to its slot in the sampled sets, false if it is skipped.
+    static BOOL Sample(const CACHE *cache, UINT32 &setindex)
+    {
+        if (CACHESIM_likely(cache->CacheSampleIndex == NULL)) return true;
+        setindex = cache->CacheSampleIndex[setindex];
+        return setindex != CACHE_BASE::SAMPLE_SKIP;
+    }
+    /// access the line holding addr in the cache of the thread. the sets of
+    /// a shared cache are only touched with their bank locked, the eviction
+    /// goes to the private caches of its users after the bank is unlocked.
+    /// a line in a set that is not sampled is dropped before the lookup.
+    /// opthit is cleared when MIN misses on the line.
+    static BOOL Line(CACHE *cache, CacheImpl *impl, ADDRINT iaddr, ADDRINT addr, CACHE_BASE::ACCESS_TYPE type, THREADID tid, BOOL &sampled, BOOL &opthit)
+    {
+        const CACHE_TAG tag = addr >> LineShift(cache);
+        UINT32 setindex = tag & cache->CacheSetIndexMask;
+        const BOOL shared = !cache->IsPrivate();
+        SIMLOCK *simlock = SimTheOne->get_global_simlock();
+        const UINT32 bank = simlock->get_l3_bank(setindex);
+        if (CACHESIM_unlikely(cache->Profile != NULL)) cache->Profile->Access(tag, tid);
+        if (CACHESIM_unlikely(!Sample(cache, setindex))) return true;
+        sampled = true;
+        if (CACHESIM_unlikely(shared))
+        {
+            cache->AddUser(tid);
+            simlock->lock_l3_bank(bank);
+        }
+        if (CACHESIM_unlikely(cache->Oracle != NULL)) opthit &= cache->Oracle->Access(setindex, tag, tid);
 
-    SplitAddress(addr, tag, setindex);
+        BOOL hit = impl->Find<ASSOC, POLICY>(setindex, tag);
+        CACHE_TAG etag;
+        if (!hit && Allocate(cache, type)) impl->Replace<ASSOC, POLICY>(setindex, tag, etag, iaddr);
+        if (CACHESIM_unlikely(impl->SetAccesses != NULL))
+        {
+            ++ impl->SetAccesses[setindex];
+            impl->SetMisses[setindex] += !hit;
+        }
 
-    CACHE_SET_BASE* set = GetCache(tid)->CacheSets[setindex];
+        if (CACHESIM_unlikely(shared))
+        {
+            cache->BankCount(bank, hit);
+            simlock->unlock_l3_bank(bank);
+        }
+        if (!etag.unused()) cache->EvictPrev(etag.CacheTag << LineShift(cache), tid);
+        return hit;
+    }
+public:
+    static BOOL Access(CACHE *cache, ADDRINT iaddr, ADDRINT addr, UINT32 size, CACHE_BASE::ACCESS_TYPE type, THREADID tid)
+    {
+        const ADDRINT highAddr = addr + size;
+        const ADDRINT lineSize = 1 << LineShift(cache);
+        const ADDRINT notLineMask = ~(lineSize - 1);
+        CacheImpl *impl = cache->GetCache(tid);
+        BOOL allHit = true;
+        BOOL sampled = false;
+        BOOL optHit = true;
+        do
+        {
+            allHit &= Line(cache, impl, iaddr, addr, type, tid, sampled, optHit);
+            addr = (addr & notLineMask) + lineSize; // start of next cache line
+        } while (addr < highAddr);
+
+        if (CACHESIM_likely(sampled)) cache->StatsCount(type, allHit, tid);
+        else cache->SkipCount(type, tid);
+        if (CACHESIM_unlikely(cache->Oracle != NULL) && sampled) cache->OracleCount(type, optHit, tid);
+        return allHit;
+    }
 
-    bool hit = set->Find(tag);
+    static BOOL AccessSingleLine(CACHE *cache, ADDRINT iaddr, ADDRINT addr, CACHE_BASE::ACCESS_TYPE type, THREADID tid)
+    {
+        BOOL sampled = false;
+        BOOL optHit = true;
+        BOOL hit = Line(cache, cache->GetCache(tid), iaddr, addr, type, tid, sampled, optHit);
+        if (CACHESIM_likely(sampled)) cache->StatsCount(type, hit, tid);
+        else cache->SkipCount(type, tid);
+        if (CACHESIM_unlikely(cache->Oracle != NULL) && sampled) cache->OracleCount(type, optHit, tid);
+        return hit;
+    }
 
-    // on miss, loads always allocate, stores optionally
-    if (!hit && (type == ACCESS_TYPE_LOAD || CacheStoreAlloc == CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE))
+    static VOID Evict(CACHE *cache, ADDRINT addr, THREADID tid)
     {
-        CACHE_TAG etag;
-        set->Replace(tag, etag, iaddr);
-        EvictPrev(etag.CacheTag, tid);
+        const CACHE_TAG tag = addr >> LineShift(cache);
+        UINT32 setindex = tag & cache->CacheSetIndexMask;
+        const BOOL shared = !cache->IsPrivate();
+        SIMLOCK *simlock = SimTheOne->get_global_simlock();
+        const UINT32 bank = simlock->get_l3_bank(setindex);
+        if (CACHESIM_unlikely(!Sample(cache, setindex))) return;
+        if (CACHESIM_unlikely(shared)) simlock->lock_l3_bank(bank);
+        cache->GetCache(tid)->Evict<ASSOC, POLICY>(tag, setindex);
+        if (CACHESIM_unlikely(shared)) simlock->unlock_l3_bank(bank);
     }
 
-    GetCache(tid)->CacheAccess[type][hit]++;
-    return hit;
-}
+    static BOOL AccessPage(CACHE *cache, ADDRINT addr, CACHE_BASE::ACCESS_TYPE type, THREADID tid)
+    {
+        // last 12 bits does not matter.
+        UINT32 setindex = GETPAGE(addr) & (cache->CacheMaxSets-1);
+        CACHE_TAG tag = GETPAGE(addr);
 
-bool CACHE::AccessPage(ADDRINT addr, ACCESS_TYPE type, THREADID tid)
-{
-    // last 12 bits does not matter.
-    UINT32 setindex = GETPAGE(addr) & (CacheMaxSets-1);
-    CACHE_TAG tag = GETPAGE(addr);
+        CacheImpl *impl = cache->GetCache(tid);
+        if (CACHESIM_unlikely(cache->Profile != NULL)) cache->Profile->Access(tag, tid);
+        if (CACHESIM_unlikely(!Sample(cache, setindex)))
+        {
+            cache->SkipCount(type, tid);
+            return true;
+        }
+        if (CACHESIM_unlikely(cache->Oracle != NULL)) 
+            cache->OracleCount(type, cache->Oracle->Access(setindex, tag, tid), tid);
 
-    CACHE_SET_BASE* set = GetCache(tid)->CacheSets[setindex];
+        BOOL hit = impl->Find<ASSOC, POLICY>(setindex, tag);
 
-    bool hit = set->Find(tag);
+        // on miss, loads always allocate, stores optionally
+        if (!hit && Allocate(cache, type))
+        {
+            CACHE_TAG etag;
+            impl->Replace<ASSOC, POLICY>(setindex, tag, etag, 0);
+            // EvictPrev(etag.CacheTag, tid);
+            if (tlbc) tlbc->AddOwner(tag.CacheTag, tid);
+            if (tlbc) tlbc->SubOwner(etag.CacheTag, tid);
+        }
 
-    // on miss, loads always allocate, stores optionally
-    if (!hit && (type == ACCESS_TYPE_LOAD || CacheStoreAlloc == CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE))
-    {
-        CACHE_TAG etag;
-        set->Replace(tag,etag, 0);
-        // EvictPrev(etag.CacheTag, tid);
-        if (tlbc) tlbc->AddOwner(tag.CacheTag, tid);
-        if (tlbc) tlbc->SubOwner(etag.CacheTag, tid);
+        cache->StatsCount(type, hit, tid);
+        return hit;
+    }
+};
+
+/// SELECT_ENGINE - use the engine specialized for this geometry.
+#define SELECT_ENGINE(ASSOC, LINESHIFT, POLICY)                                       \
+    if ((!ASSOC || CacheAssoc == ASSOC) && (!LINESHIFT || CacheLineShift == LINESHIFT)) \
+    {                                                                                 \
+        AccessRoutine     = CACHE_ENGINE<ASSOC, LINESHIFT, POLICY>::Access;           \
+        AccessLineRoutine = CACHE_ENGINE<ASSOC, LINESHIFT, POLICY>::AccessSingleLine; \
+        AccessPageRoutine = CACHE_ENGINE<ASSOC, LINESHIFT, POLICY>::AccessPage;       \
+        EvictRoutine      = CACHE_ENGINE<ASSOC, LINESHIFT, POLICY>::Evict;            \
+        InitCaches(POLICY::template Init<0>);                                         \
+        return;                                                                       \
     }
 
-    GetCache(tid)->CacheAccess[type][hit]++;
-    return hit;
+/// SELECT_ENGINES - the common geometries, 64 byte lines for the caches and 
+/// 4K pages for the tlbs, get their own engine, the rest fall back to the 
+/// generic one.
+#define SELECT_ENGINES(POLICY)      \
+    SELECT_ENGINE(4,  6,  POLICY);  \
+    SELECT_ENGINE(8,  6,  POLICY);  \
+    SELECT_ENGINE(16, 6,  POLICY);  \
+    SELECT_ENGINE(4,  12, POLICY);  \
+    SELECT_ENGINE(8,  12, POLICY);  \
+    SELECT_ENGINE(16, 12, POLICY);  \
+    SELECT_ENGINE(0,  0,  POLICY);
+
+VOID CACHE::SelectEngine()
+{
+    switch (CacheSetType)
+    {
+    case CACHE_POLICY_PLRU:   SELECT_ENGINES(CACHE_PLRU_POLICY);
+    case CACHE_POLICY_FIFO:   SELECT_ENGINES(CACHE_FIFO_POLICY);
+    case CACHE_POLICY_RANDOM: SELECT_ENGINES(CACHE_RANDOM_POLICY);
+    case CACHE_POLICY_SRRIP:  SELECT_ENGINES(CACHE_SRRIP_POLICY);
+    case CACHE_POLICY_BRRIP:  SELECT_ENGINES(CACHE_BRRIP_POLICY);
+    case CACHE_POLICY_DRRIP:  SELECT_ENGINES(CACHE_DRRIP_POLICY);
+    case CACHE_POLICY_SHIP:   SELECT_ENGINES(CACHE_SHIP_POLICY);
+    default:                  SELECT_ENGINES(CACHE_LRU_POLICY);
+    }
 }
 
-
 /* ===================================================================== */
 /* Cache Access Routines */
 /* ===================================================================== */
@@ -198,11 +410,17 @@ LOCALFUN VOID CACHE_Ul3Access(ADDRINT  iaddr               ,
 {
     if (!SimWait->dosim()) return;
 
+    // the worker pool merges the L3 accesses of all threads itself.
+    if (Ul3Defer) 
+    {
+        Ul3Defer(iaddr, addr, size, type, tid);
+        return;
+    }
+
     // third level unified cache
-    // level 3 cache is shared ... it could be access concurrently by different threads.
-    SimTheOne->get_global_simlock()->lock_l3_cache(tid);
+    // level 3 cache is shared ... it could be access concurrently by different threads,
+    // the cache locks the bank of every set it touches.
     if (ul3) ul3->Access(iaddr, addr, size, type, tid);
-    SimTheOne->get_global_simlock()->unlock_l3_cache(tid);
     return;
 }
 
@@ -361,38 +579,203 @@ LOCALFUN VOID MicroTLB_Predict(TLBM_PREDICTOR *ptlbm, ADDRINT iaddr, ADDRINT tag
     return;
 }
 
-LOCALFUN BOOL LastBlock(ADDRINT addr,  THREADID tid)
+/* ===================================================================== */
+///@ the same line filter. a thread accessing the L1 line it accessed last
+///@ hits in its private L1 and TLB. the filter counts these hits inline and
+///@ only lets the other accesses through to the simulation, which is exact
+///@ when the hit would leave the replacement state as it was: with LRU and
+///@ PLRU the line is still the most recently used one of its set, FIFO and
+///@ random do not look at hits at all. RRIP fills a line with a distant 
+///@ prediction and promotes it on the hit, SHiP trains its predictor on it,
+///@ the filter is off with them.
+/* ===================================================================== */
+LOCALFUN VOID LineFilterEvictI(ADDRINT addr, THREADID tid)
 {
-    // decode a block at a time.
-    static ADDRINT lastblock[MAX_CACHE_THREAD];
-    BOOL last = (GETBLOCK(addr) == lastblock[tid]);
-    if (!last) lastblock[tid] = GETBLOCK(addr);
-    return last;
+    LineFilters[tid].iline = ~ADDRINT(0);
 }
 
-LOCALFUN VOID InsRefBlock(ADDRINT addr                 , 
-                          THREADID tid                 )
+LOCALFUN VOID LineFilterEvictD(ADDRINT addr, THREADID tid)
 {
+    LineFilters[tid].dline = ~ADDRINT(0);
+}
 
-    // decode a block at a time.
-    if (!SimWait->dosim()) return;
+/* LineFilterData - the dcache line of the access, if it stays within one */
+/* line that is in the dcache now, unless a store missed without          */
+/* allocating.                                                            */
+LOCALFUN inline VOID LineFilterData(ADDRINT addr, UINT32 size, BOOL hit, CACHE_BASE::ACCESS_TYPE type, THREADID tid)
+{
+    const UINT32 shift = dl1->GetLineShift();
+    const BOOL in = (addr >> shift) == ((addr + size - 1) >> shift) &&
+                    (hit || type == CACHE_BASE::ACCESS_TYPE_LOAD || 
+                     dl1->GetStoreAlloc() == CACHE_BASE::CACHE_STORE_ALLOCATE);
+    LineFilters[tid].dline = in ? addr >> shift : ~ADDRINT(0);
+}
 
+/* LineFilterPolicy - whether a hit on the most recent line of a set */
+/* leaves the state of the policy as it was.                         */
+LOCALFUN BOOL LineFilterPolicy(CACHE *cache)
+{
+    switch (cache->GetPolicy())
+    {
+        case CACHE_POLICY_LRU:
+        case CACHE_POLICY_PLRU:
+        case CACHE_POLICY_FIFO:
+        case CACHE_POLICY_RANDOM:
+             return true;
+        default:
+             return false;
+    }
+}
+
+/* LineFilterFirstTlb - the first tlb the accesses of one side go to, */
+/* NULL if it is not private to that side.                            */
+LOCALFUN CACHE *LineFilterFirstTlb(BOOL data)
+{
+    if (data) return dtlbm ? dtlbm : dtlb1;
+    return itlbm ? itlbm : itlb1;
+}
+
+/* LineFilterExact - whether the filter elides exactly the hits of a side. */
+LOCALFUN BOOL LineFilterExact(BOOL data)
+{
+    CACHE *l1 = data ? dl1 : il1;
+    CACHE *tlb = LineFilterFirstTlb(data);
+    return l1 && tlb && !SimOpts->get_mem_buffer() &&
+           LineFilterPolicy(l1) && LineFilterPolicy(tlb) &&
+           !l1->Profile && !tlb->Profile && !l1->Oracle && !tlb->Oracle && SimOpts->get_l1_filter();
+}
+
+/* LineFilterFlush - add the elided hits to the L1 and TLB stats. */
+LOCALFUN VOID LineFilterFlush()
+{
+    for (THREADID tid = 0; LineFilters && tid < MAX_CACHE_THREAD; tid++)
+    {
+        LINE_FILTER &filter = LineFilters[tid];
+        if (filter.ihits)
+        {
+            SimStats->add(tid, il1->StatsCounter(CACHE_BASE::ACCESS_TYPE_LOAD, true), filter.ihits);
+            SimStats->add(tid, LineFilterFirstTlb(false)->StatsCounter(CACHE_BASE::ACCESS_TYPE_LOAD, true), filter.ihits);
+        }
+        for (UINT32 type = 0; type < CACHE_BASE::ACCESS_TYPE_NUM; type++)
+        {
+            if (!filter.dhits[type]) continue;
+            SimStats->add(tid, dl1->StatsCounter(CACHE_BASE::ACCESS_TYPE(type), true), filter.dhits[type]);
+            SimStats->add(tid, LineFilterFirstTlb(true)->StatsCounter(CACHE_BASE::ACCESS_TYPE(type), true), filter.dhits[type]);
+        }
+        memset(&filter, 0, sizeof(filter));
+        filter.iline = filter.dline = ~ADDRINT(0);
+    }
+}
+
+/* ===================================================================== */
+///@ back-invalidations of the shared L3 for the other threads, see BACK_INVAL.
+/* ===================================================================== */
+LOCALFUN VOID BackInvalQueue(ADDRINT addr, THREADID tid)
+{
+    BACK_INVAL &inval = BackInvals[tid];
+    PIN_MutexLock(&inval.Lock);
+    inval.Addrs.push_back(addr);
+    inval.Pending = true;
+    PIN_MutexUnlock(&inval.Lock);
+    // the next fetch of the thread goes past the filter and applies them.
+    if (LineFilterOn[0]) LineFilters[tid].iline = ~ADDRINT(0);
+}
+
+LOCALFUN VOID BackInvalApply(THREADID tid)
+{
+    std::vector<ADDRINT> addrs;
+    BACK_INVAL &inval = BackInvals[tid];
+    PIN_MutexLock(&inval.Lock);
+    addrs.swap(inval.Addrs);
+    inval.Pending = false;
+    PIN_MutexUnlock(&inval.Lock);
+    for (UINT32 i=0; i<addrs.size(); i++) ul3->EvictPrevNow(addrs[i], tid);
+}
+
+/* ===================================================================== */
+///@ the cache and the tlb side of every reference. the two sides share no
+///@ state, the set sharded replay runs them on different threads.
+/* ===================================================================== */
+LOCALFUN VOID InsRefCache(ADDRINT addr                 , 
+                          THREADID tid                 )
+{
     const CACHE_BASE::ACCESS_TYPE type = CACHE_BASE::ACCESS_TYPE_LOAD;
     BOOL iche_hit = 0;
-    BOOL itlb_hit = 0;
+    if (CACHESIM_unlikely(BackInvals != NULL && BackInvals[tid].Pending)) BackInvalApply(tid);
     /// ================================================== ///
     /* simulate icache. */
     /// ================================================== ///
     if (!iche_hit) iche_hit = il1->AccessSingleLine(addr, addr, type, tid);
     if (!iche_hit) CACHE_Ul2Access(addr, addr, 1, type, tid);
+    // the line is in the icache now, unless the L2 or L3 evicted it.
+    if (LineFilterOn[0]) LineFilters[tid].iline = addr >> il1->GetLineShift();
+}
 
+LOCALFUN VOID InsRefTlb(ADDRINT addr                   , 
+                        THREADID tid                   )
+{
+    const CACHE_BASE::ACCESS_TYPE type = CACHE_BASE::ACCESS_TYPE_LOAD;
+    BOOL itlb_hit = 0;
     /// ================================================== ///
     /* simulate TLB. */
     /// ================================================== ///
     if (!itlb_hit && itlbm) itlb_hit = itlbm->AccessPage(addr, type, tid);
     if (!itlb_hit && itlb1) itlb_hit = itlb1->AccessPage(addr, type, tid);
     if (!itlb_hit) TLB_Ul2Access(addr, type, tid);
+}
+
+LOCALFUN VOID DataRefTlb(ADDRINT  addr                 , 
+                         CACHE_BASE::ACCESS_TYPE type  , 
+                         THREADID tid                  )
+{
+    BOOL dtlb_hit = 0;
+    /// ================================================== ///
+    /* simulate dtlb */
+    /// ================================================== ///
+    if (!dtlb_hit && dtlbm) dtlb_hit = dtlbm->AccessPage(addr, type, tid);
+    if (!dtlb_hit && dtlb1) dtlb_hit = dtlb1->AccessPage(addr, type, tid);
+    if (!dtlb_hit) TLB_Ul2Access(addr, type, tid);
+}
+
+LOCALFUN VOID MemRefMultiCache(ADDRINT  iaddr              , 
+                               ADDRINT  addr               , 
+                               UINT32   size               , 
+                               CACHE_BASE::ACCESS_TYPE type, 
+                               THREADID tid                )
+{
+    BOOL dche_hit = 0;
+    /// ================================================== ///
+    /* simulate dcache. */
+    /// ================================================== ///
+    if (!dche_hit && dl1) dche_hit = dl1->Access(iaddr, addr, size, type, tid);
+    if (!dche_hit) CACHE_Ul2Access(iaddr, addr, size, type, tid);
+    if (LineFilterOn[1]) LineFilterData(addr, size, dche_hit, type, tid);
+}
+
+LOCALFUN VOID MemRefSingleCache(ADDRINT   iaddr             , 
+                                ADDRINT   addr              ,
+                                UINT32    size              , 
+                                CACHE_BASE::ACCESS_TYPE type, 
+                                THREADID  tid               )
+{
+    BOOL dche_hit = 0;
+    /// ================================================== ///
+    /* simulate dcache */
+    /// ================================================== ///
+    if (!dche_hit && dl1) dche_hit = dl1->AccessSingleLine(iaddr, addr, type, tid);
+    if (!dche_hit) CACHE_Ul2Access(iaddr, addr, size, type, tid);
+    if (LineFilterOn[1]) LineFilterData(addr, size, dche_hit, type, tid);
+}
 
+LOCALFUN VOID InsRefBlock(ADDRINT addr                 , 
+                          THREADID tid                 )
+{
+
+    // decode a block at a time.
+    if (!SimWait->dosim()) return;
+
+    InsRefCache(addr, tid);
+    InsRefTlb(addr, tid);
     return;
 }
 
@@ -407,21 +790,8 @@ LOCALFUN VOID MemRefMulti(ADDRINT  iaddr              ,
     // waiting for simulation to start.
     if (!SimWait->dosim()) return;
 
-    BOOL dche_hit = 0;
-    BOOL dtlb_hit = 0;
-    /// ================================================== ///
-    /* simulate dcache. */
-    /// ================================================== ///
-    if (!dche_hit && dl1) dche_hit = dl1->Access(iaddr, addr, size, type, tid);
-    if (!dche_hit) CACHE_Ul2Access(iaddr, addr, size, type, tid);
-
-    /// ================================================== ///
-    /* simulate dtlb */
-    /// ================================================== ///
-    if (!dtlb_hit && dtlbm) dtlb_hit = dtlbm->AccessPage(addr, type, tid);
-    if (!dtlb_hit && dtlb1) dtlb_hit = dtlb1->AccessPage(addr, type, tid);
-    if (!dtlb_hit) TLB_Ul2Access(addr, type, tid);
-
+    MemRefMultiCache(iaddr, addr, size, type, tid);
+    DataRefTlb(addr, type, tid);
     return;
 }
 
@@ -436,26 +806,59 @@ LOCALFUN VOID MemRefSingle(ADDRINT   iaddr             ,
     // waiting for simulation to start.
     if (!SimWait->dosim()) return;
 
-    BOOL dche_hit = 0;
-    BOOL dtlb_hit = 0;
-    /// ================================================== ///
-    /* simulate dcache */
-    /// ================================================== ///
-    if (!dche_hit && dl1) dche_hit = dl1->AccessSingleLine(iaddr, addr, type, tid);
-    if (!dche_hit) CACHE_Ul2Access(iaddr, addr, size, type, tid);
-
-    /// ================================================== ///
-    /* simulate dtlb */
-    /// ================================================== ///
-    if (!dtlb_hit && dtlbm) dtlb_hit = dtlbm->AccessPage(addr, type, tid);
-    if (!dtlb_hit && dtlb1) dtlb_hit = dtlb1->AccessPage(addr, type, tid);
-    if (!dtlb_hit) utlb2->AccessPage(addr, type, tid);
+    MemRefSingleCache(iaddr, addr, size, type, tid);
+    DataRefTlb(addr, type, tid);
 }
 
 
 /* ===================================================================== */
 /* Called by the instruction.cpp module */
 /* ===================================================================== */
+/* InsFetchFilter - whether instruction fetches go through the filter,   */
+/* and the icache line shift for it.                                     */
+BOOL InsFetchFilter(UINT32 *shift)
+{
+    if (!LineFilterOn[0]) return false;
+    *shift = il1->GetLineShift();
+    return true;
+}
+
+/* DataRefFilter - whether data accesses go through the filter, and the  */
+/* dcache line shift for it.                                             */
+BOOL DataRefFilter(UINT32 *shift)
+{
+    if (!LineFilterOn[1]) return false;
+    *shift = dl1->GetLineShift();
+    return true;
+}
+
+/* InsFetchNewLine - the IF part of an instruction fetch, whether it */
+/* fetches from another line than the last one.                      */
+ADDRINT PIN_FAST_ANALYSIS_CALL InsFetchNewLine(ADDRINT addr, UINT32 shift, THREADID tid)
+{
+    LINE_FILTER &filter = LineFilters[tid];
+    const ADDRINT same = (addr >> shift) == filter.iline;
+    filter.ihits += same;
+    return !same;
+}
+
+/* DataRefNewLine - the IF part of a data access, whether it touches a */
+/* line other than the last one.                                       */
+ADDRINT PIN_FAST_ANALYSIS_CALL DataRefNewLine(ADDRINT addr, UINT32 size, UINT32 shift, UINT32 type, THREADID tid)
+{
+    LINE_FILTER &filter = LineFilters[tid];
+    const ADDRINT same = ((addr >> shift) == filter.dline) & (((addr + size - 1) >> shift) == filter.dline);
+    filter.dhits[type] += same;
+    return !same;
+}
+
+/* LineFilterReset - simulation switched on or off, forget the last lines. */
+VOID LineFilterReset()
+{
+    for (THREADID tid = 0; LineFilters && tid < MAX_CACHE_THREAD; tid++) 
+        LineFilters[tid].iline = LineFilters[tid].dline = ~ADDRINT(0);
+}
+
 VOID InsFetchRef(ADDRINT  addr                         , 
                  THREADID tid                          )
 {
@@ -493,75 +896,469 @@ VOID DataWriteRef(ADDRINT  iaddr                       ,
 }
 
 /* ===================================================================== */
-/* Printing Routines */
+/* Called by the instruction.cpp module when a memory buffer is full */
 /* ===================================================================== */
-LOCALFUN VOID cache_and_tlb_module_print()
+VOID MemRefBufferDrain(const MEMREF *ref                 , 
+                       UINT64   num                      , 
+                       THREADID tid                      )
 {
-    char name[128];
-    sprintf(name, "%s.%d", "cache_sim.out", PIN_GetPid());
-    std::ofstream out(name);
+    // waiting for simulation to start. the whole buffer is dropped.
+    if (!SimWait->dosim()) return;
+
+    for (const MEMREF *end = ref + num; ref != end; ++ref)
+    {
+        switch (ref->type)
+        {
+            case MEMREF_IFETCH:
+                 InsRefBlock(ref->ea, tid);
+                 break;
+            case MEMREF_LOAD:
+                 if (ref->size <= 4) MemRefSingle(ref->pc, ref->ea, ref->size, CACHE_BASE::ACCESS_TYPE_LOAD, 0, 0, tid);
+                 else MemRefMulti(ref->pc, ref->ea, ref->size, CACHE_BASE::ACCESS_TYPE_LOAD, 0, 0, tid);
+                 break;
+            case MEMREF_STORE:
+                 if (ref->size <= 4) MemRefSingle(ref->pc, ref->ea, ref->size, CACHE_BASE::ACCESS_TYPE_STORE, 0, 0, tid);
+                 else MemRefMulti(ref->pc, ref->ea, ref->size, CACHE_BASE::ACCESS_TYPE_STORE, 0, 0, tid);
+                 break;
+            default:
+                 break;
+        }
+    }
+    return;
+}
 
+/* ===================================================================== */
+/* Called by the worker pool */
+/* ===================================================================== */
+VOID CacheDeferUl3(UL3_DEFER_ROUTINE access, EVICT_DEFER_ROUTINE evict)
+{
+    Ul3Defer = access;
+    if (ul3) ul3->EvictDefer = evict;
+    if (ul3) ul3->EvictDeferOwn = evict != NULL;
+    return;
+}
+
+VOID CacheUl3Access(ADDRINT  iaddr                     , 
+                    ADDRINT  addr                      , 
+                    UINT32   size                      , 
+                    UINT32   type                      , 
+                    THREADID tid                       )
+{
+    if (ul3) ul3->Access(iaddr, addr, size, CACHE_BASE::ACCESS_TYPE(type), tid);
+    return;
+}
+
+VOID CacheUl3EvictPrev(ADDRINT  addr                   , 
+                       THREADID tid                    )
+{
+    if (ul3) ul3->EvictPrevNow(addr, tid);
+    return;
+}
+
+/* ===================================================================== */
+/* Called by the trace replay engine */
+/* ===================================================================== */
+/* CacheL2Ref - a reference of a filtered trace, which already missed in */
+/* the L1 filter caches of the recording. it goes to the L2 and below,  */
+/* the tlbs do not see filtered traces.                                  */
+VOID CacheL2Ref(ADDRINT  iaddr                         , 
+                ADDRINT  addr                          , 
+                UINT32   size                          , 
+                UINT32   type                          , 
+                THREADID tid                           )
+{
+    CACHE_Ul2Access(iaddr, addr, size, CACHE_BASE::ACCESS_TYPE(type), tid);
+    return;
+}
+
+/* CacheSideRef - the cache side of a reference of MEMREF_TYPE type. */
+VOID CacheSideRef(ADDRINT  iaddr                       , 
+                  ADDRINT  addr                        , 
+                  UINT32   size                        , 
+                  UINT32   type                        , 
+                  THREADID tid                         )
+{
+    if (!SimWait->dosim()) return;
+
+    const CACHE_BASE::ACCESS_TYPE access = type == MEMREF_STORE ? CACHE_BASE::ACCESS_TYPE_STORE : 
+                                                                  CACHE_BASE::ACCESS_TYPE_LOAD;
+    if (type == MEMREF_IFETCH) InsRefCache(addr, tid);
+    else if (size <= 4) MemRefSingleCache(iaddr, addr, size, access, tid);
+    else MemRefMultiCache(iaddr, addr, size, access, tid);
+    return;
+}
+
+/* TlbSideRef - the tlb side of a reference of MEMREF_TYPE type. */
+VOID TlbSideRef(ADDRINT  addr                          , 
+                UINT32   type                          , 
+                THREADID tid                           )
+{
+    if (!SimWait->dosim()) return;
+
+    if (type == MEMREF_IFETCH) InsRefTlb(addr, tid);
+    else DataRefTlb(addr, type == MEMREF_STORE ? CACHE_BASE::ACCESS_TYPE_STORE : 
+                                                 CACHE_BASE::ACCESS_TYPE_LOAD, tid);
+    return;
+}
+
+/* CacheShardable - whether the sets of every level can be simulated on */
+/* threads of their own, with the policies keeping no state across sets */
+/* and nothing looking at the stream as a whole. every cache can then be */
+/* split on the setbits address bits above lineshift, the largest line  */
+/* shift, and every tlb on the low bits of the page below tlbsets, 0    */
+/* when there are no tlbs.                                              */
+BOOL CacheShardable(UINT32 *lineshift, UINT32 *setbits, UINT32 *tlbsets)
+{
+    CACHE *caches[] = { il1, dl1, ul2, ul3 };
+    CACHE *tlbs[] = { itlbm, dtlbm, itlb1, dtlb1, utlb2 };
+    if (Ul3Defer || !SimOpts->get_ckpt_save().empty()) return false;
+
+    *lineshift = 0;
+    *setbits = 32;
+    *tlbsets = 0;
+    for (UINT32 i = 0; i < sizeof(caches)/sizeof(caches[0]) + sizeof(tlbs)/sizeof(tlbs[0]); i++)
+    {
+        CACHE *cache = i < 4 ? caches[i] : tlbs[i - 4];
+        if (!cache) continue;
+        const CACHE_POLICY_TYPE policy = cache->GetPolicy();
+        if (cache->Profile || cache->Oracle || (policy != CACHE_POLICY_LRU && policy != CACHE_POLICY_PLRU && 
+                               policy != CACHE_POLICY_FIFO && policy != CACHE_POLICY_SRRIP)) return false;
+        if (i < 4) *lineshift = std::max(*lineshift, cache->GetLineShift());
+        else *tlbsets = *tlbsets ? std::min(*tlbsets, cache->GetMaxSets()) : cache->GetMaxSets();
+    }
+    for (UINT32 i = 0; i < sizeof(caches)/sizeof(caches[0]); i++)
+    {
+        if (!caches[i]) continue;
+        const UINT32 top = caches[i]->GetLineShift() + FloorLog2(caches[i]->GetMaxSets());
+        *setbits = std::min(*setbits, top > *lineshift ? top - *lineshift : 0);
+    }
+    return true;
+}
+
+/* CacheShareThread - let thread tid simulate the private caches and tlbs */
+/* of thread owner.                                                       */
+VOID CacheShareThread(THREADID tid, THREADID owner)
+{
+    CACHE *caches[] = { il1, dl1, ul2, ul3, itlbm, dtlbm, itlb1, dtlb1, utlb2 };
+    for (UINT32 i = 0; i < sizeof(caches)/sizeof(caches[0]); i++)
+    {
+        if (caches[i]) caches[i]->SharePrivate(tid, owner);
+    }
+    return;
+}
+
+/* ===================================================================== */
+/* Called by the sampling controller */
+/* ===================================================================== */
+UINT32 CacheLevelCounts(UINT64 *accesses, UINT64 *misses)
+{
+    CACHE *levels[CACHE_COUNTED_LEVELS] = { il1, dl1, ul2, ul3, itlbm, dtlbm, itlb1, dtlb1, utlb2 };
+    UINT32 present = 0;
+    for (UINT32 level = 0; level < CACHE_COUNTED_LEVELS; level++)
+    {
+        accesses[level] = levels[level] ? levels[level]->AccessesAll() : 0;
+        misses[level] = levels[level] ? levels[level]->MissesAll() : 0;
+        if (levels[level]) present |= 1U << level;
+    }
+    return present;
+}
+
+/* ===================================================================== */
+/* Checkpoints */
+/* ===================================================================== */
+/// a checkpoint is a CKPT_HEADER followed by the CACHE_CKPT of every cache 
+/// and tlb, in the order of CheckpointCaches, each followed by the state of
+/// its CacheImpls. loading maps the file and copies the state out of it.
+typedef struct
+{
+    char   magic[8];
+    UINT32 version;
+    UINT32 caches;
+    UINT64 icount;
+} CKPT_HEADER;
+
+LOCALCONST char CKPT_MAGIC[8] = { 'M', 'S', 'I', 'M', 'C', 'K', 'P', 'T' };
+LOCALCONST UINT32 CKPT_VERSION = 1;
+
+/* CheckpointCaches - the caches and tlbs in checkpoint slot order */
+LOCALFUN UINT32 CheckpointCaches(CACHE **caches)
+{
+    CACHE *all[] = { il1, dl1, ul2, ul3, itlbm, dtlbm, itlb1, dtlb1, utlb2 };
+    memcpy(caches, all, sizeof(all));
+    return sizeof(all)/sizeof(all[0]);
+}
+
+/* CheckpointWrite - write the state of all the caches and tlbs to file */
+LOCALFUN VOID CheckpointWrite(FILE *file, UINT64 icount)
+{
+    CACHE *caches[CACHE_COUNTED_LEVELS];
+    const UINT32 slots = CheckpointCaches(caches);
+    CKPT_HEADER header;
+    memcpy(header.magic, CKPT_MAGIC, sizeof(header.magic));
+    header.version = CKPT_VERSION;
+    header.caches = 0;
+    header.icount = icount;
+    for (UINT32 slot = 0; slot < slots; slot++) header.caches += caches[slot] != NULL;
+    fwrite(&header, sizeof(header), 1, file);
+    for (UINT32 slot = 0; slot < slots; slot++) 
+    {
+        if (caches[slot]) caches[slot]->SaveState(file, slot);
+    }
+}
+
+/* CheckpointSave - write the state of all the caches and tlbs */
+LOCALFUN VOID CheckpointSave(const string &name, UINT64 icount, BOOL verbose = true)
+{
+    FILE *file = fopen(name.c_str(), "wb");
+    if (!file)
+    {
+        MACHINESIM_PRINT("Error: could not write checkpoint %s\n", name.c_str());
+        return;
+    }
+    // a failed fwrite leaves the error indicator of the file set.
+    CheckpointWrite(file, icount);
+    const BOOL failed = ferror(file);
+    if (fclose(file) || failed)
+    {
+        MACHINESIM_PRINT("Error: could not write checkpoint %s\n", name.c_str());
+        remove(name.c_str());
+        return;
+    }
+
+    if (!verbose) return;
+    MACHINESIM_PRINT("cache and tlb state at %llu instructions saved into %s\n", 
+                     (unsigned long long) icount, name.c_str());
+}
+
+/* CheckpointLoad - restore the state of all the caches and tlbs. the */
+/* checkpoint must have been taken with the same configuration.       */
+LOCALFUN VOID CheckpointLoad(const string &name, BOOL verbose = true)
+{
+    const UINT8 *map = (const UINT8*) MAP_FAILED;
+    struct stat st;
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd >= 0 && !fstat(fd, &st) && st.st_size >= (off_t)sizeof(CKPT_HEADER))
+    {
+        map = (const UINT8*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (fd >= 0) close(fd);
+    if (map == (const UINT8*) MAP_FAILED)
+    {
+        MACHINESIM_PRINT("Error: could not read checkpoint %s\n", name.c_str());
+        PIN_ExitProcess(1);
+    }
+
+    CACHE *caches[CACHE_COUNTED_LEVELS];
+    const UINT32 slots = CheckpointCaches(caches);
+    const UINT8 *data = map, *end = map + st.st_size;
+    CKPT_HEADER header;
+    memcpy(&header, data, sizeof(header));
+    data += sizeof(header);
+    BOOL valid = !memcmp(header.magic, CKPT_MAGIC, sizeof(CKPT_MAGIC)) && header.version == CKPT_VERSION;
+
+    // every cache of this configuration must be in the checkpoint.
+    UINT32 loaded = 0;
+    for (UINT32 i = 0; valid && i < header.caches; i++)
+    {
+        CACHE_CKPT ckpt;
+        if ((UINT64)(end - data) < sizeof(ckpt)) { valid = false; break; }
+        memcpy(&ckpt, data, sizeof(ckpt));
+        data += sizeof(ckpt);
+        if (ckpt.slot >= slots || !caches[ckpt.slot]) { valid = false; break; }
+        data = caches[ckpt.slot]->LoadState(data, end, ckpt);
+        valid = data != NULL;
+        loaded ++;
+    }
+    for (UINT32 slot = 0; slot < slots; slot++) loaded -= caches[slot] != NULL;
+    munmap((VOID*) map, st.st_size);
+    if (ul3) ul3->AddPrevUsers();
+
+    if (!valid || loaded)
+    {
+        MACHINESIM_PRINT("Error: checkpoint %s does not match the cache and tlb configuration\n", name.c_str());
+        PIN_ExitProcess(1);
+    }
+    if (!verbose) return;
+    MACHINESIM_PRINT("cache and tlb state at %llu instructions loaded from %s\n", 
+                     (unsigned long long) header.icount, name.c_str());
+}
+
+/* CacheCheckpointAt - called as the instruction count grows, saves the */
+/* checkpoint once the count given with -ckptat is reached. the first   */
+/* thread to get there claims the save. threads other than the caller  */
+/* would change their caches while they are written, pin can not stop  */
+/* them from here, so there is no checkpoint once threads ran.         */
+VOID CacheCheckpointAt(UINT64 icount, UINT32 threads)
+{
+    static volatile BOOL saved = false;
+    if (saved || SimOpts->get_ckpt_save().empty() || !SimOpts->get_ckpt_at() || 
+        icount < SimOpts->get_ckpt_at()) return;
+    if (__atomic_exchange_n(&saved, true, __ATOMIC_ACQ_REL)) return;
+    if (threads > 1)
+    {
+        MACHINESIM_PRINT("Error: %u threads ran by instruction %llu, -ckptat only saves the state of one thread\n", 
+                         threads, (unsigned long long) icount);
+        return;
+    }
+    CheckpointSave(SimOpts->get_ckpt_save(), icount);
+}
+
+/* ===================================================================== */
+/* Called by the time segmented replay */
+/* ===================================================================== */
+/* CacheStateSave/CacheStateLoad - a checkpoint of the state at the end */
+/* of a segment, and the start of the next one from it.                */
+VOID CacheStateSave(const string &name, UINT64 icount)
+{
+    CheckpointSave(name, icount, false);
+    return;
+}
+
+VOID CacheStateLoad(const string &name)
+{
+    CheckpointLoad(name, false);
+    return;
+}
+
+/* CacheStateHash - a hash of the state of every cache and tlb, the same */
+/* state that goes into a checkpoint.                                    */
+UINT64 CacheStateHash()
+{
+    char *data = NULL;
+    size_t size = 0;
+    FILE *file = open_memstream(&data, &size);
+    if (!file) return 0;
+    CheckpointWrite(file, 0);
+    fclose(file);
+
+    UINT64 hash = 0xcbf29ce484222325ULL, word;
+    size_t i = 0;
+    for (; i + sizeof(word) <= size; i += sizeof(word))
+    {
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++) hash = (hash ^ (UINT8)data[i]) * 0x100000001b3ULL;
+    free(data);
+    return hash;
+}
+
+/* CacheCounters - copy the counters of the first threads threads and the */
+/* L3 bank counters into counts, NULL only counts them. the hits of the   */
+/* same line filter are added to the counters first.                      */
+UINT32 CacheCounters(UINT64 *counts, UINT32 threads)
+{
+    const UINT32 claimed = SimStats->get_claimed();
+    UINT32 banks = 0;
+    CACHE_STATS *bankstats = ul3 ? ul3->GetBankStats(&banks) : NULL;
+    if (!counts) return threads * claimed + 2 * banks;
+
+    LineFilterFlush();
+    for (THREADID tid = 0; tid < threads; tid++, counts += claimed) 
+        memcpy(counts, SimStats->get_block(tid), sizeof(UINT64) * claimed);
+    for (UINT32 bank = 0; bank < banks; bank++, counts += 2) 
+        memcpy(counts, bankstats + bank * CACHE_BASE::BANK_STATS, sizeof(UINT64) * 2);
+    return threads * claimed + 2 * banks;
+}
+
+/* CacheCountersAdd - add counts of CacheCounters to the counters */
+VOID CacheCountersAdd(const UINT64 *counts, UINT32 threads)
+{
+    const UINT32 claimed = SimStats->get_claimed();
+    UINT32 banks = 0;
+    CACHE_STATS *bankstats = ul3 ? ul3->GetBankStats(&banks) : NULL;
+
+    for (THREADID tid = 0; tid < threads; tid++)
+    {
+        for (UINT32 c = 0; c < claimed; c++) SimStats->add(tid, c, *counts++);
+    }
+    for (UINT32 bank = 0; bank < banks; bank++)
+    {
+        bankstats[bank * CACHE_BASE::BANK_STATS] += *counts++;
+        bankstats[bank * CACHE_BASE::BANK_STATS + 1] += *counts++;
+    }
+    return;
+}
+
+/* ===================================================================== */
+/* Printing Routines */
+/* ===================================================================== */
+/// CacheHierarchyPrint - the parameters and the stats of every level.
+LOCALFUN VOID CacheHierarchyPrint(std::ofstream &out, const CACHE_HIERARCHY &h)
+{
     out << "#==================\n" << "# General stats\n" << "#====================\n";
     out << "# :" << endl;
     out << "# " << SimTheOne->get_global_icount() << " instructions executed\n";
     out << "# " << endl;
 
-    if (il1)   out << il1->StatsParam();
-    if (dl1)   out << dl1->StatsParam();
-    if (ul2)   out << ul2->StatsParam();
-    if (ul3)   out << ul3->StatsParam();
-    if (dtlbm) out << dtlbm->StatsParam();
-    if (itlbm) out << itlbm->StatsParam();
-    if (dtlb1) out << dtlb1->StatsParam();
-    if (itlb1) out << itlb1->StatsParam();
-    if (utlb2) out << utlb2->StatsParam();
+    if (h.il1)   out << h.il1->StatsParam();
+    if (h.dl1)   out << h.dl1->StatsParam();
+    if (h.ul2)   out << h.ul2->StatsParam();
+    if (h.ul3)   out << h.ul3->StatsParam();
+    if (h.dtlbm) out << h.dtlbm->StatsParam();
+    if (h.itlbm) out << h.itlbm->StatsParam();
+    if (h.dtlb1) out << h.dtlb1->StatsParam();
+    if (h.itlb1) out << h.itlb1->StatsParam();
+    if (h.utlb2) out << h.utlb2->StatsParam();
     out << "\n\n";
 
-    if (il1)
+    if (h.il1)
     {
     out << "################\n" << "# L1 ICACHE stats\n" << "################\n";
-    out << il1->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    out << h.il1->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
     }
-    if (dl1)
+    if (h.dl1)
     {
     out << "################\n" << "# L1 DCACHE stats\n" << "################\n";
-    out << dl1->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    out << h.dl1->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
     }
-    if (ul2)
+    if (h.ul2)
     {
     out << "################\n" << "# L2 unified CACHE stats\n" << "################\n";
-    out << ul2->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    out << h.ul2->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
     }
-    if (ul3)
+    if (h.ul3)
     {
     out << "################\n" << "# L3 unified CACHE stats\n" << "################\n";
-    out << ul3->StatsLong("# ", CACHE_BASE::CACHE_TYPE_DCACHE, 0);
+    out << h.ul3->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    out << h.ul3->StatsBanks("# ");
     }
-    if (itlbm)
+    if (h.itlbm)
     {
     out << "################\n" << "# 4. Micro 4K ITLB stats\n" << "################\n";
-    out << itlbm->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    out << h.itlbm->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
     }
-    if (dtlbm)
+    if (h.dtlbm)
     {
     out << "################\n" << "# 4. Micro 4K DTLB stats\n" << "################\n";
-    out << dtlbm->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    out << h.dtlbm->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
     }
-    if (itlb1)
+    if (h.itlb1)
     {
     out << "################\n" << "# L1 4K TLB stats\n" << "################\n";
-    out << itlb1->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    out << h.itlb1->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
     }
-    if (dtlb1)
+    if (h.dtlb1)
     {
     out << "################\n" << "# L1 4K TLB stats\n" << "################\n";
-    out << dtlb1->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    out << h.dtlb1->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
     }
-    if (utlb2) 
+    if (h.utlb2) 
     {
     out << "################\n" << "# L2 TLB stats\n" << "################\n";
-    out << utlb2->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    out << h.utlb2->StatsLongAll("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
     }
+}
+
+LOCALFUN VOID cache_and_tlb_module_print()
+{
+    char name[128];
+    sprintf(name, "%s.%d", "cache_sim.out", PIN_GetPid());
+    std::ofstream out(name);
+
+    CACHE_HIERARCHY h = { il1, dl1, ul2, ul3, itlbm, dtlbm, itlb1, dtlb1, utlb2 };
+    CacheHierarchyPrint(out, h);
     if (tlbc)
     {
     out << "################\n" << "# TLB Coherence\n" << "################\n";
@@ -575,121 +1372,153 @@ LOCALFUN VOID cache_and_tlb_module_print()
     return;
 }
 
+LOCALFUN VOID stackdist_module_print()
+{
+    char name[128];
+    sprintf(name, "%s.%d", "stackdist.out", PIN_GetPid());
+    std::ofstream out(name);
+
+    const char *names[] = { "L1 instruction CACHE", "L1 data CACHE", "L2 unified CACHE", "L3 unified CACHE",
+                            "Micro 4K ITLB", "Micro 4K DTLB", "L1 ITLB", "L1 DTLB", "L2 unified TLB" };
+    CACHE *caches[] = { il1, dl1, ul2, ul3, itlbm, dtlbm, itlb1, dtlb1, utlb2 };
+    for (UINT32 i=0; i<sizeof(caches)/sizeof(caches[0]); i++)
+    {
+        if (!caches[i] || !caches[i]->Profile) continue;
+        out << "################\n" << "# " << names[i] << " stack distance\n" << "################\n";
+        out << caches[i]->Profile->StatsLong("# ");
+    }
+
+    /* done */
+    fprintf(stdout, "stack distance profiles dumped into %s.%d\n", "stackdist.out", PIN_GetPid());
+    return;
+}
+
 /* ===================================================================== */
 /* Initialization and Finalization Routines */
 /* ===================================================================== */
 
+/// CachePolicyName - the replacement policy of a cache level, the -r 
+/// policy unless config.xml picks one for the level.
+LOCALFUN string CachePolicyName(const cache_systemcore &level)
+{
+    if (level.replacement_policy[0]) return level.replacement_policy;
+    return SimOpts->get_replacepolicy();
+}
+
+/// CacheLevelNew - a cache or tlb of a configuration, NULL if disabled. 
+/// a policy that can not be simulated is an error, silently simulating 
+/// another one would spoil the comparison of the policies.
+LOCALFUN CACHE *CacheLevelNew(const cache_systemcore &level, UINT32 cachelevel, const char *name)
+{
+    if (!level.cache_enable) return NULL;
+    const CACHE_POLICY_TYPE policy = CachePolicyType(CachePolicyName(level));
+    if (policy == CACHE_POLICY_NUM)
+    {
+        MACHINESIM_PRINT("Error: %s has the unknown replacement policy %s\n", name, CachePolicyName(level).c_str());
+        PIN_ExitProcess(1);
+    }
+    if (policy == CACHE_POLICY_PLRU && !IsPowerOfTwo(level.associativity))
+    {
+        MACHINESIM_PRINT("Error: PLRU needs a power of 2 associativity, %s has %d ways\n", name, level.associativity);
+        PIN_ExitProcess(1);
+    }
+    return new CACHE("Micro 4K TLB Cache", cachelevel,
+                     level.number_entries*level.cache_linesize,
+                     level.cache_linesize,
+                     level.associativity,
+                     CachePolicyName(level),
+                     CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE,
+                     0,
+                     cachelevel == 3 ? SimOpts->get_l3_sample() : 1,
+                     cachelevel == 3 && SimOpts->get_l3_sample_hash());
+}
+
+/// CacheHierarchyBuild - the caches and tlbs of a configuration. the L2 
+/// and L3 back-invalidate the levels above unless they are non_inclusive.
+LOCALFUN VOID CacheHierarchyBuild(const root_system &sys, CACHE_HIERARCHY *h)
+{
+    h->il1 = CacheLevelNew(sys.L1_icache, 1, "L1_icache");
+    h->dl1 = CacheLevelNew(sys.L1_dcache, 1, "L1_dcache");
+    h->ul2 = CacheLevelNew(sys.L2_ucache, 2, "L2_ucache");
+    if (h->ul2 && !sys.L2_ucache.non_inclusive)
+    {
+        h->ul2->SetPrev(h->il1);
+        h->ul2->SetPrev(h->dl1);
+    }
+    h->ul3 = CacheLevelNew(sys.L3_ucache, 3, "L3_ucache");
+    if (h->ul3 && !sys.L3_ucache.non_inclusive) h->ul3->SetPrev(h->il1);
+
+    h->itlbm = CacheLevelNew(sys.LM_itlb, 1, "LM_itlb");
+    h->dtlbm = CacheLevelNew(sys.LM_dtlb, 1, "LM_dtlb");
+    h->itlb1 = CacheLevelNew(sys.L1_itlb, 1, "L1_itlb");
+    if (h->itlb1) h->itlb1->SetPrev(h->itlbm);
+    h->dtlb1 = CacheLevelNew(sys.L1_dtlb, 1, "L1_dtlb");
+    if (h->dtlb1) h->dtlb1->SetPrev(h->dtlbm);
+    h->utlb2 = CacheLevelNew(sys.L2_utlb, 1, "L2_utlb");
+    if (h->utlb2 && !sys.L2_utlb.non_inclusive)
+    {
+        h->utlb2->SetPrev(h->dtlb1);
+        h->utlb2->SetPrev(h->itlb1);
+    }
+}
+
 /// init_sim_cache - initialize cache module.
 VOID MachineSimCacheTLBModuleInit()
 {
-    if (SimOpts->get_xml_parser()->sys.L1_icache.cache_enable)
-    {
-        il1 = new CACHE("Micro 4K TLB Cache", 1,
-                        SimOpts->get_xml_parser()->sys.L1_icache.number_entries*
-                        SimOpts->get_xml_parser()->sys.L1_icache.cache_linesize,
-                        SimOpts->get_xml_parser()->sys.L1_icache.cache_linesize,
-                        SimOpts->get_xml_parser()->sys.L1_icache.associativity,
-                        SimOpts->get_replacepolicy(),
-                        CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE,
-                        0);
-
-    }
-    if (SimOpts->get_xml_parser()->sys.L1_dcache.cache_enable)
-    {
-        dl1 = new CACHE("Micro 4K TLB Cache", 1,
-                        SimOpts->get_xml_parser()->sys.L1_dcache.number_entries*
-                        SimOpts->get_xml_parser()->sys.L1_dcache.cache_linesize,
-                        SimOpts->get_xml_parser()->sys.L1_dcache.cache_linesize,
-                        SimOpts->get_xml_parser()->sys.L1_dcache.associativity,
-                        SimOpts->get_replacepolicy(),
-                        CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE,
-                        0);
-
-    }
-    if (SimOpts->get_xml_parser()->sys.L2_ucache.cache_enable)
-    {
-        ul2 = new CACHE("Micro 4K TLB Cache", 1,
-                        SimOpts->get_xml_parser()->sys.L2_ucache.number_entries*
-                        SimOpts->get_xml_parser()->sys.L2_ucache.cache_linesize,
-                        SimOpts->get_xml_parser()->sys.L2_ucache.cache_linesize,
-                        SimOpts->get_xml_parser()->sys.L2_ucache.associativity,
-                        SimOpts->get_replacepolicy(),
-                        CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE,
-                        0);
-        ul2->SetPrev(il1);
-        ul2->SetPrev(dl1);
-    }
-    if (SimOpts->get_xml_parser()->sys.L3_ucache.cache_enable)
-    {
-        ul3 = new CACHE("Micro 4K TLB Cache", 1,
-                        SimOpts->get_xml_parser()->sys.L3_ucache.number_entries*
-                        SimOpts->get_xml_parser()->sys.L3_ucache.cache_linesize,
-                        SimOpts->get_xml_parser()->sys.L3_ucache.cache_linesize,
-                        SimOpts->get_xml_parser()->sys.L3_ucache.associativity,
-                        SimOpts->get_replacepolicy(),
-                        CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE,
-                        0);
-        ul3->SetPrev(il1);
-    }
-    if (SimOpts->get_xml_parser()->sys.LM_itlb.cache_enable)
-    {
-        itlbm = new CACHE("Micro 4K TLB Cache", 1,
-                          SimOpts->get_xml_parser()->sys.LM_itlb.number_entries*
-                          SimOpts->get_xml_parser()->sys.LM_itlb.cache_linesize,
-                          SimOpts->get_xml_parser()->sys.LM_itlb.cache_linesize,
-                          SimOpts->get_xml_parser()->sys.LM_itlb.associativity,
-                          SimOpts->get_replacepolicy(),
-                          CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE,
-                          0);
-    }
-    if (SimOpts->get_xml_parser()->sys.LM_itlb.cache_enable)
-    {
-        dtlbm = new CACHE("Micro 4K TLB Cache", 1,
-                          SimOpts->get_xml_parser()->sys.LM_dtlb.number_entries*
-                          SimOpts->get_xml_parser()->sys.LM_dtlb.cache_linesize,
-                          SimOpts->get_xml_parser()->sys.LM_dtlb.cache_linesize,
-                          SimOpts->get_xml_parser()->sys.LM_dtlb.associativity,
-                          SimOpts->get_replacepolicy(),
-                          CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE,
-                          0);
-    }
-    if (SimOpts->get_xml_parser()->sys.L1_itlb.cache_enable)
-    {
-        itlb1 = new CACHE("Micro 4K TLB Cache", 1,
-                          SimOpts->get_xml_parser()->sys.L1_itlb.number_entries* 
-                          SimOpts->get_xml_parser()->sys.L1_itlb.cache_linesize,
-                          SimOpts->get_xml_parser()->sys.L1_itlb.cache_linesize,
-                          SimOpts->get_xml_parser()->sys.L1_itlb.associativity,
-                          SimOpts->get_replacepolicy(),
-                          CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE,
-                          0);
-        itlb1->SetPrev(itlbm);
-    }
-    if (SimOpts->get_xml_parser()->sys.L1_dtlb.cache_enable)
-    {
-        dtlb1 = new CACHE("Micro 4K TLB Cache", 1,
-                          SimOpts->get_xml_parser()->sys.L1_dtlb.number_entries*
-                          SimOpts->get_xml_parser()->sys.L1_dtlb.cache_linesize,
-                          SimOpts->get_xml_parser()->sys.L1_dtlb.cache_linesize,
-                          SimOpts->get_xml_parser()->sys.L1_dtlb.associativity,
-                          SimOpts->get_replacepolicy(),
-                          CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE,
-                          0);
-
-        dtlb1->SetPrev(dtlbm);
-    }
-    if (SimOpts->get_xml_parser()->sys.L2_utlb.cache_enable)
-    {
-        utlb2 = new CACHE("Micro 4K TLB Cache", 1,
-                          SimOpts->get_xml_parser()->sys.L2_utlb.number_entries*   
-                          SimOpts->get_xml_parser()->sys.L2_utlb.cache_linesize,
-                          SimOpts->get_xml_parser()->sys.L2_utlb.cache_linesize,
-                          SimOpts->get_xml_parser()->sys.L2_utlb.associativity,
-                          SimOpts->get_replacepolicy(),
-                          CACHE::CACHE_STORE::CACHE_STORE_ALLOCATE,
-                          0);
-        utlb2->SetPrev(dtlb1);
-        utlb2->SetPrev(itlb1);
+    CacheFindWayInit();
+    SimTheOne->get_global_simlock()->init_l3_banks(SimOpts->get_l3_banks());
+
+    CACHE_HIERARCHY h;
+    CacheHierarchyBuild(SimOpts->get_xml_parser()->sys, &h);
+    il1 = h.il1; dl1 = h.dl1; ul2 = h.ul2; ul3 = h.ul3;
+    itlbm = h.itlbm; dtlbm = h.dtlbm; itlb1 = h.itlb1; dtlb1 = h.dtlb1; utlb2 = h.utlb2;
+    // stack distance profiles of the stream reaching every level.
+    if (SimOpts->get_stackdist()) 
+    {
+        CACHE *caches[] = { il1, dl1, ul2, ul3, itlbm, dtlbm, itlb1, dtlb1, utlb2 };
+        for (UINT32 i=0; i<sizeof(caches)/sizeof(caches[0]); i++)
+        {
+            if (!caches[i]) continue;
+            caches[i]->Profile = new STACKDIST(caches[i]->GetLineSize(), 
+                                               caches[i]->GetMaxSets(), 
+                                               !caches[i]->IsPrivate());
+        }
+    }
+    // Belady's MIN of the stream reaching every level.
+    if (SimOpts->get_opt()) 
+    {
+        CACHE *caches[] = { il1, dl1, ul2, ul3, itlbm, dtlbm, itlb1, dtlb1, utlb2 };
+        for (UINT32 i=0; i<sizeof(caches)/sizeof(caches[0]); i++)
+        {
+            if (caches[i]) caches[i]->SetOracle(SimOpts->get_opt_window());
+        }
+    }
+    // start from the state of a checkpoint.
+    if (!SimOpts->get_ckpt_load().empty()) CheckpointLoad(SimOpts->get_ckpt_load());
+    // buffered references reach the caches after the count that -ckptat 
+    // looks at, the caches are not in the state at that count.
+    if (!SimOpts->get_ckpt_save().empty() && SimOpts->get_ckpt_at() && SimOpts->get_mem_buffer())
+    {
+        MACHINESIM_PRINT("Error: -ckptat does not work with -membuf, -simthreads or -sweep\n");
+        PIN_ExitProcess(1);
+    }
+    // the same line filter, which is told about back-invalidations.
+    LineFilterOn[0] = LineFilterExact(false);
+    LineFilterOn[1] = LineFilterExact(true);
+    if (LineFilterOn[0] || LineFilterOn[1])
+    {
+        LineFilters = (LINE_FILTER*) AlignedAlloc(sizeof(LINE_FILTER)*MAX_CACHE_THREAD, CACHELINE_SIZE);
+        memset(LineFilters, 0, sizeof(LINE_FILTER)*MAX_CACHE_THREAD);
+        LineFilterReset();
+    }
+    if (LineFilterOn[0]) il1->EvictNotify = LineFilterEvictI;
+    if (LineFilterOn[1]) dl1->EvictNotify = LineFilterEvictD;
+    // an L3 eviction back-invalidates the private caches of the other 
+    // threads through their queues, see CacheDeferUl3 for the others.
+    if (ul3 && !ul3->prev.empty())
+    {
+        BackInvals = new BACK_INVAL[MAX_CACHE_THREAD];
+        ul3->EvictDefer = BackInvalQueue;
     }
     // done. 
     return;
@@ -697,8 +1526,17 @@ VOID MachineSimCacheTLBModuleInit()
 
 VOID MachineSimCacheTLBModuleFini()
 {
+    // the hits the filter kept from the caches count as well.
+    LineFilterFlush();
+    free(LineFilters);
+
+    // without -ckptat the checkpoint is the state at the end.
+    if (!SimOpts->get_ckpt_save().empty() && !SimOpts->get_ckpt_at()) 
+        CheckpointSave(SimOpts->get_ckpt_save(), SimTheOne->get_global_icount());
+
     // print cache simulation results.
     cache_and_tlb_module_print();
+    if (SimOpts->get_stackdist()) stackdist_module_print();
 
     // free cache simulation resources.
     if (il1)    delete il1;
@@ -711,6 +1549,103 @@ VOID MachineSimCacheTLBModuleFini()
     if (dtlb1)  delete dtlb1;
     if (utlb2)  delete utlb2;
     if (tlbc)   delete tlbc;
+    delete [] BackInvals;
+}
+
+/* ===================================================================== */
+/* Called by the configuration sweep */
+/* ===================================================================== */
+/// the hierarchies of -sweep are run by a sweep thread each, which is the 
+/// only one to ever touch them. they see every reference, there is no line
+/// filter, no deferred L3 and no checkpoint or stack distance profile.
+LOCALFUN VOID HierarchyUl2Access(const CACHE_HIERARCHY *h        , 
+                                 ADDRINT  iaddr                  , 
+                                 ADDRINT  addr                   , 
+                                 UINT32   size                   , 
+                                 CACHE_BASE::ACCESS_TYPE type    , 
+                                 THREADID tid                    )
+{
+    BOOL ul2Hit = 0;
+    if (!ul2Hit && h->ul2) ul2Hit = h->ul2->Access(iaddr, addr, size, type, tid);
+    if (!ul2Hit && h->ul3) h->ul3->Access(iaddr, addr, size, type, tid);
+}
+
+LOCALFUN VOID HierarchyTlbAccess(CACHE *tlbm, CACHE *tlb1, CACHE *utlb2, 
+                                 ADDRINT  addr                   , 
+                                 CACHE_BASE::ACCESS_TYPE type    , 
+                                 THREADID tid                    )
+{
+    BOOL tlbHit = 0;
+    if (!tlbHit && tlbm)  tlbHit = tlbm->AccessPage(addr, type, tid);
+    if (!tlbHit && tlb1)  tlbHit = tlb1->AccessPage(addr, type, tid);
+    if (!tlbHit && utlb2) utlb2->AccessPage(addr, type, tid);
+}
+
+/* CacheHierarchyCounters - the most counters a hierarchy claims, with */
+/* every level there.                                                 */
+UINT32 CacheHierarchyCounters()
+{
+    const UINT32 stats = SIMSTATS::claimed_size(CACHE_BASE::ACCESS_TYPE_NUM*2);
+    const UINT32 skips = SIMSTATS::claimed_size(CACHE_BASE::ACCESS_TYPE_NUM);
+    return CACHE_COUNTED_LEVELS * (stats + skips + (SimOpts->get_opt() ? stats : 0));
+}
+
+/* CacheHierarchyNew - the hierarchy of another configuration */
+CACHE_HIERARCHY *CacheHierarchyNew(const ParseXML *config)
+{
+    CACHE_HIERARCHY *h = new CACHE_HIERARCHY;
+    CacheHierarchyBuild(config->sys, h);
+    return h;
+}
+
+/* CacheHierarchyRefs - run num buffered references of thread tid through */
+/* hierarchy h, from the L2 on for the references of a filtered trace.    */
+VOID CacheHierarchyRefs(const CACHE_HIERARCHY *h             , 
+                        const MEMREF *ref                    , 
+                        UINT64   num                         , 
+                        BOOL     filtered                    , 
+                        THREADID tid                         )
+{
+    for (const MEMREF *end = ref + num; ref != end; ++ref)
+    {
+        const CACHE_BASE::ACCESS_TYPE type = ref->type == MEMREF_STORE ? CACHE_BASE::ACCESS_TYPE_STORE : 
+                                                                         CACHE_BASE::ACCESS_TYPE_LOAD;
+        if (filtered)
+        {
+            HierarchyUl2Access(h, ref->pc, ref->ea, ref->size, type, tid);
+            continue;
+        }
+        if (ref->type == MEMREF_IFETCH)
+        {
+            BOOL iche_hit = 0;
+            if (!iche_hit && h->il1) iche_hit = h->il1->AccessSingleLine(ref->ea, ref->ea, type, tid);
+            if (!iche_hit) HierarchyUl2Access(h, ref->ea, ref->ea, 1, type, tid);
+            HierarchyTlbAccess(h->itlbm, h->itlb1, h->utlb2, ref->ea, type, tid);
+            continue;
+        }
+
+        BOOL dche_hit = 0;
+        if (!dche_hit && h->dl1) dche_hit = ref->size <= 4 ? h->dl1->AccessSingleLine(ref->pc, ref->ea, type, tid) :
+                                                             h->dl1->Access(ref->pc, ref->ea, ref->size, type, tid);
+        if (!dche_hit) HierarchyUl2Access(h, ref->pc, ref->ea, ref->size, type, tid);
+        HierarchyTlbAccess(h->dtlbm, h->dtlb1, h->utlb2, ref->ea, type, tid);
+    }
+}
+
+/* CacheHierarchyReport - dump the stats of hierarchy h into name */
+VOID CacheHierarchyReport(const CACHE_HIERARCHY *h, const string &name, const string &config)
+{
+    std::ofstream out(name.c_str());
+    out << "# configuration " << config << endl;
+    CacheHierarchyPrint(out, *h);
+    fprintf(stdout, "simulation stats of %s dumped into %s\n", config.c_str(), name.c_str());
+}
+
+VOID CacheHierarchyDelete(CACHE_HIERARCHY *h)
+{
+    delete h->il1;   delete h->dl1;   delete h->ul2;   delete h->ul3;
+    delete h->itlbm; delete h->dtlbm; delete h->itlb1; delete h->dtlb1; delete h->utlb2;
+    delete h;
 }
 
 #if 0
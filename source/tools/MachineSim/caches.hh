@@ -36,6 +36,11 @@ END_LEGAL */
 
 #include "pin.H"
 #include "utils.hh"
+#include "stackdist.hh"
+#include "optgen.hh"
+
+#include <vector>
+#include <cmath>
 
 typedef UINT64 CACHE_STATS; // type of cache hit/miss counters
 
@@ -167,13 +172,8 @@ bool SortByAddress(PageRecord &rec1, PageRecord& rec2)
 
 
 #define FOREACH_CACHE(X)        for(INT index=0;index<MAX_CACHE_THREAD;++index) {X;}
-#define FOREACH_CACHEWAY(X)     for(INT index=0;index<CacheAssoc;++index) {X;}
+#define FOREACH_CACHEWAY(X)     for(UINT32 index=0;index<CacheAssoc;++index) {X;}
 #define FOREACH_CACHEACCESS(X)  for(INT index=0;index<ACCESS_TYPE_NUM;++index) {X;}
-#define FOREACH_CACHE_SUM(X)    do {                          \
-   INT64 sum = 0;                                             \
-   for(INT index=0;index<MAX_CACHE_THREAD;++index) {sum+=X;}  \
-   return sum;                                                \
-} while(0);
 #define FOREACH_CACHEACCESS_SUM(X)  do {                      \
    INT64 sum = 0;                                             \
    for(INT index=0;index<ACCESS_TYPE_NUM;++index) {sum+=X;}   \
@@ -186,202 +186,589 @@ bool SortByAddress(PageRecord &rec1, PageRecord& rec2)
 //  @
 //  @ - associativity - how many lines are in the set
 //  @ - replacement   - what is the replacement policy for the set.
+//  @
+//  @ The sets are not objects of their own. All the sets of a cache are kept
+//  @ in the flat arrays of its CacheImpl and a set is addressed by its index.
 /* ===================================================================== */
 /* Cache Sets ... */
 /* ===================================================================== */
 
-/// @ CACHE_SET_BASE - This is the base of all cache sets. 
-class CACHE_SET_BASE
+/// @ CACHE_FIND_WAY - compare all the tags of a set against tag and return 
+//  @ the matching way, or assoc if none of them matches. the vectorized
+//  @ versions are picked at startup based on what the host supports.
+typedef UINT32 (*CACHE_FIND_WAY)(const CACHE_TAG *tags, CACHE_TAG tag, UINT32 assoc);
+extern CACHE_FIND_WAY CacheFindWay;
+
+/// @ CACHE_ASSOC - associativity used by the cache routines. the routines
+//  @ are templates on ASSOC, which is the associativity when it is known at
+//  @ compile time, or 0 for the generic routines that read it at runtime.
+#define CACHE_ASSOC(ASSOC, assoc)   ((ASSOC) ? (ASSOC) : (assoc))
+#define FOREACH_ASSOCWAY(X)         for(UINT32 index=0;index<CACHE_ASSOC(ASSOC,cache.CacheAssoc);++index) {X;}
+
+/// @ CacheImpl - Implemetation of the cache. The tags of set s are kept in
+//  @ CacheTags[s*CacheAssoc ... s*CacheAssoc+CacheAssoc-1], the replacement
+//  @ policy keeps one byte of metadata for every way at the same position in
+//  @ CacheMeta, and the most recently used way of every set is kept in 
+//  @ CacheMru as a hint that is checked before the set is scanned.
+class CacheImpl
 {
-protected:
-    // associativity of the cache set. 
-    INT32 CacheAssoc;
-    // all the tags in the cache size.
-    CACHE_TAG *CacheTags;
 public:
+    // Number of sets in the cache.
+    UINT32 CacheSetNum;
+    // Associativity of the cache.
+    UINT32 CacheAssoc;
+    // Level of the cache.
+    UINT32 CacheLevel;
+    // The cache that owns this cache implementation.
     CACHE_BASE *CacheBase;
+
+    // the tags of all the sets, CacheSetNum*CacheAssoc of them.
+    CACHE_TAG *CacheTags;
+    // the replacement metadata of every way of every set.
+    UINT8 *CacheMeta;
+    // the most recently used way of every set.
+    UINT8 *CacheMru;
+
+    // replacement state shared by all the sets, owned by the policy.
+    UINT32 PolicyPsel;
+    UINT32 PolicyRand;
+    UINT8  *PolicyTable;
+    UINT16 *PolicySig;
+
+    // line accesses and misses of every set, only kept when sets are sampled.
+    UINT64 *SetAccesses;
+    UINT64 *SetMisses;
+
 public:
-    /// @ constructor.
-    CACHE_SET_BASE(UINT32 assoc             , 
-                   UINT32 level             ,
-                   CACHE_BASE* cache        )
-                   : 
-                   CacheAssoc(assoc)        ,
-                   CacheTags(0)             , 
-                   CacheBase(cache)
+    /// @ FindWay - the way of the set holding tag, or the associativity if
+    /// @ the tag is not in the set. a known associativity compiles into an
+    /// @ unrolled compare of all the ways.
+    template <UINT32 ASSOC> UINT32 FindWay(const CACHE_TAG *tags, CACHE_TAG tag) const
     {
-       CacheTags  = new CACHE_TAG[CacheAssoc];
+        if (!ASSOC) return CacheFindWay(tags, tag, CacheAssoc);
+        UINT32 mask = 0;
+        for (UINT32 way=0; way<ASSOC; ++way) mask |= (UINT32)(tags[way] == tag) << way;
+        return mask ? __builtin_ctz(mask) : ASSOC;
     }
 
-    /// @ destructor.
-    virtual ~CACHE_SET_BASE() { /*free (CacheTags);*/ }
+    /// @ FreeWay - an unused way of the set, or the associativity if the
+    /// @ set is full.
+    template <UINT32 ASSOC> UINT32 FreeWay(UINT32 setindex) const
+    {
+        return FindWay<ASSOC>(&CacheTags[setindex*CACHE_ASSOC(ASSOC, CacheAssoc)], CACHE_TAG(0));
+    }
 
-    /// @ GetUnused - get the free entry in the cache set.
-    INT32 GetUnused() const
+    /// @ Random - a pseudo random number from the state of the cache.
+    UINT32 Random()
     {
-        FOREACH_CACHEWAY(if (CacheTags[index].unused()) return index;);
-        return CacheAssoc;
+        PolicyRand ^= PolicyRand << 13;
+        PolicyRand ^= PolicyRand >> 17;
+        PolicyRand ^= PolicyRand << 5;
+        return PolicyRand;
     }
 
-    // Find and Replace are the only two functions that need to be specialized.
-    // Usually the Find function needs not be specialized as most cache implementation
-    // shares the same idea.
-    virtual UINT32   Find(CACHE_TAG  tag) ABSTRACT_CLASS;
-    virtual VOID     Replace(CACHE_TAG& tag, CACHE_TAG &etag, ADDRINT iaddr) ABSTRACT_CLASS;
-    virtual VOID     Evict(CACHE_TAG tag) ABSTRACT_CLASS;
-};
+    /// @ Find - look up the tag in the set, update the policy on hit.
+    template <UINT32 ASSOC, class POLICY> BOOL Find(UINT32 setindex, CACHE_TAG tag)
+    {
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, CacheAssoc);
+        const CACHE_TAG *tags = &CacheTags[setindex*assoc];
+        UINT32 way = CacheMru[setindex];
+        // did not hit into last line, compare all the ways at once.
+        if (tags[way] != tag && (way = FindWay<ASSOC>(tags, tag)) == assoc) return false;
+        POLICY::template Hit<ASSOC>(*this, setindex, way);
+        CacheMru[setindex] = way;
+        return true;
+    }
 
-/// @ CACHE_LRU_SET - brief Cache set with least recently used replacement
-//  @ policy. LRU implemented by keeping a timestamp for every access and
-//  @ the entry with the smallest timestamp is the one to replace.
-class CACHE_LRU_SET : public CACHE_SET_BASE
-{
-private:
-    // the use history of each cache line in the set. it is increment
-    // on every access to this cache set.
-    UINT64* UseStack;
-public:
-    // Optimization for simulation speed, cache the last block.
-    UINT8   LastBlock;
-private:
-    BOOL Probe(UINT32 index, CACHE_TAG tag)
+    /// @ Replace - fill the tag into the way the policy picks and return
+    /// @ the tag that was there.
+    template <UINT32 ASSOC, class POLICY> VOID Replace(UINT32 setindex, CACHE_TAG tag, CACHE_TAG &etag, ADDRINT iaddr)
     {
-       ++UseStack[index];
-       if (CacheTags[index] == tag)
-       {
-           // Time-stamp this access.
-           UseStack[index] = SimTheOne->get_global_icount();
-           LastBlock = index;
-           return true;
-       }
-       return false;
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, CacheAssoc);
+        const UINT32 way = POLICY::template Victim<ASSOC>(*this, setindex);
+        etag = CacheTags[setindex*assoc+way];
+        CacheTags[setindex*assoc+way] = tag;
+        POLICY::template Fill<ASSOC>(*this, setindex, way, iaddr);
+        CacheMru[setindex] = way;
+    }
+
+    /// @ Evict - evict a block from this cache
+    template <UINT32 ASSOC, class POLICY> VOID Evict(CACHE_TAG tag, UINT32 setindex)
+    {
+        ASSERTX(setindex < CacheSetNum);
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, CacheAssoc);
+        CACHE_TAG *tags = &CacheTags[setindex*assoc];
+        const UINT32 way = FindWay<ASSOC>(tags, tag);
+        if (way == assoc) return;
+        tags[way] = 0;
+        POLICY::template Evict<ASSOC>(*this, setindex, way);
     }
+
 public:
-    ///@ constructore and destructor.
-    CACHE_LRU_SET(UINT32 CacheAssoc           , 
-                  UINT32 CacheLevel           , 
-                  CACHE_BASE* CacheBase       ) 
-                  : 
-                  CACHE_SET_BASE(CacheAssoc   , 
-                                 CacheLevel   , 
-                                 CacheBase    )
+    /// @ constructor and destructor.
+    inline CacheImpl(UINT32 SetNum        , 
+                     UINT32 SetAssoc      , 
+                     UINT32 level         , 
+                     CACHE_BASE* cache    );
+    ~CacheImpl() 
     {
-        UseStack = new UINT64[CacheAssoc];
-        memset(UseStack, 0, sizeof(UINT16)*CacheAssoc);
+        free(CacheTags);
+        delete [] CacheMeta;
+        delete [] CacheMru;
+        delete [] PolicyTable;
+        delete [] PolicySig;
+        delete [] SetAccesses;
+        delete [] SetMisses;
     }
-    virtual ~CACHE_LRU_SET() { free (UseStack); }
 
-    VOID Evict(CACHE_TAG tag)
+    /// @ Empty - whether no line was ever filled.
+    BOOL Empty() const
     {
-        INT EvictIndex = -1;
-        FOREACH_CACHEWAY(if (CacheTags[index] == tag) EvictIndex = index;);
-        if (EvictIndex > 0) CacheTags[EvictIndex] = 0;
+        for (UINT32 i=0; i<CacheSetNum*CacheAssoc; i++) if (!CacheTags[i].unused()) return false;
+        return true;
     }
+    /// @ Save - write the tags and the replacement state to a checkpoint. 
+    /// @ Load - read them back from the mapped checkpoint, past the end.
+    inline VOID Save(FILE *file) const;
+    inline const UINT8 *Load(const UINT8 *data);
+    inline UINT64 SavedSize() const;
+
+    /// @ EnableSetStats - count the accesses and misses of every set.
+    static VOID EnableSetStats(CacheImpl &cache)
+    {
+        cache.SetAccesses = new UINT64[cache.CacheSetNum];
+        cache.SetMisses = new UINT64[cache.CacheSetNum];
+        memset(cache.SetAccesses, 0, sizeof(UINT64)*cache.CacheSetNum);
+        memset(cache.SetMisses, 0, sizeof(UINT64)*cache.CacheSetNum);
+    }
+};
 
-    UINT32 Find(CACHE_TAG tag)
+/// @ CACHE_POLICY - Everything related to replacement policies
+//  @
+//  @ A policy is a class of static templates that CacheImpl instantiates for
+//  @ the associativity, it keeps its state in the CacheMeta byte of every way
+//  @ and in the Policy* fields shared by all the sets of the cache.
+//  @
+//  @ - Init   - initialize the metadata of all the sets.
+//  @ - Hit    - way of set is hit.
+//  @ - Victim - return the way of set to replace. unused ways come first.
+//  @ - Fill   - way of set is filled by the instruction at iaddr.
+//  @ - Evict  - way of set is invalidated.
+/* ===================================================================== */
+/* Replacement Policies ... */
+/* ===================================================================== */
+typedef enum
+{
+  CACHE_POLICY_LRU,
+  CACHE_POLICY_PLRU,
+  CACHE_POLICY_FIFO,
+  CACHE_POLICY_RANDOM,
+  CACHE_POLICY_SRRIP,
+  CACHE_POLICY_BRRIP,
+  CACHE_POLICY_DRRIP,
+  CACHE_POLICY_SHIP,
+  CACHE_POLICY_NUM
+} CACHE_POLICY_TYPE;
+
+static const char *CachePolicyNames[CACHE_POLICY_NUM] =
+{
+  "LRU", "PLRU", "FIFO", "RANDOM", "SRRIP", "BRRIP", "DRRIP", "SHIP"
+};
+
+/// @ CACHE_LRU_POLICY - least recently used replacement. every way keeps its
+//  @ recency rank, 0 is the most recently used and assoc-1 the least. way i
+//  @ starts with rank i and invalidated ways are demoted to assoc-1, so the
+//  @ unused ways are always ranked below the used ones.
+class CACHE_LRU_POLICY
+{
+public:
+    template <UINT32 ASSOC> static VOID Init(CacheImpl &cache)
+    {
+        for (UINT32 i=0; i<cache.CacheSetNum; i++)
+        {
+            FOREACH_ASSOCWAY(cache.CacheMeta[i*cache.CacheAssoc+index] = index;);
+        }
+    }
+    template <UINT32 ASSOC> static VOID Hit(CacheImpl &cache, UINT32 setindex, UINT32 way)
+    {
+        UINT8 *ranks = &cache.CacheMeta[setindex*CACHE_ASSOC(ASSOC, cache.CacheAssoc)];
+        const UINT8 rank = ranks[way];
+        if (!rank) return;
+        FOREACH_ASSOCWAY(ranks[index] += (ranks[index] < rank););
+        ranks[way] = 0;
+    }
+    template <UINT32 ASSOC> static UINT32 Victim(CacheImpl &cache, UINT32 setindex)
+    {
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, cache.CacheAssoc);
+        const UINT8 *ranks = &cache.CacheMeta[setindex*assoc];
+        FOREACH_ASSOCWAY(if (ranks[index] == assoc-1) return index;);
+        return 0;
+    }
+    template <UINT32 ASSOC> static VOID Fill(CacheImpl &cache, UINT32 setindex, UINT32 way, ADDRINT iaddr)
+    {
+        Hit<ASSOC>(cache, setindex, way);
+    }
+    template <UINT32 ASSOC> static VOID Evict(CacheImpl &cache, UINT32 setindex, UINT32 way)
     {
-        // increment the access history of the cache entry.
-        BOOL found = false;
-        // check whether hit the last line accessed.
-        if (CacheTags[LastBlock] == tag) return true;
-        // did not hit into last line.
-        FOREACH_CACHEWAY(found = Probe(index, tag); if (found) break;);
-        return found;
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, cache.CacheAssoc);
+        UINT8 *ranks = &cache.CacheMeta[setindex*assoc];
+        const UINT8 rank = ranks[way];
+        FOREACH_ASSOCWAY(ranks[index] -= (ranks[index] > rank););
+        ranks[way] = assoc-1;
     }
+};
 
-    VOID Replace(CACHE_TAG& tag, CACHE_TAG& etag, ADDRINT iaddr)
+/// @ CACHE_PLRU_POLICY - tree pseudo LRU. the assoc-1 nodes of the binary
+//  @ tree of a set are kept in the meta bytes of ways 1 ... assoc-1, node n
+//  @ has children 2n and 2n+1 and its bit points to the half holding the
+//  @ victim. the associativity must be a power of 2.
+class CACHE_PLRU_POLICY
+{
+public:
+    template <UINT32 ASSOC> static VOID Init(CacheImpl &cache)
+    {
+        ASSERTX(IsPowerOfTwo(cache.CacheAssoc));
+    }
+    template <UINT32 ASSOC> static VOID Hit(CacheImpl &cache, UINT32 setindex, UINT32 way)
     {
-        INT32 MaxIndex = CacheAssoc-1;
-        // Is there a free entry ?
-        if (CacheAssoc != (MaxIndex = GetUnused()))  goto lru_replace_entry;
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, cache.CacheAssoc);
+        UINT8 *tree = &cache.CacheMeta[setindex*assoc];
+        // point every node on the path away from the way.
+        for (UINT32 node = (way + assoc) >> 1, child = way + assoc; node; child = node, node >>= 1)
+        {
+            tree[node] = !(child & 1);
+        }
+    }
+    template <UINT32 ASSOC> static UINT32 Victim(CacheImpl &cache, UINT32 setindex)
+    {
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, cache.CacheAssoc);
+        const UINT32 free = cache.FreeWay<ASSOC>(setindex);
+        if (free != assoc) return free;
+        const UINT8 *tree = &cache.CacheMeta[setindex*assoc];
+        UINT32 node = 1;
+        while (node < assoc) node = (node << 1) | tree[node];
+        return node - assoc;
+    }
+    template <UINT32 ASSOC> static VOID Fill(CacheImpl &cache, UINT32 setindex, UINT32 way, ADDRINT iaddr)
+    {
+        Hit<ASSOC>(cache, setindex, way);
+    }
+    template <UINT32 ASSOC> static VOID Evict(CacheImpl &cache, UINT32 setindex, UINT32 way)
+    {
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, cache.CacheAssoc);
+        UINT8 *tree = &cache.CacheMeta[setindex*assoc];
+        // point every node on the path to the way.
+        for (UINT32 node = (way + assoc) >> 1, child = way + assoc; node; child = node, node >>= 1)
+        {
+            tree[node] = child & 1;
+        }
+    }
+};
 
-        MaxIndex = 0;
-        // find the entry that is least recently used. the entry that has the highest
-        // UseStack is the one that is least recently used.
-        FOREACH_CACHEWAY(if (UseStack[index] < UseStack[MaxIndex]) MaxIndex = index;);
-lru_replace_entry:
-        etag = CacheTags[MaxIndex];
-        // MaxIndex contains the entry that was least recently accessed.
-        CacheTags[MaxIndex] = tag;
-        UseStack[MaxIndex]  = 0;
-        return;
+/// @ CACHE_FIFO_POLICY - first in first out. the meta byte of way 0 holds
+//  @ the next way to replace once the set is full, it moves on every time
+//  @ that way is filled.
+class CACHE_FIFO_POLICY
+{
+public:
+    template <UINT32 ASSOC> static VOID Init(CacheImpl &cache) {}
+    template <UINT32 ASSOC> static VOID Hit(CacheImpl &cache, UINT32 setindex, UINT32 way) {}
+    template <UINT32 ASSOC> static UINT32 Victim(CacheImpl &cache, UINT32 setindex)
+    {
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, cache.CacheAssoc);
+        const UINT32 free = cache.FreeWay<ASSOC>(setindex);
+        return free != assoc ? free : cache.CacheMeta[setindex*assoc];
     }
+    template <UINT32 ASSOC> static VOID Fill(CacheImpl &cache, UINT32 setindex, UINT32 way, ADDRINT iaddr)
+    {
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, cache.CacheAssoc);
+        UINT8 &next = cache.CacheMeta[setindex*assoc];
+        if (next == way) next = (way + 1) % assoc;
+    }
+    template <UINT32 ASSOC> static VOID Evict(CacheImpl &cache, UINT32 setindex, UINT32 way) {}
 };
 
-/// @ CacheImpl - Implemetation of the cache.
-class CacheImpl
+/// @ CACHE_RANDOM_POLICY - replace a random way once the set is full.
+class CACHE_RANDOM_POLICY
 {
 public:
-    // Is the cache used ?
-    UINT32 CacheUsed;
-    // Number of sets in the cache.
-    UINT32 CacheSetNum;
-    // Associativity of the cache.
-    UINT32 CacheAssoc;
-    // Level of the cache.
-    UINT32 CacheLevel;
-    // Cache stats for load and store and hit and miss.
-    CACHE_STATS CacheAccess[2][2];
+    template <UINT32 ASSOC> static VOID Init(CacheImpl &cache) {}
+    template <UINT32 ASSOC> static VOID Hit(CacheImpl &cache, UINT32 setindex, UINT32 way) {}
+    template <UINT32 ASSOC> static UINT32 Victim(CacheImpl &cache, UINT32 setindex)
+    {
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, cache.CacheAssoc);
+        const UINT32 free = cache.FreeWay<ASSOC>(setindex);
+        return free != assoc ? free : cache.Random() % assoc;
+    }
+    template <UINT32 ASSOC> static VOID Fill(CacheImpl &cache, UINT32 setindex, UINT32 way, ADDRINT iaddr) {}
+    template <UINT32 ASSOC> static VOID Evict(CacheImpl &cache, UINT32 setindex, UINT32 way) {}
+};
 
-    // The cache that owns this cache implementation.
-    CACHE_BASE *CacheBase;
+/// @ CACHE_RRIP_BASE - re-reference interval prediction (Jaleel et al.
+//  @ ISCA 2010). the low bits of the meta byte hold the 2 bit re-reference
+//  @ prediction value of the way, a hit predicts near re-reference and the
+//  @ victim is a way predicted to be re-referenced in the distant future.
+//  @ the policies below differ in what they predict for a filled line.
+class CACHE_RRIP_BASE
+{
+public:
+    enum { RRPV_MASK = 0x3, RRPV_LONG = 2, RRPV_DISTANT = 3 };
 
-    // all the sets in the cache.
-    // this is a base class pointer. it can be used to point to
-    // subclasses of the CACHE_SET::CACHE_SET_BASE.
-    CACHE_SET_BASE **CacheSets;
+    template <UINT32 ASSOC> static VOID Init(CacheImpl &cache)
+    {
+        memset(cache.CacheMeta, RRPV_DISTANT, sizeof(UINT8)*cache.CacheSetNum*cache.CacheAssoc);
+    }
+    template <UINT32 ASSOC> static VOID Hit(CacheImpl &cache, UINT32 setindex, UINT32 way)
+    {
+        cache.CacheMeta[setindex*CACHE_ASSOC(ASSOC, cache.CacheAssoc)+way] &= ~RRPV_MASK;
+    }
+    template <UINT32 ASSOC> static UINT32 Victim(CacheImpl &cache, UINT32 setindex)
+    {
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, cache.CacheAssoc);
+        const UINT32 free = cache.FreeWay<ASSOC>(setindex);
+        if (free != assoc) return free;
+        // age the set until one of the ways is predicted distant.
+        UINT8 *rrpv = &cache.CacheMeta[setindex*assoc];
+        UINT8 oldest = 0;
+        FOREACH_ASSOCWAY(oldest = std::max<UINT8>(oldest, rrpv[index] & RRPV_MASK););
+        const UINT8 age = RRPV_DISTANT - oldest;
+        if (age) FOREACH_ASSOCWAY(rrpv[index] += age;);
+        FOREACH_ASSOCWAY(if ((rrpv[index] & RRPV_MASK) == RRPV_DISTANT) return index;);
+        return 0;
+    }
+    template <UINT32 ASSOC> static VOID Insert(CacheImpl &cache, UINT32 setindex, UINT32 way, UINT8 prediction)
+    {
+        UINT8 &meta = cache.CacheMeta[setindex*CACHE_ASSOC(ASSOC, cache.CacheAssoc)+way];
+        meta = (meta & ~RRPV_MASK) | prediction;
+    }
+    template <UINT32 ASSOC> static VOID Evict(CacheImpl &cache, UINT32 setindex, UINT32 way)
+    {
+        Insert<ASSOC>(cache, setindex, way, RRPV_DISTANT);
+    }
+    /// bimodal insertion, long re-reference for 1 out of 32 fills.
+    static UINT8 Bimodal(CacheImpl &cache)
+    {
+        return (cache.Random() & 31) ? RRPV_DISTANT : RRPV_LONG;
+    }
+};
 
+/// @ CACHE_SRRIP_POLICY - static RRIP, fills predict long re-reference.
+class CACHE_SRRIP_POLICY : public CACHE_RRIP_BASE
+{
 public:
-    /// @ Evict - evict a block from this cache
-    virtual VOID Evict(CACHE_TAG &tag, UINT32 setindex)
+    template <UINT32 ASSOC> static VOID Fill(CacheImpl &cache, UINT32 setindex, UINT32 way, ADDRINT iaddr)
     {
-        ASSERTX(setindex <= CacheSetNum);
-        CacheSets[setindex]->Evict(tag); 
+        Insert<ASSOC>(cache, setindex, way, RRPV_LONG);
     }
-   
-    /// @ Shutdown - Shutdown the cache table in use.
-    virtual void Shutdown()
+};
+
+/// @ CACHE_BRRIP_POLICY - bimodal RRIP, most fills predict distant
+//  @ re-reference, which keeps thrashing working sets out of the cache.
+class CACHE_BRRIP_POLICY : public CACHE_RRIP_BASE
+{
+public:
+    template <UINT32 ASSOC> static VOID Fill(CacheImpl &cache, UINT32 setindex, UINT32 way, ADDRINT iaddr)
     {
-        for (UINT32 i=0; i<CacheSetNum; ++i) delete CacheSets[i];
-        delete [] CacheSets;
+        Insert<ASSOC>(cache, setindex, way, Bimodal(cache));
     }
+};
+
+/// @ CACHE_DRRIP_POLICY - dynamic RRIP. set dueling between SRRIP and BRRIP,
+//  @ 32 leader sets always use one of them and every miss in a leader set
+//  @ moves the 10 bit PolicyPsel counter against it. the follower sets use
+//  @ the policy with fewer misses.
+class CACHE_DRRIP_POLICY : public CACHE_RRIP_BASE
+{
 public:
-    /// @ constructor and destructor.
-    CacheImpl(UINT32 SetNum        , 
-              UINT32 SetAssoc      , 
-              UINT32 level         , 
-              CACHE_BASE* cache    )        
-              : 
-              CacheUsed(0)         , 
-              CacheSetNum(SetNum)  , 
-              CacheAssoc(SetAssoc) , 
-              CacheLevel(level)    ,
-              CacheBase(cache)       
-    {
-        ASSERTX(CacheSetNum);
-        for (INT32 type=0; type<2; ++type)
+    enum { PSEL_MAX = 1023, PSEL_MID = 512 };
+
+    template <UINT32 ASSOC> static VOID Init(CacheImpl &cache)
+    {
+        CACHE_RRIP_BASE::Init<ASSOC>(cache);
+        cache.PolicyPsel = PSEL_MID;
+    }
+    template <UINT32 ASSOC> static VOID Fill(CacheImpl &cache, UINT32 setindex, UINT32 way, ADDRINT iaddr)
+    {
+        const UINT32 lo = setindex & 31, hi = (setindex >> 5) & 31;
+        BOOL srrip;
+        if (lo == hi)
+        {
+            // SRRIP leader set missed.
+            cache.PolicyPsel += cache.PolicyPsel < PSEL_MAX;
+            srrip = true;
+        }
+        else if (lo == (~hi & 31))
         {
-            CacheAccess[type][true]  = 0;
-            CacheAccess[type][false] = 0;
+            // BRRIP leader set missed.
+            cache.PolicyPsel -= cache.PolicyPsel > 0;
+            srrip = false;
         }
+        else srrip = cache.PolicyPsel < PSEL_MID;
+        Insert<ASSOC>(cache, setindex, way, srrip ? (UINT8)RRPV_LONG : Bimodal(cache));
+    }
+};
+
+/// @ CACHE_SHIP_POLICY - signature based hit prediction (Wu et al. MICRO
+//  @ 2011) on top of SRRIP. the signature of a line is a hash of the pc
+//  @ that filled it, kept in PolicySig. the 2 bit counters in PolicyTable
+//  @ learn whether the lines of a signature get reused, bit 7 of the meta
+//  @ byte records whether the line has been hit. lines from signatures that
+//  @ never see reuse are filled with a distant prediction.
+class CACHE_SHIP_POLICY : public CACHE_RRIP_BASE
+{
+public:
+    enum { SIG_BITS = 14, SIG_MASK = (1 << SIG_BITS) - 1, SHCT_MAX = 3, REUSED = 0x80 };
 
-        /// ------------------------------------------------ ///
-        //  Cache set initialization                          //
-        /// ------------------------------------------------ ///
-        // CacheSets is an array of cache set pointers.
-        CacheSets = new CACHE_SET_BASE*[CacheSetNum];
-        memset(CacheSets, 90, sizeof(CACHE_SET_BASE*)*CacheSetNum);
-        for (UINT32 i=0; i<CacheSetNum; i++)
+    static UINT32 Signature(ADDRINT iaddr) { return (iaddr ^ (iaddr >> SIG_BITS)) & SIG_MASK; }
+
+    template <UINT32 ASSOC> static VOID Init(CacheImpl &cache)
+    {
+        CACHE_RRIP_BASE::Init<ASSOC>(cache);
+        cache.PolicyTable = new UINT8[SIG_MASK+1];
+        cache.PolicySig = new UINT16[cache.CacheSetNum*cache.CacheAssoc];
+        memset(cache.PolicyTable, 1, sizeof(UINT8)*(SIG_MASK+1));
+        memset(cache.PolicySig, 0, sizeof(UINT16)*cache.CacheSetNum*cache.CacheAssoc);
+    }
+    template <UINT32 ASSOC> static VOID Hit(CacheImpl &cache, UINT32 setindex, UINT32 way)
+    {
+        const UINT32 pos = setindex*CACHE_ASSOC(ASSOC, cache.CacheAssoc)+way;
+        UINT8 &counter = cache.PolicyTable[cache.PolicySig[pos]];
+        counter += counter < SHCT_MAX;
+        cache.CacheMeta[pos] = REUSED;
+    }
+    template <UINT32 ASSOC> static UINT32 Victim(CacheImpl &cache, UINT32 setindex)
+    {
+        const UINT32 assoc = CACHE_ASSOC(ASSOC, cache.CacheAssoc);
+        const BOOL full = cache.FreeWay<ASSOC>(setindex) == assoc;
+        const UINT32 way = CACHE_RRIP_BASE::Victim<ASSOC>(cache, setindex);
+        const UINT32 pos = setindex*assoc+way;
+        // the line dies without being reused.
+        if (full && !(cache.CacheMeta[pos] & REUSED))
         {
-            CacheSets[i] = new CACHE_LRU_SET(CacheAssoc, 
-                                             CacheLevel, 
-                                             CacheBase);
+            UINT8 &counter = cache.PolicyTable[cache.PolicySig[pos]];
+            counter -= counter > 0;
         }
-        return;
+        return way;
+    }
+    template <UINT32 ASSOC> static VOID Fill(CacheImpl &cache, UINT32 setindex, UINT32 way, ADDRINT iaddr)
+    {
+        const UINT32 pos = setindex*CACHE_ASSOC(ASSOC, cache.CacheAssoc)+way;
+        cache.PolicySig[pos] = Signature(iaddr);
+        cache.CacheMeta[pos] = cache.PolicyTable[cache.PolicySig[pos]] ? RRPV_LONG : RRPV_DISTANT;
+    }
+    template <UINT32 ASSOC> static VOID Evict(CacheImpl &cache, UINT32 setindex, UINT32 way)
+    {
+        cache.CacheMeta[setindex*CACHE_ASSOC(ASSOC, cache.CacheAssoc)+way] = RRPV_DISTANT;
     }
-    virtual ~CacheImpl() { Shutdown(); }
 };
 
+/// @ CachePolicyType - the policy with the name, CACHE_POLICY_NUM if there
+//  @ is no such policy.
+static inline CACHE_POLICY_TYPE CachePolicyType(const std::string &name)
+{
+    for (UINT32 i=0; i<CACHE_POLICY_NUM; i++)
+    {
+        if (!strcasecmp(name.c_str(), CachePolicyNames[i])) return CACHE_POLICY_TYPE(i);
+    }
+    return CACHE_POLICY_NUM;
+}
+
+CacheImpl::CacheImpl(UINT32 SetNum        , 
+                     UINT32 SetAssoc      , 
+                     UINT32 level         , 
+                     CACHE_BASE* cache    )        
+                     : 
+                     CacheSetNum(SetNum)  , 
+                     CacheAssoc(SetAssoc) , 
+                     CacheLevel(level)    ,
+                     CacheBase(cache)       
+{
+    ASSERTX(CacheSetNum);
+    ASSERTX(CacheAssoc && CacheAssoc <= 32);
+
+    /// ------------------------------------------------ ///
+    //  Cache set initialization                          //
+    /// ------------------------------------------------ ///
+    // one contiguous, cache line aligned tag array for all the sets.
+    CacheTags = (CACHE_TAG*) AlignedAlloc(sizeof(CACHE_TAG)*CacheSetNum*CacheAssoc, CACHELINE_SIZE);
+    CacheMeta = new UINT8[CacheSetNum*CacheAssoc];
+    CacheMru  = new UINT8[CacheSetNum];
+    memset(CacheMru, 0, sizeof(UINT8)*CacheSetNum);
+    memset(CacheMeta, 0, sizeof(UINT8)*CacheSetNum*CacheAssoc);
+    for (UINT32 i=0; i<CacheSetNum*CacheAssoc; i++) CacheTags[i] = 0;
+    // the policy of the cache sets up the rest.
+    PolicyPsel  = 0;
+    PolicyRand  = 0x9e3779b9 ^ CacheSetNum;
+    PolicyTable = NULL;
+    PolicySig   = NULL;
+    SetAccesses = NULL;
+    SetMisses   = NULL;
+    return;
+}
+
+/// @ the state of a CacheImpl in a checkpoint, the shared state followed
+//  @ by the tags, the metadata, the mru hints and, with SHiP, the counter
+//  @ table and the signatures, all of them as laid out in memory.
+typedef struct
+{
+    UINT32 tid;
+    UINT32 psel;
+    UINT32 rand;
+    UINT32 ship;
+} CACHE_CKPT_IMPL;
+
+VOID CacheImpl::Save(FILE *file) const
+{
+    CACHE_CKPT_IMPL ckpt = { 0, PolicyPsel, PolicyRand, PolicyTable != NULL };
+    fwrite(&ckpt.psel, sizeof(ckpt) - sizeof(ckpt.tid), 1, file);
+    fwrite(CacheTags, sizeof(CACHE_TAG), CacheSetNum*CacheAssoc, file);
+    fwrite(CacheMeta, sizeof(UINT8), CacheSetNum*CacheAssoc, file);
+    fwrite(CacheMru, sizeof(UINT8), CacheSetNum, file);
+    if (!ckpt.ship) return;
+    fwrite(PolicyTable, sizeof(UINT8), CACHE_SHIP_POLICY::SIG_MASK+1, file);
+    fwrite(PolicySig, sizeof(UINT16), CacheSetNum*CacheAssoc, file);
+}
+
+UINT64 CacheImpl::SavedSize() const
+{
+    UINT64 size = sizeof(CACHE_CKPT_IMPL) - sizeof(UINT32) + 
+                  (sizeof(CACHE_TAG) + sizeof(UINT8)) * CacheSetNum * CacheAssoc + CacheSetNum;
+    if (PolicyTable) size += CACHE_SHIP_POLICY::SIG_MASK + 1 + sizeof(UINT16) * CacheSetNum * CacheAssoc;
+    return size;
+}
+
+const UINT8 *CacheImpl::Load(const UINT8 *data)
+{
+    CACHE_CKPT_IMPL ckpt;
+    memcpy(&ckpt.psel, data, sizeof(ckpt) - sizeof(ckpt.tid));
+    data += sizeof(ckpt) - sizeof(ckpt.tid);
+    PolicyPsel = ckpt.psel;
+    PolicyRand = ckpt.rand;
+    memcpy(CacheTags, data, sizeof(CACHE_TAG)*CacheSetNum*CacheAssoc); data += sizeof(CACHE_TAG)*CacheSetNum*CacheAssoc;
+    memcpy(CacheMeta, data, sizeof(UINT8)*CacheSetNum*CacheAssoc);     data += sizeof(UINT8)*CacheSetNum*CacheAssoc;
+    memcpy(CacheMru,  data, sizeof(UINT8)*CacheSetNum);                data += sizeof(UINT8)*CacheSetNum;
+    if (!ckpt.ship) return data;
+    // the policy matches the checkpoint, so the SHiP tables are there.
+    memcpy(PolicyTable, data, sizeof(UINT8)*(CACHE_SHIP_POLICY::SIG_MASK+1)); data += sizeof(UINT8)*(CACHE_SHIP_POLICY::SIG_MASK+1);
+    memcpy(PolicySig, data, sizeof(UINT16)*CacheSetNum*CacheAssoc);          data += sizeof(UINT16)*CacheSetNum*CacheAssoc;
+    return data;
+}
+
+/// @ CACHE_CKPT - a cache in a checkpoint, its geometry and the number of
+//  @ CacheImpls that follow, each with the tid it belongs to.
+typedef struct
+{
+    UINT32 slot;
+    UINT32 level;
+    UINT32 size;
+    UINT32 linesize;
+    UINT32 assoc;
+    UINT32 maxsets;
+    UINT32 sets;
+    UINT32 policy;
+    UINT32 impls;
+} CACHE_CKPT;
+
 /// @ CACHE_BASE - brief Generic cache base class; no allocate specialization,
 //  @ no cache set specialization. This is the base class of all caches,
 class CACHE_BASE
@@ -412,8 +799,8 @@ public:
 protected:
     // the name of the cache.
     string CacheName;
-    // the type of the set of the cache.
-    UINT32 CacheSetType;
+    // the replacement policy of the sets of the cache.
+    CACHE_POLICY_TYPE CacheSetType;
     // level of the cache.
     INT32  CacheLevel;
     // the maximum number of sets in the cache.
@@ -427,21 +814,52 @@ protected:
     // Cache computed params
     const UINT32 CacheLineShift;
     const UINT32 CacheSetIndexMask;
+    // Hit and miss counters of loads and stores, claimed from SIMSTATS.
+    SIMSTATS::COUNTER CacheStats;
+    // Hit and miss counters of every bank of a shared cache, one cache
+    // line per bank. they are only updated with the bank locked.
+    CACHE_STATS *BankStats;
+public:
+    enum { BANK_STATS = CACHELINE_SIZE/sizeof(CACHE_STATS) };
+    enum { USER_WORDS = (MAX_CACHE_THREAD + 63)/64 };
+    // the threads that accessed a shared cache, one bit each. the private 
+    // caches above of any of them may hold a line the shared cache evicts.
+    volatile UINT64 Users[USER_WORDS];
+    // the stack distance profile of the stream reaching this cache.
+    STACKDIST *Profile;
+    // Belady's MIN of the stream reaching this cache, see SetOracle.
+    OPTGEN *Oracle;
+    // MIN hit and miss counters of loads and stores, claimed by SetOracle.
+    SIMSTATS::COUNTER OracleStats;
+    // set sampling. only the sets with a CacheSampleIndex other than
+    // SAMPLE_SKIP are simulated, at that index. NULL simulates every set.
+    enum { SAMPLE_SKIP = 0xffffffff };
+    UINT32 *CacheSampleIndex;
+    UINT32 CacheSampledSets;
+    // references to sets that are not sampled, by access type.
+    SIMSTATS::COUNTER SkipStats;
 
 private:
-    // private cache or not.
-    BOOL IsPrivate() const   { return CacheLevel < 3; }
     // shutdown the cache and free the resources.
     VOID Shutdown()
     {
-      if (CACHESIM_likely(IsPrivate())) { FOREACH_CACHE(GetCache(index)->Shutdown()); }
-      else ShrdCache->Shutdown();
+      if (CACHESIM_likely(IsPrivate())) { FOREACH_CACHE(if (PrivOwner[index] == (THREADID)index) delete PrivCache[index]); }
+      else delete ShrdCache;
+      free(BankStats);
+      delete Profile;
+      delete Oracle;
+      delete [] CacheSampleIndex;
     }
 public:
+    // private cache or not.
+    BOOL IsPrivate() const   { return CacheLevel < 3; }
+
     // The only physical manifestation of the cache. Used for LLC.
     CacheImpl* ShrdCache;
     // The per thread physical manifestation of the cache. Used for private cache.
     CacheImpl* PrivCache[MAX_CACHE_THREAD];
+    // The thread whose private cache a thread simulates, itself unless shared.
+    THREADID PrivOwner[MAX_CACHE_THREAD];
 
     // constructors/destructors
     CACHE_BASE(std::string name     , 
@@ -451,9 +869,12 @@ public:
                UINT32 assoc         , 
                std::string type     , 
                UINT32 storealloc    , 
-               OS_THREAD_ID threadid)
+               OS_THREAD_ID threadid, 
+               UINT32 sample = 1    , 
+               BOOL samplehash = false)
                : 
                CacheName(name)                   ,
+               CacheSetType(CachePolicyType(type)),
                CacheLevel(level)                 ,
                CacheMaxSets(size/(lsize*assoc))  ,
                CacheStoreAlloc(storealloc)       ,
@@ -461,21 +882,56 @@ public:
                CacheLineSize(lsize)              ,
                CacheAssoc(assoc)                 ,
                CacheLineShift(FloorLog2(lsize))  ,
-               CacheSetIndexMask((size/(assoc*lsize))-1)
+               CacheSetIndexMask((size/(assoc*lsize))-1) ,
+               CacheStats(SimStats->claim(ACCESS_TYPE_NUM*2)),
+               BankStats(NULL)                   ,
+               Profile(NULL)                     ,
+               Oracle(NULL)                      ,
+               OracleStats(0)                    ,
+               CacheSampleIndex(NULL)            ,
+               CacheSampledSets(CacheMaxSets)    ,
+               SkipStats(SimStats->claim(ACCESS_TYPE_NUM))
      {
+        memset((VOID*)Users, 0, sizeof(Users));
         ASSERTX(CacheMaxSets);
         ASSERTX(IsPowerOfTwo(CacheLineSize));
         ASSERTX(IsPowerOfTwo(CacheSetIndexMask + 1));
 
+        // the configuration is checked by CacheLevelNew.
+        ASSERTX(CacheSetType != CACHE_POLICY_NUM);
+        ASSERTX(CacheSetType != CACHE_POLICY_PLRU || IsPowerOfTwo(CacheAssoc));
+
+        // pick 1 out of sample sets, every sample-th set or the sets that
+        // hash to 0, and number them 0 ... CacheSampledSets-1.
+        if (sample > 1)
+        {
+            CacheSampleIndex = new UINT32[CacheMaxSets];
+            CacheSampledSets = 0;
+            for (UINT32 set = 0; set < CacheMaxSets; set++)
+            {
+                const UINT32 key = samplehash ? (set * 0x9e3779b1) >> 7 : set;
+                CacheSampleIndex[set] = (key % sample) ? UINT32(SAMPLE_SKIP) : CacheSampledSets++;
+            }
+            if (!CacheSampledSets) CacheSampleIndex[0] = CacheSampledSets++;
+        }
+
         if (IsPrivate())
         {
-            FOREACH_CACHE(PrivCache[index]=new CacheImpl(CacheMaxSets, 
+            FOREACH_CACHE(PrivCache[index]=new CacheImpl(CacheSampledSets, 
                                                          CacheAssoc, 
                                                          CacheLevel, this));
+            FOREACH_CACHE(PrivOwner[index]=index);
+        }
+        else 
+        {
+            ShrdCache = new CacheImpl(CacheSampledSets, 
+                                      CacheAssoc, 
+                                      CacheLevel, this);
+            const UINT32 banks = SimTheOne->get_global_simlock()->get_l3_banks();
+            BankStats = (CACHE_STATS*) AlignedAlloc(sizeof(CACHE_STATS)*BANK_STATS*banks, CACHELINE_SIZE);
+            memset(BankStats, 0, sizeof(CACHE_STATS)*BANK_STATS*banks);
         }
-        else ShrdCache = new CacheImpl(CacheMaxSets, 
-                                       CacheAssoc, 
-                                       CacheLevel, this);
+        if (CacheSampleIndex) InitCaches(CacheImpl::EnableSetStats);
         return;
     }
     virtual ~CACHE_BASE() { Shutdown(); }
@@ -486,15 +942,84 @@ public:
     UINT32 GetMaxSets()       const { return CacheMaxSets;     }
     UINT32 GetStoreAlloc()    const { return CacheStoreAlloc;  }
     UINT32 GetAssociativity() const { return CacheAssoc;       }
+    CACHE_POLICY_TYPE GetPolicy() const { return CacheSetType; }
+    UINT32 GetLineShift() const { return CacheLineShift; }
+
+    /// apply init to every physical manifestation of the cache.
+    VOID InitCaches(VOID (*init)(CacheImpl&))
+    {
+        if (CACHESIM_likely(IsPrivate())) { FOREACH_CACHE(if (PrivOwner[index] == (THREADID)index) init(*PrivCache[index])); }
+        else init(*ShrdCache);
+    }
+
+    /// let thread tid simulate the private cache of thread owner. the set
+    /// sharded replay counts every shard of a thread as a thread of its own,
+    /// the shards touch disjoint sets of the one cache of the thread.
+    VOID SharePrivate(THREADID tid, THREADID owner)
+    {
+        if (!IsPrivate() || tid == owner) return;
+        if (PrivOwner[tid] == tid) delete PrivCache[tid];
+        PrivCache[tid] = PrivCache[owner];
+        PrivOwner[tid] = owner;
+    }
 
     // accessors
     CacheImpl *GetCache(THREADID tid) const
     {
         CacheImpl *Cache=PrivCache[tid];
         if (CACHESIM_unlikely(!IsPrivate())) Cache=ShrdCache;
-        Cache->CacheUsed=1;
         return Cache;
     }
+    // the counter of a load or store hit or miss.
+    SIMSTATS::COUNTER StatsCounter(ACCESS_TYPE type, BOOL hit) const
+    {
+        return CacheStats + (type<<1) + (hit ? 1 : 0);
+    }
+    // the bank counters of a shared cache, BANK_STATS per bank, misses 
+    // first. NULL for a private cache.
+    CACHE_STATS *GetBankStats(UINT32 *banks) const
+    {
+        *banks = BankStats ? SimTheOne->get_global_simlock()->get_l3_banks() : 0;
+        return BankStats;
+    }
+    // count a hit or miss in a bank of a shared cache, bank locked.
+    // nothing is counted while the caches are functionally warmed.
+    VOID BankCount(UINT32 bank, BOOL hit)
+    {
+        if (CACHESIM_unlikely(!SimWait->dostats())) return;
+        BankStats[bank*BANK_STATS + (hit ? 1 : 0)] ++;
+    }
+    // make thread tid a user of a shared cache.
+    VOID AddUser(THREADID tid)
+    {
+        const UINT64 bit = UINT64(1) << (tid & 63);
+        if (CACHESIM_unlikely(!(Users[tid >> 6] & bit))) __atomic_fetch_or(&Users[tid >> 6], bit, __ATOMIC_RELAXED);
+    }
+    // count a reference to a set that is not sampled.
+    VOID SkipCount(ACCESS_TYPE type, THREADID tid) const
+    {
+        if (CACHESIM_unlikely(!SimWait->dostats())) return;
+        SimStats->inc(tid, SkipStats + type);
+    }
+    // count a load or store hit or miss of a thread.
+    VOID StatsCount(ACCESS_TYPE type, BOOL hit, THREADID tid) const
+    {
+        if (CACHESIM_unlikely(!SimWait->dostats())) return;
+        SimStats->inc(tid, StatsCounter(type, hit));
+    }
+    // count whether MIN hit on a load or store of a thread.
+    VOID OracleCount(ACCESS_TYPE type, BOOL hit, THREADID tid) const
+    {
+        if (CACHESIM_unlikely(!SimWait->dostats())) return;
+        SimStats->inc(tid, OracleStats + (type<<1) + (hit ? 1 : 0));
+    }
+    // run MIN next to the policy of the cache, on the sampled sets, with a
+    // window of window times the associativity.
+    VOID SetOracle(UINT32 window)
+    {
+        Oracle = new OPTGEN(CacheSampledSets, CacheAssoc, window, !IsPrivate());
+        OracleStats = SimStats->claim(ACCESS_TYPE_NUM*2);
+    }
     VOID SplitAddress(const ADDRINT addr, UINT32& setindex) const
     {
         CACHE_TAG tag = addr >> CacheLineShift;
@@ -519,16 +1044,16 @@ public:
     CACHE_STATS Hits(THREADID tid)                       const { return SumAccess(true, tid);                                        }
     CACHE_STATS Misses(THREADID tid)                     const { return SumAccess(false, tid);                                       }
     CACHE_STATS Accesses(THREADID tid)                   const { return Hits(tid) + Misses(tid);                                     }
-    CACHE_STATS Hits(ACCESS_TYPE type, THREADID tid)     const { return GetCache(tid)->CacheAccess[type][true];                      }
-    CACHE_STATS Misses(ACCESS_TYPE type, THREADID tid)   const { return GetCache(tid)->CacheAccess[type][false];                     }
+    CACHE_STATS Hits(ACCESS_TYPE type, THREADID tid)     const { return SimStats->get(tid, StatsCounter(type, true));                }
+    CACHE_STATS Misses(ACCESS_TYPE type, THREADID tid)   const { return SimStats->get(tid, StatsCounter(type, false));               }
     CACHE_STATS Accesses(ACCESS_TYPE type, THREADID tid) const { return Hits(type, tid) + Misses(type, tid);                         }
-    CACHE_STATS HitsAll(ACCESS_TYPE type)                const { FOREACH_CACHE_SUM(GetCache(index)->CacheAccess[type][true]);        }
-    CACHE_STATS MissesAll(ACCESS_TYPE accessType)        const { FOREACH_CACHE_SUM(GetCache(index)->CacheAccess[accessType][false]); }
-    CACHE_STATS HitsAll()                                const { FOREACH_CACHE_SUM(SumAccess(true, index));                          }
-    CACHE_STATS MissesAll()                              const { FOREACH_CACHE_SUM(SumAccess(false, index));                         }
+    CACHE_STATS HitsAll(ACCESS_TYPE type)                const { return SimStats->sum(StatsCounter(type, true));                     }
+    CACHE_STATS MissesAll(ACCESS_TYPE accessType)        const { return SimStats->sum(StatsCounter(accessType, false));              }
+    CACHE_STATS HitsAll()                                const { FOREACH_CACHEACCESS_SUM(HitsAll(ACCESS_TYPE(index)));               }
+    CACHE_STATS MissesAll()                              const { FOREACH_CACHEACCESS_SUM(MissesAll(ACCESS_TYPE(index)));             }
     CACHE_STATS AccessesAll(ACCESS_TYPE type)            const { return HitsAll(type) + MissesAll(type);                             }
     CACHE_STATS AccessesAll()                            const { return HitsAll() + MissesAll();                                     }
-    CACHE_STATS SumAccess(BOOL hit, THREADID tid)        const {  FOREACH_CACHEACCESS_SUM(GetCache(tid)->CacheAccess[index][hit];);  }
+    CACHE_STATS SumAccess(BOOL hit, THREADID tid)        const {  FOREACH_CACHEACCESS_SUM(SimStats->get(tid, StatsCounter(ACCESS_TYPE(index), hit))); }
 
     // Return the parameterics of the cache.
     string StatsParam(void) const
@@ -539,11 +1064,21 @@ public:
        out += "# Cache Total Size : " + mydecstr(CacheSize, numberWidth) + "\n";
        out += "# Cache Line Size : "  +  mydecstr(CacheLineSize, numberWidth) + "\n";
        out += "# Cache Associativity : " +  mydecstr(CacheAssoc, numberWidth/2) + "\n";
+       out += "# Cache Replacement Policy : " + string(CachePolicyNames[CacheSetType]) + "\n";
        return out;
     }
 
     string StatsLong(string prefix = "", CACHE_TYPE = CACHE_TYPE_DCACHE, THREADID tid = MAX_CACHE_THREAD) const;
     string StatsLongAll(string prefix = "", CACHE_TYPE = CACHE_TYPE_DCACHE);
+    string StatsBanks(string prefix = "") const;
+    string StatsSampling(string prefix = "") const;
+    string StatsOracle(string prefix = "") const;
+
+    /// checkpoints. SaveState writes the cache as the given slot. LoadState 
+    /// checks the geometry recorded in the checkpoint against the cache and
+    /// reads the state back, NULL if it does not match.
+    VOID SaveState(FILE *file, UINT32 slot) const;
+    const UINT8 *LoadState(const UINT8 *data, const UINT8 *end, const CACHE_CKPT &ckpt);
 };
 
 
@@ -552,7 +1087,7 @@ string CACHE_BASE::StatsLong(string prefix, CACHE_TYPE cache_type, THREADID tid)
     string out;
 
     // The cache has never been used.
-    if (!GetCache(tid)->CacheUsed) return out;
+    if (!Accesses(tid)) return out;
 
     const UINT32 headerWidth = 19;
     const UINT32 numberWidth = 12;
@@ -605,6 +1140,162 @@ string CACHE_BASE::StatsLong(string prefix, CACHE_TYPE cache_type, THREADID tid)
     return out;
 }
 
+string CACHE_BASE::StatsBanks(string prefix) const
+{
+    string out;
+
+    // only the shared cache is banked.
+    if (!BankStats) return out;
+
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+    const UINT32 banks = SimTheOne->get_global_simlock()->get_l3_banks();
+
+    out += prefix + "Banks:" + "\n";
+    for (UINT32 bank = 0; bank < banks; bank++)
+    {
+        const CACHE_STATS misses = BankStats[bank*BANK_STATS];
+        const CACHE_STATS accesses = misses + BankStats[bank*BANK_STATS+1];
+        if (!accesses) continue;
+        out += prefix + ljstr("Bank " + decstr(bank) + ":", headerWidth)
+               + mydecstr(accesses, numberWidth) + " Accesses "
+               + mydecstr(misses, numberWidth) + " Misses "
+               + fltstr(100.0 * misses / accesses, 2, 6) + "%\n";
+    }
+    out += prefix + "\n";
+    return out;
+}
+
+/// SaveState - only the private copies of the threads that filled a line
+/// are written.
+VOID CACHE_BASE::SaveState(FILE *file, UINT32 slot) const
+{
+    std::vector<THREADID> used;
+    for (THREADID tid = 0; tid < (IsPrivate() ? MAX_CACHE_THREAD : 1); tid++)
+    {
+        if (!GetCache(tid)->Empty()) used.push_back(tid);
+    }
+
+    CACHE_CKPT ckpt = { slot, (UINT32)CacheLevel, CacheSize, CacheLineSize, CacheAssoc, 
+                        CacheMaxSets, CacheSampledSets, CacheSetType, (UINT32)used.size() };
+    fwrite(&ckpt, sizeof(ckpt), 1, file);
+    for (UINT32 i = 0; i < used.size(); i++)
+    {
+        fwrite(&used[i], sizeof(UINT32), 1, file);
+        GetCache(used[i])->Save(file);
+    }
+}
+
+const UINT8 *CACHE_BASE::LoadState(const UINT8 *data, const UINT8 *end, const CACHE_CKPT &ckpt)
+{
+    if (ckpt.level != (UINT32)CacheLevel || ckpt.size != CacheSize || ckpt.linesize != CacheLineSize || 
+        ckpt.assoc != CacheAssoc || ckpt.maxsets != CacheMaxSets || ckpt.sets != CacheSampledSets || 
+        ckpt.policy != (UINT32)CacheSetType) return NULL;
+
+    for (UINT32 i = 0; i < ckpt.impls; i++)
+    {
+        UINT32 tid;
+        if ((UINT64)(end - data) < sizeof(tid)) return NULL;
+        memcpy(&tid, data, sizeof(tid));
+        data += sizeof(tid);
+        if (tid >= MAX_CACHE_THREAD || (UINT64)(end - data) < GetCache(tid)->SavedSize()) return NULL;
+        data = GetCache(tid)->Load(data);
+    }
+    return data;
+}
+
+/// StatsOracle - the hits and misses of MIN on the sampled sets, and the 
+/// share of the misses of the policy MIN would have saved.
+string CACHE_BASE::StatsOracle(string prefix) const
+{
+    string out;
+    if (!Oracle) return out;
+
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    CACHE_STATS hits = 0, misses = 0;
+    FOREACH_CACHEACCESS(hits += SimStats->sum(OracleStats + (index<<1) + 1));
+    FOREACH_CACHEACCESS(misses += SimStats->sum(OracleStats + (index<<1)));
+    const CACHE_STATS accesses = hits + misses;
+    if (!accesses) return out;
+
+    out += prefix + "\n";
+    out += prefix + ljstr("OPT-Hits:        ", headerWidth)
+           + mydecstr(hits, numberWidth) +
+           "  " +fltstr(100.0 * hits / accesses, 2, 6) + "%\n";
+
+    out += prefix + ljstr("OPT-Misses:      ", headerWidth)
+           + mydecstr(misses, numberWidth) +
+           "  " +fltstr(100.0 * misses / accesses, 2, 6) + "%\n";
+
+    out += prefix + ljstr("OPT MPKI:    ", headerWidth)
+           + "  " +fltstr(1000.0 * misses / SimTheOne->get_global_icount(), 2, 6) + "\n";
+
+    // the misses the policy has over MIN.
+    out += prefix + ljstr("OPT Headroom:", headerWidth)
+           + "  " +fltstr(MissesAll() ? 100.0 * ((double)MissesAll() - misses) / MissesAll() : 0.0, 2, 6) + "%\n";
+    return out;
+}
+
+/// StatsSampling - estimate the stats of all the sets from the sampled ones.
+/// the sampled sets are a cluster sample of the lines, the miss ratio is a
+/// ratio estimate over the sets and its 95% confidence interval comes from
+/// the variance of the per set misses around it (Cochran, Sampling 
+/// Techniques, 6.9), with the finite population correction.
+string CACHE_BASE::StatsSampling(string prefix) const
+{
+    string out;
+    if (!CacheSampleIndex) return out;
+
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    // per set counts, summed over the threads.
+    std::vector<double> accesses(CacheSampledSets, 0), misses(CacheSampledSets, 0);
+    for (THREADID tid = 0; tid < (IsPrivate() ? MAX_CACHE_THREAD : 1); tid++)
+    {
+        const CacheImpl *cache = GetCache(tid);
+        for (UINT32 set = 0; set < CacheSampledSets; set++)
+        {
+            accesses[set] += cache->SetAccesses[set];
+            misses[set] += cache->SetMisses[set];
+        }
+    }
+
+    const double n = CacheSampledSets, N = CacheMaxSets;
+    double a = 0, m = 0;
+    for (UINT32 set = 0; set < CacheSampledSets; set++) { a += accesses[set]; m += misses[set]; }
+    if (!a) return out;
+    const double ratio = m / a;
+    double var = 0;
+    for (UINT32 set = 0; set < CacheSampledSets; set++) 
+    {
+        const double d = misses[set] - ratio * accesses[set];
+        var += d * d;
+    }
+    var = n > 1 ? var / (n - 1) * (1 - n / N) * n / (a * a) : 0;
+    const double ci = 1.96 * sqrt(var);
+
+    // scale the sampled accesses up to all the references.
+    CACHE_STATS skipped = 0;
+    FOREACH_CACHEACCESS(skipped += SimStats->sum(SkipStats + index));
+    const double scale = AccessesAll() ? (double)(AccessesAll() + skipped) / AccessesAll() : 0;
+
+    out += prefix + "\n";
+    out += prefix + ljstr("Sampled-Sets:    ", headerWidth)
+           + mydecstr(CacheSampledSets, numberWidth) + " of " + decstr(CacheMaxSets) + "\n";
+    out += prefix + ljstr("Skipped-Accesses:", headerWidth)
+           + mydecstr(skipped, numberWidth) + "\n";
+    out += prefix + ljstr("Est-Misses:      ", headerWidth)
+           + mydecstr((UINT64)(MissesAll() * scale), numberWidth) + "\n";
+    out += prefix + ljstr("Est-Miss-Ratio:  ", headerWidth)
+           + "  " + fltstr(100.0 * ratio, 2, 6) + "% +/- " + fltstr(100.0 * ci, 2, 6) + "% (95% CI, lines)\n";
+    out += prefix + ljstr("Est MPKI:  ", headerWidth)
+           + "  " + fltstr(1000.0 * MissesAll() * scale / SimTheOne->get_global_icount(), 2, 6) + "\n";
+    return out;
+}
+
 string CACHE_BASE::StatsLongAll(string prefix, CACHE_TYPE cache_type)
 {
     string out;
@@ -655,6 +1346,9 @@ string CACHE_BASE::StatsLongAll(string prefix, CACHE_TYPE cache_type)
     out += prefix + ljstr("Total MPKI:  ", headerWidth)
            + "  " +fltstr(1000.0 * MissesAll() / SimTheOne->get_global_icount(), 2, 6) + "\n";
 
+    out += StatsOracle(prefix);
+    out += StatsSampling(prefix);
+
 
 #if 0
     /// sort by install count.
@@ -701,14 +1395,40 @@ string CACHE_BASE::StatsLongAll(string prefix, CACHE_TYPE cache_type)
     return out;
 }
 
+/// @ CACHE_ENGINE - the cache access routines specialized on the
+//  @ associativity, the line shift and the replacement policy. a 0
+//  @ associativity or line shift reads the parameter at runtime.
+template <UINT32 ASSOC, UINT32 LINESHIFT, class POLICY> class CACHE_ENGINE;
+
 /// @ CACHE - brief cache class with specific cache set allocation policies
 //  @ All that remains to be done here is allocate and deallocate the right
 //  @ type of cache sets.
 class CACHE : public CACHE_BASE
 {
+template <UINT32 ASSOC, UINT32 LINESHIFT, class POLICY> friend class CACHE_ENGINE;
+public:
+   // the access routines of a cache engine.
+   typedef BOOL (*ACCESS_ROUTINE)(CACHE*, ADDRINT, ADDRINT, UINT32, ACCESS_TYPE, THREADID);
+   typedef BOOL (*ACCESS_LINE_ROUTINE)(CACHE*, ADDRINT, ADDRINT, ACCESS_TYPE, THREADID);
+   typedef BOOL (*ACCESS_PAGE_ROUTINE)(CACHE*, ADDRINT, ACCESS_TYPE, THREADID);
+   typedef VOID (*EVICT_ROUTINE)(CACHE*, ADDRINT, THREADID);
+private:
+   // the engine picked for the geometry and policy of this cache.
+   ACCESS_ROUTINE      AccessRoutine;
+   ACCESS_LINE_ROUTINE AccessLineRoutine;
+   ACCESS_PAGE_ROUTINE AccessPageRoutine;
+   EVICT_ROUTINE       EvictRoutine;
+   /// pick the engine specialized for the geometry and policy of this cache.
+   VOID SelectEngine();
 public:
    // higher and lower level cache.
    std::set<CACHE*> prev;
+   // where the back-invalidations go when they are deferred. those for 
+   // the evicting thread itself are only deferred with EvictDeferOwn.
+   EVICT_DEFER_ROUTINE EvictDefer;
+   BOOL EvictDeferOwn;
+   // told about every line evicted from this cache by a lower level.
+   EVICT_DEFER_ROUTINE EvictNotify;
 public:
     // constructors/destructors
     CACHE(std::string name    ,      // name of the cache. 
@@ -718,7 +1438,9 @@ public:
           UINT32 associativity,      // associativity of the cache.
           std::string rep     ,      // replacement policy.
           UINT32 storealloc   ,      // allocation on store. 
-          THREADID threadid   )
+          THREADID threadid   , 
+          UINT32 sample = 1   ,      // simulate 1 out of sample sets.
+          BOOL samplehash = false)   // pick the sets by hash.
           :  
           CACHE_BASE(name         , 
                      level        , 
@@ -727,30 +1449,77 @@ public:
                      associativity, 
                      rep          , 
                      storealloc   , 
-                     threadid     ) 
+                     threadid     , 
+                     sample       , 
+                     samplehash   ) 
     {
        assert(IsPowerOfTwo(size));
        assert(IsPowerOfTwo(linesize));
        prev.clear();
+       EvictDefer = NULL;
+       EvictDeferOwn = false;
+       EvictNotify = NULL;
+       SelectEngine();
     }
 
     /// Cache access from addr to addr+size-1
-    BOOL Access(ADDRINT iaddr, ADDRINT addr, UINT32 size, ACCESS_TYPE type, THREADID tid);
+    BOOL Access(ADDRINT iaddr, ADDRINT addr, UINT32 size, ACCESS_TYPE type, THREADID tid)
+    {
+        return AccessRoutine(this, iaddr, addr, size, type, tid);
+    }
     /// Cache access at addr that does not span cache lines
-    BOOL AccessSingleLine(ADDRINT iaddr, ADDRINT addr, ACCESS_TYPE type, THREADID tid);
-    BOOL AccessPage(ADDRINT addr, ACCESS_TYPE type, THREADID tid);
+    BOOL AccessSingleLine(ADDRINT iaddr, ADDRINT addr, ACCESS_TYPE type, THREADID tid)
+    {
+        return AccessLineRoutine(this, iaddr, addr, type, tid);
+    }
+    BOOL AccessPage(ADDRINT addr, ACCESS_TYPE type, THREADID tid)
+    {
+        return AccessPageRoutine(this, addr, type, tid);
+    }
 
     /// set up the higher lower and higher level cache.
     VOID SetPrev(CACHE *cache) { if (cache) prev.insert(cache); }
     VOID Evict(ADDRINT addr, THREADID tid)
     {
-        CACHE_TAG tag=0;
-        UINT32 setindex=0;
-        SplitAddress(addr, tag, setindex);
-        GetCache(tid)->Evict(tag, setindex);
+        EvictRoutine(this, addr, tid);
+        if (CACHESIM_unlikely(EvictNotify != NULL)) EvictNotify(addr, tid);
         EvictPrev(addr, tid);
     }
+    /// make every thread with lines in the caches above a user of a shared
+    /// cache, once a checkpoint filled them.
+    VOID AddPrevUsers()
+    {
+       if (IsPrivate()) return;
+       for (THREADID tid = 0; tid < MAX_CACHE_THREAD; tid++)
+       {
+          for(std::set<CACHE*>::iterator I=prev.begin(), E=prev.end(); I!=E; ++I)
+          {
+             if (!(*I)->GetCache(tid)->Empty()) AddUser(tid);
+          }
+       }
+    }
+    /// a private cache back-invalidates the caches above of its thread, a
+    /// shared one those of every thread that used it.
     VOID EvictPrev(ADDRINT addr, THREADID tid)
+    {
+       if (CACHESIM_likely(IsPrivate()))
+       {
+          if (CACHESIM_unlikely(EvictDefer != NULL)) EvictDefer(addr, tid);
+          else EvictPrevNow(addr, tid);
+          return;
+       }
+       if (prev.empty()) return;
+       for (UINT32 w = 0; w < USER_WORDS; w++)
+       {
+          for (UINT64 bits = Users[w]; bits; bits &= bits - 1)
+          {
+             const THREADID user = w*64 + __builtin_ctzll(bits);
+             if (EvictDefer != NULL && (EvictDeferOwn || user != tid)) EvictDefer(addr, user);
+             else EvictPrevNow(addr, user);
+          }
+       }
+    }
+    VOID EvictPrevNow(ADDRINT addr, THREADID tid)
     {
        for(std::set<CACHE*>::iterator I=prev.begin(), E=prev.end(); I!=E; ++I) (*I)->Evict(addr, tid);
     }
@@ -37,6 +37,7 @@ END_LEGAL */
 
 #include "pin.H"
 #include "utils.hh"
+#include <cstddef>
 
 /* ===================================================================== */
 /* Cache Simulation Functions */
@@ -48,156 +49,62 @@ VOID DataWriteRef(ADDRINT iaddr, ADDRINT addr, UINT32 size, UINT64 base, UINT64
 /* ===================================================================== */
 /* Globals variables */
 /* ===================================================================== */
-static FILE * tracefile = NULL;
+/* per-thread memory reference buffer used by -membuf */
+static BUFFER_ID MemRefBufferId;
 
-/* =============================================== */
-/* Instruction Count.                              */
-/* =============================================== */
-
-/* EstimateMIPS - estimate the million instruction per second */
-LOCALFUN VOID EstimateMIPS(UINT64 icount)
-{
-    /* calculate elapsed time. */
-    clock_gettime(CLOCK_MONOTONIC, SimTheOne->get_time_fini());
-    double seconds = ((double)SimTheOne->get_time_fini()->tv_sec + 
-                     NANO*SimTheOne->get_time_fini()->tv_nsec) -
-                     ((double)SimTheOne->get_time_init()->tv_sec + 
-                     NANO*SimTheOne->get_time_fini()->tv_nsec);
-
-    MACHINESIM_PRINT("Simulated %lluM instructions %lf MIPS\n", 
-                    (unsigned long long) icount/MEGA, 
-                    (double) icount/MEGA/seconds);
-    return;
-}
-
-/* MaxInstructionExecuted - check whether to exit due to max inst count */
-LOCALFUN VOID MaxInstructionExecuted(UINT64 icount)
-{
-    if (icount > SimOpts->get_maxsiminst())
-    {
-        MACHINESIM_PRINT("PIN_ExitApplication due to reaching max sim count\n");
-        PIN_ExitApplication(0);
-    }
-    return;
-}
-
-/* DoSimpleICount - This function is called before every instruction is executed */
-LOCALFUN VOID DoSimpleICount(ADDRINT ip, THREADID id) 
-{ 
-    if (!SimWait->dosim()) return;
-
-    /* one more instructions executed. */
-    UINT64 icount = SimTheOne->add_global_icount();
-    if (icount % MEGA == 0) EstimateMIPS(icount);
-
-    MaxInstructionExecuted(icount);
-    
-    /* done */
-    return;
-}
-
-/* DoICountOnType - count instructions based type */
-LOCALFUN VOID DoICountOnType(THREADID id, int type)
-{
-    switch(type)
-    {
-        case SIMGLOBALS::INSTYPE::INS_LOAD:
-             SimTheOne->IncFetch();
-             break;
-        case SIMGLOBALS::INSTYPE::INS_STORE:
-             SimTheOne->IncStore();
-             break;
-        case SIMGLOBALS::INSTYPE::INS_CALL:
-             SimTheOne->IncCall();
-             break;
-        case SIMGLOBALS::INSTYPE::INS_RET:
-             SimTheOne->IncReturn();
-             break;
-        case SIMGLOBALS::INSTYPE::INS_BRANCH:
-             SimTheOne->IncBranch();
-             break;
-        default:
-             break;
-    }
-    return;
-}
-    
-/* SimpleInstructionCount - insert instrumentation calls to count # of ins. */
-VOID SimpleInstructionCount(INS ins, VOID *v)
+/// =========================================================
+//  Cache Simulation Callbacks.
+/// =========================================================
+/* CacheSimFiltered - setup data cache simulation behind the same line */
+/* filter. the base and index registers are not passed, nothing in the */
+/* simulation looks at them.                                           */
+LOCALFUN VOID CacheSimFiltered(INS ins, UINT32 shift)
 {
-    /// =========================================================
-    // Insert a call to DoSimpleICount before every instruction.
-    /// =========================================================
-    INS_InsertCall(ins, IPOINT_BEFORE, 
-                  (AFUNPTR)DoSimpleICount, 
-                   IARG_INST_PTR, 
-                   IARG_THREAD_ID, 
-                   IARG_END);
-
-    /// --------------------------------------------- ///
-    //  Read or write memory location                  //
-    /// --------------------------------------------- ///
     if (INS_IsMemoryRead(ins))
     {
-       INS_InsertCall(ins, IPOINT_BEFORE, 
-                     (AFUNPTR)DoICountOnType, 
-                     IARG_THREAD_ID, 
-                     IARG_UINT32, SIMGLOBALS::INSTYPE::INS_LOAD,
-                     IARG_END);
+        INS_InsertIfPredicatedCall(ins, IPOINT_BEFORE,
+                                   (AFUNPTR)DataRefNewLine,
+                                   IARG_FAST_ANALYSIS_CALL,
+                                   IARG_MEMORYREAD_EA,
+                                   IARG_MEMORYREAD_SIZE,
+                                   IARG_UINT32, shift,
+                                   IARG_UINT32, 0,
+                                   IARG_THREAD_ID,
+                                   IARG_END);
+        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE,
+                                     (AFUNPTR)DataFetchRef,
+                                     IARG_INST_PTR,
+                                     IARG_MEMORYREAD_EA,
+                                     IARG_MEMORYREAD_SIZE,
+                                     IARG_UINT32, 0,
+                                     IARG_UINT32, 0,
+                                     IARG_THREAD_ID,
+                                     IARG_END);
     }
 
     if (INS_IsMemoryWrite(ins))
     {
-       INS_InsertCall(ins, IPOINT_BEFORE, 
-                     (AFUNPTR)DoICountOnType, 
-                     IARG_THREAD_ID, 
-                     IARG_UINT32, SIMGLOBALS::INSTYPE::INS_STORE,
-                     IARG_END);
-    }
-
-
-    /// --------------------------------------------- ///
-    //  Branch Instruction                             //
-    /// --------------------------------------------- ///
-    if (INS_IsBranch(ins))
-    {
-       INS_InsertCall(ins, IPOINT_BEFORE, 
-                     (AFUNPTR)DoICountOnType, 
-                     IARG_THREAD_ID, 
-                     IARG_UINT32, SIMGLOBALS::INSTYPE::INS_BRANCH,
-                     IARG_END);
-    }
-
-
-    /// --------------------------------------------- ///
-    //  Call Instruction                               //
-    /// --------------------------------------------- ///
-    if (INS_IsCall(ins))
-    {
-       INS_InsertCall(ins, IPOINT_BEFORE, 
-                     (AFUNPTR)DoICountOnType, 
-                     IARG_THREAD_ID, 
-                     IARG_UINT32, SIMGLOBALS::INSTYPE::INS_CALL,
-                     IARG_END);
-    }
-
-    /// --------------------------------------------- ///
-    //  Return Instruction                             //
-    /// --------------------------------------------- ///
-    if (INS_IsRet(ins))
-    {
-       INS_InsertCall(ins, IPOINT_BEFORE, 
-                     (AFUNPTR)DoICountOnType, 
-                     IARG_THREAD_ID, 
-                     IARG_UINT32, SIMGLOBALS::INSTYPE::INS_RET,
-                     IARG_END);
+        INS_InsertIfPredicatedCall(ins, IPOINT_BEFORE,
+                                   (AFUNPTR)DataRefNewLine,
+                                   IARG_FAST_ANALYSIS_CALL,
+                                   IARG_MEMORYWRITE_EA,
+                                   IARG_MEMORYWRITE_SIZE,
+                                   IARG_UINT32, shift,
+                                   IARG_UINT32, 1,
+                                   IARG_THREAD_ID,
+                                   IARG_END);
+        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE,
+                                     (AFUNPTR)DataWriteRef,
+                                     IARG_INST_PTR,
+                                     IARG_MEMORYWRITE_EA,
+                                     IARG_MEMORYWRITE_SIZE,
+                                     IARG_UINT32, 0,
+                                     IARG_UINT32, 0,
+                                     IARG_THREAD_ID,
+                                     IARG_END);
     }
-    return;
 }
 
-/// =========================================================
-//  Cache Simulation Callbacks.
-/// =========================================================
 /* CacheSim - setup calls to do cache simulation */
 VOID CacheSim(INS ins,VOID *v)
 {
@@ -206,6 +113,24 @@ VOID CacheSim(INS ins,VOID *v)
     /// --------------------------------------------- ///
     // all instruction fetches access I-cache
     // assume instruction access does not cross cache line.
+    // the fetches from the line of the last fetch are counted inline.
+    UINT32 ishift = 0;
+    if (InsFetchFilter(&ishift))
+    {
+        INS_InsertIfCall(ins, IPOINT_BEFORE,
+                         (AFUNPTR)InsFetchNewLine,
+                         IARG_FAST_ANALYSIS_CALL,
+                         IARG_INST_PTR,
+                         IARG_UINT32, ishift,
+                         IARG_THREAD_ID,
+                         IARG_END);
+        INS_InsertThenCall(ins, IPOINT_BEFORE,
+                          (AFUNPTR)InsFetchRef,
+                           IARG_INST_PTR,
+                           IARG_THREAD_ID,
+                           IARG_END);
+    }
+    else
     INS_InsertCall(ins, IPOINT_BEFORE,
                   (AFUNPTR)InsFetchRef,
                    IARG_INST_PTR,
@@ -215,6 +140,14 @@ VOID CacheSim(INS ins,VOID *v)
     /// --------------------------------------------- ///
     //  data cache simulation                          //
     /// --------------------------------------------- ///
+    // the accesses within the line of the last access are counted inline.
+    UINT32 dshift = 0;
+    if (DataRefFilter(&dshift))
+    {
+        CacheSimFiltered(ins, dshift);
+        return;
+    }
+
     if (INS_IsMemoryRead(ins))
     {
             /// --------------------------------------------- ///
@@ -307,73 +240,57 @@ VOID CacheSim(INS ins,VOID *v)
      }
 }
 
-/* ===================================================================== */
-/* Instruction Printing for TraceBased Simulation */
-/* ===================================================================== */
-LOCALFUN VOID DumpPC(VOID *ip, USIZE size, UINT32 memOperands)
-{
-    MACHINESIM_FPRINT(tracefile, "%p  %d  %d  ", ip, size, memOperands);
-}
-
-LOCALFUN VOID RecordMemRead(VOID * ip, VOID * addr, USIZE size)
-{
-    MACHINESIM_FPRINT(tracefile,"0x00 %p %d\n", addr,size);
-}
-
-LOCALFUN VOID RecordMemWrite(VOID * ip, VOID * addr, USIZE size)
-{
-    MACHINESIM_FPRINT(tracefile,"0x01 %p %d\n", addr, size);
-}
-
-LOCALFUN VOID DumpInstructionBytes(VOID *ip, USIZE size)
+/// =========================================================
+//  Buffered Cache Simulation.
+/// =========================================================
+/* MemRefBufferFull - run a full buffer through the cache hierarchy */
+LOCALFUN VOID * MemRefBufferFull(BUFFER_ID id, THREADID tid, const CONTEXT *ctxt, 
+                                 VOID *buf, UINT64 num, VOID *v)
 {
-    for (UINT8 i=0; i<size; i++) MACHINESIM_FPRINT(tracefile, "%x ",(*((UINT8*)ip+i)) );
-    MACHINESIM_FPRINT(tracefile,"\n");
+    /* the hierarchies of -sweep simulate a copy */
+    SweepPush(static_cast<MEMREF*>(buf), num, false, tid);
+    /* the worker pool simulates it, continue with a fresh buffer */
+    if (SimOpts->get_sim_threads()) return MachineSimWorkerPush(id, buf, num, tid);
+    MemRefBufferDrain(static_cast<MEMREF*>(buf), num, tid);
+    /* hand the same buffer back to pin */
+    return buf;
 }
 
-/* GenerateSimulationTrace - generate instruction trace */
-VOID GenerateSimulationTrace(INS ins, VOID *v)
+/* CacheSimBuffered - setup buffer fills to do cache simulation in bulk */
+VOID CacheSimBuffered(INS ins, VOID *v)
 {
-    USIZE size = INS_Size(ins);
-
-    UINT32 memOperands = INS_MemoryOperandCount(ins);
-
-    /* insert a call to DumpPC before every instruction, and pass it the IP */
-    INS_InsertCall(ins, IPOINT_BEFORE,
-                   (AFUNPTR)DumpPC,
-                   IARG_INST_PTR,
-                   IARG_UINT32 , size ,
-                   IARG_UINT32, memOperands,
-                   IARG_END);
-
-    INS_InsertCall(ins, IPOINT_BEFORE,
-                   (AFUNPTR)DumpInstructionBytes,
-                   IARG_INST_PTR,
-                   IARG_UINT32 , size ,
-                   IARG_END);
+    /// --------------------------------------------- ///
+    //  instruction fetch record                       //
+    /// --------------------------------------------- ///
+    INS_InsertFillBuffer(ins, IPOINT_BEFORE, MemRefBufferId,
+                         IARG_INST_PTR, offsetof(MEMREF, pc),
+                         IARG_INST_PTR, offsetof(MEMREF, ea),
+                         IARG_UINT32, INS_Size(ins), offsetof(MEMREF, size),
+                         IARG_UINT32, MEMREF_IFETCH, offsetof(MEMREF, type),
+                         IARG_END);
 
-    /* iterate over each memory operand of the instruction. */
-    for (UINT32 memOp = 0; memOp < memOperands; memOp++)
+    /// --------------------------------------------- ///
+    //  data read and write records                    //
+    /// --------------------------------------------- ///
+    // only predicated-on memory instructions access D-cache
+    if (INS_IsMemoryRead(ins))
     {
-        if (INS_MemoryOperandIsRead(ins, memOp))
-        {
-            INS_InsertCall(ins, IPOINT_BEFORE,
-                           (AFUNPTR)RecordMemRead,
-                           IARG_INST_PTR,
-                           IARG_MEMORYOP_EA, memOp,
-                           IARG_MEMORYREAD_SIZE,
-                           IARG_END);
-        }
+        INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, MemRefBufferId,
+                                       IARG_INST_PTR, offsetof(MEMREF, pc),
+                                       IARG_MEMORYREAD_EA, offsetof(MEMREF, ea),
+                                       IARG_MEMORYREAD_SIZE, offsetof(MEMREF, size),
+                                       IARG_UINT32, MEMREF_LOAD, offsetof(MEMREF, type),
+                                       IARG_END);
+    }
 
-        if (INS_MemoryOperandIsWritten(ins, memOp))
-        {
-            INS_InsertCall(ins, IPOINT_BEFORE,
-                           (AFUNPTR)RecordMemWrite,
-                           IARG_INST_PTR,
-                           IARG_MEMORYOP_EA, memOp,
-                           IARG_MEMORYWRITE_SIZE,
-                           IARG_END);
-        }
+    if (INS_IsMemoryWrite(ins))
+    {
+        INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, MemRefBufferId,
+                                       IARG_INST_PTR, offsetof(MEMREF, pc),
+                                       IARG_MEMORYWRITE_EA, offsetof(MEMREF, ea),
+                                       IARG_MEMORYWRITE_SIZE, offsetof(MEMREF, size),
+                                       IARG_UINT32, MEMREF_STORE, offsetof(MEMREF, type),
+                                       IARG_END);
     }
     return;
 }
@@ -381,9 +298,13 @@ VOID GenerateSimulationTrace(INS ins, VOID *v)
 /* InstructionInstrument - setup instruction level instructmentation */
 VOID InstructionInstrument(INS ins, VOID *v)
 {
-    /* count instruction/simulate cache ? */
-    if (SimOpts->get_ins_count()) SimpleInstructionCount(ins, v);
-    if (SimOpts->get_mem_simul()) CacheSim(ins, v);
+    /* simulate cache ? instructions are counted per basicblock. */
+    /* nothing to simulate while fast-forwarding.                */
+    if (SimOpts->get_mem_simul() && SimWait->instrument()) 
+    {
+        if (SimOpts->get_mem_buffer()) CacheSimBuffered(ins, v);
+        else CacheSim(ins, v);
+    }
 
     /* trace base simulation enabled. */
     if (SimOpts->get_tracerecord()) GenerateSimulationTrace(ins, v);
@@ -411,7 +332,18 @@ LOCALFUN VOID instruction_module_print()
 /* ===================================================================== */
 void MachineSimInstructionModuleInit(void)
 {
-    /* do nothing right now */
+    /* memory references are buffered per thread and simulated in bulk. */
+    if (SimOpts->get_mem_simul() && SimOpts->get_mem_buffer())
+    {
+        MemRefBufferId = PIN_DefineTraceBuffer(sizeof(MEMREF), 
+                                               SimOpts->get_mem_buffer_pages(),
+                                               MemRefBufferFull, 0);
+        if (MemRefBufferId == BUFFER_ID_INVALID)
+        {
+            MACHINESIM_PRINT("Error: could not allocate the memory reference buffer\n");
+            PIN_ExitProcess(1);
+        }
+    }
 }
 
 void MachineSimInstructionModuleFini(void)
@@ -55,7 +55,31 @@ SIMGLOBALS* SimTheOne  = NULL;
 /* ===================================================================== */
 KNOB<BOOL>   KnobInstructionCountOnly(KNOB_MODE_WRITEONCE     , "pintool",  "instcount"     ,"0"    , "instruction count only");
 KNOB<BOOL>   KnobMemorySimulationOnly(KNOB_MODE_WRITEONCE     , "pintool",  "memsim"        ,"0"    , "simulate memory only");
+KNOB<BOOL>   KnobMemoryBuffer(KNOB_MODE_WRITEONCE             , "pintool",  "membuf"        ,"0"    , "buffer memory references and simulate them in bulk (with -memsim)");
+KNOB<UINT32> KnobMemoryBufferPages(KNOB_MODE_WRITEONCE        , "pintool",  "membufpages"   ,"256"  , "number of 4K pages in each per-thread memory reference buffer");
+KNOB<UINT32> KnobSimThreads(KNOB_MODE_WRITEONCE               , "pintool",  "simthreads"    ,"0"    , "number of internal threads simulating the buffered references (implies -membuf)");
+KNOB<string> KnobSweep(KNOB_MODE_APPEND                     , "pintool",  "sweep"         ,""     , "config.xml of another hierarchy simulated from the same references, once per hierarchy (implies -membuf)");
+KNOB<BOOL>   KnobStackDist(KNOB_MODE_WRITEONCE                , "pintool",  "stackdist"     ,"0"    , "profile stack distances for miss ratio curves of every level");
+KNOB<BOOL>   KnobOpt(KNOB_MODE_WRITEONCE                      , "pintool",  "opt"           ,"0"    , "count the hits and misses of Belady's optimal replacement at every level");
+KNOB<UINT32> KnobOptWindow(KNOB_MODE_WRITEONCE                , "pintool",  "optwindow"     ,"8"    , "references per set the optimal replacement looks back, times the associativity");
+KNOB<UINT32> KnobL3Sample(KNOB_MODE_WRITEONCE                 , "pintool",  "l3sample"      ,"1"    , "simulate 1 out of every N sets of the L3 and estimate the rest");
+KNOB<BOOL>   KnobL3SampleHash(KNOB_MODE_WRITEONCE             , "pintool",  "l3samplehash"  ,"0"    , "pick the sampled L3 sets by hash instead of every Nth");
+KNOB<UINT64> KnobSampleSkip(KNOB_MODE_WRITEONCE               , "pintool",  "sampleskip"    ,"0"    , "instructions not simulated at all after each -uniform_length window, before the caches are warmed again");
+KNOB<UINT32> KnobL3Banks(KNOB_MODE_WRITEONCE                  , "pintool",  "l3banks"       ,"64"   , "number of independently locked banks of the shared L3 sets");
+KNOB<BOOL>   KnobL1Filter(KNOB_MODE_WRITEONCE                 , "pintool",  "l1filter"      ,"1"    , "count accesses to the last L1 line of a thread as hits inline, where that is exact");
+KNOB<string> KnobCkptSave(KNOB_MODE_WRITEONCE                , "pintool",  "ckptsave"      ,""     , "save the state of all caches and tlbs into this checkpoint file");
+KNOB<UINT64> KnobCkptAt(KNOB_MODE_WRITEONCE                  , "pintool",  "ckptat"        ,"0"    , "instruction count to save the checkpoint at, 0 for the end of the run");
+KNOB<string> KnobCkptLoad(KNOB_MODE_WRITEONCE                , "pintool",  "ckptload"      ,""     , "start from the cache and tlb state of this checkpoint file");
+KNOB<BOOL>   KnobFastForward(KNOB_MODE_WRITEONCE              , "pintool",  "fastforward"   ,"1"    , "instrument nothing while simulation is off, re-instrument when it switches");
 KNOB<BOOL>   KnobEnableTraceRecord(KNOB_MODE_WRITEONCE        , "pintool",  "tc"            ,"0"    , "Enable Trace simulation");
+KNOB<string> KnobTraceFile(KNOB_MODE_WRITEONCE                , "pintool",  "tcfile"        ,""     , "binary trace file name, trace.out.<pid> by default");
+KNOB<UINT32> KnobTraceChunk(KNOB_MODE_WRITEONCE               , "pintool",  "tcchunk"       ,"1048576", "bytes of trace records per thread packed into a chunk");
+KNOB<UINT32> KnobTraceBuffers(KNOB_MODE_WRITEONCE             , "pintool",  "tcbuffers"     ,"3"    , "chunk buffers per thread, filled while the trace writer packs and writes the others");
+KNOB<BOOL>   KnobTraceDrop(KNOB_MODE_WRITEONCE                , "pintool",  "tcdrop"        ,"0"    , "drop and count a chunk instead of waiting when the trace writer is behind");
+KNOB<UINT32> KnobTraceWrite(KNOB_MODE_WRITEONCE               , "pintool",  "tcwrite"       ,"4194304", "bytes of the aligned writes of the trace file");
+KNOB<UINT32> KnobTraceFilter(KNOB_MODE_WRITEONCE              , "pintool",  "tcfilter"      ,"0"    , "bytes of the private L1 filter caches, record only their misses and writebacks");
+KNOB<UINT32> KnobTraceFilterAssoc(KNOB_MODE_WRITEONCE         , "pintool",  "tcfilterassoc" ,"8"    , "associativity of the L1 filter caches");
+KNOB<UINT32> KnobTraceFilterLine(KNOB_MODE_WRITEONCE          , "pintool",  "tcfilterline"  ,"64"   , "line size of the L1 filter caches");
 KNOB<UINT32> KnobWthdCount(KNOB_MODE_WRITEONCE                , "pintool",  "wthd"          ,"0"    , "Number of worker threads created before simulation");
 KNOB<UINT32> KnobWriteMissAllocate(KNOB_MODE_WRITEONCE        , "pintool",  "w"             ,"0"    , "write miss allocate (0 for allocate, 1 for not allocate ");
 KNOB<UINT32> KnobCacheDetailPrint(KNOB_MODE_WRITEONCE         , "pintool",  "dp"            ,"0"    , "Enable detailed private cache miss data");
@@ -93,8 +117,34 @@ LOCALFUN VOID InitSimOpts()
 {
     SimOpts->set_ins_count(KnobInstructionCountOnly.Value());
     SimOpts->set_mem_simul(KnobMemorySimulationOnly.Value());
+    SimOpts->set_mem_buffer(KnobMemoryBuffer.Value());
+    SimOpts->set_mem_buffer_pages(KnobMemoryBufferPages.Value());
+    SimOpts->set_l3_banks(KnobL3Banks.Value());
+    SimOpts->set_sim_threads(KnobSimThreads.Value());
+    SimOpts->set_stackdist(KnobStackDist.Value());
+    SimOpts->set_opt(KnobOpt.Value());
+    SimOpts->set_opt_window(KnobOptWindow.Value());
+    SimOpts->set_l3_sample(KnobL3Sample.Value());
+    SimOpts->set_l3_sample_hash(KnobL3SampleHash.Value());
+    SimOpts->set_sample_skip(KnobSampleSkip.Value());
+    SimOpts->set_l1_filter(KnobL1Filter.Value());
+    SimOpts->set_ckpt_save(KnobCkptSave.Value());
+    SimOpts->set_ckpt_at(KnobCkptAt.Value());
+    SimOpts->set_ckpt_load(KnobCkptLoad.Value());
+    for (UINT32 i=0; i<KnobSweep.NumberOfValues(); i++) SimOpts->add_sweep(KnobSweep.Value(i));
+    if (SimOpts->get_ckpt_at()) SimOpts->set_ins_count(true);
+    if (SimOpts->get_sim_threads()) SimOpts->set_mem_buffer(true);
+    if (!SimOpts->get_sweep().empty()) SimOpts->set_mem_buffer(true);
     SimOpts->set_replacepolicy(KnobSetType.Value());
     SimOpts->set_tracerecord(KnobEnableTraceRecord.Value());
+    SimOpts->set_tracefile(KnobTraceFile.Value());
+    SimOpts->set_tracechunk(KnobTraceChunk.Value());
+    SimOpts->set_tracebuffers(KnobTraceBuffers.Value());
+    SimOpts->set_tracedrop(KnobTraceDrop.Value());
+    SimOpts->set_tracewrite(KnobTraceWrite.Value());
+    SimOpts->set_tracefilter(KnobTraceFilter.Value());
+    SimOpts->set_tracefilter_assoc(KnobTraceFilterAssoc.Value());
+    SimOpts->set_tracefilter_line(KnobTraceFilterLine.Value());
     SimOpts->set_maxsiminst(KnobMaxSimInstCount.Value());
     SimOpts->set_xml_parser(new ParseXML());
     SimOpts->get_xml_parser()->parse(KnobConfigFile.Value().c_str());
@@ -109,6 +159,7 @@ LOCALFUN VOID initialize_SimTheOne()
 /// InitSimWait - initialize simulation wait reasons.
 LOCALFUN VOID InitSimWait()
 {
+    SimWait->settoggle(KnobFastForward.Value());
 ///    SimWait->setwait(SIMPARAMS::WAIT_WORKER_THREAD);
 }
 
@@ -128,9 +179,21 @@ VOID MachineSimMainModuleFini()
    finalize_simobjs();
 }
 
+LOCALFUN VOID FiniUnlocked(int code, VOID * v)
+{
+   /* join the internal threads. the workers finish simulating first. */
+   MachineSimWorkerModuleExit();
+   MachineSimSweepModuleExit();
+   MachineSimTraceModuleExit();
+}
+
 LOCALFUN VOID Fini(int code, VOID * v)
 {
-   /* finalize modules. */
+   /* finalize modules, the internal threads are gone. */
+   MachineSimWorkerModuleFini();
+   MachineSimSweepModuleFini();
+   MachineSimSamplingModuleFini();
+   MachineSimTraceModuleFini();
    MachineSimCacheTLBModuleFini();
    MachineSimInstructionModuleFini();
    MachineSimBasicBlockModuleFini();
@@ -141,6 +204,26 @@ LOCALFUN INT32 Usage()
 {
     LOG("-instcount\t\t\t Turn on instruction count\n");
     LOG("-memsim\t\t\t Turn on cache hiearchy simulation\n");
+    LOG("-membuf\t\t\t Buffer memory references and simulate them in bulk\n");
+    LOG("-simthreads\t\t\t Simulate the buffered references on internal threads\n");
+    LOG("-sweep\t\t\t Simulate the hierarchy of another config.xml too, a report for each\n");
+    LOG("-stackdist\t\t\t Print LRU miss ratio curves of every level for all sizes\n");
+    LOG("-opt/-optwindow\t\t Count the misses of Belady's optimal replacement at every level\n");
+    LOG("-l3banks\t\t\t Number of independently locked banks of the shared L3\n");
+    LOG("-l3sample\t\t\t Simulate 1 out of N sets of the L3, with error bounds\n");
+    LOG("-l3samplehash\t\t\t Pick the sampled L3 sets by hash\n");
+    LOG("-uniform_period/-uniform_length\t Count only a window every period, warm the caches in between\n");
+    LOG("-sampleskip\t\t\t Do not simulate that many instructions after each window\n");
+    LOG("-regions:in\t\t\t Simulate only the weighted regions of a regions file, e.g. simpoints\n");
+    LOG("-l1filter\t\t\t Count accesses to the last L1 line as hits inline (default on)\n");
+    LOG("-ckptsave/-ckptat\t\t Save the cache and tlb state at an instruction count\n");
+    LOG("-ckptload\t\t\t Start from the cache and tlb state of a checkpoint\n");
+    LOG("-fastforward\t\t\t Instrument nothing while simulation is off (default on)\n");
+    LOG("-regions:warmup\t\t\t Warm the caches that many instructions before each region\n");
+    LOG("-tc/-tcfile\t\t\t Record a binary trace, tracecvt converts and prints traces\n");
+    LOG("\t\t\t\t machinesim-replay simulates them without pin\n");
+    LOG("-tcbuffers/-tcdrop\t\t Buffers per thread for the trace writer, drop chunks when it is behind\n");
+    LOG("-tcfilter\t\t\t Record only the misses and writebacks of private L1 filter caches\n");
     LOG("This pin tool implements multiple levels of caches and TLBs.\n\n");
     return -1;
 }
@@ -160,17 +243,31 @@ GLOBALFUN int main(int argc, char *argv[])
     /* initialize instruction module. */
     MachineSimInstructionModuleInit();
 
+    /* initialize the trace recorder. */
+    MachineSimTraceModuleInit();
+
     /* initialize basicblock module. */
     MachineSimBasicBlockModuleInit();
 
+    /* initialize the periodic sampling controller, before the caches */
+    /* decide on the same line filter it turns off.                    */
+    MachineSimSamplingModuleInit();
+
     /* initialize the cache module simulation. */
     MachineSimCacheTLBModuleInit();
 
+    /* initialize the simulation worker pool. */
+    MachineSimWorkerModuleInit();
+
+    /* initialize the hierarchies of the configuration sweep. */
+    MachineSimSweepModuleInit();
+
     RTN_AddInstrumentFunction(RoutineInstrument, 0);
     INS_AddInstrumentFunction(InstructionInstrument, 0);
     TRACE_AddInstrumentFunction(TraceInstrument, 0);
     /// IMG_AddInstrumentFunction(ImageInstrument, 0);
 
+    PIN_AddFiniUnlockedFunction(FiniUnlocked, 0);
     PIN_AddFiniFunction(Fini, 0);
 
     PIN_StartProgram();
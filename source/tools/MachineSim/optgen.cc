@@ -0,0 +1,122 @@
+/*BEGIN_LEGAL
+Intel Open Source License
+
+Copyright (c) 2002-2011 Intel CorpORAtion. All rights reserved.
+
+Written by Xin Tong, University of Toronto.
+
+Redistribution and use in source and binary fORMs, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary fORM must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel CorpORAtion nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+
+/* ===================================================================== */
+/* This file contains the optimal replacement oracle of the PIN tool     */
+/* ===================================================================== */
+
+#include "optgen.hh"
+#include <algorithm>
+
+/* ===================================================================== */
+/* Occupancy Vectors */
+/* ===================================================================== */
+OPTGEN_SETS::OPTGEN_SETS(UINT32 sets, UINT32 assoc, UINT32 window) : Assoc(assoc), WindowMask(window - 1)
+{
+    ASSERTX(IsPowerOfTwo(window));
+    ASSERTX(assoc < OPTGEN_HELD);
+    Time = new UINT64[sets];
+    Lines = new ADDRINT[(UINT64)sets*window];
+    Occupancy = new UINT16[(UINT64)sets*window];
+    memset(Time, 0, sizeof(UINT64)*sets);
+    // ~0 marks an empty entry, no tag is all ones.
+    memset(Lines, 0xff, sizeof(ADDRINT)*sets*window);
+    memset(Occupancy, 0, sizeof(UINT16)*sets*window);
+}
+
+OPTGEN_SETS::~OPTGEN_SETS()
+{
+    delete [] Time;
+    delete [] Lines;
+    delete [] Occupancy;
+}
+
+BOOL OPTGEN_SETS::Access(UINT32 set, ADDRINT line)
+{
+    const UINT64 window = (UINT64)WindowMask + 1;
+    const UINT64 now = Time[set];
+    const UINT64 first = now >= window ? now - window : 0;
+    ADDRINT *lines = &Lines[set*window];
+    UINT16 *occupancy = &Occupancy[set*window];
+
+    // a line referenced again right after itself takes no new entry. the 
+    // entry holds the line over itself, which adds one to its occupancy 
+    // and is counted only once.
+    if (now && lines[(now-1) & WindowMask] == line)
+    {
+        UINT16 &last = occupancy[(now-1) & WindowMask];
+        if (last & OPTGEN_HELD) return true;
+        if (last < Assoc) { last = (last + 1) | OPTGEN_HELD; return true; }
+    }
+
+    // walk back to the last reference of the line. MIN keeps the line if 
+    // the set had room at every reference since.
+    BOOL hit = false;
+    UINT32 peak = 0;
+    for (UINT64 t = now; t-- > first; )
+    {
+        UINT32 o = occupancy[t & WindowMask] & ~OPTGEN_HELD;
+        if (lines[t & WindowMask] != line) { peak = std::max(peak, o); continue; }
+        // the line already holds its own entry.
+        UINT64 start = t;
+        if (occupancy[t & WindowMask] & OPTGEN_HELD) { o--; start++; }
+        peak = std::max(peak, o);
+        if (peak < Assoc)
+        {
+            for (UINT64 u = start; u < now; u++) occupancy[u & WindowMask] ++;
+            hit = true;
+        }
+        break;
+    }
+    lines[now & WindowMask] = line;
+    occupancy[now & WindowMask] = 0;
+    Time[set]++;
+    return hit;
+}
+
+/* ===================================================================== */
+/* Optimal Replacement Of A Level */
+/* ===================================================================== */
+OPTGEN::OPTGEN(UINT32 sets, UINT32 assoc, UINT32 window, BOOL shared) 
+       : Sets(sets), Assoc(assoc), Window(1U << CeilLog2(window*assoc)), Shared(shared)
+{
+    memset(Instances, 0, sizeof(Instances));
+    // the sets of a shared level are touched under the bank locks only, 
+    // they can not be created on the first reference.
+    if (Shared) Instances[0] = new OPTGEN_SETS(Sets, Assoc, Window);
+}
+
+OPTGEN::~OPTGEN()
+{
+    for (THREADID tid = 0; tid < MAX_CACHE_THREAD; tid++) delete Instances[tid];
+}
@@ -0,0 +1,107 @@
+/*BEGIN_LEGAL
+Intel Open Source License
+
+Copyright (c) 2002-2011 Intel Corporation. All rights reserved.
+
+Written by Xin Tong, University of Toronto.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+
+#ifndef PIN_OPTGEN_H
+#define PIN_OPTGEN_H
+
+#include "pin.H"
+#include "utils.hh"
+
+/// @ OPTGEN - Belady's optimal replacement of one level of the hierarchy
+//  @
+//  @ OPT tells how far the replacement policy of a level is from the 
+//  @ fewest misses any policy could get on the stream reaching the level.
+//  @ OPTgen (Jain and Lin, ISCA 2016) decides whether Belady's MIN hits on 
+//  @ a reference as the stream goes by, without looking ahead. every set 
+//  @ keeps the lines of its last references and, for each of them, the 
+//  @ number of lines MIN keeps in the set over that reference, its 
+//  @ occupancy. a line referenced again hits if the occupancy stayed below
+//  @ the associativity since its last reference, and then occupies the set
+//  @ over that interval. this is MIN with bypassing, a line may be left 
+//  @ out of the cache.
+//  @
+//  @ a set remembers a window of -optwindow times its associativity of 
+//  @ references, a line reused further apart counts as a miss. back to
+//  @ back references to a line take a single entry of the window. the memory
+//  @ is bounded whatever the length of the trace, and MIN hardly ever keeps
+//  @ a line that long at 8 times the associativity.
+/* ===================================================================== */
+/* Optimal Replacement ... */
+/* ===================================================================== */
+// an occupancy whose line is held over its own reference.
+#define OPTGEN_HELD  (0x8000)
+
+/// @ OPTGEN_SETS - the occupancy vectors of the sets of one cache.
+class OPTGEN_SETS
+{
+private:
+    UINT32 Assoc;
+    UINT32 WindowMask;
+    // references to every set so far.
+    UINT64 *Time;
+    // the window of every set, the line and the occupancy of a reference
+    // at its time modulo the window. back to back references to a line 
+    // share one entry.
+    ADDRINT *Lines;
+    UINT16 *Occupancy;
+public:
+    OPTGEN_SETS(UINT32 sets, UINT32 assoc, UINT32 window);
+    ~OPTGEN_SETS();
+    /// whether MIN hits on line, a reference to set.
+    BOOL Access(UINT32 set, ADDRINT line);
+};
+
+/// @ OPTGEN - MIN of one level. a private level gets the sets of every 
+//  @ thread, created on the first reference of the thread, a shared one 
+//  @ a single instance, whose sets are only touched with their bank locked.
+class OPTGEN
+{
+private:
+    UINT32 Sets;
+    UINT32 Assoc;
+    UINT32 Window;
+    BOOL   Shared;
+    OPTGEN_SETS *Instances[MAX_CACHE_THREAD];
+public:
+    OPTGEN(UINT32 sets, UINT32 assoc, UINT32 window, BOOL shared);
+    ~OPTGEN();
+    /// line is the tag of the referenced line or page, set its set.
+    BOOL Access(UINT32 set, ADDRINT line, THREADID tid)
+    {
+        OPTGEN_SETS *&sets = Instances[Shared ? 0 : tid];
+        if (CACHESIM_unlikely(!sets)) sets = new OPTGEN_SETS(Sets, Assoc, Window);
+        return sets->Access(set, line);
+    }
+};
+
+#endif // PIN_OPTGEN_H
@@ -0,0 +1,1008 @@
+/*BEGIN_LEGAL
+Intel Open Source License
+
+Copyright (c) 2002-2011 Intel CorpORAtion. All rights reserved.
+
+Written by Xin Tong, University of Toronto.
+
+Redistribution and use in source and binary fORMs, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary fORM must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel CorpORAtion nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+
+/* ===================================================================== */
+/* This file contains the trace replay engine of the PIN tool           */
+/* ===================================================================== */
+/// machinesim-replay runs a binary trace recorded with -tc through the
+/// cache and tlb hierarchy of config.xml, without pin. it links the cache
+/// module as it is, built against the pin.H of replay/, and writes the
+/// same cache_sim.out report as -memsim.
+///
+///    machinesim-replay [options] <trace>
+///
+/// the chunks are read and decoded into MEMREF batches on decoder threads,
+/// chunk i by decoder i % decoders, and simulated on the main thread in the
+/// order of the trace. the chunks of the threads are simulated one after 
+/// the other, in the order the recording wrote them.
+///
+/// a filtered trace (-tcfilter) only has the misses and writebacks of the 
+/// L1 filter caches, its references go straight to the L2 and the tlbs 
+/// are not simulated.
+///
+/// with -shards the sets of every level are split among shard workers. the
+/// decoders partition every chunk by the address bits just above the line
+/// of the largest line size, which pick the set in every cache and keep a
+/// line and its back-invalidations on one worker. the tlbs are split on the
+/// low bits of the page. a worker simulates the shards of every thread as
+/// threads of their own, which share the private caches of the thread and 
+/// count into blocks of their own, folded into the thread at the end. a
+/// reference spanning lines of different workers is simulated by the worker
+/// of its first line while the other workers wait at it. policies with state
+/// across sets and stack distance profiles replay on the main thread.
+///
+/// without -shards the cache model on the main thread bounds the replay.
+/// with them the batching per shard and the waits at spanning references
+/// are paid for on every reference, the workers only win them back when 
+/// they run on cores of their own.
+///
+/// with -segments the trace is cut into time segments of about the same 
+/// number of instructions, each replayed in a process of its own. a segment
+/// first warms the caches with the -warmup instructions before it, counting
+/// nothing, and the counters of the segments are added up. with -fixup K the
+/// segments are replayed again from the state at the end of the segment 
+/// before, until the state meets the one of the first run at one of the 
+/// first K chunk boundaries, from where that run was exact. a segment that
+/// does not meet it within K boundaries is replayed to its end and the next 
+/// segment replayed again from there, which makes the counters exact.
+///
+/// with -sweep every decoded chunk is also replayed through the hierarchy
+/// of every other configuration, each on a sweep thread of sweep.cc, while
+/// the main thread replays the one of -c.
+///
+/// with -opt every level also counts the hits and misses of Belady's 
+/// optimal replacement (OPTgen of optgen.cc) on its sampled sets, looking
+/// back -optwindow times the associativity references of every set. it 
+/// replays on the main thread and in a single segment.
+///
+/// with -format champsim or pcea the trace is a foreign one of trace.hh,
+/// its chunks encoded into records by the decoders as they read them. a 
+/// ChampSim trace has to be uncompressed, or converted by tracecvt.
+
+#include "pin.H"
+#include "utils.hh"
+#include "trace.hh"
+#include <new>
+#include <deque>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <time.h>
+
+/* ===================================================================== */
+/* Cache Simulation Functions */
+/* ===================================================================== */
+VOID InsFetchRef(ADDRINT addr, THREADID tid);
+VOID DataFetchRef(ADDRINT iaddr, ADDRINT addr, UINT32 size, UINT64 base, UINT64 idx, THREADID tid);
+VOID DataWriteRef(ADDRINT iaddr, ADDRINT addr, UINT32 size, UINT64 base, UINT64 idx, THREADID tid);
+
+/* ===================================================================== */
+/* Globals variables */
+/* ===================================================================== */
+SIMXLATOR * SimXlator  = NULL;
+SIMPARAMS * SimWait    = NULL;
+SIMOPTS   * SimOpts    = NULL;
+SIMSTATS  * SimStats   = NULL;
+SIMGLOBALS* SimTheOne  = NULL;
+
+/// REPLAY_BATCH - the references of a chunk one shard worker simulates,
+/// their MEMREF type tagged with the REPLAY_REF kind.
+typedef struct
+{
+   THREADID tid;
+   UINT64 num;
+   std::vector<MEMREF> refs;
+} REPLAY_BATCH;
+
+/// REPLAY_JOB - a decoded chunk, an instruction fetch for every 
+/// instruction followed by its memory references.
+typedef struct
+{
+   UINT32 chunk;
+   BOOL   valid;   /* false if the chunk could not be read or decoded */
+   UINT64 num;     /* references filled in, refs only ever grows */
+   std::vector<MEMREF> refs;
+   std::vector<REPLAY_BATCH> shards;   /* with -shards, a batch per worker */
+   volatile UINT32 pending;            /* workers not done with the job */
+} REPLAY_JOB;
+
+/// REPLAY_REF - the kind of a batched reference, or'ed into its type. a 
+/// wait and a cross entry carry the id of the crossing reference in pc, a
+/// wait the owning worker in ea and a cross the mask of waiting workers.
+typedef enum
+{
+   REPLAY_REF_TYPE  = 0x0f,
+   REPLAY_REF_CACHE = 0x10,   /* the cache side of the reference */
+   REPLAY_REF_TLB   = 0x20,   /* the tlb side of the reference */
+   REPLAY_REF_L2    = 0x40,   /* a reference of a filtered trace */
+   REPLAY_REF_WAIT  = 0x80,   /* wait until the owner simulated the crossing */
+   REPLAY_REF_CROSS = 0x100   /* wait for the workers, simulate the next entry */
+} REPLAY_REF;
+
+/// REPLAY_DECODER - a decoder thread and its jobs. the decoder fills the
+/// jobs from Free and queues them on Full, in the order of its chunks.
+class REPLAY_DECODER
+{
+public:
+   enum { RING_SIZE = 4 };
+   SIMRING<REPLAY_JOB*, RING_SIZE> Full;
+   SIMRING<REPLAY_JOB*, RING_SIZE> Free;
+   REPLAY_JOB Jobs[RING_SIZE];
+   TRACE_READER Reader;
+   TRACE_DECODER Decoder;
+   UINT32 First;
+   pthread_t Thread;
+public:
+   REPLAY_DECODER() : First(0) { for (UINT32 i = 0; i < RING_SIZE; i++) Free.push(&Jobs[i]); }
+};
+
+/// REPLAY_WORKER - a shard worker, it simulates its batch of every job
+/// queued on Jobs, until a NULL job. Reached is the last crossing id the
+/// worker waits at, Done the last crossing it simulated as the owner.
+class REPLAY_WORKER
+{
+public:
+   enum { RING_SIZE = 8 };
+   SIMRING<REPLAY_JOB*, RING_SIZE> Jobs;
+   volatile UINT64 Reached __attribute__ ((aligned (CACHELINE_SIZE)));
+   volatile UINT64 Done __attribute__ ((aligned (CACHELINE_SIZE)));
+   UINT32 Index __attribute__ ((aligned (CACHELINE_SIZE)));
+   pthread_t Thread;
+public:
+   REPLAY_WORKER() : Reached(0), Done(0), Index(0) {}
+};
+
+/// REPLAY_SEGMENT - a time segment of the trace, shared with the process
+/// replaying it. the chunk boundaries from first on are numbered from 0.
+typedef struct
+{
+   UINT32 warm;        /* first chunk of the warmup */
+   UINT32 first;       /* first chunk of the segment */
+   UINT32 last;        /* first chunk of the next segment */
+   UINT32 converged;   /* boundary a replay met the reference run at */
+   UINT32 pass;        /* fixup pass of the checkpoint of the end state */
+   BOOL   ok;
+   UINT64 refs;
+} REPLAY_SEGMENT;
+
+/// the two runs of a segment, the reference run and the fixup replay.
+enum { REPLAY_RUN_REF = 0, REPLAY_RUN_FIXUP = 1, REPLAY_RUNS = 2 };
+LOCALCONST UINT32 REPLAY_DIVERGED = 0xffffffff;
+
+LOCALVAR REPLAY_DECODER *ReplayDecoders = NULL;
+LOCALVAR UINT32 ReplayDecoderNum = 2;
+LOCALVAR UINT32 ReplayFirstChunk = 0;
+LOCALVAR UINT32 ReplayChunks = 0;
+LOCALVAR volatile BOOL ReplayExiting = false;
+LOCALVAR BOOL ReplayFiltered = false;
+LOCALVAR UINT32 ReplayFormat = TRACE_FORMAT_NATIVE;
+
+LOCALVAR REPLAY_WORKER *ReplayWorkers = NULL;
+LOCALVAR UINT32 ReplayShardNum = 1;      /* workers, a power of 2 */
+LOCALVAR UINT32 ReplayShardShift = 0;    /* the shard is the address bits above */
+LOCALVAR UINT32 ReplayTlbShards = 0;     /* tlb shards, 0 without tlbs */
+LOCALVAR UINT32 ReplayThreads = 0;       /* threads of the trace */
+LOCALVAR std::deque<REPLAY_JOB*> ReplayInflight;
+
+LOCALVAR REPLAY_SEGMENT *ReplaySegments = NULL;
+LOCALVAR UINT32 ReplaySegmentNum = 1;
+LOCALVAR UINT64 ReplayWarmup = 10000000;
+LOCALVAR UINT32 ReplayFixup = 0;         /* boundaries checked, 0 for no fixup */
+LOCALVAR UINT32 ReplayCounterNum = 0;    /* counters of CacheCounters */
+LOCALVAR UINT64 *ReplayHashes = NULL;    /* state at boundaries 0 ... ReplayFixup */
+LOCALVAR UINT64 *ReplayCounts = NULL;    /* counters there, and at the end */
+LOCALVAR UINT32 ReplaySegment = 0;       /* segment and run of this process */
+LOCALVAR UINT32 ReplayRun = REPLAY_RUN_REF;
+LOCALVAR OS_PROCESS_ID ReplayPid = 0;
+
+/* ===================================================================== */
+/* Decoding */
+/* ===================================================================== */
+/* ReplayDecode - decode chunk c into the references of job. a write and */
+/* a writeback are both stores.                                          */
+LOCALFUN BOOL ReplayDecode(TRACE_READER &reader, TRACE_DECODER &dec, UINT32 c, REPLAY_JOB *job)
+{
+    static const UINT32 types[] = { MEMREF_LOAD, MEMREF_STORE, MEMREF_STORE, MEMREF_IFETCH };
+    TRACE_INS ins;
+    job->num = 0;
+    if (!reader.Load(c, &dec)) return false;
+
+    const BOOL filtered = (reader.Header.flags & TRACE_FILTERED) != 0;
+    UINT64 num = 0;
+    int rc;
+    while ((rc = dec.Next(&ins)) > 0)
+    {
+        if (job->refs.size() < num + 1 + ins.nrefs) job->refs.resize(2 * (num + 1 + ins.nrefs));
+        MEMREF *ref = &job->refs[num];
+        if (!filtered)
+        {
+            ref->pc = ref->ea = (ADDRINT)ins.pc;
+            ref->size = ins.size;
+            ref->type = MEMREF_IFETCH;
+            ref++;
+        }
+        for (UINT32 i = 0; i < ins.nrefs; i++, ref++)
+        {
+            ref->pc = (ADDRINT)ins.pc;
+            ref->ea = (ADDRINT)ins.refs[i].addr;
+            ref->size = ins.refs[i].size;
+            ref->type = types[ins.refs[i].type];
+        }
+        num = ref - &job->refs[0];
+    }
+    job->num = num;
+    return rc == 0;
+}
+
+/* ReplayPut - append a batched reference for worker w */
+LOCALFUN inline VOID ReplayPut(REPLAY_BATCH &batch, ADDRINT pc, ADDRINT ea, UINT32 size, UINT32 type)
+{
+    if (batch.refs.size() == batch.num) batch.refs.resize(2 * batch.num + 1024);
+    MEMREF &ref = batch.refs[batch.num++];
+    ref.pc = pc;
+    ref.ea = ea;
+    ref.size = size;
+    ref.type = type;
+}
+
+/* ReplayPartition - split the references of job among the shard workers. */
+/* a reference reaching into lines of other workers gets a crossing id,   */
+/* ids grow with the chunk and the position in it.                        */
+LOCALFUN VOID ReplayPartition(REPLAY_JOB *job, THREADID tid)
+{
+    const UINT32 mask = ReplayShardNum - 1;
+    const UINT32 kind = ReplayFiltered ? REPLAY_REF_L2 : REPLAY_REF_CACHE;
+    UINT64 id = (UINT64)job->chunk << 32;
+    job->shards.resize(ReplayShardNum);
+    for (UINT32 w = 0; w < ReplayShardNum; w++)
+    {
+        job->shards[w].tid = tid;
+        job->shards[w].num = 0;
+    }
+
+    for (const MEMREF *ref = job->refs.data(), *end = ref + job->num; ref != end; ++ref)
+    {
+        const ADDRINT unit = ref->ea >> ReplayShardShift;
+        const ADDRINT last = ref->type == MEMREF_IFETCH ? unit : (ref->ea + ref->size - 1) >> ReplayShardShift;
+        const UINT32 owner = unit & mask;
+        UINT64 waiters = 0;
+        for (ADDRINT u = unit + 1; u <= last && u - unit <= mask; u++) waiters |= 1ULL << (u & mask);
+        waiters &= ~(1ULL << owner);
+        if (CACHESIM_unlikely(waiters != 0))
+        {
+            ++ id;
+            for (UINT32 w = 0; w < ReplayShardNum; w++)
+            {
+                if (waiters & (1ULL << w)) ReplayPut(job->shards[w], id, owner, 0, REPLAY_REF_WAIT);
+            }
+            ReplayPut(job->shards[owner], id, waiters, 0, REPLAY_REF_CROSS);
+        }
+        ReplayPut(job->shards[owner], ref->pc, ref->ea, ref->size, ref->type | kind);
+        if (ReplayTlbShards)
+        {
+            const UINT32 w = ReplayShardNum - 1 - (GETPAGE(ref->ea) & (ReplayTlbShards - 1));
+            ReplayPut(job->shards[w], ref->pc, ref->ea, ref->size, ref->type | REPLAY_REF_TLB);
+        }
+    }
+}
+
+/* ReplayDecoderRun - the decoder threads */
+LOCALFUN VOID *ReplayDecoderRun(VOID *arg)
+{
+    REPLAY_DECODER *decoder = (REPLAY_DECODER*) arg;
+    for (UINT32 c = decoder->First; c < ReplayChunks && !ReplayExiting; c += ReplayDecoderNum)
+    {
+        REPLAY_JOB *job;
+        while (!decoder->Free.pop(job))
+        {
+            if (ReplayExiting) return NULL;
+            PIN_Yield();
+        }
+        job->chunk = c;
+        job->valid = ReplayDecode(decoder->Reader, decoder->Decoder, c, job);
+        if (job->valid && ReplayShardNum > 1) ReplayPartition(job, decoder->Reader.Index[c].tid);
+        while (!decoder->Full.push(job))
+        {
+            if (ReplayExiting) return NULL;
+            PIN_Yield();
+        }
+    }
+    return NULL;
+}
+
+/* ===================================================================== */
+/* Simulation */
+/* ===================================================================== */
+/* ReplayRefs - run the references of a chunk of thread tid through the */
+/* hierarchy, behind the same line filter as -memsim.                    */
+LOCALFUN VOID ReplayRefs(const MEMREF *ref, UINT64 num, THREADID tid)
+{
+    UINT32 ishift = 0, dshift = 0;
+    const BOOL ifilter = InsFetchFilter(&ishift);
+    const BOOL dfilter = DataRefFilter(&dshift);
+
+    for (const MEMREF *end = ref + num; ref != end; ++ref)
+    {
+        switch (ref->type)
+        {
+            case MEMREF_IFETCH:
+                 if (!ifilter || InsFetchNewLine(ref->ea, ishift, tid)) InsFetchRef(ref->ea, tid);
+                 break;
+            case MEMREF_LOAD:
+                 if (!dfilter || DataRefNewLine(ref->ea, ref->size, dshift, 0, tid)) 
+                     DataFetchRef(ref->pc, ref->ea, ref->size, 0, 0, tid);
+                 break;
+            case MEMREF_STORE:
+                 if (!dfilter || DataRefNewLine(ref->ea, ref->size, dshift, 1, tid)) 
+                     DataWriteRef(ref->pc, ref->ea, ref->size, 0, 0, tid);
+                 break;
+            default:
+                 break;
+        }
+    }
+}
+
+/* ReplayL2Refs - run the references of a chunk of a filtered trace */
+LOCALFUN VOID ReplayL2Refs(const MEMREF *ref, UINT64 num, THREADID tid)
+{
+    for (const MEMREF *end = ref + num; ref != end; ++ref)
+    {
+        CacheL2Ref(ref->pc, ref->ea, ref->size, ref->type == MEMREF_STORE, tid);
+    }
+}
+
+/* ReplayShardRef - simulate a batched reference as thread tid */
+LOCALFUN inline VOID ReplayShardRef(const MEMREF *ref, THREADID tid)
+{
+    const UINT32 type = ref->type & REPLAY_REF_TYPE;
+    switch (ref->type & ~REPLAY_REF_TYPE)
+    {
+        case REPLAY_REF_CACHE:
+             CacheSideRef(ref->pc, ref->ea, ref->size, type, tid);
+             break;
+        case REPLAY_REF_TLB:
+             TlbSideRef(ref->ea, type, tid);
+             break;
+        case REPLAY_REF_L2:
+             CacheL2Ref(ref->pc, ref->ea, ref->size, type == MEMREF_STORE, tid);
+             break;
+        default:
+             break;
+    }
+}
+
+/* ReplayShardRefs - simulate the batch of worker for thread tid. at a */
+/* crossing the waiting workers stop before their next reference until */
+/* the owner simulated it, the owner starts once all of them got there. */
+LOCALFUN VOID ReplayShardRefs(REPLAY_WORKER *worker, const MEMREF *ref, UINT64 num, THREADID tid)
+{
+    for (const MEMREF *end = ref + num; ref != end; ++ref)
+    {
+        if (CACHESIM_likely(!(ref->type & (REPLAY_REF_WAIT | REPLAY_REF_CROSS))))
+        {
+            ReplayShardRef(ref, tid);
+        }
+        else if (ref->type == REPLAY_REF_WAIT)
+        {
+            const REPLAY_WORKER &owner = ReplayWorkers[ref->ea];
+            __atomic_store_n(&worker->Reached, ref->pc, __ATOMIC_RELEASE);
+            while (__atomic_load_n(&owner.Done, __ATOMIC_ACQUIRE) < ref->pc) PIN_Yield();
+        }
+        else
+        {
+            const UINT64 id = ref->pc;
+            for (UINT32 w = 0; w < ReplayShardNum; w++)
+            {
+                if (!(ref->ea & (1ULL << w))) continue;
+                while (__atomic_load_n(&ReplayWorkers[w].Reached, __ATOMIC_ACQUIRE) < id) PIN_Yield();
+            }
+            ReplayShardRef(++ref, tid);
+            __atomic_store_n(&worker->Done, id, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/* ReplayWorkerRun - the shard workers. shard w of thread t simulates */
+/* as thread t + w * threads.                                           */
+LOCALFUN VOID *ReplayWorkerRun(VOID *arg)
+{
+    REPLAY_WORKER *worker = (REPLAY_WORKER*) arg;
+    for (;;)
+    {
+        REPLAY_JOB *job;
+        while (!worker->Jobs.pop(job)) PIN_Yield();
+        if (!job) return NULL;
+
+        const REPLAY_BATCH &batch = job->shards[worker->Index];
+        ReplayShardRefs(worker, batch.refs.data(), batch.num, batch.tid + worker->Index * ReplayThreads);
+        __atomic_sub_fetch(&job->pending, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* ReplayRecycle - hand the jobs all the workers are done with back to */
+/* their decoders, in the order of the chunks.                           */
+LOCALFUN VOID ReplayRecycle()
+{
+    while (!ReplayInflight.empty() && !__atomic_load_n(&ReplayInflight.front()->pending, __ATOMIC_ACQUIRE))
+    {
+        REPLAY_JOB *job = ReplayInflight.front();
+        ReplayDecoders[job->chunk % ReplayDecoderNum].Free.push(job);
+        ReplayInflight.pop_front();
+    }
+}
+
+/* ReplayDispatch - queue a partitioned job on every worker */
+LOCALFUN VOID ReplayDispatch(REPLAY_JOB *job)
+{
+    job->pending = ReplayShardNum;
+    for (UINT32 w = 0; w < ReplayShardNum; w++)
+    {
+        while (!ReplayWorkers[w].Jobs.push(job)) 
+        {
+            ReplayRecycle();
+            PIN_Yield();
+        }
+    }
+    ReplayInflight.push_back(job);
+    ReplayRecycle();
+}
+
+/* ReplayHash/ReplayCount - the state hashes of a run of segment k, and */
+/* its counters at boundary b, ReplayFixup + 1 for the end.              */
+LOCALFUN UINT64 *ReplayHash(UINT32 k, UINT32 run)
+{
+    return ReplayHashes + (k * REPLAY_RUNS + run) * (ReplayFixup + 1);
+}
+
+LOCALFUN UINT64 *ReplayCount(UINT32 k, UINT32 run, UINT32 b)
+{
+    return ReplayCounts + ((k * REPLAY_RUNS + run) * (ReplayFixup + 2) + b) * (UINT64)ReplayCounterNum;
+}
+
+/* ReplayBoundary - called before chunk c of a segment run and after its  */
+/* last one. counting starts at the segment, the counters and the state are */
+/* taken at the first boundaries. false once a fixup replay met the state  */
+/* of the reference run, the rest of the reference run is exact.           */
+LOCALFUN BOOL ReplayBoundary(UINT32 c)
+{
+    REPLAY_SEGMENT &seg = ReplaySegments[ReplaySegment];
+    if (c < seg.first) return true;
+    const UINT32 b = c - seg.first;
+    if (!b) SimWait->setwarm(false);
+
+    if (b <= ReplayFixup)
+    {
+        CacheCounters(ReplayCount(ReplaySegment, ReplayRun, b), ReplayThreads);
+        if (ReplayFixup)
+        {
+            const UINT64 hash = CacheStateHash();
+            ReplayHash(ReplaySegment, ReplayRun)[b] = hash;
+            if (ReplayRun == REPLAY_RUN_FIXUP && hash == ReplayHash(ReplaySegment, REPLAY_RUN_REF)[b])
+            {
+                seg.converged = b;
+                return false;
+            }
+        }
+    }
+    if (c == seg.last) CacheCounters(ReplayCount(ReplaySegment, ReplayRun, ReplayFixup + 1), ReplayThreads);
+    return true;
+}
+
+/* Replay - simulate the chunks from ReplayFirstChunk on, false on a bad */
+/* chunk. the references of the warmup are not counted.                  */
+LOCALFUN BOOL Replay(const char *name, const TRACE_READER &trace, UINT64 *refs)
+{
+    UINT64 icount = 0;
+    *refs = 0;
+
+    for (UINT32 c = ReplayFirstChunk; ; c++)
+    {
+        if (ReplaySegments && !ReplayBoundary(c)) break;
+        if (c == ReplayChunks) break;
+
+        REPLAY_DECODER &decoder = ReplayDecoders[(c - ReplayFirstChunk) % ReplayDecoderNum];
+        REPLAY_JOB *job;
+        while (!decoder.Full.pop(job)) 
+        {
+            ReplayRecycle();
+            PIN_Yield();
+        }
+        ASSERTX(job->chunk == c);
+
+        const TRACE_INDEX &chunk = trace.Index[c];
+        if (!job->valid)
+        {
+            MACHINESIM_PRINT("Error: chunk %u of %s is corrupt\n", c, name);
+            return false;
+        }
+        if (SimWait->dostats()) *refs += job->num;
+        SweepPush(job->refs.data(), job->num, ReplayFiltered, chunk.tid);
+        if (ReplayShardNum > 1) ReplayDispatch(job);
+        else if (ReplayFiltered) ReplayL2Refs(job->refs.data(), job->num, chunk.tid);
+        else ReplayRefs(job->refs.data(), job->num, chunk.tid);
+
+        /* the instructions of the chunk, simulated or not */
+        SimTheOne->get_thread_icount(chunk.tid)->icount += chunk.count;
+        icount += chunk.count;
+        /* every thread is simulated on this one */
+        CacheCheckpointAt(icount, 1);
+        if (ReplayShardNum == 1) decoder.Free.push(job);
+    }
+    return true;
+}
+
+/* ===================================================================== */
+/* Set Sharding */
+/* ===================================================================== */
+/* ReplayShardInit - start the shard workers, as many of the -shards as */
+/* the geometry of the hierarchy and the threads of the trace allow.     */
+LOCALFUN VOID ReplayShardInit(const TRACE_READER &trace)
+{
+    UINT32 shift, setbits, tlbsets;
+    if (ReplayShardNum <= 1) return;
+    if (!CacheShardable(&shift, &setbits, &tlbsets))
+    {
+        MACHINESIM_PRINT("Warning: -shards needs LRU, PLRU, FIFO or SRRIP sets, no -stackdist, no -opt and no -ckptsave, "
+                         "replaying on one thread\n");
+        ReplayShardNum = 1;
+        return;
+    }
+
+    while (ReplayShardNum > 1 && (ReplayShardNum > (1U << std::min(setbits, 6U)) || 
+                                  ReplayShardNum * ReplayThreads > MAX_CACHE_THREAD)) ReplayShardNum >>= 1;
+    if (ReplayShardNum <= 1)
+    {
+        MACHINESIM_PRINT("Warning: the sets or the %u simulated threads leave no room for -shards, "
+                         "replaying on one thread\n", MAX_CACHE_THREAD);
+        return;
+    }
+    ReplayShardShift = shift;
+    ReplayTlbShards = ReplayFiltered ? 0 : std::min(ReplayShardNum, tlbsets);
+    MACHINESIM_PRINT("replaying on %u set shards, %u of them for the tlbs\n", ReplayShardNum, ReplayTlbShards);
+
+    for (UINT32 w = 1; w < ReplayShardNum; w++)
+    {
+        for (THREADID tid = 0; tid < ReplayThreads; tid++) CacheShareThread(tid + w * ReplayThreads, tid);
+    }
+    ReplayWorkers = SimRingsNew<REPLAY_WORKER>(ReplayShardNum);
+    for (UINT32 w = 0; w < ReplayShardNum; w++)
+    {
+        REPLAY_WORKER &worker = ReplayWorkers[w];
+        worker.Index = w;
+        pthread_create(&worker.Thread, NULL, ReplayWorkerRun, &worker);
+    }
+}
+
+/* ReplayShardFini - stop the shard workers once they simulated every */
+/* job and fold the counts of the shards into their threads.           */
+LOCALFUN VOID ReplayShardFini()
+{
+    if (!ReplayWorkers) return;
+    for (UINT32 w = 0; w < ReplayShardNum; w++)
+    {
+        while (!ReplayWorkers[w].Jobs.push(NULL)) PIN_Yield();
+    }
+    for (UINT32 w = 0; w < ReplayShardNum; w++) pthread_join(ReplayWorkers[w].Thread, NULL);
+    SimRingsDelete(ReplayWorkers, ReplayShardNum);
+    ReplayWorkers = NULL;
+    ReplayInflight.clear();
+
+    for (UINT32 w = 1; w < ReplayShardNum; w++)
+    {
+        for (THREADID tid = 0; tid < ReplayThreads; tid++) SimStats->fold(tid + w * ReplayThreads, tid);
+    }
+}
+
+/* ===================================================================== */
+/* Decoders */
+/* ===================================================================== */
+/* ReplayStart - start the decoders on chunks first ... last-1, every */
+/* decoder reads the trace through a file of its own.                  */
+LOCALFUN BOOL ReplayStart(const char *name, const TRACE_READER &trace, UINT32 first, UINT32 last)
+{
+    ReplayFirstChunk = first;
+    ReplayChunks = last;
+    ReplayExiting = false;
+    ReplayDecoders = SimRingsNew<REPLAY_DECODER>(ReplayDecoderNum);
+    for (UINT32 i = 0; i < ReplayDecoderNum; i++)
+    {
+        REPLAY_DECODER &decoder = ReplayDecoders[i];
+        decoder.First = first + i;
+        if (!decoder.Reader.Open(name, trace)) return false;
+        pthread_create(&decoder.Thread, NULL, ReplayDecoderRun, &decoder);
+    }
+    return true;
+}
+
+/* ReplayStop - stop the decoders, done or not */
+LOCALFUN VOID ReplayStop()
+{
+    ReplayExiting = true;
+    for (UINT32 i = 0; i < ReplayDecoderNum; i++) pthread_join(ReplayDecoders[i].Thread, NULL);
+    SimRingsDelete(ReplayDecoders, ReplayDecoderNum);
+    ReplayDecoders = NULL;
+}
+
+/* ===================================================================== */
+/* Time Segments */
+/* ===================================================================== */
+/* ReplayCkptName - the checkpoint of the end state of segment k written */
+/* by fixup pass pass.                                                   */
+LOCALFUN string ReplayCkptName(UINT32 k, UINT32 pass)
+{
+    return "replay." + decstr(ReplayPid) + "." + decstr(k) + "." + decstr(pass) + ".ckpt";
+}
+
+/* ReplaySegmentRun - replay a run of segment k in this process, from the */
+/* end state of segment k-1 for a fixup replay.                           */
+LOCALFUN BOOL ReplaySegmentRun(const char *name, const TRACE_READER &trace, UINT32 k, UINT32 run, UINT32 pass)
+{
+    REPLAY_SEGMENT &seg = ReplaySegments[k];
+    ReplaySegment = k;
+    ReplayRun = run;
+    if (run == REPLAY_RUN_FIXUP) CacheStateLoad(ReplayCkptName(k - 1, ReplaySegments[k - 1].pass));
+
+    const UINT32 first = run == REPLAY_RUN_REF ? seg.warm : seg.first;
+    SimWait->setwarm(first < seg.first);
+    UINT64 refs = 0;
+    BOOL ok = ReplayStart(name, trace, first, seg.last) && Replay(name, trace, &refs);
+    ReplayStop();
+
+    /* the next segment replays from the end state, unless this one met its reference run */
+    if (ok && ReplayFixup && k + 1 < ReplaySegmentNum && seg.converged == REPLAY_DIVERGED) 
+        CacheStateSave(ReplayCkptName(k, pass), trace.Index[seg.last - 1].icount);
+    if (run == REPLAY_RUN_REF) seg.refs = refs;
+    return ok;
+}
+
+/* ReplayFork - replay the runs of the segments marked in todo, each in a */
+/* process of its own, false if one of them failed.                        */
+LOCALFUN BOOL ReplayFork(const char *name, const TRACE_READER &trace, const std::vector<BOOL> &todo, UINT32 run, UINT32 pass)
+{
+    std::vector<pid_t> pids(ReplaySegmentNum, 0);
+    BOOL ok = true;
+    fflush(stdout);
+    fflush(stderr);
+    for (UINT32 k = 0; k < ReplaySegmentNum; k++)
+    {
+        if (!todo[k]) continue;
+        ReplaySegments[k].converged = REPLAY_DIVERGED;
+        ReplaySegments[k].ok = false;
+        pids[k] = fork();
+        if (pids[k] == 0)
+        {
+            ReplaySegments[k].ok = ReplaySegmentRun(name, trace, k, run, pass);
+            fflush(stdout);
+            _exit(ReplaySegments[k].ok ? 0 : 1);
+        }
+        if (pids[k] < 0) ok = false;
+    }
+    for (UINT32 k = 0; k < ReplaySegmentNum; k++)
+    {
+        int status;
+        if (pids[k] <= 0) continue;
+        waitpid(pids[k], &status, 0);
+        ok = ok && WIFEXITED(status) && !WEXITSTATUS(status) && ReplaySegments[k].ok;
+    }
+    return ok;
+}
+
+/* ReplayMerge - make the fixup replay of segment k its reference run. a */
+/* replay that met the reference run at b only replaces the counters up  */
+/* to b, the end state stays the one of the reference run.               */
+LOCALFUN VOID ReplayMerge(UINT32 k, UINT32 pass)
+{
+    REPLAY_SEGMENT &seg = ReplaySegments[k];
+    const UINT32 n = ReplayCounterNum, b = seg.converged;
+    const UINT32 last = std::min(ReplayFixup, seg.last - seg.first);
+    UINT64 *hash = ReplayHash(k, REPLAY_RUN_REF), *rehash = ReplayHash(k, REPLAY_RUN_FIXUP);
+    UINT64 *base = ReplayCount(k, REPLAY_RUN_REF, 0), *rebase = ReplayCount(k, REPLAY_RUN_FIXUP, 0);
+
+    if (b == REPLAY_DIVERGED)
+    {
+        /* the replay ran to the end, its end state is the one to go on from */
+        memcpy(hash, rehash, sizeof(UINT64) * (ReplayFixup + 1));
+        memcpy(base, rebase, sizeof(UINT64) * n * (ReplayFixup + 2));
+        seg.pass = pass;
+        return;
+    }
+
+    /* the counters from b on are the ones of the reference run, moved by */
+    /* what the replay counted up to b                                    */
+    std::vector<UINT64> delta(n);
+    const UINT64 *at = ReplayCount(k, REPLAY_RUN_FIXUP, b), *was = ReplayCount(k, REPLAY_RUN_REF, b);
+    for (UINT32 i = 0; i < n; i++) delta[i] = (at[i] - rebase[i]) - (was[i] - base[i]);
+    for (UINT32 j = b + 1; j <= ReplayFixup + 1; j++)
+    {
+        if (j <= ReplayFixup && j > last) continue;
+        UINT64 *count = ReplayCount(k, REPLAY_RUN_REF, j);
+        for (UINT32 i = 0; i < n; i++) count[i] += delta[i];
+    }
+    for (UINT32 j = 1; j <= b; j++)
+    {
+        UINT64 *count = ReplayCount(k, REPLAY_RUN_REF, j);
+        const UINT64 *recount = ReplayCount(k, REPLAY_RUN_FIXUP, j);
+        for (UINT32 i = 0; i < n; i++) count[i] = recount[i] - rebase[i] + base[i];
+    }
+    memcpy(hash, rehash, sizeof(UINT64) * b);
+}
+
+/* ReplayTimeSegments - replay the segments in parallel, and fix them up */
+/* until every segment started from the end state of the one before.     */
+LOCALFUN BOOL ReplayTimeSegments(const char *name, const TRACE_READER &trace, UINT64 *refs)
+{
+    /* cut the trace into segments of about the same number of instructions */
+    UINT64 total = 0, icount = 0;
+    for (UINT32 c = 0; c < trace.Chunks(); c++) total += trace.Index[c].count;
+    std::vector<UINT32> firsts;
+    for (UINT32 c = 0; c < trace.Chunks(); c++)
+    {
+        if (firsts.size() < ReplaySegmentNum && icount >= firsts.size() * (total / ReplaySegmentNum)) firsts.push_back(c);
+        icount += trace.Index[c].count;
+    }
+    ReplaySegmentNum = firsts.size();
+
+    /* the counters of both runs of every segment, in memory shared with the replays */
+    ReplayCounterNum = CacheCounters(NULL, ReplayThreads);
+    const UINT64 segsize = sizeof(REPLAY_SEGMENT) * ReplaySegmentNum;
+    const UINT64 hashsize = sizeof(UINT64) * ReplaySegmentNum * REPLAY_RUNS * (ReplayFixup + 1);
+    const UINT64 countsize = sizeof(UINT64) * ReplaySegmentNum * REPLAY_RUNS * (ReplayFixup + 2) * ReplayCounterNum;
+    UINT8 *shared = (UINT8*) mmap(NULL, segsize + hashsize + countsize, PROT_READ | PROT_WRITE, 
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == (UINT8*) MAP_FAILED)
+    {
+        MACHINESIM_PRINT("Error: no memory for %u segments\n", ReplaySegmentNum);
+        return false;
+    }
+    ReplaySegments = (REPLAY_SEGMENT*) shared;
+    ReplayHashes = (UINT64*) (shared + segsize);
+    ReplayCounts = (UINT64*) (shared + segsize + hashsize);
+    ReplayPid = PIN_GetPid();
+
+    for (UINT32 k = 0; k < ReplaySegmentNum; k++)
+    {
+        REPLAY_SEGMENT &seg = ReplaySegments[k];
+        seg.first = firsts[k];
+        seg.last = k + 1 < ReplaySegmentNum ? firsts[k + 1] : trace.Chunks();
+        seg.pass = 0;
+        /* the warmup takes whole chunks until it has the instructions */
+        UINT64 warm = 0;
+        for (seg.warm = seg.first; seg.warm > 0 && warm < ReplayWarmup; seg.warm--) warm += trace.Index[seg.warm - 1].count;
+    }
+    MACHINESIM_PRINT("replaying %u time segments of %llu instructions, %llu warmup instructions\n", 
+                     ReplaySegmentNum, (unsigned long long)(total / ReplaySegmentNum), (unsigned long long)ReplayWarmup);
+
+    std::vector<BOOL> todo(ReplaySegmentNum, true);
+    BOOL ok = ReplayFork(name, trace, todo, REPLAY_RUN_REF, 0);
+
+    /* fixup passes, a segment is replayed once the end state before it changed */
+    UINT32 pass = 0, replays = 0, met = 0;
+    todo[0] = false;
+    while (ok && ReplayFixup && std::find(todo.begin(), todo.end(), true) != todo.end())
+    {
+        ok = ReplayFork(name, trace, todo, REPLAY_RUN_FIXUP, ++pass);
+        for (UINT32 k = ReplaySegmentNum; ok && k-- > 1; )
+        {
+            if (!todo[k]) continue;
+            const BOOL diverged = ReplaySegments[k].converged == REPLAY_DIVERGED;
+            ReplayMerge(k, pass);
+            todo[k] = false;
+            if (k + 1 < ReplaySegmentNum && diverged) todo[k + 1] = true;
+            replays ++;
+            met += !diverged;
+        }
+    }
+    if (ReplayFixup) MACHINESIM_PRINT("%u fixup passes replayed %u segments, %u met their first run\n", pass, replays, met);
+
+    /* add up the counters of the segments from their start */
+    std::vector<UINT64> counts(ReplayCounterNum, 0);
+    *refs = 0;
+    for (UINT32 k = 0; ok && k < ReplaySegmentNum; k++)
+    {
+        const UINT64 *end = ReplayCount(k, REPLAY_RUN_REF, ReplayFixup + 1), *start = ReplayCount(k, REPLAY_RUN_REF, 0);
+        for (UINT32 i = 0; i < ReplayCounterNum; i++) counts[i] += end[i] - start[i];
+        *refs += ReplaySegments[k].refs;
+    }
+    /* the instruction counts of the threads are counters as well */
+    if (ok) CacheCountersAdd(counts.data(), ReplayThreads);
+
+    for (UINT32 k = 0; k + 1 < ReplaySegmentNum; k++)
+    {
+        for (UINT32 p = 0; p <= pass; p++) unlink(ReplayCkptName(k, p).c_str());
+    }
+    munmap(shared, segsize + hashsize + countsize);
+    ReplaySegments = NULL;
+    return ok;
+}
+
+/* ===================================================================== */
+/* Options */
+/* ===================================================================== */
+LOCALFUN INT32 Usage()
+{
+    LOG("usage: machinesim-replay [options] <trace>\n");
+    LOG("-c\t\t\t config.xml of the cache and tlb hierarchy (default config.xml)\n");
+    LOG("-format\t\t\t champsim or pcea for a foreign trace (default a trace of -tc)\n");
+    LOG("-r\t\t\t cache replacement policy of the levels config.xml leaves open (default LRU)\n");
+    LOG("-stackdist\t\t\t Print LRU miss ratio curves of every level for all sizes\n");
+    LOG("-opt\t\t\t Count the hits and misses of Belady's optimal replacement at every level\n");
+    LOG("-optwindow\t\t\t References per set the optimal replacement looks back, times the associativity (default 8)\n");
+    LOG("-l3sample\t\t\t Simulate 1 out of N sets of the L3, with error bounds\n");
+    LOG("-l3samplehash\t\t\t Pick the sampled L3 sets by hash\n");
+    LOG("-l1filter 0|1\t\t\t Count accesses to the last L1 line as hits inline (default on)\n");
+    LOG("-ckptsave/-ckptat\t\t Save the cache and tlb state at an instruction count\n");
+    LOG("-ckptload\t\t\t Start from the cache and tlb state of a checkpoint\n");
+    LOG("-decoders\t\t\t Threads reading and decoding the trace (default 2)\n");
+    LOG("-shards\t\t\t Threads simulating the sets of every level, a power of 2 (default 1)\n");
+    LOG("-sweep\t\t\t config.xml of another hierarchy replayed on a thread of its own, a report for each\n");
+    LOG("-segments\t\t\t Processes replaying time segments of the trace (default 1)\n");
+    LOG("-warmup\t\t\t Instructions warming the caches before a time segment (default 10000000)\n");
+    LOG("-fixup\t\t\t Replay segments from the state before them, meeting the first run within N chunks\n");
+    return 2;
+}
+
+/* InitSimOpts - the options of the command line, NULL if they are bad, */
+/* the name of the trace otherwise.                                      */
+LOCALFUN const char *InitSimOpts(int argc, char *argv[])
+{
+    string config = "config.xml";
+    const char *trace = NULL;
+    SimOpts->set_replacepolicy("LRU");
+    /* no worker pool and no buffering, the filter decides as with -memsim */
+    SimOpts->set_mem_simul(true);
+
+    for (int i = 1; i < argc; i++)
+    {
+        const string opt = argv[i];
+        const BOOL more = i + 1 < argc;
+        if (opt == "-stackdist")                SimOpts->set_stackdist(true);
+        else if (opt == "-opt")                 SimOpts->set_opt(true);
+        else if (opt == "-optwindow" && more)   SimOpts->set_opt_window(strtoul(argv[++i], NULL, 0));
+        else if (opt == "-l3samplehash")        SimOpts->set_l3_sample_hash(true);
+        else if (opt == "-c" && more)           config = argv[++i];
+        else if (opt == "-format" && more)
+        {
+            const string format = argv[++i];
+            if (format == "champsim") ReplayFormat = TRACE_FORMAT_CHAMPSIM;
+            else if (format == "pcea") ReplayFormat = TRACE_FORMAT_PCEA;
+            else return NULL;
+        }
+        else if (opt == "-r" && more)           SimOpts->set_replacepolicy(argv[++i]);
+        else if (opt == "-l3sample" && more)    SimOpts->set_l3_sample(strtoul(argv[++i], NULL, 0));
+        else if (opt == "-l1filter" && more)    SimOpts->set_l1_filter(strtoul(argv[++i], NULL, 0) != 0);
+        else if (opt == "-ckptsave" && more)    SimOpts->set_ckpt_save(argv[++i]);
+        else if (opt == "-ckptat" && more)      SimOpts->set_ckpt_at(strtoull(argv[++i], NULL, 0));
+        else if (opt == "-ckptload" && more)    SimOpts->set_ckpt_load(argv[++i]);
+        else if (opt == "-sweep" && more)       SimOpts->add_sweep(argv[++i]);
+        else if (opt == "-decoders" && more)    ReplayDecoderNum = std::max(1UL, strtoul(argv[++i], NULL, 0));
+        else if (opt == "-shards" && more)      ReplayShardNum = 1U << FloorLog2(std::max(1UL, strtoul(argv[++i], NULL, 0)));
+        else if (opt == "-segments" && more)    ReplaySegmentNum = std::max(1UL, strtoul(argv[++i], NULL, 0));
+        else if (opt == "-warmup" && more)      ReplayWarmup = strtoull(argv[++i], NULL, 0);
+        else if (opt == "-fixup" && more)       ReplayFixup = strtoul(argv[++i], NULL, 0);
+        else if (opt[0] != '-' && !trace)       trace = argv[i];
+        else return NULL;
+    }
+    if (!trace) return NULL;
+
+    FILE *file = fopen(config.c_str(), "r");
+    if (!file)
+    {
+        MACHINESIM_PRINT("Error: could not read the configuration %s\n", config.c_str());
+        return NULL;
+    }
+    fclose(file);
+    SimOpts->set_xml_parser(new ParseXML());
+    SimOpts->get_xml_parser()->parse(config.c_str());
+    return trace;
+}
+
+/* ===================================================================== */
+/* Main */
+/* ===================================================================== */
+int main(int argc, char *argv[])
+{
+    SimStats   = SIMSTATS::get_singleton();
+    SimXlator  = SIMXLATOR::get_singleton();
+    SimWait    = SIMPARAMS::get_singleton();
+    SimOpts    = SIMOPTS::get_singleton();
+    SimTheOne  = SIMGLOBALS::get_singleton();
+
+    const char *name = InitSimOpts(argc, argv);
+    if (!name) return Usage();
+
+    TRACE_READER trace;
+    if (!trace.Open(name, ReplayFormat))
+    {
+        MACHINESIM_PRINT("Error: %s is not a trace\n", name);
+        return 1;
+    }
+    if (trace.Truncated) 
+        MACHINESIM_PRINT("Warning: %s %s\n", name, ReplayFormat ? "ends in a partial record" : "has no index, it was cut short");
+    if (trace.Import.Malformed) 
+        MACHINESIM_PRINT("Warning: %s has %llu malformed lines, skipped\n", name, (unsigned long long)trace.Import.Malformed);
+    for (UINT32 c = 0; c < trace.Chunks(); c++)
+    {
+        if (trace.Index[c].tid < MAX_CACHE_THREAD) continue;
+        MACHINESIM_PRINT("Error: thread %u of %s is beyond the %u simulated threads\n", 
+                         trace.Index[c].tid, name, MAX_CACHE_THREAD);
+        return 1;
+    }
+    ReplayFiltered = (trace.Header.flags & TRACE_FILTERED) != 0;
+    if (ReplayFiltered)
+        MACHINESIM_PRINT("%s is filtered by %u byte L1 caches, replaying from the L2\n", name, trace.Header.filtersize);
+
+    ReplayThreads = 1;
+    for (UINT32 c = 0; c < trace.Chunks(); c++) ReplayThreads = std::max(ReplayThreads, trace.Index[c].tid + 1);
+    if (ReplaySegmentNum > 1 && (SimOpts->get_stackdist() || SimOpts->get_opt() || SimOpts->get_l3_sample() > 1 || 
+                                 !SimOpts->get_ckpt_save().empty() || !SimOpts->get_sweep().empty()))
+    {
+        MACHINESIM_PRINT("Warning: -segments can not add up -stackdist, -opt, -l3sample, -ckptsave or -sweep, replaying as one segment\n");
+        ReplaySegmentNum = 1;
+    }
+    if (ReplaySegmentNum > 1 && ReplayShardNum > 1)
+    {
+        MACHINESIM_PRINT("Warning: -segments replays every segment on one thread, ignoring -shards\n");
+        ReplayShardNum = 1;
+    }
+
+    MachineSimCacheTLBModuleInit();
+    /* a set of every thread is simulated on one thread, the L3 evicts */
+    /* from the private caches of all of them on the spot.              */
+    CacheDeferUl3(NULL, NULL);
+    MachineSimSweepModuleInit();
+    ReplayShardInit(trace);
+    clock_gettime(CLOCK_MONOTONIC, SimTheOne->get_time_init());
+
+    UINT64 refs = 0;
+    BOOL ok;
+    if (ReplaySegmentNum > 1) ok = ReplayTimeSegments(name, trace, &refs);
+    else
+    {
+        ok = ReplayStart(name, trace, 0, trace.Chunks()) && Replay(name, trace, &refs);
+        ReplayShardFini();
+        ReplayStop();
+    }
+    MachineSimSweepModuleExit();
+    MachineSimSweepModuleFini();
+
+    clock_gettime(CLOCK_MONOTONIC, SimTheOne->get_time_fini());
+    const struct timespec *tinit = SimTheOne->get_time_init(), *tfini = SimTheOne->get_time_fini();
+    const double seconds = (tfini->tv_sec - tinit->tv_sec) + (tfini->tv_nsec - tinit->tv_nsec) * NANO;
+    MACHINESIM_FPRINT(stdout, "replayed %llu instructions, %llu references in %.2f seconds (%.1f M references/s)\n",
+                      (unsigned long long)SimTheOne->get_global_icount(), (unsigned long long)refs, 
+                      seconds, seconds > 0 ? refs / seconds / 1e6 : 0.0);
+
+    MachineSimCacheTLBModuleFini();
+    return ok ? 0 : 1;
+}
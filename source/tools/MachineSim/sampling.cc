@@ -0,0 +1,288 @@
+/*BEGIN_LEGAL
+Intel Open Source License
+
+Copyright (c) 2002-2011 Intel CorpORAtion. All rights reserved.
+
+Written by Xin Tong, University of Toronto.
+
+Redistribution and use in source and binary fORMs, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary fORM must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel CorpORAtion nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+
+/* ===================================================================== */
+/* This file contains the sampling controllers of the PIN tool          */
+/* ===================================================================== */
+
+#include "pin.H"
+#include "instlib.H"
+#include "utils.hh"
+#include <vector>
+#include <cmath>
+
+using namespace INSTLIB;
+
+/* ===================================================================== */
+/* Globals variables */
+/* ===================================================================== */
+/// the run is cut into periods by the -uniform_period and -uniform_length 
+/// knobs of the uniform controller. each period ends in a detailed window,
+/// the only place anything is counted. the rest of the period the caches
+/// are functionally warmed, i.e. simulated without counting, except for 
+/// the first -sampleskip instructions after a window which are not 
+/// simulated at all. with -membuf the phases apply to the buffers as they
+/// are drained, so the window boundaries are off by up to a buffer.
+///
+/// alternatively the -regions:in file of the regions controller lists the
+/// regions to simulate, e.g. the simpoints of PinPoints, with a weight 
+/// each. the run is fast-forwarded without simulation up to the warmup 
+/// (-regions:warmup) and prolog of a region, which warm the caches, and
+/// the region itself is counted. the estimate of the whole program is 
+/// the weighted mean of the regions.
+typedef enum
+{
+   SAMPLE_WARM=0,
+   SAMPLE_DETAIL,
+   SAMPLE_SKIP
+} SAMPLE_PHASE;
+
+/// SAMPLE_WINDOW - what a detailed window or region counted.
+typedef struct
+{
+   UINT32 id;
+   double weight;
+   UINT64 icount;
+   UINT64 accesses[CACHE_COUNTED_LEVELS];
+   UINT64 misses[CACHE_COUNTED_LEVELS];
+} SAMPLE_WINDOW;
+
+LOCALVAR CONTROL_UNIFORM SampleControl;
+LOCALVAR CONTROL_IREGIONS RegionControl;
+LOCALVAR BOOL RegionActive = false;
+LOCALVAR ALARM_ICOUNT SampleSkipAlarm;
+LOCALVAR PIN_MUTEX SampleLock;
+LOCALVAR SAMPLE_PHASE SamplePhase = SAMPLE_WARM;
+LOCALVAR BOOL SampleActive = false;
+/* the counts at the start of the current window */
+LOCALVAR SAMPLE_WINDOW SampleStart;
+/* the mask of the levels the hierarchy has */
+LOCALVAR UINT32 SampleLevels = 0;
+LOCALVAR std::vector<SAMPLE_WINDOW> SampleWindows;
+
+LOCALCONST char *SampleLevelNames[CACHE_COUNTED_LEVELS] = { "L1I", "L1D", "L2", "L3",
+                                                            "ITLBM", "DTLBM", "ITLB1", "DTLB1", "UTLB2" };
+
+/* ===================================================================== */
+/* Phase Changes */
+/* ===================================================================== */
+/* SampleCounts - the instructions and cache counts so far */
+LOCALFUN VOID SampleCounts(SAMPLE_WINDOW *counts)
+{
+    counts->icount = SimTheOne->get_global_icount();
+    SampleLevels = CacheLevelCounts(counts->accesses, counts->misses);
+}
+
+/* SampleEnter - switch to a phase, the sample lock held */
+LOCALFUN VOID SampleEnter(SAMPLE_PHASE phase)
+{
+    SamplePhase = phase;
+    if (phase == SAMPLE_SKIP) SimWait->setwait(SIMPARAMS::WAIT_SAMPLING);
+    else SimWait->clrwait(SIMPARAMS::WAIT_SAMPLING);
+    SimWait->setwarm(phase == SAMPLE_WARM);
+}
+
+/* SampleSkipDone - the skipped instructions after a window have run */
+LOCALFUN VOID SampleSkipDone(VOID *v, CONTEXT *ctxt, VOID *ip, THREADID tid)
+{
+    PIN_MutexLock(&SampleLock);
+    if (SamplePhase == SAMPLE_SKIP) SampleEnter(SAMPLE_WARM);
+    PIN_MutexUnlock(&SampleLock);
+}
+
+/* SampleWindowBegin - a detailed window starts, the sample lock held */
+LOCALFUN VOID SampleWindowBegin()
+{
+    SampleEnter(SAMPLE_DETAIL);
+    SampleCounts(&SampleStart);
+}
+
+/* SampleWindowEnd - a detailed window stops, the sample lock held */
+LOCALFUN VOID SampleWindowEnd(UINT32 id, double weight)
+{
+    if (SamplePhase != SAMPLE_DETAIL) return;
+    SAMPLE_WINDOW window;
+    SampleCounts(&window);
+    window.id = id;
+    window.weight = weight;
+    window.icount -= SampleStart.icount;
+    for (UINT32 level = 0; level < CACHE_COUNTED_LEVELS; level++)
+    {
+        window.accesses[level] -= SampleStart.accesses[level];
+        window.misses[level] -= SampleStart.misses[level];
+    }
+    SampleWindows.push_back(window);
+}
+
+/* SampleHandler - a detailed window starts or stops */
+LOCALFUN VOID SampleHandler(CONTROL_EVENT ev, VOID *v, CONTEXT *ctxt, VOID *ip, THREADID tid)
+{
+    PIN_MutexLock(&SampleLock);
+    switch (ev)
+    {
+    case CONTROL_START:
+        SampleWindowBegin();
+        break;
+    case CONTROL_STOP:
+        SampleWindowEnd(SampleWindows.size(), 1.0);
+        if (SimOpts->get_sample_skip()) 
+        {
+            SampleEnter(SAMPLE_SKIP);
+            SampleSkipAlarm.SetAlarm(SimOpts->get_sample_skip(), SampleSkipDone, 0, PIN_CONTROLLER_ALL_TIDS);
+        }
+        else SampleEnter(SAMPLE_WARM);
+        break;
+    default:
+        break;
+    }
+    PIN_MutexUnlock(&SampleLock);
+}
+
+/* RegionHandler - a region, its warmup or its prolog starts or stops */
+LOCALFUN VOID RegionHandler(CONTROL_EVENT ev, VOID *v, CONTEXT *ctxt, VOID *ip, THREADID tid)
+{
+    PIN_MutexLock(&SampleLock);
+    const IREGION *region = RegionControl.LastTriggeredRegion(tid);
+    switch (ev)
+    {
+    case CONTROL_WARMUP_START:
+    case CONTROL_PROLOG_START:
+        SampleEnter(SAMPLE_WARM);
+        break;
+    case CONTROL_START:
+        SampleWindowBegin();
+        break;
+    case CONTROL_STOP:
+        SampleWindowEnd(region->GetRegionId(), region->GetWeightTimesHundredThousand() / 100000.0);
+        SampleEnter(SAMPLE_SKIP);
+        break;
+    default:
+        break;
+    }
+    PIN_MutexUnlock(&SampleLock);
+}
+
+/* ===================================================================== */
+/* Printing Routines */
+/* ===================================================================== */
+/// sampling_module_print - the counts of every window, then the MPKI of 
+/// every level estimated as the mean of the window MPKIs, with the 95% 
+/// confidence interval of the mean from the variance across the windows.
+/// a window without accesses to a level counts as an MPKI of 0.
+/// the means of regions are weighted by the region weights, which are no
+/// random sample, so they get no confidence interval.
+LOCALFUN VOID sampling_module_print()
+{
+    char name[128];
+    sprintf(name, "%s.%d", "sampling.out", PIN_GetPid());
+    std::ofstream out(name);
+
+    out << "#==================\n" << "# Sampling windows\n" << "#====================\n";
+    out << "# " << (RegionActive ? "region weight" : "window") << " instructions";
+    for (UINT32 level = 0; level < CACHE_COUNTED_LEVELS; level++) 
+        out << " " << SampleLevelNames[level] << "-accesses " << SampleLevelNames[level] << "-misses";
+    out << "\n";
+    for (UINT32 i = 0; i < SampleWindows.size(); i++)
+    {
+        out << SampleWindows[i].id;
+        if (RegionActive) out << " " << SampleWindows[i].weight;
+        out << " " << SampleWindows[i].icount;
+        for (UINT32 level = 0; level < CACHE_COUNTED_LEVELS; level++)
+            out << " " << SampleWindows[i].accesses[level] << " " << SampleWindows[i].misses[level];
+        out << "\n";
+    }
+
+    out << "#\n# " << SampleWindows.size() << (RegionActive ? " regions\n" : " windows\n");
+    for (UINT32 level = 0; level < CACHE_COUNTED_LEVELS; level++)
+    {
+        double n = 0, w = 0, sum = 0, sumsq = 0;
+        if (!(SampleLevels & (1U << level))) continue;
+        for (UINT32 i = 0; i < SampleWindows.size(); i++)
+        {
+            if (!SampleWindows[i].icount) continue;
+            const double mpki = 1000.0 * SampleWindows[i].misses[level] / SampleWindows[i].icount;
+            n += 1; w += SampleWindows[i].weight; 
+            sum += SampleWindows[i].weight * mpki; sumsq += mpki * mpki;
+        }
+        if (!n || !w) continue;
+        const double mean = sum / w;
+        out << "# " << ljstr(SampleLevelNames[level], 6) << " MPKI: " << fltstr(mean, 3, 10);
+        if (!RegionActive)
+        {
+            const double var = n > 1 ? (sumsq - n * mean * mean) / (n - 1) : 0;
+            const double ci = 1.96 * sqrt(std::max(var, 0.0) / n);
+            out << " +/- " << fltstr(ci, 3, 8) << " (95% CI";
+            if (mean > 0) out << ", " << fltstr(100.0 * ci / mean, 2, 6) << "% of the mean";
+            out << ")";
+        }
+        else out << " (weights sum to " << fltstr(w, 3, 5) << ")";
+        out << "\n";
+    }
+
+    /* done */
+    fprintf(stdout, "sampling stats dumped into %s.%d\n", "sampling.out", PIN_GetPid());
+    return;
+}
+
+/* ===================================================================== */
+/* Module initialization and finialization functions */
+/* ===================================================================== */
+void MachineSimSamplingModuleInit(void)
+{
+    /* sample only when the uniform or the regions controller knobs are given. */
+    BOOL uniform = SampleControl.CheckKnobs(SampleHandler, 0);
+    RegionActive = RegionControl.CheckKnobs(RegionHandler, 0);
+    if (!uniform && !RegionActive) return;
+    if (uniform && RegionActive)
+    {
+        MACHINESIM_PRINT("Error: -uniform_period and -regions:in can not be combined\n");
+        PIN_ExitProcess(1);
+    }
+    SampleActive = true;
+    PIN_MutexInit(&SampleLock);
+    SampleSkipAlarm.Activate();
+
+    /* the window MPKI needs the instruction counts of -instcount. warm the */
+    /* caches up to the first window, or fast-forward to the first region. */
+    SimOpts->set_ins_count(true);
+    /* the same line filter adds its hits to the stats only at the end. */
+    SimOpts->set_l1_filter(false);
+    SampleEnter(RegionActive ? SAMPLE_SKIP : SAMPLE_WARM);
+}
+
+void MachineSimSamplingModuleFini(void)
+{
+    if (!SampleActive) return;
+    sampling_module_print();
+    PIN_MutexFini(&SampleLock);
+}
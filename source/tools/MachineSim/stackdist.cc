@@ -0,0 +1,232 @@
+/*BEGIN_LEGAL
+Intel Open Source License
+
+Copyright (c) 2002-2011 Intel CorpORAtion. All rights reserved.
+
+Written by Xin Tong, University of Toronto.
+
+Redistribution and use in source and binary fORMs, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary fORM must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel CorpORAtion nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+
+/* ===================================================================== */
+/* This file contains the stack distance profiles of the PIN tool        */
+/* ===================================================================== */
+
+#include "stackdist.hh"
+#include <algorithm>
+
+/* ===================================================================== */
+/* Fully Associative Profile */
+/* ===================================================================== */
+STACKDIST_FA::STACKDIST_FA() : Tree(64*KILO + 1, 0), Now(0), Cold(0)
+{
+    memset(Hist, 0, sizeof(Hist));
+}
+
+VOID STACKDIST_FA::TreeAdd(UINT64 time, INT32 val)
+{
+    for (UINT64 i = time + 1; i < Tree.size(); i += i & -i) Tree[i] += val;
+}
+
+/// TreeSum - the number of marks at times [0, time].
+UINT64 STACKDIST_FA::TreeSum(UINT64 time) const
+{
+    UINT64 sum = 0;
+    for (UINT64 i = time + 1; i; i -= i & -i) sum += Tree[i];
+    return sum;
+}
+
+/// Compact - renumber the live lines 0 ... n-1 in the order of their last
+/// reference and rebuild the tree, with room for as many references again.
+VOID STACKDIST_FA::Compact()
+{
+    std::vector<std::pair<UINT64, ADDRINT> > order;
+    order.reserve(Last.size());
+    for (LASTTIME::iterator I = Last.begin(), E = Last.end(); I != E; ++I) 
+    {
+        order.push_back(std::make_pair(I->second, I->first));
+    }
+    std::sort(order.begin(), order.end());
+
+    Tree.assign(std::max<size_t>(2*order.size(), 64*KILO) + 1, 0);
+    for (Now = 0; Now < order.size(); Now++)
+    {
+        Last[order[Now].second] = Now;
+        TreeAdd(Now, 1);
+    }
+}
+
+VOID STACKDIST_FA::Access(ADDRINT line)
+{
+    if (Now + 1 >= Tree.size()) Compact();
+
+    LASTTIME::iterator I = Last.find(line);
+    if (I == Last.end()) 
+    {
+        Cold ++;
+        Last[line] = Now;
+    }
+    else
+    {
+        // lines referenced after the last reference to this line.
+        const UINT64 distance = TreeSum(Now) - TreeSum(I->second);
+        Hist[distance ? FloorLog2(distance) + 1 : 0] ++;
+        TreeAdd(I->second, -1);
+        I->second = Now;
+    }
+    TreeAdd(Now, 1);
+    Now ++;
+}
+
+/* ===================================================================== */
+/* Set Associative Profile */
+/* ===================================================================== */
+STACKDIST_SET::STACKDIST_SET(UINT32 sets) : SetMask(sets - 1)
+{
+    ASSERTX(IsPowerOfTwo(sets));
+    Stacks = new ADDRINT[sets*STACKDIST_MAX_WAYS];
+    memset(Stacks, 0, sizeof(ADDRINT)*sets*STACKDIST_MAX_WAYS);
+    memset(Hist, 0, sizeof(Hist));
+}
+
+VOID STACKDIST_SET::Access(ADDRINT line)
+{
+    // 0 marks an empty entry, line 0 is never referenced by a program.
+    ADDRINT *stack = &Stacks[(line & SetMask)*STACKDIST_MAX_WAYS];
+    UINT32 depth = 0;
+    while (depth < STACKDIST_MAX_WAYS && stack[depth] && stack[depth] != line) depth++;
+    if (depth == STACKDIST_MAX_WAYS || !stack[depth]) Hist[STACKDIST_MAX_WAYS] ++;
+    else Hist[depth] ++;
+    // move the line to the top.
+    memmove(&stack[1], &stack[0], sizeof(ADDRINT)*std::min<UINT32>(depth, STACKDIST_MAX_WAYS-1));
+    stack[0] = line;
+}
+
+/* ===================================================================== */
+/* Profiles of a Level */
+/* ===================================================================== */
+STACKDIST::STACKDIST(UINT32 linesize, UINT32 sets, BOOL shared) 
+          : LineSize(linesize), Sets(sets), Shared(shared)
+{
+    PIN_MutexInit(&Lock);
+    memset(Profiles, 0, sizeof(Profiles));
+}
+
+STACKDIST::~STACKDIST()
+{
+    for (THREADID tid = 0; tid < MAX_CACHE_THREAD; tid++)
+    {
+        delete Profiles[tid].fa;
+        for (UINT32 i = 0; i < SET_PROFILES; i++) delete Profiles[tid].set[i];
+    }
+    PIN_MutexFini(&Lock);
+}
+
+STACKDIST::PROFILES &STACKDIST::Get(THREADID tid)
+{
+    PROFILES &profiles = Profiles[Shared ? 0 : tid];
+    if (CACHESIM_unlikely(!profiles.fa))
+    {
+        profiles.fa = new STACKDIST_FA;
+        for (UINT32 i = 0; i < SET_PROFILES; i++) 
+        {
+            // sets/4 ... sets*4
+            profiles.set[i] = new STACKDIST_SET(std::max<UINT32>(1, (Sets << i) >> 2));
+        }
+    }
+    return profiles;
+}
+
+VOID STACKDIST::Access(ADDRINT line, THREADID tid)
+{
+    if (Shared) PIN_MutexLock(&Lock);
+    PROFILES &profiles = Get(tid);
+    profiles.fa->Access(line);
+    for (UINT32 i = 0; i < SET_PROFILES; i++) profiles.set[i]->Access(line);
+    if (Shared) PIN_MutexUnlock(&Lock);
+}
+
+std::string STACKDIST::StatsLong(std::string prefix) const
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    // sum the profiles of all the threads.
+    UINT64 fahist[STACKDIST_BUCKETS] = {0};
+    UINT64 sethist[SET_PROFILES][STACKDIST_MAX_WAYS+1] = {{0}};
+    UINT64 cold = 0;
+    UINT32 sets[SET_PROFILES] = {0};
+    for (THREADID tid = 0; tid < MAX_CACHE_THREAD; tid++)
+    {
+        const PROFILES &profiles = Profiles[tid];
+        if (!profiles.fa) continue;
+        cold += profiles.fa->Cold;
+        for (UINT32 k = 0; k < STACKDIST_BUCKETS; k++) fahist[k] += profiles.fa->Hist[k];
+        for (UINT32 i = 0; i < SET_PROFILES; i++) 
+        {
+            sets[i] = profiles.set[i]->GetSets();
+            for (UINT32 w = 0; w <= STACKDIST_MAX_WAYS; w++) sethist[i][w] += profiles.set[i]->Hist[w];
+        }
+    }
+
+    UINT64 refs = cold;
+    for (UINT32 k = 0; k < STACKDIST_BUCKETS; k++) refs += fahist[k];
+    std::string out;
+    if (!refs) return out;
+
+    // a capacity of 2^k lines hits the buckets 0 ... k.
+    out += prefix + "Fully associative LRU miss ratio curve, " + decstr(LineSize) + " byte lines:\n";
+    UINT64 last = STACKDIST_BUCKETS - 1;
+    while (last && !fahist[last]) last--;
+    UINT64 hits = 0;
+    for (UINT32 k = 0; k <= last + 1 && k < STACKDIST_BUCKETS; k++)
+    {
+        hits += fahist[k];
+        const UINT64 lines = 1ULL << k;
+        out += prefix + ljstr(mydecstr(lines, numberWidth) + " lines", headerWidth)
+               + mydecstr(refs - hits, numberWidth) + " Misses  " 
+               + fltstr(100.0 * (refs - hits) / refs, 2, 6) + "%\n";
+    }
+    out += prefix + "\n";
+
+    // an associativity of w ways hits the depths 0 ... w-1.
+    for (UINT32 i = 0; i < SET_PROFILES; i++)
+    {
+        if (!sets[i]) continue;
+        out += prefix + "Set associative LRU miss ratio curve, " + decstr(sets[i]) + " sets:\n";
+        hits = 0;
+        for (UINT32 w = 1; w <= STACKDIST_MAX_WAYS; w++)
+        {
+            hits += sethist[i][w-1];
+            out += prefix + ljstr(mydecstr(w, numberWidth/2) + " ways " 
+                   + mydecstr((UINT64)sets[i]*w, numberWidth) + " lines", headerWidth*2)
+                   + mydecstr(refs - hits, numberWidth) + " Misses  " 
+                   + fltstr(100.0 * (refs - hits) / refs, 2, 6) + "%\n";
+        }
+        out += prefix + "\n";
+    }
+    return out;
+}
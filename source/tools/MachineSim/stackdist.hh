@@ -0,0 +1,141 @@
+/*BEGIN_LEGAL
+Intel Open Source License
+
+Copyright (c) 2002-2011 Intel Corporation. All rights reserved.
+
+Written by Xin Tong, University of Toronto.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+
+#ifndef PIN_STACKDIST_H
+#define PIN_STACKDIST_H
+
+#include "pin.H"
+#include "utils.hh"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/// @ STACKDIST - Everything related to stack distance profiling
+//  @
+//  @ A profile watches the stream of lines that reaches one level of the 
+//  @ hierarchy and records the LRU stack distance of every reference 
+//  @ (Mattson et al. 1970). A reference with distance d hits in every LRU
+//  @ cache holding more than d lines, so one pass gives the miss ratio of
+//  @ the level for every capacity.
+//  @
+//  @ - STACKDIST_FA  - fully associative, every capacity in lines.
+//  @ - STACKDIST_SET - set associative with a fixed number of sets, every 
+//  @                   associativity up to STACKDIST_MAX_WAYS.
+/* ===================================================================== */
+/* Stack Distance Profiles ... */
+/* ===================================================================== */
+#define STACKDIST_BUCKETS   (64)
+#define STACKDIST_MAX_WAYS  (32)
+
+/// @ STACKDIST_FA - fully associative profile. the distance of a reference
+//  @ is the number of distinct lines touched since the last reference to 
+//  @ the same line. every live line marks the time of its last reference in
+//  @ a Fenwick tree, so the distance is a prefix sum, O(log n) a reference.
+//  @ time is renumbered when the tree fills up. distances are counted in
+//  @ power of 2 buckets, bucket k holds [2^(k-1), 2^k).
+class STACKDIST_FA
+{
+private:
+    typedef std::unordered_map<ADDRINT, UINT64> LASTTIME;
+    // last reference time of every line.
+    LASTTIME Last;
+    // Fenwick tree over time, 1 at the last reference time of a live line.
+    std::vector<INT32> Tree;
+    // the current time.
+    UINT64 Now;
+
+    VOID   TreeAdd(UINT64 time, INT32 val);
+    UINT64 TreeSum(UINT64 time) const;
+    VOID   Compact();
+public:
+    // distance histogram and cold references.
+    UINT64 Hist[STACKDIST_BUCKETS];
+    UINT64 Cold;
+
+    STACKDIST_FA();
+    VOID Access(ADDRINT line);
+};
+
+/// @ STACKDIST_SET - set associative profile. every set keeps its LRU stack
+//  @ up to STACKDIST_MAX_WAYS deep, the distance of a reference is its 
+//  @ depth in the stack of its set.
+class STACKDIST_SET
+{
+private:
+    UINT32 SetMask;
+    // STACKDIST_MAX_WAYS lines per set, most recent first.
+    ADDRINT *Stacks;
+public:
+    // distance histogram, the last entry is deeper than the stack.
+    UINT64 Hist[STACKDIST_MAX_WAYS+1];
+
+    STACKDIST_SET(UINT32 sets);
+    ~STACKDIST_SET() { delete [] Stacks; }
+    UINT32 GetSets() const { return SetMask + 1; }
+    VOID Access(ADDRINT line);
+};
+
+/// @ STACKDIST - the profiles of one level of the hierarchy. a private 
+//  @ level gets one set of profiles per thread, created on the first 
+//  @ reference of the thread, a shared one a single set behind a lock.
+//  @ the set associative profiles cover the configured number of sets of 
+//  @ the level, and 4x fewer up to 4x more.
+class STACKDIST
+{
+public:
+    enum { SET_PROFILES = 5 };
+private:
+    typedef struct
+    {
+        STACKDIST_FA  *fa;
+        STACKDIST_SET *set[SET_PROFILES];
+    } PROFILES;
+    
+    UINT32 LineSize;
+    UINT32 Sets;
+    BOOL   Shared;
+    PIN_MUTEX Lock;
+    PROFILES Profiles[MAX_CACHE_THREAD];
+
+    PROFILES &Get(THREADID tid);
+public:
+    STACKDIST(UINT32 linesize, UINT32 sets, BOOL shared);
+    ~STACKDIST();
+    /// line is the address of the referenced line or page.
+    VOID Access(ADDRINT line, THREADID tid);
+    /// the miss ratio curves, summed over the threads.
+    std::string StatsLong(std::string prefix) const;
+};
+
+#endif // PIN_STACKDIST_H
@@ -0,0 +1,195 @@
+/*BEGIN_LEGAL
+Intel Open Source License
+
+Copyright (c) 2002-2011 Intel CorpORAtion. All rights reserved.
+
+Written by Xin Tong, University of Toronto.
+
+Redistribution and use in source and binary fORMs, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary fORM must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel CorpORAtion nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+
+/* ===================================================================== */
+/* This file contains the configuration sweep of the PIN tool            */
+/* ===================================================================== */
+/// -sweep names more config.xml files, which may differ from -c in any of
+/// the line sizes, associativities, replacement policies and inclusion of
+/// the levels. every configuration gets a hierarchy of its own, simulated
+/// from the same references by a sweep thread of its own. every full buffer
+/// is copied once and queued to all sweep threads in the same order, the 
+/// last thread done with a copy frees it. the report of configuration k is
+/// cache_sim.out.<pid>.k, next to the one of -c.
+
+#include "pin.H"
+#include "utils.hh"
+#include <new>
+
+/* ===================================================================== */
+/* Globals variables */
+/* ===================================================================== */
+/// SWEEP_BATCH - a copy of a full buffer, shared by the sweep threads.
+typedef struct
+{
+   MEMREF  *refs;
+   UINT64   num;
+   BOOL     filtered;          /* references of a filtered trace */
+   THREADID tid;
+   volatile UINT32 pending;    /* sweep threads not done with the batch */
+} SWEEP_BATCH;
+
+/// SWEEP_CONFIG - a configuration of -sweep, its hierarchy and the thread
+/// simulating it.
+class SWEEP_CONFIG
+{
+public:
+   enum { RING_SIZE = 64 };
+   // batches, pushed under SweepLock by any thread, popped by the sweep thread.
+   SIMRING<SWEEP_BATCH*, RING_SIZE> Full;
+   CACHE_HIERARCHY *Levels;
+   string Config;
+   SIMPOLLER Poller;
+public:
+   SWEEP_CONFIG() : Levels(NULL) {}
+};
+
+LOCALVAR SWEEP_CONFIG *SweepConfigs = NULL;
+LOCALVAR UINT32 SweepNum = 0;
+LOCALVAR PIN_MUTEX SweepLock;
+
+/* ===================================================================== */
+/* Application Side */
+/* ===================================================================== */
+/* SweepPush - queue a copy of num references of thread tid to every */
+/* sweep thread                                                       */
+VOID SweepPush(const MEMREF *ref, UINT64 num, BOOL filtered, THREADID tid)
+{
+    // waiting for simulation to start. the whole buffer is dropped.
+    if (!SweepNum || !num || !SimWait->dosim()) return;
+
+    SWEEP_BATCH *batch = new SWEEP_BATCH;
+    batch->refs = new MEMREF[num];
+    memcpy(batch->refs, ref, sizeof(MEMREF)*num);
+    batch->num = num;
+    batch->filtered = filtered;
+    batch->tid = tid;
+    batch->pending = SweepNum;
+
+    // one pusher at a time, the rings have a single producer.
+    PIN_MutexLock(&SweepLock);
+    for (UINT32 k=0; k<SweepNum; k++)
+    {
+        // the sweep thread is behind, wait for it.
+        while (!SweepConfigs[k].Full.push(batch)) PIN_Yield();
+    }
+    PIN_MutexUnlock(&SweepLock);
+}
+
+/* ===================================================================== */
+/* Sweep Side */
+/* ===================================================================== */
+/* SweepPoll - simulate the batches through the hierarchy of a configuration */
+LOCALFUN BOOL SweepPoll(VOID *arg)
+{
+    SWEEP_CONFIG &config = *static_cast<SWEEP_CONFIG*>(arg);
+
+    BOOL busy = false;
+    SWEEP_BATCH *batch;
+    while (config.Full.pop(batch))
+    {
+        busy = true;
+        CacheHierarchyRefs(config.Levels, batch->refs, batch->num, batch->filtered, batch->tid);
+        if (__atomic_sub_fetch(&batch->pending, 1, __ATOMIC_ACQ_REL)) continue;
+        delete [] batch->refs;
+        delete batch;
+    }
+    return busy;
+}
+
+/* ===================================================================== */
+/* Module initialization and finialization functions */
+/* ===================================================================== */
+VOID MachineSimSweepModuleInit()
+{
+    const std::vector<string> &configs = SimOpts->get_sweep();
+    if (configs.empty()) return;
+
+    // every hierarchy claims its counters from the fixed blocks of SIMSTATS.
+    const UINT32 room = (SIMSTATS::MAX_COUNTERS - SimStats->get_claimed()) / CacheHierarchyCounters();
+    if (configs.size() > room)
+    {
+        MACHINESIM_PRINT("Error: %u -sweep configurations, the simulator counters leave room for %u\n", 
+                         (UINT32)configs.size(), room);
+        PIN_ExitProcess(1);
+    }
+
+    SweepNum = configs.size();
+    SweepConfigs = SimRingsNew<SWEEP_CONFIG>(SweepNum);
+    PIN_MutexInit(&SweepLock);
+
+    for (UINT32 k=0; k<SweepNum; k++)
+    {
+        FILE *file = fopen(configs[k].c_str(), "r");
+        if (!file)
+        {
+            MACHINESIM_PRINT("Error: could not read the sweep configuration %s\n", configs[k].c_str());
+            PIN_ExitProcess(1);
+        }
+        fclose(file);
+
+        ParseXML config;
+        config.parse(configs[k].c_str());
+        SweepConfigs[k].Config = configs[k];
+        SweepConfigs[k].Levels = CacheHierarchyNew(&config);
+        if (!SweepConfigs[k].Poller.Start(SweepPoll, &SweepConfigs[k]))
+        {
+            MACHINESIM_PRINT("Error: could not spawn the sweep thread of %s\n", configs[k].c_str());
+            PIN_ExitProcess(1);
+        }
+    }
+}
+
+VOID MachineSimSweepModuleExit()
+{
+    if (!SweepNum) return;
+
+    // the references are all pushed, let the sweep threads finish them.
+    for (UINT32 k=0; k<SweepNum; k++) SweepConfigs[k].Poller.Exit();
+}
+
+VOID MachineSimSweepModuleFini()
+{
+    if (!SweepNum) return;
+
+    for (UINT32 k=0; k<SweepNum; k++)
+    {
+        char name[128];
+        sprintf(name, "%s.%d.%u", "cache_sim.out", PIN_GetPid(), k + 1);
+        CacheHierarchyReport(SweepConfigs[k].Levels, name, SweepConfigs[k].Config);
+        CacheHierarchyDelete(SweepConfigs[k].Levels);
+    }
+    PIN_MutexFini(&SweepLock);
+    SimRingsDelete(SweepConfigs, SweepNum); SweepConfigs = NULL;
+    SweepNum = 0;
+}
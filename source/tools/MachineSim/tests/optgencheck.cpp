@@ -0,0 +1,63 @@
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include "optgen.hh"
+
+/// @@@ native check of optgen.cc, built with replay/pin.H. random streams,
+/// @@@ with many back to back references, go through the OPTgen sets of a
+/// @@@ cache and through a brute force Belady MIN with bypassing that looks
+/// @@@ ahead. the streams fit the window, the hits must be the same.
+#define STREAMS 20000
+#define SETS    4
+#define WINDOW  512
+
+/* MinHits - the hits of MIN with bypassing on a set of assoc ways */
+static int MinHits(const std::vector<int> &s, int assoc)
+{
+   int n = s.size(), hits = 0;
+   std::vector<int> next(n), last(1024, n);
+   for (int i = n - 1; i >= 0; i--) { next[i] = last[s[i]]; last[s[i]] = i; }
+   // the lines in the set and their next reference.
+   std::vector<std::pair<int,int> > set;
+   for (int i = 0; i < n; i++)
+   {
+      bool hit = false;
+      for (size_t k = 0; k < set.size(); k++) if (set[k].first == s[i]) { hit = true; set[k].second = next[i]; }
+      if (hit) { hits++; continue; }
+      if ((int)set.size() < assoc) { set.push_back(std::make_pair(s[i], next[i])); continue; }
+      // replace the line used furthest away, or bypass the new one.
+      int far = -1, at = next[i];
+      for (size_t k = 0; k < set.size(); k++) if (set[k].second > at) { at = set[k].second; far = k; }
+      if (far >= 0) set[far] = std::make_pair(s[i], next[i]);
+   }
+   return hits;
+}
+
+int main()
+{
+   srand(1);
+   for (int it = 0; it < STREAMS; it++)
+   {
+      int assoc = 1 + rand() % 8, lines = 2 + rand() % 24, n = 1 + rand() % 400;
+      std::vector<int> streams[SETS];
+      OPTGEN_SETS opt(SETS, assoc, WINDOW);
+      int hits[SETS] = { 0 };
+      for (int i = 0; i < n; i++)
+      {
+         int set = rand() % SETS;
+         std::vector<int> &s = streams[set];
+         int line = (!s.empty() && rand() % 3 == 0) ? s.back() : rand() % lines;
+         s.push_back(line);
+         hits[set] += opt.Access(set, line);
+      }
+      for (int set = 0; set < SETS; set++)
+      {
+         int min = MinHits(streams[set], assoc);
+         if (hits[set] == min) continue;
+         printf("optgencheck: stream %d set %d assoc %d: OPTgen %d hits, MIN %d\n", it, set, assoc, hits[set], min);
+         return 1;
+      }
+   }
+   printf("optgencheck: %d streams ok\n", STREAMS);
+   return 0;
+}
@@ -0,0 +1,23 @@
+#include <cstdlib>
+#include <cstdio>
+#include <pthread.h>
+
+/// @@@ implements the same sequential store loop in many threads. expect the total
+/// @@@ instruction count to be THREADS times the count of a single loop.
+#define THREADS 32
+#define ARRSIZE 1024*1024
+void *work(void *arg)
+{
+   int *larr = (int*) malloc(sizeof(int) * ARRSIZE);
+   for(int i =0; i < ARRSIZE; ++i) larr[i] = 1;
+   free(larr);
+   return NULL;
+}
+
+int main()
+{
+   pthread_t threads[THREADS];
+   for(int i =0; i < THREADS; ++i) pthread_create(&threads[i], NULL, work, NULL);
+   for(int i =0; i < THREADS; ++i) pthread_join(threads[i], NULL);
+   return 0;
+}
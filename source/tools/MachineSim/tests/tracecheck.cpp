@@ -0,0 +1,259 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "trace.hh"
+
+/// @@@ native check of trace.hh. random instructions of two threads are
+/// @@@ written through TRACE_WRITER and must decode as they were, from the
+/// @@@ binary trace and from the pcea text tracecvt exports, rep strings
+/// @@@ included. a filtered chunk without records keeps its instructions
+/// @@@ and ChampSim records import with the line sized references they hold.
+/// @@@ with an argument the binary trace is left there, for the replay checks.
+#define INSTRUCTIONS 200000
+#define STATICS      4096
+#define CHUNK        (1 << 16)
+
+typedef struct
+{
+   uint32_t tid;
+   uint64_t pc;
+   uint32_t size;
+   uint8_t  bytes[TRACE_INS_MAX];
+   uint32_t nrefs;
+   TRACE_REF refs[4];
+} CHECK_INS;
+
+static const char *Name = "tracecheck.bin";
+static const char *Text = "tracecheck.pcea";
+static const char *Filtered = "tracecheck.filtered";
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("tracecheck: " __VA_ARGS__); printf("\n"); return false; } } while (0)
+
+/* Generate - instructions of 2 threads, with rep strings at every 64th pc */
+static void Generate(std::vector<CHECK_INS> &trace)
+{
+   CHECK_INS statics[STATICS];
+   for (uint32_t id = 0; id < STATICS; id++)
+   {
+      CHECK_INS &s = statics[id];
+      s.pc = 0x400000 + id * 16;
+      s.size = 1 + rand() % TRACE_INS_MAX;
+      for (uint32_t i = 0; i < s.size; i++) s.bytes[i] = rand();
+      s.nrefs = id % 64 ? rand() % 4 : 2;
+   }
+   uint32_t id[2] = { 0, 0 };
+   while (trace.size() < INSTRUCTIONS)
+   {
+      const uint32_t tid = rand() % 4 == 0;
+      CHECK_INS ins = statics[id[tid]];
+      const uint32_t reps = id[tid] % 64 ? 1 : 1 + rand() % 8;
+      for (uint32_t r = 0; r < reps; r++)
+      {
+         ins.tid = tid;
+         for (uint32_t i = 0; i < ins.nrefs; i++)
+         {
+            ins.refs[i].addr = 0x7f0000000000ULL + (rand() % (1 << 20)) * 8;
+            ins.refs[i].size = 1 << (rand() % 7);
+            ins.refs[i].type = rand() % 2 ? TRACE_REF_WRITE : TRACE_REF_READ;
+         }
+         trace.push_back(ins);
+      }
+      id[tid] = rand() % 8 ? (id[tid] + 1) % STATICS : rand() % STATICS;
+   }
+}
+
+/* Same - whether a decoded instruction is the one generated */
+static bool Same(const TRACE_INS &d, const CHECK_INS &ins, bool bytes)
+{
+   if (d.pc != ins.pc || d.size != ins.size || d.nrefs != ins.nrefs) return false;
+   if (bytes && memcmp(d.bytes, ins.bytes, ins.size)) return false;
+   for (uint32_t i = 0; i < ins.nrefs; i++)
+   {
+      if (d.refs[i].addr != ins.refs[i].addr || d.refs[i].size != ins.refs[i].size ||
+          d.refs[i].type != ins.refs[i].type) return false;
+   }
+   return true;
+}
+
+/* CheckNative - write the instructions into a binary trace and read it back */
+static bool CheckNative(const std::vector<CHECK_INS> &trace)
+{
+   TRACE_WRITER writer;
+   TRACE_ENCODER enc[2];
+   CHECK(writer.Open(Name, CHUNK), "can not write %s", Name);
+   enc[0].Init(CHUNK);
+   enc[1].Init(CHUNK);
+   for (size_t i = 0; i < trace.size(); i++)
+   {
+      const CHECK_INS &ins = trace[i];
+      TRACE_ENCODER &e = enc[ins.tid];
+      if (!e.Fits(TRACE_ENCODER::RecordMax(ins.nrefs)))
+      {
+         CHECK(writer.Chunk(ins.tid, e), "writing a chunk failed");
+         e.Reset();
+      }
+      e.Ins((uint32_t)((ins.pc - 0x400000) / 16), ins.pc, ins.size, ins.bytes, ins.nrefs);
+      for (uint32_t r = 0; r < ins.nrefs; r++) e.Ref(ins.refs[r].addr, ins.refs[r].size, ins.refs[r].type);
+   }
+   CHECK(writer.Chunk(0, enc[0]) && writer.Chunk(1, enc[1]) && writer.Close(), "closing %s failed", Name);
+
+   TRACE_READER reader;
+   TRACE_DECODER dec;
+   TRACE_INS d;
+   size_t next[2] = { 0, 0 };
+   CHECK(reader.Open(Name) && !reader.Truncated, "can not read %s", Name);
+   for (uint32_t c = 0; c < reader.Chunks(); c++)
+   {
+      const uint32_t tid = reader.Index[c].tid;
+      CHECK(reader.Load(c, &dec), "chunk %u does not load", c);
+      int rc;
+      while ((rc = dec.Next(&d)) > 0)
+      {
+         while (next[tid] < trace.size() && trace[next[tid]].tid != tid) next[tid]++;
+         CHECK(next[tid] < trace.size() && Same(d, trace[next[tid]], true),
+               "instruction %llu of thread %u differs", (unsigned long long)d.icount, tid);
+         next[tid]++;
+      }
+      CHECK(rc == 0, "chunk %u is corrupt", c);
+   }
+   for (uint32_t tid = 0; tid < 2; tid++)
+   {
+      while (next[tid] < trace.size() && trace[next[tid]].tid != tid) next[tid]++;
+      CHECK(next[tid] == trace.size(), "thread %u lost instructions", tid);
+   }
+   return true;
+}
+
+/* CheckPcea - write thread 0 as tracecvt exports it and import it again */
+static bool CheckPcea(const std::vector<CHECK_INS> &trace)
+{
+   FILE *out = fopen(Text, "w");
+   CHECK(out, "can not write %s", Text);
+   fprintf(out, "# a comment\n");
+   for (size_t i = 0; i < trace.size(); i++)
+   {
+      const CHECK_INS &ins = trace[i];
+      if (ins.tid) continue;
+      fprintf(out, "0x%llx %u\n", (unsigned long long)ins.pc, ins.size);
+      for (uint32_t r = 0; r < ins.nrefs; r++)
+      {
+         fprintf(out, "0x%llx 0x%llx %c %u\n", (unsigned long long)ins.pc, (unsigned long long)ins.refs[r].addr,
+                 ins.refs[r].type == TRACE_REF_WRITE ? 'W' : 'R', ins.refs[r].size);
+      }
+   }
+   fclose(out);
+
+   TRACE_READER reader;
+   TRACE_DECODER dec;
+   TRACE_INS d;
+   size_t next = 0;
+   uint64_t count = 0;
+   CHECK(reader.Open(Text, TRACE_FORMAT_PCEA), "can not read %s", Text);
+   for (uint32_t c = 0; c < reader.Chunks(); c++)
+   {
+      count += reader.Index[c].count;
+      CHECK(reader.Load(c, &dec), "pcea chunk %u does not load", c);
+      while (dec.Next(&d) > 0)
+      {
+         while (next < trace.size() && trace[next].tid) next++;
+         CHECK(next < trace.size() && Same(d, trace[next], false), "pcea instruction %llu differs", (unsigned long long)d.icount);
+         next++;
+      }
+   }
+   while (next < trace.size() && trace[next].tid) next++;
+   CHECK(next == trace.size() && count == reader.Index.back().icount + reader.Index.back().count,
+         "pcea import lost instructions");
+   return true;
+}
+
+/* CheckLegacyPcea - without the bare lines, references of the same pc */
+/* after each other are one instruction.                                 */
+static bool CheckLegacyPcea()
+{
+   FILE *out = fopen(Text, "w");
+   CHECK(out, "can not write %s", Text);
+   fprintf(out, "0x1000 0x2000 R\n0x1000 0x2040 W 8\n0x1004\n0x1008 0x3000 R\n");
+   fclose(out);
+   TRACE_READER reader;
+   TRACE_DECODER dec;
+   TRACE_INS d;
+   CHECK(reader.Open(Text, TRACE_FORMAT_PCEA) && reader.Chunks() == 1 && reader.Load(0, &dec), "can not read %s", Text);
+   CHECK(dec.Next(&d) > 0 && d.pc == 0x1000 && d.size == 4 && d.nrefs == 2 && d.refs[0].size == TRACE_FOREIGN_REF &&
+         d.refs[1].size == 8 && d.refs[1].type == TRACE_REF_WRITE, "legacy pcea instruction 0 differs");
+   CHECK(dec.Next(&d) > 0 && d.pc == 0x1004 && d.nrefs == 0, "legacy pcea instruction 1 differs");
+   CHECK(dec.Next(&d) > 0 && d.pc == 0x1008 && d.nrefs == 1 && dec.Next(&d) == 0, "legacy pcea instruction 2 differs");
+   return true;
+}
+
+/* CheckChampSim - records import with their loads and stores */
+static bool CheckChampSim()
+{
+   FILE *out = fopen(Text, "wb");
+   CHECK(out, "can not write %s", Text);
+   for (uint32_t i = 0; i < 1000; i++)
+   {
+      CHAMPSIM_INSTR r;
+      memset(&r, 0, sizeof(r));
+      r.ip = 0x400000 + 4 * i;
+      if (i % 3 == 0) r.source_memory[0] = 0x10000 + 64 * i;
+      if (i % 5 == 0) r.destination_memory[1] = 0x20000 + 64 * i;
+      fwrite(&r, sizeof(r), 1, out);
+   }
+   fclose(out);
+   TRACE_READER reader;
+   TRACE_DECODER dec;
+   TRACE_INS d;
+   CHECK(reader.Open(Text, TRACE_FORMAT_CHAMPSIM) && reader.Chunks() == 1 && reader.Load(0, &dec), "can not read %s", Text);
+   for (uint32_t i = 0; i < 1000; i++)
+   {
+      CHECK(dec.Next(&d) > 0 && d.pc == 0x400000 + 4 * i && d.nrefs == (uint32_t)((i % 3 == 0) + (i % 5 == 0)),
+            "ChampSim record %u differs", i);
+      for (uint32_t r = 0; r < d.nrefs; r++) CHECK(d.refs[r].size == TRACE_FOREIGN_REF, "ChampSim reference of %u sized", i);
+   }
+   CHECK(dec.Next(&d) == 0, "ChampSim records left over");
+   return true;
+}
+
+/* CheckEmptyChunk - a filtered chunk of instructions without records */
+static bool CheckEmptyChunk()
+{
+   static const uint8_t bytes[4] = { 0x90, 0x90, 0x90, 0x90 };
+   TRACE_WRITER writer;
+   TRACE_ENCODER enc;
+   writer.Header.flags = TRACE_FILTERED;
+   CHECK(writer.Open(Filtered, CHUNK), "can not write %s", Filtered);
+   enc.Init(CHUNK);
+   for (uint32_t i = 0; i < 10; i++)
+   {
+      enc.Skip();
+      if (i % 3 == 0) enc.Miss(0, 0x1000, 4, bytes, 0x2000 + 64 * i, 64, TRACE_REF_READ);
+   }
+   CHECK(writer.Chunk(0, enc), "writing a chunk failed");
+   enc.Reset();
+   for (uint32_t i = 0; i < 7; i++) enc.Skip();
+   CHECK(writer.Chunk(0, enc) && writer.Close(), "closing %s failed", Filtered);
+
+   TRACE_READER reader;
+   TRACE_DECODER dec;
+   TRACE_INS d;
+   CHECK(reader.Open(Filtered) && reader.Chunks() == 2, "the chunk without records is lost");
+   CHECK(reader.Index[1].icount == 10 && reader.Index[1].count == 7 && reader.Index[1].rawsize == 0,
+         "the chunk without records is not 7 instructions from 10 on");
+   CHECK(reader.Load(1, &dec) && dec.Next(&d) == 0, "the chunk without records does not load");
+   return true;
+}
+
+int main(int argc, char *argv[])
+{
+   std::vector<CHECK_INS> trace;
+   if (argc > 1) Name = argv[1];
+   srand(1);
+   Generate(trace);
+   bool ok = CheckNative(trace) && CheckPcea(trace) && CheckLegacyPcea() && CheckChampSim() && CheckEmptyChunk();
+   if (argc <= 1) remove(Name);
+   remove(Text);
+   remove(Filtered);
+   if (ok) printf("tracecheck: %u instructions ok\n", (uint32_t)trace.size());
+   return ok ? 0 : 1;
+}
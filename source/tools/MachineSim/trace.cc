@@ -0,0 +1,513 @@
+/*BEGIN_LEGAL
+Intel Open Source License
+
+Copyright (c) 2002-2011 Intel CorpORAtion. All rights reserved.
+
+Written by Xin Tong, University of Toronto.
+
+Redistribution and use in source and binary fORMs, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary fORM must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel CorpORAtion nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+
+/* ===================================================================== */
+/* This file contains the trace recorder of the PIN tool                */
+/* ===================================================================== */
+
+#include "pin.H"
+#include "utils.hh"
+#include "trace.hh"
+#include <new>
+#include <unordered_map>
+
+/* ===================================================================== */
+/* Globals variables */
+/* ===================================================================== */
+/// -tc records every executed instruction and its memory references into
+/// the binary trace of trace.hh. every thread encodes its records into a
+/// chunk buffer of its own. a full buffer is handed to the trace writer, 
+/// a pin internal thread which packs and writes it, and the thread goes on
+/// with one of its -tcbuffers buffers the writer is done with. when all of
+/// them are still queued the thread waits for the writer, or with -tcdrop
+/// drops the chunk and counts what it dropped. the index shows the gap.
+///
+/// with -tcfilter the references of every thread first go through private
+/// L1 instruction and data filter caches, and only the lines that miss and
+/// the dirty lines written back are recorded.
+
+/// TRACE_STATIC - a static instruction, created at instrumentation and
+/// handed to the analysis routine. never freed, code may be instrumented
+/// again at any time.
+typedef struct
+{
+   UINT32  id;
+   UINT32  nrefs;
+   UINT32  max;      /* largest record, TRACE_ENCODER::RecordMax */
+   UINT32  size;
+   ADDRINT pc;
+   UINT8   bytes[TRACE_INS_MAX];
+} TRACE_STATIC;
+
+/// TRACE_FILTER - a small private write back LRU cache in front of a 
+/// filtered trace. the ways of a set are kept in MRU order.
+class TRACE_FILTER
+{
+public:
+   typedef enum { HIT=0, MISS, WRITEBACK } RESULT;
+   UINT32   SetMask;
+   UINT32   Assoc;
+   ADDRINT *Lines;       /* line number + 1, 0 for an invalid way */
+   UINT8   *Dirty;
+   UINT64   Hits;
+   UINT64   Misses;
+   UINT64   Writebacks;
+public:
+   TRACE_FILTER() : Lines(NULL), Dirty(NULL), Hits(0), Misses(0), Writebacks(0) {}
+   ~TRACE_FILTER() { delete [] Lines; delete [] Dirty; }
+
+   VOID Init(UINT32 lines, UINT32 assoc)
+   {
+      Assoc = assoc;
+      SetMask = lines / assoc - 1;
+      Lines = new ADDRINT[lines]();
+      Dirty = new UINT8[lines]();
+   }
+
+   /// Reset - invalidate every line, for a new thread.
+   VOID Reset()
+   {
+      memset(Lines, 0, sizeof(ADDRINT) * (SetMask + 1) * Assoc);
+      memset(Dirty, 0, (SetMask + 1) * Assoc);
+   }
+
+   /// Access - look up line and fill it on a miss. victim is the dirty
+   /// line written back for it.
+   RESULT Access(ADDRINT line, BOOL write, ADDRINT *victim)
+   {
+      ADDRINT *set = Lines + (line & SetMask) * Assoc;
+      UINT8 *dirty = Dirty + (line & SetMask) * Assoc;
+      RESULT result = HIT;
+      UINT8 d = write;
+      UINT32 way = 0;
+      while (way < Assoc && set[way] != line + 1) way++;
+      if (way < Assoc) 
+      {
+         Hits++;
+         d |= dirty[way];
+      }
+      else
+      {
+         Misses++;
+         result = MISS;
+         way = Assoc - 1;
+         if (set[way] && dirty[way])
+         {
+            Writebacks++;
+            result = WRITEBACK;
+            *victim = set[way] - 1;
+         }
+      }
+      for (; way > 0; way--)
+      {
+         set[way] = set[way - 1];
+         dirty[way] = dirty[way - 1];
+      }
+      set[0] = line + 1;
+      dirty[0] = d;
+      return result;
+   }
+};
+
+/// TRACE_JOB - a full chunk buffer queued for the writer.
+typedef struct
+{
+   UINT8  *buf;
+   UINT32  size;
+   UINT64  icount;
+   UINT64  count;
+} TRACE_JOB;
+
+/// TRACE_THREAD - the recording state of an application thread.
+class TRACE_THREAD
+{
+public:
+   enum { RING_SIZE = 16 };
+   // full buffers, the application thread produces and the writer consumes.
+   SIMRING<TRACE_JOB, RING_SIZE> Full;
+   // written buffers the application thread can fill again.
+   SIMRING<UINT8*, RING_SIZE> Free;
+   TRACE_ENCODER Enc;
+   TRACE_FILTER IFilter;
+   TRACE_FILTER DFilter;
+   UINT32 Buffers;       /* allocated so far */
+   UINT64 Stalls;        /* waits for the writer */
+   UINT64 DropChunks;
+   UINT64 DropIns;
+public:
+   TRACE_THREAD() : Buffers(0), Stalls(0), DropChunks(0), DropIns(0) {}
+};
+
+LOCALVAR TRACE_WRITER TraceWriter;
+LOCALVAR BOOL TraceFailed = false;
+LOCALVAR string TraceName;
+LOCALVAR TRACE_THREAD *TraceThreads = NULL;
+LOCALVAR SIMPOLLER TraceWriterPoller;
+LOCALVAR UINT32 TraceLineShift = 0;
+/* the latest static instruction at every pc, under the pin vm lock */
+LOCALVAR std::unordered_map<ADDRINT, TRACE_STATIC*> TraceStatics;
+LOCALVAR UINT32 TraceStaticNum = 0;
+
+/* ===================================================================== */
+/* Application Side */
+/* ===================================================================== */
+/* TraceBuffer - a buffer to fill for thread, NULL if all of them are */
+/* queued and chunks are dropped.                                      */
+LOCALFUN UINT8 *TraceBuffer(TRACE_THREAD &thread)
+{
+    UINT8 *buf = NULL;
+    if (thread.Free.pop(buf)) return buf;
+    if (thread.Buffers < SimOpts->get_tracebuffers())
+    {
+        thread.Buffers++;
+        return new UINT8[SimOpts->get_tracechunk()];
+    }
+    if (SimOpts->get_tracedrop()) return NULL;
+
+    // the writer is behind, wait for it.
+    thread.Stalls++;
+    while (!thread.Free.pop(buf)) PIN_Yield();
+    return buf;
+}
+
+/* TraceFlush - queue the chunk of the thread and start a new one. the */
+/* last chunk of an exiting thread leaves it without a buffer.         */
+LOCALFUN VOID TraceFlush(TRACE_THREAD &thread, BOOL last)
+{
+    TRACE_ENCODER &enc = thread.Enc;
+    if (!enc.Size() && !last) return;
+
+    UINT8 *next = last ? NULL : TraceBuffer(thread);
+    if (!next && !last)
+    {
+        thread.DropChunks++;
+        thread.DropIns += enc.Count();
+        enc.Reset();
+        return;
+    }
+
+    TRACE_JOB job = { NULL, enc.Size(), enc.First, enc.Count() };
+    job.buf = enc.Swap(next, next ? SimOpts->get_tracechunk() : 0);
+    // every buffer of the thread fits into the ring.
+    BOOL queued = thread.Full.push(job);
+    ASSERTX(queued);
+}
+
+LOCALFUN VOID PIN_FAST_ANALYSIS_CALL TraceRecordIns(TRACE_STATIC *ins, THREADID tid)
+{
+    TRACE_THREAD &thread = TraceThreads[tid];
+    if (CACHESIM_unlikely(!thread.Enc.Fits(ins->max))) TraceFlush(thread, false);
+    thread.Enc.Ins(ins->id, ins->pc, ins->size, ins->bytes, ins->nrefs);
+}
+
+LOCALFUN VOID PIN_FAST_ANALYSIS_CALL TraceRecordRef(ADDRINT addr, UINT32 size, UINT32 type, THREADID tid)
+{
+    TraceThreads[tid].Enc.Ref(addr, size, type);
+}
+
+/* TraceFilterLines - run the lines of a reference through a filter cache, */
+/* record the misses and writebacks.                                        */
+LOCALFUN VOID TraceFilterLines(TRACE_THREAD &thread, TRACE_FILTER &filter, TRACE_STATIC *ins, 
+                               ADDRINT addr, UINT32 size, UINT32 type)
+{
+    const ADDRINT last = (addr + MAX(size, 1U) - 1) >> TraceLineShift;
+    for (ADDRINT line = addr >> TraceLineShift; line <= last; line++)
+    {
+        ADDRINT victim = 0;
+        TRACE_FILTER::RESULT result = filter.Access(line, type == TRACE_REF_WRITE, &victim);
+        if (CACHESIM_likely(result == TRACE_FILTER::HIT)) continue;
+        thread.Enc.Miss(ins->id, ins->pc, ins->size, ins->bytes, line << TraceLineShift, 1 << TraceLineShift, type);
+        if (result == TRACE_FILTER::WRITEBACK)
+        {
+            thread.Enc.Miss(ins->id, ins->pc, ins->size, ins->bytes, 
+                            victim << TraceLineShift, 1 << TraceLineShift, TRACE_REF_WRITEBACK);
+        }
+    }
+}
+
+LOCALFUN VOID PIN_FAST_ANALYSIS_CALL TraceFilterIns(TRACE_STATIC *ins, THREADID tid)
+{
+    TRACE_THREAD &thread = TraceThreads[tid];
+    if (CACHESIM_unlikely(!thread.Enc.Fits(ins->max))) TraceFlush(thread, false);
+    thread.Enc.Skip();
+    TraceFilterLines(thread, thread.IFilter, ins, ins->pc, ins->size, TRACE_REF_IFETCH);
+}
+
+LOCALFUN VOID PIN_FAST_ANALYSIS_CALL TraceFilterRef(TRACE_STATIC *ins, ADDRINT addr, UINT32 size, UINT32 type, THREADID tid)
+{
+    TRACE_THREAD &thread = TraceThreads[tid];
+    TraceFilterLines(thread, thread.DFilter, ins, addr, size, type);
+}
+
+/* TraceStatic - the static instruction of ins, a new one if the code at */
+/* its address changed.                                                   */
+LOCALFUN TRACE_STATIC *TraceStatic(INS ins, UINT32 nrefs, UINT32 maxrefs)
+{
+    TRACE_STATIC s;
+    s.pc = INS_Address(ins);
+    s.size = MIN(INS_Size(ins), (USIZE)TRACE_INS_MAX);
+    s.nrefs = nrefs;
+    s.max = TRACE_ENCODER::RecordMax(maxrefs);
+    PIN_SafeCopy(s.bytes, (VOID*)s.pc, s.size);
+
+    std::unordered_map<ADDRINT, TRACE_STATIC*>::iterator it = TraceStatics.find(s.pc);
+    if (it != TraceStatics.end() && it->second->size == s.size && it->second->nrefs == nrefs &&
+        !memcmp(it->second->bytes, s.bytes, s.size)) return it->second;
+
+    s.id = TraceStaticNum++;
+    TRACE_STATIC *p = new TRACE_STATIC(s);
+    TraceStatics[s.pc] = p;
+    return p;
+}
+
+/* TraceInsertRef - record a read or a write of a memory operand */
+LOCALFUN VOID TraceInsertRef(INS ins, UINT32 memOp, UINT32 type, TRACE_STATIC *s)
+{
+    if (SimOpts->get_tracefilter())
+    {
+        INS_InsertCall(ins, IPOINT_BEFORE,
+                       (AFUNPTR)TraceFilterRef,
+                       IARG_FAST_ANALYSIS_CALL,
+                       IARG_PTR, s,
+                       IARG_MEMORYOP_EA, memOp,
+                       IARG_UINT32, INS_MemoryOperandSize(ins, memOp),
+                       IARG_UINT32, type,
+                       IARG_THREAD_ID,
+                       IARG_END);
+        return;
+    }
+    INS_InsertCall(ins, IPOINT_BEFORE,
+                   (AFUNPTR)TraceRecordRef,
+                   IARG_FAST_ANALYSIS_CALL,
+                   IARG_MEMORYOP_EA, memOp,
+                   IARG_UINT32, INS_MemoryOperandSize(ins, memOp),
+                   IARG_UINT32, type,
+                   IARG_THREAD_ID,
+                   IARG_END);
+}
+
+/* GenerateSimulationTrace - generate instruction trace */
+VOID GenerateSimulationTrace(INS ins, VOID *v)
+{
+    UINT32 memOperands = INS_MemoryOperandCount(ins);
+
+    /* a reference for every read and every write of a memory operand. */
+    /* filtered, every line the instruction and the references touch   */
+    /* may miss and write back a line.                                 */
+    UINT32 nrefs = 0, lines = (TRACE_INS_MAX >> TraceLineShift) + 2;
+    for (UINT32 memOp = 0; memOp < memOperands; memOp++)
+    {
+        UINT32 n = (INS_MemoryOperandIsRead(ins, memOp) ? 1 : 0) + (INS_MemoryOperandIsWritten(ins, memOp) ? 1 : 0);
+        nrefs += n;
+        lines += n * ((INS_MemoryOperandSize(ins, memOp) >> TraceLineShift) + 2);
+    }
+    nrefs = MIN(nrefs, (UINT32)TRACE_REFS_MAX);
+    BOOL filtered = SimOpts->get_tracefilter() != 0;
+    TRACE_STATIC *s = TraceStatic(ins, nrefs, filtered ? MIN(2 * lines, (UINT32)TRACE_REFS_MAX) : nrefs);
+
+    INS_InsertCall(ins, IPOINT_BEFORE,
+                   filtered ? (AFUNPTR)TraceFilterIns : (AFUNPTR)TraceRecordIns,
+                   IARG_FAST_ANALYSIS_CALL,
+                   IARG_PTR, s,
+                   IARG_THREAD_ID,
+                   IARG_END);
+
+    /* iterate over each memory operand of the instruction. */
+    UINT32 refs = 0;
+    for (UINT32 memOp = 0; memOp < memOperands; memOp++)
+    {
+        if (INS_MemoryOperandIsRead(ins, memOp) && refs++ < nrefs) TraceInsertRef(ins, memOp, TRACE_REF_READ, s);
+        if (INS_MemoryOperandIsWritten(ins, memOp) && refs++ < nrefs) TraceInsertRef(ins, memOp, TRACE_REF_WRITE, s);
+    }
+    return;
+}
+
+/* ===================================================================== */
+/* Writer Side */
+/* ===================================================================== */
+/* TraceWriterPoll - pack and write the queued chunks of every thread */
+LOCALFUN BOOL TraceWriterPoll(VOID *arg)
+{
+    BOOL busy = false;
+    for (THREADID tid = 0; tid < MAX_CACHE_THREAD; tid++)
+    {
+        TRACE_THREAD &thread = TraceThreads[tid];
+        TRACE_JOB job;
+        while (thread.Full.pop(job))
+        {
+            busy = true;
+            if (!TraceWriter.Chunk(tid, job.buf, job.size, job.icount, job.count)) TraceFailed = true;
+            thread.Free.push(job.buf);
+        }
+    }
+    return busy;
+}
+
+/* ===================================================================== */
+/* Thread Start And Exit */
+/* ===================================================================== */
+LOCALFUN VOID TraceThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    ASSERTX(tid < MAX_CACHE_THREAD);
+    TRACE_THREAD &thread = TraceThreads[tid];
+    // a new thread may reuse the id of one that exited.
+    thread.Enc.ICount = 0;
+    const UINT32 filter = SimOpts->get_tracefilter();
+    if (filter && !thread.IFilter.Lines)
+    {
+        thread.IFilter.Init(filter >> TraceLineShift, SimOpts->get_tracefilter_assoc());
+        thread.DFilter.Init(filter >> TraceLineShift, SimOpts->get_tracefilter_assoc());
+    }
+    else if (filter)
+    {
+        // the lines the old thread left in the filters are not the new one's.
+        thread.IFilter.Reset();
+        thread.DFilter.Reset();
+    }
+    UINT8 *buf = NULL;
+    while (!(buf = TraceBuffer(thread))) PIN_Yield();
+    thread.Enc.Swap(buf, SimOpts->get_tracechunk());
+}
+
+LOCALFUN VOID TraceThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+    TraceFlush(TraceThreads[tid], true);
+}
+
+/* ===================================================================== */
+/* Printing Routines */
+/* ===================================================================== */
+LOCALFUN VOID trace_module_print()
+{
+    UINT64 icount = 0, stalls = 0, chunks = 0, dropped = 0;
+    UINT64 refs = 0, misses = 0, writebacks = 0;
+    for (UINT32 c = 0; c < TraceWriter.Index.size(); c++) icount += TraceWriter.Index[c].count;
+    for (THREADID tid = 0; tid < MAX_CACHE_THREAD; tid++)
+    {
+        const TRACE_THREAD &thread = TraceThreads[tid];
+        stalls += thread.Stalls;
+        chunks += thread.DropChunks;
+        dropped += thread.DropIns;
+        refs += thread.IFilter.Hits + thread.IFilter.Misses + thread.DFilter.Hits + thread.DFilter.Misses;
+        misses += thread.IFilter.Misses + thread.DFilter.Misses;
+        writebacks += thread.DFilter.Writebacks;
+    }
+
+    MACHINESIM_FPRINT(stdout, "trace of %llu instructions dumped into %s (%llu bytes packed into %llu)\n",
+                      (unsigned long long)icount, TraceName.c_str(), 
+                      (unsigned long long)TraceWriter.RawBytes, (unsigned long long)TraceWriter.PackedBytes);
+    if (stalls) MACHINESIM_FPRINT(stdout, "trace: threads waited %llu times for the writer\n", (unsigned long long)stalls);
+    if (chunks) MACHINESIM_FPRINT(stdout, "trace: dropped %llu chunks of %llu instructions\n", 
+                                  (unsigned long long)chunks, (unsigned long long)dropped);
+    if (refs) MACHINESIM_FPRINT(stdout, "trace: %llu of %llu line accesses missed the L1 filters, %llu writebacks\n",
+                                (unsigned long long)misses, (unsigned long long)refs, (unsigned long long)writebacks);
+}
+
+/* ===================================================================== */
+/* Module initialization and finialization functions */
+/* ===================================================================== */
+void MachineSimTraceModuleInit(void)
+{
+    if (!SimOpts->get_tracerecord()) return;
+
+    TraceName = SimOpts->get_tracefile();
+    if (TraceName.empty()) TraceName = "trace.out." + decstr(PIN_GetPid());
+    if (SimOpts->get_tracechunk() < TRACE_ENCODER::RecordMax(TRACE_REFS_MAX))
+    {
+        MACHINESIM_PRINT("Error: -tcchunk must be at least %u bytes\n", TRACE_ENCODER::RecordMax(TRACE_REFS_MAX));
+        PIN_ExitProcess(1);
+    }
+    if (SimOpts->get_tracebuffers() < 2 || SimOpts->get_tracebuffers() > TRACE_THREAD::RING_SIZE)
+    {
+        MACHINESIM_PRINT("Error: -tcbuffers must be between 2 and %d\n", TRACE_THREAD::RING_SIZE);
+        PIN_ExitProcess(1);
+    }
+    const UINT32 filter = SimOpts->get_tracefilter();
+    const UINT32 line = SimOpts->get_tracefilter_line();
+    const UINT32 assoc = SimOpts->get_tracefilter_assoc();
+    if (filter)
+    {
+        if (!IsPowerOfTwo(filter) || !IsPowerOfTwo(line) || !assoc || filter < line * assoc ||
+            !IsPowerOfTwo(filter / line / assoc))
+        {
+            MACHINESIM_PRINT("Error: -tcfilter %u -tcfilterassoc %u -tcfilterline %u is not a cache\n", filter, assoc, line);
+            PIN_ExitProcess(1);
+        }
+        TraceLineShift = FloorLog2(line);
+        TraceWriter.Header.flags = TRACE_FILTERED;
+        TraceWriter.Header.filtersize = filter;
+        TraceWriter.Header.filterassoc = assoc;
+        TraceWriter.Header.filterline = line;
+    }
+    if (!TraceWriter.Open(TraceName.c_str(), SimOpts->get_tracechunk(), SimOpts->get_tracewrite()))
+    {
+        MACHINESIM_PRINT("Error: could not create the trace file %s\n", TraceName.c_str());
+        PIN_ExitProcess(1);
+    }
+
+    TraceThreads = SimRingsNew<TRACE_THREAD>(MAX_CACHE_THREAD);
+    PIN_AddThreadStartFunction(TraceThreadStart, 0);
+    PIN_AddThreadFiniFunction(TraceThreadFini, 0);
+    if (!TraceWriterPoller.Start(TraceWriterPoll, NULL))
+    {
+        MACHINESIM_PRINT("Error: could not spawn the trace writer\n");
+        PIN_ExitProcess(1);
+    }
+}
+
+void MachineSimTraceModuleExit(void)
+{
+    if (!SimOpts->get_tracerecord()) return;
+
+    // queue the chunks of the threads still running and let the writer finish.
+    for (THREADID tid = 0; tid < MAX_CACHE_THREAD; tid++)
+    {
+        if (TraceThreads[tid].Enc.Buf) TraceFlush(TraceThreads[tid], true);
+    }
+    TraceWriterPoller.Exit();
+}
+
+void MachineSimTraceModuleFini(void)
+{
+    if (!SimOpts->get_tracerecord()) return;
+
+    if (!TraceWriter.Close() || TraceFailed) MACHINESIM_PRINT("Error: could not write the trace file %s\n", TraceName.c_str());
+    trace_module_print();
+
+    for (THREADID tid = 0; tid < MAX_CACHE_THREAD; tid++) 
+    {
+        UINT8 *buf = NULL;
+        while (TraceThreads[tid].Free.pop(buf)) delete [] buf;
+    }
+    SimRingsDelete(TraceThreads, MAX_CACHE_THREAD); TraceThreads = NULL;
+}
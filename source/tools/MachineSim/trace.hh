@@ -0,0 +1,1066 @@
+/*BEGIN_LEGAL
+Intel Open Source License
+
+Copyright (c) 2002-2011 Intel CorpORAtion. All rights reserved.
+
+Written by Xin Tong, University of Toronto.
+
+Redistribution and use in source and binary fORMs, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary fORM must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel CorpORAtion nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+
+/* ===================================================================== */
+/* This file contains the binary trace format of the PIN tool           */
+/* ===================================================================== */
+
+#ifndef PIN_TRACEFMT_H
+#define PIN_TRACEFMT_H
+
+/* this header is shared with the standalone trace tools, it must not */
+/* depend on pin.H.                                                    */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <vector>
+#include <unordered_map>
+
+/// @ TRACE - the binary trace written by -tc.
+//  @
+//  @ a file header is followed by chunks and the chunks by an index. every
+//  @ chunk holds the records of one thread, starting at some instruction
+//  @ of the thread, and is packed on its own so that it can be decoded
+//  @ without the ones before it. the index at the end lists the file offset,
+//  @ thread and instruction range of every chunk for seeking by instruction
+//  @ count. a trace cut short, e.g. by a crash, has no index and is read by
+//  @ walking the chunk headers instead.
+//  @
+//  @ a record is one executed instruction and the memory references it made:
+//  @
+//  @    tag      bit 0 set if the instruction bytes follow, bits 1-7 number
+//  @             of memory references
+//  @    [varint  filtered traces only, instructions since the last record]
+//  @    varint   pc minus the fall-through pc of the previous record, zigzag
+//  @    [u8      size of the instruction, followed by its bytes]
+//  @    per memory reference:
+//  @    varint   size << 2 | TRACE_REF_TYPE
+//  @    varint   address minus the end of the previous reference, zigzag
+//  @
+//  @ the bytes of a static instruction are stored only the first time it
+//  @ executes in a chunk. the deltas start from 0, and the instruction 
+//  @ count from the first instruction of the chunk, in every chunk.
+//  @
+//  @ a filtered trace only has the references that miss in private L1
+//  @ filter caches, as whole lines, and the dirty lines they write back. 
+//  @ only the instructions with such references have a record, but the 
+//  @ chunks still count every instruction.
+#define TRACE_MAGIC "MSIMTRAC"
+
+enum
+{
+   TRACE_VERSION    = 2,
+   TRACE_CHUNK_TAG  = 0x4b4e4843,   /* "CHNK" */
+   TRACE_INDEX_TAG  = 0x58444e49,   /* "INDX" */
+   TRACE_CHUNK_SIZE = 1 << 20,      /* default unpacked bytes per chunk */
+   TRACE_REC_DEF    = 1,
+   TRACE_REFS_MAX   = 127,
+   TRACE_INS_MAX    = 15
+};
+
+typedef enum
+{
+   TRACE_REF_READ=0,
+   TRACE_REF_WRITE,
+   TRACE_REF_WRITEBACK,  /* filtered traces, a dirty line evicted */
+   TRACE_REF_IFETCH      /* filtered traces, an instruction line missed */
+} TRACE_REF_TYPE;
+
+enum
+{
+   TRACE_FILTERED   = 1   /* TRACE_HEADER flags */
+};
+
+typedef struct
+{
+   char     magic[8];
+   uint32_t version;
+   uint32_t chunksize;   /* unpacked size of the chunk buffers */
+   uint32_t flags;
+   uint32_t filtersize;  /* bytes of each of the L1 filter caches */
+   uint32_t filterassoc;
+   uint32_t filterline;
+} TRACE_HEADER;
+
+typedef struct
+{
+   uint32_t tag;
+   uint32_t tid;
+   uint32_t rawsize;     /* unpacked bytes of records */
+   uint32_t packedsize;  /* bytes following, rawsize if stored unpacked */
+   uint64_t icount;      /* instructions of the thread before the chunk */
+   uint64_t count;       /* instructions in the chunk */
+} TRACE_CHUNK;
+
+typedef struct
+{
+   uint64_t offset;      /* file offset of the TRACE_CHUNK */
+   uint64_t icount;
+   uint64_t count;
+   uint32_t tid;
+   uint32_t rawsize;
+} TRACE_INDEX;
+
+typedef struct
+{
+   uint32_t tag;
+   uint32_t chunks;
+   uint64_t offset;      /* file offset of the index */
+   char     magic[8];
+} TRACE_FOOTER;
+
+/* ===================================================================== */
+/* Variable Length Integers */
+/* ===================================================================== */
+inline uint8_t *TracePutVar(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) { *p++ = (uint8_t)(v | 0x80); v >>= 7; }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/* TraceGetVar - NULL if the varint runs past end */
+inline const uint8_t *TraceGetVar(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+    uint64_t val = 0;
+    for (uint32_t shift = 0; p < end && shift < 64; shift += 7)
+    {
+        uint8_t b = *p++;
+        val |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) { *v = val; return p; }
+    }
+    return NULL;
+}
+
+inline uint64_t TraceZigZag(int64_t v)  { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+inline int64_t  TraceZagZig(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+/* ===================================================================== */
+/* Block Compression */
+/* ===================================================================== */
+/// @ a byte oriented LZ77 in the manner of LZ4. a sequence is a token, the
+//  @ literal bytes, a 16 bit little endian offset and the rest of the match
+//  @ length. the high nibble of the token is the literal length and the low
+//  @ nibble the match length minus 4, 15 meaning more bytes follow, each
+//  @ added until one is not 255. the last sequence has literals only.
+enum
+{
+   TRACE_LZ_MINMATCH = 4,
+   TRACE_LZ_HASHBITS = 14,
+   TRACE_LZ_MAXOFF   = 65535
+};
+
+/* TracePackBound - the largest packed size of n bytes */
+inline uint32_t TracePackBound(uint32_t n) { return n + n / 255 + 16; }
+
+inline uint8_t *TracePackLength(uint8_t *op, uint32_t len)
+{
+    for (len -= 15; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/* TracePack - pack n bytes of src into dst, return the packed size. the */
+/* table holds 1 << TRACE_LZ_HASHBITS entries.                           */
+inline uint32_t TracePack(const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t *table)
+{
+    const uint8_t *ip = src, *anchor = src, *end = src + n;
+    const uint8_t *limit = n > 12 ? end - 12 : src;
+    uint8_t *op = dst;
+
+    memset(table, 0, sizeof(uint32_t) << TRACE_LZ_HASHBITS);
+    while (ip < limit)
+    {
+        uint32_t seq, cand;
+        memcpy(&seq, ip, 4);
+        uint32_t h = (seq * 2654435761u) >> (32 - TRACE_LZ_HASHBITS);
+        const uint8_t *ref = src + table[h];
+        table[h] = (uint32_t)(ip - src);
+        memcpy(&cand, ref, 4);
+        if (ref >= ip || ip - ref > TRACE_LZ_MAXOFF || cand != seq) { ip++; continue; }
+
+        /* extend the match */
+        const uint8_t *m = ip + TRACE_LZ_MINMATCH, *r = ref + TRACE_LZ_MINMATCH;
+        while (m < end && *m == *r) { m++; r++; }
+
+        uint32_t lit = (uint32_t)(ip - anchor), len = (uint32_t)(m - ip) - TRACE_LZ_MINMATCH;
+        uint32_t off = (uint32_t)(ip - ref);
+        *op++ = (uint8_t)(((lit < 15 ? lit : 15) << 4) | (len < 15 ? len : 15));
+        if (lit >= 15) op = TracePackLength(op, lit);
+        memcpy(op, anchor, lit); op += lit;
+        *op++ = (uint8_t)off;
+        *op++ = (uint8_t)(off >> 8);
+        if (len >= 15) op = TracePackLength(op, len);
+        ip = anchor = m;
+    }
+
+    /* the last literals */
+    uint32_t lit = (uint32_t)(end - anchor);
+    *op++ = (uint8_t)((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15) op = TracePackLength(op, lit);
+    memcpy(op, anchor, lit); op += lit;
+    return (uint32_t)(op - dst);
+}
+
+inline const uint8_t *TraceUnpackLength(const uint8_t *ip, const uint8_t *end, uint32_t *len)
+{
+    uint8_t b;
+    do
+    {
+        if (ip >= end) return NULL;
+        b = *ip++;
+        *len += b;
+    } while (b == 255);
+    return ip;
+}
+
+/* TraceUnpack - unpack n bytes of src into dst of cap bytes. false if */
+/* src is corrupt.                                                      */
+inline bool TraceUnpack(const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t cap, uint32_t *size)
+{
+    const uint8_t *ip = src, *end = src + n;
+    uint8_t *op = dst, *oend = dst + cap;
+
+    while (ip < end)
+    {
+        uint32_t token = *ip++;
+        uint32_t len = token >> 4;
+        if (len == 15 && !(ip = TraceUnpackLength(ip, end, &len))) return false;
+        if (len > (uint32_t)(end - ip) || len > (uint32_t)(oend - op)) return false;
+        memcpy(op, ip, len); op += len; ip += len;
+        if (ip == end) break;
+
+        if (end - ip < 2) return false;
+        uint32_t off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!off || off > (uint32_t)(op - dst)) return false;
+        len = token & 15;
+        if (len == 15 && !(ip = TraceUnpackLength(ip, end, &len))) return false;
+        len += TRACE_LZ_MINMATCH;
+        if (len > (uint32_t)(oend - op)) return false;
+        /* the match may overlap what it produces */
+        const uint8_t *ref = op - off;
+        while (len--) *op++ = *ref++;
+    }
+    *size = (uint32_t)(op - dst);
+    return true;
+}
+
+/* ===================================================================== */
+/* Record Encoding And Decoding */
+/* ===================================================================== */
+/// @ TRACE_ENCODER - encode the records of one thread into a chunk buffer.
+//  @ static instructions are known by an id, given by the caller, which
+//  @ tells whether their bytes are in the chunk already.
+class TRACE_ENCODER
+{
+public:
+    uint8_t *Buf;
+    uint8_t *Cur;
+    uint8_t *End;
+    uint64_t NextPc;
+    uint64_t LastAddr;
+    uint64_t ICount;    /* instructions encoded so far */
+    uint64_t First;     /* ICount at the start of the chunk */
+    uint32_t Chunk;     /* chunks started so far */
+    std::vector<uint32_t> Seen;  /* chunk each static instruction was last stored in */
+    /* filtered traces */
+    uint8_t *Open;      /* tag of the record of the current instruction */
+    uint64_t LastIns;   /* instruction of the last record */
+
+    TRACE_ENCODER() : Buf(NULL), Cur(NULL), End(NULL), ICount(0), Chunk(0), Open(NULL) {}
+    ~TRACE_ENCODER() { delete [] Buf; }
+
+    void Init(uint32_t size) { Swap(new uint8_t[size], size); }
+
+    /* Swap - start a new chunk in buf, return the buffer of the last one */
+    uint8_t *Swap(uint8_t *buf, uint32_t size)
+    {
+        uint8_t *old = Buf;
+        Buf = buf;
+        End = buf + size;
+        Reset();
+        return old;
+    }
+
+    /* Reset - start a new chunk */
+    void Reset()
+    {
+        Cur = Buf;
+        NextPc = LastAddr = 0;
+        First = LastIns = ICount;
+        Open = NULL;
+        Chunk++;
+    }
+
+    uint32_t Size() const { return (uint32_t)(Cur - Buf); }
+    uint64_t Count() const { return ICount - First; }
+
+    /* RecordMax - the largest record of an instruction with nrefs references */
+    static uint32_t RecordMax(uint32_t nrefs) { return 1 + 10 + 10 + 1 + TRACE_INS_MAX + nrefs * (5 + 10); }
+    bool Fits(uint32_t bytes) const { return Cur + bytes <= End; }
+
+    /* Ins - start the record of an instruction, its nrefs references follow */
+    void Ins(uint32_t id, uint64_t pc, uint32_t size, const uint8_t *bytes, uint32_t nrefs)
+    {
+        Record(id, pc, size, bytes, nrefs, false);
+        ICount++;
+    }
+
+    /* Skip - count an instruction of a filtered trace, without a record */
+    void Skip()
+    {
+        ICount++;
+        Open = NULL;
+    }
+
+    /* Miss - add a reference of the last skipped instruction to its record */
+    void Miss(uint32_t id, uint64_t pc, uint32_t size, const uint8_t *bytes,
+              uint64_t addr, uint32_t refsize, uint32_t type)
+    {
+        if (!Open)
+        {
+            Open = Cur;
+            Record(id, pc, size, bytes, 0, true);
+        }
+        if ((*Open >> 1) == TRACE_REFS_MAX) return;
+        *Open += 2;
+        Ref(addr, refsize, type);
+    }
+
+    void Record(uint32_t id, uint64_t pc, uint32_t size, const uint8_t *bytes, uint32_t nrefs, bool filtered)
+    {
+        if (id >= Seen.size()) Seen.resize(id + 1024, 0);
+        uint8_t *p = Cur;
+        bool def = Seen[id] != Chunk;
+        *p++ = (uint8_t)((nrefs << 1) | (def ? TRACE_REC_DEF : 0));
+        if (filtered)
+        {
+            p = TracePutVar(p, ICount - 1 - LastIns);
+            LastIns = ICount - 1;
+        }
+        p = TracePutVar(p, TraceZigZag((int64_t)(pc - NextPc)));
+        if (def)
+        {
+            Seen[id] = Chunk;
+            *p++ = (uint8_t)size;
+            memcpy(p, bytes, size);
+            p += size;
+        }
+        Cur = p;
+        NextPc = pc + size;
+    }
+
+    void Ref(uint64_t addr, uint32_t size, uint32_t type)
+    {
+        uint8_t *p = TracePutVar(Cur, ((uint64_t)size << 2) | type);
+        Cur = TracePutVar(p, TraceZigZag((int64_t)(addr - LastAddr)));
+        LastAddr = addr + size;
+    }
+};
+
+typedef struct
+{
+   uint64_t addr;
+   uint32_t size;
+   uint32_t type;
+} TRACE_REF;
+
+/// @ TRACE_INS - a decoded record. bytes point into the chunk buffer.
+typedef struct
+{
+   uint64_t icount;    /* instruction of the thread */
+   uint64_t pc;
+   uint32_t size;
+   uint32_t nrefs;
+   const uint8_t *bytes;
+   TRACE_REF refs[TRACE_REFS_MAX];
+} TRACE_INS;
+
+/// @ TRACE_DECODER - decode the records of an unpacked chunk.
+class TRACE_DECODER
+{
+public:
+    const uint8_t *Cur;
+    const uint8_t *End;
+    uint64_t NextPc;
+    uint64_t LastAddr;
+    uint64_t ICount;    /* instruction of the next record */
+    bool Filtered;
+    std::unordered_map<uint64_t, const uint8_t*> Defs;  /* pc to size and bytes */
+    /* the defs found last, direct mapped by pc in front of Defs */
+    enum { DEF_CACHE = 1024 };
+    struct { uint64_t pc; const uint8_t *def; } DefCache[DEF_CACHE];
+
+    /* Begin - decode size bytes of a chunk starting at instruction icount */
+    void Begin(const uint8_t *raw, uint32_t size, uint64_t icount, bool filtered)
+    {
+        Cur = raw;
+        End = raw + size;
+        NextPc = LastAddr = 0;
+        ICount = icount;
+        Filtered = filtered;
+        Defs.clear();
+        memset(DefCache, 0, sizeof(DefCache));
+    }
+
+    /* Next - 1 for a record, 0 at the end of the chunk, -1 if corrupt */
+    int Next(TRACE_INS *ins)
+    {
+        if (Cur >= End) return 0;
+        const uint8_t *p = Cur;
+        uint64_t v;
+        uint32_t tag = *p++;
+        if (Filtered)
+        {
+            if (!(p = TraceGetVar(p, End, &v))) return -1;
+            ICount += v;
+        }
+        ins->icount = ICount;
+        if (!(p = TraceGetVar(p, End, &v))) return -1;
+        ins->pc = NextPc + (uint64_t)TraceZagZig(v);
+        const uint8_t *def;
+        if (tag & TRACE_REC_DEF)
+        {
+            if (p >= End || p + 1 + *p > End) return -1;
+            def = Defs[ins->pc] = p;
+            p += 1 + *p;
+        }
+        else if (DefCache[ins->pc % DEF_CACHE].pc == ins->pc && DefCache[ins->pc % DEF_CACHE].def)
+        {
+            def = DefCache[ins->pc % DEF_CACHE].def;
+        }
+        else
+        {
+            std::unordered_map<uint64_t, const uint8_t*>::const_iterator it = Defs.find(ins->pc);
+            if (it == Defs.end()) return -1;
+            def = it->second;
+        }
+        DefCache[ins->pc % DEF_CACHE].pc = ins->pc;
+        DefCache[ins->pc % DEF_CACHE].def = def;
+        ins->size = *def;
+        ins->bytes = def + 1;
+        ins->nrefs = tag >> 1;
+        for (uint32_t i = 0; i < ins->nrefs; i++)
+        {
+            if (!(p = TraceGetVar(p, End, &v))) return -1;
+            ins->refs[i].size = (uint32_t)(v >> 2);
+            ins->refs[i].type = (uint32_t)(v & 3);
+            if (!(p = TraceGetVar(p, End, &v))) return -1;
+            ins->refs[i].addr = LastAddr + (uint64_t)TraceZagZig(v);
+            LastAddr = ins->refs[i].addr + ins->refs[i].size;
+        }
+        NextPc = ins->pc + ins->size;
+        Cur = p;
+        if (!Filtered) ICount++;
+        return 1;
+    }
+};
+
+/* ===================================================================== */
+/* Foreign Traces */
+/* ===================================================================== */
+/// @ TRACE_FORMAT - the traces of other simulators, replayed as they are
+//  @ and converted both ways by tracecvt.
+//  @
+//  @ - TRACE_FORMAT_CHAMPSIM - the 64 byte input_instr records of ChampSim,
+//  @                           uncompressed, one per instruction with up to
+//  @                           4 loads and 2 stores, 0 for none.
+//  @ - TRACE_FORMAT_PCEA     - text, a line "pc ea type [size]" per memory
+//  @                           reference, type R or W, numbers in hex but
+//  @                           the sizes. a bare line "pc [size]" starts an
+//  @                           instruction, the reference lines of the same
+//  @                           pc after it are its references. without the
+//  @                           bare line the reference lines of the same pc
+//  @                           after each other are one instruction, which
+//  @                           merges the iterations of a rep string.
+//  @
+//  @ neither has the instruction bytes. an instruction without a size
+//  @ reaches up to the pc after it the first time it is seen, if that is at
+//  @ most TRACE_INS_MAX bytes on, TRACE_FOREIGN_INS bytes otherwise, its
+//  @ bytes are zero. a 
+//  @ reference without a size is TRACE_FOREIGN_REF bytes. foreign traces
+//  @ are a single thread, 0, cut into chunks of about TRACE_FOREIGN_RECORDS
+//  @ records.
+//  @
+//  @ tracecvt writes pcea with the bare lines and the sizes, a thread of a
+//  @ trace exported to it and replayed gives the report of the thread. 
+//  @ ChampSim is lossy: it only tells the line of a reference, not its
+//  @ size, so an access spanning lines touches just the first, it holds 4
+//  @ loads and 2 stores of an instruction, the others are dropped, and the
+//  @ branches tracecvt writes are guessed from the control flow.
+typedef enum
+{
+   TRACE_FORMAT_NATIVE=0,
+   TRACE_FORMAT_CHAMPSIM,
+   TRACE_FORMAT_PCEA
+} TRACE_FORMAT;
+
+enum
+{
+   TRACE_FOREIGN_INS     = 4,
+   TRACE_FOREIGN_REF     = 1,
+   TRACE_FOREIGN_RECORDS = 1 << 16,
+   TRACE_FOREIGN_LINE    = 256,   /* longest pcea line */
+   CHAMPSIM_DESTINATIONS = 2,
+   CHAMPSIM_SOURCES      = 4,
+   CHAMPSIM_REG_IP       = 26     /* REG_INSTRUCTION_POINTER */
+};
+
+/// @ CHAMPSIM_INSTR - a record of a ChampSim trace, its input_instr.
+typedef struct
+{
+   uint64_t ip;
+   uint8_t  is_branch;
+   uint8_t  branch_taken;
+   uint8_t  destination_registers[CHAMPSIM_DESTINATIONS];
+   uint8_t  source_registers[CHAMPSIM_SOURCES];
+   uint64_t destination_memory[CHAMPSIM_DESTINATIONS];
+   uint64_t source_memory[CHAMPSIM_SOURCES];
+} CHAMPSIM_INSTR;
+
+/* TraceNumber - the number at p in base, NULL if there is none */
+inline const char *TraceNumber(const char *p, const char *end, uint32_t base, uint64_t *v)
+{
+    if (base == 16 && end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+    const char *s = p;
+    uint64_t val = 0;
+    for (; p < end; p++)
+    {
+        uint32_t d;
+        if (*p >= '0' && *p <= '9') d = *p - '0';
+        else if (base == 16 && *p >= 'a' && *p <= 'f') d = *p - 'a' + 10;
+        else if (base == 16 && *p >= 'A' && *p <= 'F') d = *p - 'A' + 10;
+        else break;
+        val = val * base + d;
+    }
+    *v = val;
+    return p == s ? NULL : p;
+}
+
+inline const char *TraceBlank(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+/// @ TRACE_IMPORT - cut a foreign trace into chunks and encode them into
+//  @ records. Split works on the bytes read so far, Encode on a chunk Split
+//  @ returned. every thread needs one of its own.
+class TRACE_IMPORT
+{
+public:
+    uint32_t Format;
+    uint64_t Malformed;   /* pcea lines Split skipped */
+    std::unordered_map<uint64_t, uint32_t> Ids;   /* pc to static id */
+    std::vector<uint8_t> Sizes;                   /* id to size */
+
+    TRACE_IMPORT(uint32_t format = TRACE_FORMAT_NATIVE) : Format(format), Malformed(0) {}
+
+    /* Input - the largest chunk of the foreign trace, in bytes */
+    static uint32_t Input(uint32_t format)
+    {
+        return format == TRACE_FORMAT_CHAMPSIM ? TRACE_FOREIGN_RECORDS * sizeof(CHAMPSIM_INSTR) :
+                                                 (TRACE_FOREIGN_RECORDS + TRACE_REFS_MAX) * TRACE_FOREIGN_LINE;
+    }
+    /* Output - the largest chunk of records it is encoded into */
+    static uint32_t Output(uint32_t format)
+    {
+        return format == TRACE_FORMAT_CHAMPSIM ? 
+               TRACE_FOREIGN_RECORDS * TRACE_ENCODER::RecordMax(CHAMPSIM_SOURCES + CHAMPSIM_DESTINATIONS) :
+               (TRACE_FOREIGN_RECORDS + TRACE_REFS_MAX) * TRACE_ENCODER::RecordMax(1);
+    }
+
+    /* Split - the bytes of the first chunk of buf and its instructions, 0 */
+    /* if more is to be read first. last if buf reaches to the end.        */
+    uint32_t Split(const uint8_t *buf, uint32_t size, bool last, uint64_t *count)
+    {
+        return Walk(buf, size, last, count, NULL);
+    }
+
+    /* Encode - the records of a chunk Split returned, into a new chunk of */
+    /* enc, which holds Output bytes.                                      */
+    void Encode(const uint8_t *buf, uint32_t size, TRACE_ENCODER *enc)
+    {
+        uint64_t count;
+        enc->Reset();
+        Walk(buf, size, true, &count, enc);
+    }
+
+private:
+    /* Emit - an instruction of insize bytes, 0 if unknown, followed by the */
+    /* one at next, 0 if unknown.                                          */
+    void Emit(TRACE_ENCODER *enc, uint64_t pc, uint32_t insize, uint64_t next, const TRACE_REF *refs, uint32_t nrefs)
+    {
+        static const uint8_t zeros[TRACE_INS_MAX] = { 0 };
+        std::unordered_map<uint64_t, uint32_t>::iterator it = Ids.find(pc);
+        uint32_t id;
+        if (it != Ids.end()) id = it->second;
+        else
+        {
+            id = Ids[pc] = (uint32_t)Sizes.size();
+            if (insize && insize <= TRACE_INS_MAX) Sizes.push_back((uint8_t)insize);
+            else Sizes.push_back(next > pc && next - pc <= TRACE_INS_MAX ? (uint8_t)(next - pc) : (uint8_t)TRACE_FOREIGN_INS);
+        }
+        enc->Ins(id, pc, Sizes[id], zeros, nrefs);
+        for (uint32_t i = 0; i < nrefs; i++) enc->Ref(refs[i].addr, refs[i].size, refs[i].type);
+    }
+
+    /* Line - parse a pcea line, 1 for a reference or an instruction, which */
+    /* has a type of -1 and its size, 0 if none, in that of ref. 0 for a    */
+    /* blank or comment line, -1 if malformed.                              */
+    static int Line(const char *p, const char *end, uint64_t *pc, TRACE_REF *ref, int32_t *type)
+    {
+        uint64_t v;
+        const char *q;
+        p = TraceBlank(p, end);
+        if (p == end || *p == '#') return 0;
+        if (!(p = TraceNumber(p, end, 16, pc))) return -1;
+        p = TraceBlank(p, end);
+        *type = -1;
+        ref->size = 0;
+        if (p == end) return 1;
+        if ((q = TraceNumber(p, end, 10, &v)) && TraceBlank(q, end) == end)
+        {
+            if (v < (1U << 16)) ref->size = (uint32_t)v;
+            return 1;
+        }
+        if (!(p = TraceNumber(p, end, 16, &ref->addr))) return -1;
+        p = TraceBlank(p, end);
+        if (p == end) return -1;
+        switch (*p++)
+        {
+          case 'R': case 'r': case 'L': case '0': *type = TRACE_REF_READ; break;
+          case 'W': case 'w': case 'S': case '1': *type = TRACE_REF_WRITE; break;
+          default: return -1;
+        }
+        ref->type = (uint32_t)*type;
+        ref->size = TRACE_FOREIGN_REF;
+        if (p < end && *p != ' ' && *p != '\t' && *p != '\r') return -1;
+        p = TraceBlank(p, end);
+        if (p == end) return 1;
+        if (!(p = TraceNumber(p, end, 10, &v)) || TraceBlank(p, end) != end) return -1;
+        if (v && v < (1U << 16)) ref->size = (uint32_t)v;
+        return 1;
+    }
+
+    uint32_t Walk(const uint8_t *buf, uint32_t size, bool last, uint64_t *count, TRACE_ENCODER *enc)
+    {
+        *count = 0;
+        if (Format == TRACE_FORMAT_CHAMPSIM)
+        {
+            uint32_t n = size / sizeof(CHAMPSIM_INSTR);
+            if (n > TRACE_FOREIGN_RECORDS) n = TRACE_FOREIGN_RECORDS;
+            else if (n < TRACE_FOREIGN_RECORDS && !last) return 0;
+            *count = n;
+            for (uint32_t i = 0; enc && i < n; i++)
+            {
+                CHAMPSIM_INSTR r, next;
+                TRACE_REF refs[CHAMPSIM_SOURCES + CHAMPSIM_DESTINATIONS];
+                uint32_t nrefs = 0;
+                memcpy(&r, buf + i * sizeof(r), sizeof(r));
+                if (i + 1 < n) memcpy(&next, buf + (i + 1) * sizeof(r), sizeof(r));
+                else next.ip = 0;
+                for (uint32_t k = 0; k < CHAMPSIM_SOURCES; k++)
+                {
+                    if (!r.source_memory[k]) continue;
+                    TRACE_REF ref = { r.source_memory[k], TRACE_FOREIGN_REF, TRACE_REF_READ };
+                    refs[nrefs++] = ref;
+                }
+                for (uint32_t k = 0; k < CHAMPSIM_DESTINATIONS; k++)
+                {
+                    if (!r.destination_memory[k]) continue;
+                    TRACE_REF ref = { r.destination_memory[k], TRACE_FOREIGN_REF, TRACE_REF_WRITE };
+                    refs[nrefs++] = ref;
+                }
+                Emit(enc, r.ip, 0, next.ip, refs, nrefs);
+            }
+            return n * sizeof(CHAMPSIM_INSTR);
+        }
+
+        /* pcea, a chunk ends at a line starting an instruction, once it has */
+        /* TRACE_FOREIGN_RECORDS lines. an instruction with more references */
+        /* than a record holds goes on as another one.                      */
+        const char *p = (const char*)buf, *end = p + size;
+        uint32_t lines = 0, nrefs = 0, insize = 0;
+        uint64_t pc = 0;
+        bool pending = false;
+        TRACE_REF refs[TRACE_REFS_MAX];
+        while (p < end)
+        {
+            const char *eol = (const char*)memchr(p, '\n', end - p);
+            if (!eol && !last) break;
+            const char *next = eol ? eol + 1 : end;
+
+            uint64_t linepc;
+            TRACE_REF ref;
+            int32_t type;
+            int rc = Line(p, eol ? eol : end, &linepc, &ref, &type);
+            const bool more = rc > 0 && pending && type >= 0 && linepc == pc && nrefs < TRACE_REFS_MAX;
+            if (!more && lines >= TRACE_FOREIGN_RECORDS) 
+            {
+                if (enc && pending) Emit(enc, pc, insize, rc > 0 ? linepc : 0, refs, nrefs);
+                return (uint32_t)(p - (const char*)buf);
+            }
+            lines++;
+            p = next;
+            if (rc < 0 && !enc) Malformed++;
+            if (rc <= 0) continue;
+            if (more)
+            {
+                refs[nrefs++] = ref;
+                continue;
+            }
+            if (enc && pending) Emit(enc, pc, insize, linepc, refs, nrefs);
+            pc = linepc;
+            nrefs = 0;
+            insize = type < 0 ? ref.size : 0;
+            if (type >= 0) refs[nrefs++] = ref;
+            pending = true;
+            (*count)++;
+        }
+        if (!last) 
+        {
+            *count = 0;
+            return 0;
+        }
+        if (enc && pending) Emit(enc, pc, insize, 0, refs, nrefs);
+        return size;
+    }
+};
+
+/// @ TRACE_SPLITTER - read a foreign trace a chunk at a time, from a file
+//  @ or a pipe, through a buffer of the largest chunk.
+class TRACE_SPLITTER
+{
+public:
+    FILE *In;
+    TRACE_IMPORT Import;
+    std::vector<uint8_t> Buf;
+    uint32_t Begin;
+    uint32_t End;
+    bool Eof;
+    uint64_t Offset;   /* file offset of the next chunk */
+
+    TRACE_SPLITTER(FILE *in, uint32_t format) 
+        : In(in), Import(format), Buf(TRACE_IMPORT::Input(format)), Begin(0), End(0), Eof(false), Offset(0) {}
+
+    /* Next - 1 and the next chunk, which stays in the buffer until the */
+    /* next call, 0 at the end, -1 if unreadable or a line is too long. */
+    int Next(const uint8_t **data, uint32_t *size, uint64_t *count)
+    {
+        for (;;)
+        {
+            uint32_t n = Import.Split(&Buf[Begin], End - Begin, Eof, count);
+            if (n || Eof)
+            {
+                *data = &Buf[Begin];
+                *size = n;
+                Begin += n;
+                Offset += n;
+                return n ? 1 : 0;
+            }
+            if (Begin == 0 && End == Buf.size()) return -1;
+            memmove(&Buf[0], &Buf[Begin], End - Begin);
+            End -= Begin;
+            Begin = 0;
+            End += (uint32_t)fread(&Buf[End], 1, Buf.size() - End, In);
+            if (ferror(In)) return -1;
+            Eof = End < Buf.size();
+        }
+    }
+};
+
+/* ===================================================================== */
+/* Trace Files */
+/* ===================================================================== */
+/// @ TRACE_WRITER - write packed chunks and the index. not thread safe.
+//  @ with a staging buffer the file is written in writes of its size, at
+//  @ offsets aligned to it.
+class TRACE_WRITER
+{
+public:
+    FILE *Out;
+    uint64_t Offset;
+    uint32_t ChunkSize;
+    uint8_t *Packed;
+    uint32_t *Table;
+    void *Stage;
+    TRACE_HEADER Header;   /* flags and filter caches set before Open */
+    std::vector<TRACE_INDEX> Index;
+    uint64_t RawBytes;
+    uint64_t PackedBytes;
+
+    TRACE_WRITER() : Out(NULL), Packed(NULL), Table(NULL), Stage(NULL), RawBytes(0), PackedBytes(0)
+    {
+        memset(&Header, 0, sizeof(Header));
+    }
+    ~TRACE_WRITER() { if (Out) fclose(Out); delete [] Packed; delete [] Table; free(Stage); }
+
+    bool Open(const char *name, uint32_t chunksize, uint32_t stagesize = 0)
+    {
+        if (!(Out = fopen(name, "wb"))) return false;
+        if (stagesize && (posix_memalign(&Stage, 4096, stagesize) ||
+                          setvbuf(Out, (char*)Stage, _IOFBF, stagesize))) return false;
+        ChunkSize = chunksize;
+        Packed = new uint8_t[TracePackBound(chunksize)];
+        Table = new uint32_t[1 << TRACE_LZ_HASHBITS];
+
+        memcpy(Header.magic, TRACE_MAGIC, sizeof(Header.magic));
+        Header.version = TRACE_VERSION;
+        Header.chunksize = chunksize;
+        Offset = sizeof(Header);
+        return fwrite(&Header, sizeof(Header), 1, Out) == 1;
+    }
+
+    /* Chunk - pack and write the chunk of the encoder, if not empty */
+    bool Chunk(uint32_t tid, const TRACE_ENCODER &enc)
+    {
+        return Chunk(tid, enc.Buf, enc.Size(), enc.First, enc.Count());
+    }
+
+    /* Chunk - pack and write size bytes of records of thread tid, count */
+    /* instructions from instruction icount on. a filtered chunk may    */
+    /* have instructions but no records, it is written with size 0.     */
+    bool Chunk(uint32_t tid, const uint8_t *raw, uint32_t size, uint64_t icount, uint64_t count)
+    {
+        if (!size) return !count || Write(tid, raw, 0, 0, icount, count);
+        uint32_t packedsize = TracePack(raw, size, Packed, Table);
+        if (packedsize >= size) return Write(tid, raw, size, size, icount, count);
+        return Write(tid, Packed, size, packedsize, icount, count);
+    }
+
+    /* Write - write a chunk packed elsewhere, into packedsize bytes, which */
+    /* are rawsize if it did not pack.                                      */
+    bool Write(uint32_t tid, const uint8_t *data, uint32_t rawsize, uint32_t packedsize, uint64_t icount, uint64_t count)
+    {
+        if (!rawsize && !count) return true;
+        TRACE_CHUNK chunk;
+        chunk.tag = TRACE_CHUNK_TAG;
+        chunk.tid = tid;
+        chunk.rawsize = rawsize;
+        chunk.packedsize = packedsize;
+        chunk.icount = icount;
+        chunk.count = count;
+
+        TRACE_INDEX entry = { Offset, chunk.icount, chunk.count, tid, chunk.rawsize };
+        Index.push_back(entry);
+        Offset += sizeof(chunk) + chunk.packedsize;
+        RawBytes += chunk.rawsize;
+        PackedBytes += chunk.packedsize;
+        return fwrite(&chunk, sizeof(chunk), 1, Out) == 1 &&
+               fwrite(data, 1, chunk.packedsize, Out) == chunk.packedsize;
+    }
+
+    /* Close - write the index and the footer */
+    bool Close()
+    {
+        if (!Out) return true;
+        TRACE_FOOTER footer;
+        footer.tag = TRACE_INDEX_TAG;
+        footer.chunks = (uint32_t)Index.size();
+        footer.offset = Offset;
+        memcpy(footer.magic, TRACE_MAGIC, sizeof(footer.magic));
+        bool ok = (Index.empty() || fwrite(&Index[0], sizeof(TRACE_INDEX), Index.size(), Out) == Index.size()) &&
+                  fwrite(&footer, sizeof(footer), 1, Out) == 1;
+        ok = (fclose(Out) == 0) && ok;
+        Out = NULL;
+        return ok;
+    }
+};
+
+/// @ TRACE_READER - read the chunks of a trace by index. the chunks of a
+//  @ foreign trace are encoded into records as they are loaded, its index
+//  @ gives the file offset and the size of the foreign records of a chunk.
+class TRACE_READER
+{
+public:
+    FILE *In;
+    TRACE_HEADER Header;
+    std::vector<TRACE_INDEX> Index;
+    std::vector<uint8_t> Packed;
+    std::vector<uint8_t> Raw;
+    bool Truncated;      /* no index, the chunk headers were walked */
+    uint32_t Format;
+    TRACE_IMPORT Import;
+    TRACE_ENCODER Encoder;
+
+    TRACE_READER() : In(NULL), Truncated(false), Format(TRACE_FORMAT_NATIVE) {}
+    ~TRACE_READER() { if (In) fclose(In); }
+
+    bool Open(const char *name, uint32_t format = TRACE_FORMAT_NATIVE)
+    {
+        if (!(In = fopen(name, "rb"))) return false;
+        if (format != TRACE_FORMAT_NATIVE) return OpenForeign(format);
+        if (fread(&Header, sizeof(Header), 1, In) != 1 ||
+            memcmp(Header.magic, TRACE_MAGIC, sizeof(Header.magic)) ||
+            Header.version != TRACE_VERSION) return false;
+        Buffers(TRACE_FORMAT_NATIVE);
+
+        /* the index at the end */
+        TRACE_FOOTER footer;
+        if (!fseeko(In, -(off_t)sizeof(footer), SEEK_END) && fread(&footer, sizeof(footer), 1, In) == 1 &&
+            footer.tag == TRACE_INDEX_TAG && !memcmp(footer.magic, TRACE_MAGIC, sizeof(footer.magic)))
+        {
+            Index.resize(footer.chunks);
+            if (!footer.chunks) return true;
+            if (!fseeko(In, (off_t)footer.offset, SEEK_SET) &&
+                fread(&Index[0], sizeof(TRACE_INDEX), footer.chunks, In) == footer.chunks) return true;
+            Index.clear();
+        }
+
+        /* or walk the chunks up to the first one cut short */
+        Truncated = true;
+        uint64_t offset = sizeof(Header);
+        TRACE_CHUNK chunk;
+        while (!fseeko(In, (off_t)offset, SEEK_SET) && fread(&chunk, sizeof(chunk), 1, In) == 1 &&
+               chunk.tag == TRACE_CHUNK_TAG && chunk.rawsize <= Header.chunksize &&
+               chunk.packedsize <= Packed.size())
+        {
+            if (fseeko(In, (off_t)chunk.packedsize - 1, SEEK_CUR) || fgetc(In) == EOF) break;
+            TRACE_INDEX entry = { offset, chunk.icount, chunk.count, chunk.tid, chunk.rawsize };
+            Index.push_back(entry);
+            offset += sizeof(chunk) + chunk.packedsize;
+        }
+        return true;
+    }
+
+    /* Open - the file of another reader of the trace, with its index */
+    bool Open(const char *name, const TRACE_READER &same)
+    {
+        if (!(In = fopen(name, "rb"))) return false;
+        Header = same.Header;
+        Index = same.Index;
+        Truncated = same.Truncated;
+        Buffers(same.Format);
+        return true;
+    }
+
+    uint32_t Chunks() const { return (uint32_t)Index.size(); }
+
+    /* Load - read and unpack chunk i and start decoding it */
+    bool Load(uint32_t i, TRACE_DECODER *dec)
+    {
+        TRACE_CHUNK chunk;
+        uint32_t size;
+        if (Format != TRACE_FORMAT_NATIVE)
+        {
+            if (i >= Index.size() || Index[i].rawsize > Packed.size() || fseeko(In, (off_t)Index[i].offset, SEEK_SET) ||
+                fread(&Packed[0], 1, Index[i].rawsize, In) != Index[i].rawsize) return false;
+            Import.Encode(&Packed[0], Index[i].rawsize, &Encoder);
+            dec->Begin(Encoder.Buf, Encoder.Size(), Index[i].icount, false);
+            return true;
+        }
+        if (i >= Index.size() || fseeko(In, (off_t)Index[i].offset, SEEK_SET) ||
+            fread(&chunk, sizeof(chunk), 1, In) != 1 || chunk.tag != TRACE_CHUNK_TAG ||
+            chunk.rawsize > Raw.size() || chunk.packedsize > Packed.size()) return false;
+        if (chunk.packedsize == chunk.rawsize)
+        {
+            if (fread(&Raw[0], 1, chunk.rawsize, In) != chunk.rawsize) return false;
+        }
+        else if (fread(&Packed[0], 1, chunk.packedsize, In) != chunk.packedsize ||
+                 !TraceUnpack(&Packed[0], chunk.packedsize, &Raw[0], (uint32_t)Raw.size(), &size) ||
+                 size != chunk.rawsize) return false;
+        dec->Begin(&Raw[0], chunk.rawsize, chunk.icount, (Header.flags & TRACE_FILTERED) != 0);
+        return true;
+    }
+
+    /* Find - the chunk of thread tid holding its instruction icount, -1 if none */
+    int64_t Find(uint32_t tid, uint64_t icount) const
+    {
+        for (uint32_t i = 0; i < Index.size(); i++)
+        {
+            if (Index[i].tid == tid && icount >= Index[i].icount &&
+                icount < Index[i].icount + Index[i].count) return i;
+        }
+        return -1;
+    }
+
+private:
+    void Buffers(uint32_t format)
+    {
+        Format = Import.Format = format;
+        if (format == TRACE_FORMAT_NATIVE)
+        {
+            Raw.resize(Header.chunksize);
+            Packed.resize(TracePackBound(Header.chunksize));
+            return;
+        }
+        Packed.resize(TRACE_IMPORT::Input(format));
+        Encoder.Init(TRACE_IMPORT::Output(format));
+    }
+
+    /* OpenForeign - index a foreign trace. ChampSim records are cut by */
+    /* their number, a pcea trace is read through once.                 */
+    bool OpenForeign(uint32_t format)
+    {
+        memcpy(Header.magic, TRACE_MAGIC, sizeof(Header.magic));
+        Header.version = TRACE_VERSION;
+        Header.chunksize = TRACE_IMPORT::Output(format);
+        Header.flags = Header.filtersize = Header.filterassoc = Header.filterline = 0;
+        Buffers(format);
+
+        if (format == TRACE_FORMAT_CHAMPSIM)
+        {
+            if (fseeko(In, 0, SEEK_END)) return false;
+            const uint64_t records = (uint64_t)ftello(In) / sizeof(CHAMPSIM_INSTR);
+            Truncated = (uint64_t)ftello(In) % sizeof(CHAMPSIM_INSTR) != 0;
+            for (uint64_t r = 0; r < records; r += TRACE_FOREIGN_RECORDS)
+            {
+                const uint64_t count = records - r < TRACE_FOREIGN_RECORDS ? records - r : TRACE_FOREIGN_RECORDS;
+                TRACE_INDEX entry = { r * sizeof(CHAMPSIM_INSTR), r, count, 0, (uint32_t)(count * sizeof(CHAMPSIM_INSTR)) };
+                Index.push_back(entry);
+            }
+            return true;
+        }
+
+        TRACE_SPLITTER split(In, format);
+        const uint8_t *data;
+        uint32_t size;
+        uint64_t count, icount = 0, offset = 0;
+        int rc;
+        while ((rc = split.Next(&data, &size, &count)) > 0)
+        {
+            TRACE_INDEX entry = { offset, icount, count, 0, size };
+            Index.push_back(entry);
+            icount += count;
+            offset = split.Offset;
+        }
+        Import.Malformed = split.Import.Malformed;
+        return rc == 0;
+    }
+};
+
+#endif // PIN_TRACEFMT_H
@@ -0,0 +1,651 @@
+/*BEGIN_LEGAL
+Intel Open Source License
+
+Copyright (c) 2002-2011 Intel CorpORAtion. All rights reserved.
+
+Written by Xin Tong, University of Toronto.
+
+Redistribution and use in source and binary fORMs, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary fORM must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel CorpORAtion nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+
+/* ===================================================================== */
+/* This file contains the trace converter of the PIN tool               */
+/* ===================================================================== */
+/// tracecvt converts the text traces of the old -tc into the binary
+/// format of trace.hh, and prints binary traces in the old text format.
+/// it also converts the foreign traces of trace.hh, ChampSim and pcea, 
+/// both ways.
+///
+///    tracecvt [-chunk bytes] <text> <binary>   convert a text trace
+///    tracecvt -d <binary> [tid [icount]]       print a binary trace as text
+///    tracecvt -i <binary>                      print the chunk index
+///    tracecvt [-threads n] -import <format> <foreign> <binary>
+///    tracecvt [-threads n] -export <format> <binary> <foreign> [tid]
+///
+/// a foreign trace of - is read from stdin or written to stdout, e.g. for
+/// xz compressed ChampSim traces. the chunks are converted on n threads,
+/// one per processor by default. an export writes the chunks of all the 
+/// threads in the order of the trace, or those of thread tid. a thread
+/// exported to pcea comes back as it was, but for the instruction bytes.
+/// ChampSim loses the reference sizes and the references past 4 loads and
+/// 2 stores of an instruction, the export tells how many it dropped.
+///
+/// the text trace has a line per instruction, its pc, size, number of
+/// memory operands and bytes, followed by a line per memory reference,
+/// 0x00 for a read or 0x01 for a write, the address and the size. it does
+/// not tell the threads apart, everything is converted as thread 0.
+/// printed binary traces give the number of references in place of the
+/// number of memory operands, and a comment line at every chunk. filtered
+/// traces also have 0x02 for a writeback and 0x03 for an instruction line,
+/// and the instruction count in front of every instruction, after an @.
+
+#include "trace.hh"
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+/* ===================================================================== */
+/* Globals variables */
+/* ===================================================================== */
+typedef struct
+{
+   uint64_t pc;
+   uint32_t size;
+   uint8_t  bytes[TRACE_INS_MAX];
+} CVT_STATIC;
+
+static std::vector<CVT_STATIC> Statics;
+static std::unordered_map<uint64_t, uint32_t> StaticIds;
+
+/* ===================================================================== */
+/* Text To Binary */
+/* ===================================================================== */
+/* ParseHex - a %p printed address, (nil) for 0 */
+static bool ParseHex(const char *s, uint64_t *v)
+{
+    char *end;
+    if (!strcmp(s, "(nil)")) { *v = 0; return true; }
+    *v = strtoull(s, &end, 16);
+    return end != s && !*end;
+}
+
+/* StaticId - the id of the static instruction, a new one if the bytes */
+/* at pc changed.                                                       */
+static uint32_t StaticId(const CVT_STATIC &ins)
+{
+    std::unordered_map<uint64_t, uint32_t>::iterator it = StaticIds.find(ins.pc);
+    if (it != StaticIds.end())
+    {
+        const CVT_STATIC &old = Statics[it->second];
+        if (old.size == ins.size && !memcmp(old.bytes, ins.bytes, ins.size)) return it->second;
+    }
+    uint32_t id = (uint32_t)Statics.size();
+    Statics.push_back(ins);
+    StaticIds[ins.pc] = id;
+    return id;
+}
+
+static bool Emit(TRACE_WRITER &out, TRACE_ENCODER &enc, const CVT_STATIC &ins, const std::vector<TRACE_REF> &refs)
+{
+    uint32_t nrefs = refs.size() < TRACE_REFS_MAX ? (uint32_t)refs.size() : (uint32_t)TRACE_REFS_MAX;
+    if (!enc.Fits(TRACE_ENCODER::RecordMax(nrefs)))
+    {
+        if (!out.Chunk(0, enc)) return false;
+        enc.Reset();
+    }
+    enc.Ins(StaticId(ins), ins.pc, ins.size, ins.bytes, nrefs);
+    for (uint32_t i = 0; i < nrefs; i++) enc.Ref(refs[i].addr, refs[i].size, refs[i].type);
+    return true;
+}
+
+static int Convert(const char *text, const char *binary, uint32_t chunksize)
+{
+    FILE *in = fopen(text, "r");
+    if (!in) { fprintf(stderr, "tracecvt: can not open %s\n", text); return 1; }
+    TRACE_WRITER out;
+    if (!out.Open(binary, chunksize)) { fprintf(stderr, "tracecvt: can not create %s\n", binary); return 1; }
+    TRACE_ENCODER enc;
+    enc.Init(chunksize);
+
+    CVT_STATIC ins;
+    std::vector<TRACE_REF> refs;
+    bool pending = false, ok = true;
+    uint64_t lineno = 0, skipped = 0;
+    char line[1024];
+    while (ok && fgets(line, sizeof(line), in))
+    {
+        char *tok[3 + TRACE_INS_MAX];
+        uint32_t n = 0;
+        lineno++;
+        for (char *s = strtok(line, " \t\r\n"); s && n < 3 + TRACE_INS_MAX; s = strtok(NULL, " \t\r\n")) tok[n++] = s;
+        if (!n || tok[0][0] == '#') continue;
+
+        if (n == 3 && (!strcmp(tok[0], "0x00") || !strcmp(tok[0], "0x01")))
+        {
+            /* a memory reference of the pending instruction */
+            TRACE_REF ref;
+            ref.type = tok[0][3] == '1' ? TRACE_REF_WRITE : TRACE_REF_READ;
+            ref.size = (uint32_t)strtoul(tok[2], NULL, 10);
+            if (pending && ParseHex(tok[1], &ref.addr)) { refs.push_back(ref); continue; }
+        }
+        else if (n >= 3)
+        {
+            /* a new instruction, the references of the last one are complete */
+            CVT_STATIC next;
+            uint32_t i;
+            next.size = (uint32_t)strtoul(tok[1], NULL, 10);
+            if (ParseHex(tok[0], &next.pc) && next.size && next.size <= TRACE_INS_MAX && n == 3 + next.size)
+            {
+                for (i = 0; i < next.size; i++)
+                {
+                    uint64_t b;
+                    if (!ParseHex(tok[3 + i], &b) || b > 0xff) break;
+                    next.bytes[i] = (uint8_t)b;
+                }
+                if (i == next.size)
+                {
+                    if (pending) ok = Emit(out, enc, ins, refs);
+                    ins = next;
+                    refs.clear();
+                    pending = true;
+                    continue;
+                }
+            }
+        }
+        /* threads writing at the same time garble lines of the text trace */
+        if (!skipped++) fprintf(stderr, "tracecvt: %s:%llu: skipping malformed lines\n", text, (unsigned long long)lineno);
+    }
+    fclose(in);
+
+    if (ok && pending) ok = Emit(out, enc, ins, refs);
+    ok = ok && out.Chunk(0, enc);
+    ok = out.Close() && ok;
+    if (!ok) { fprintf(stderr, "tracecvt: can not write %s\n", binary); return 1; }
+
+    fprintf(stderr, "tracecvt: %llu instructions, %llu malformed lines skipped, %llu bytes packed into %llu\n",
+            (unsigned long long)enc.ICount, (unsigned long long)skipped,
+            (unsigned long long)out.RawBytes, (unsigned long long)out.PackedBytes);
+    return 0;
+}
+
+/* ===================================================================== */
+/* Binary To Text */
+/* ===================================================================== */
+static int Print(const char *binary, int64_t tid, uint64_t icount)
+{
+    TRACE_READER in;
+    if (!in.Open(binary)) { fprintf(stderr, "tracecvt: %s is not a trace\n", binary); return 1; }
+
+    /* seek to the chunk of the instruction */
+    uint32_t first = 0;
+    if (tid >= 0)
+    {
+        int64_t c = in.Find((uint32_t)tid, icount);
+        if (c < 0) { fprintf(stderr, "tracecvt: thread %lld has no instruction %llu\n", (long long)tid, (unsigned long long)icount); return 1; }
+        first = (uint32_t)c;
+    }
+
+    TRACE_DECODER dec;
+    TRACE_INS ins;
+    for (uint32_t c = first; c < in.Chunks(); c++)
+    {
+        const TRACE_INDEX &chunk = in.Index[c];
+        if (tid >= 0 && chunk.tid != tid) continue;
+        if (!in.Load(c, &dec)) { fprintf(stderr, "tracecvt: chunk %u is corrupt\n", c); return 1; }
+        printf("# chunk %u thread %u icount %llu\n", c, chunk.tid, (unsigned long long)chunk.icount);
+
+        int rc;
+        while ((rc = dec.Next(&ins)) > 0)
+        {
+            if (tid >= 0 && ins.icount < icount) continue;
+            if (in.Header.flags & TRACE_FILTERED) printf("@%llu ", (unsigned long long)ins.icount);
+            printf("0x%llx  %u  %u  ", (unsigned long long)ins.pc, ins.size, ins.nrefs);
+            for (uint32_t i = 0; i < ins.size; i++) printf("%x ", ins.bytes[i]);
+            printf("\n");
+            for (uint32_t i = 0; i < ins.nrefs; i++)
+                printf("0x0%u 0x%llx %u\n", ins.refs[i].type, (unsigned long long)ins.refs[i].addr, ins.refs[i].size);
+        }
+        if (rc < 0) { fprintf(stderr, "tracecvt: chunk %u is corrupt\n", c); return 1; }
+    }
+    return 0;
+}
+
+static int PrintIndex(const char *binary)
+{
+    TRACE_READER in;
+    if (!in.Open(binary)) { fprintf(stderr, "tracecvt: %s is not a trace\n", binary); return 1; }
+
+    uint64_t count = 0, raw = 0;
+    if (in.Header.flags & TRACE_FILTERED)
+        printf("# filtered by %u byte %u way L1 caches of %u byte lines\n",
+               in.Header.filtersize, in.Header.filterassoc, in.Header.filterline);
+    printf("# chunk offset thread icount count bytes\n");
+    for (uint32_t c = 0; c < in.Chunks(); c++)
+    {
+        const TRACE_INDEX &chunk = in.Index[c];
+        printf("%u %llu %u %llu %llu %u\n", c, (unsigned long long)chunk.offset, chunk.tid,
+               (unsigned long long)chunk.icount, (unsigned long long)chunk.count, chunk.rawsize);
+        count += chunk.count;
+        raw += chunk.rawsize;
+    }
+    printf("# %u chunks, %llu instructions, %llu bytes unpacked%s\n", in.Chunks(), (unsigned long long)count,
+           (unsigned long long)raw, in.Truncated ? ", no index (trace cut short)" : "");
+    return 0;
+}
+
+/* ===================================================================== */
+/* Conversion Workers */
+/* ===================================================================== */
+/// -import and -export convert the chunks on worker threads. the main 
+/// thread hands the chunks out in order through a ring of jobs and writes
+/// the converted ones in the same order, reading and writing the traces
+/// as streams.
+typedef enum
+{
+   CVT_FREE=0,
+   CVT_QUEUED,
+   CVT_DONE
+} CVT_STATE;
+
+typedef struct
+{
+   uint32_t state;
+   bool     ok;
+   uint32_t chunk;            /* export: chunk of the binary trace */
+   uint32_t tid;              /* export: its thread */
+   uint64_t firstpc;          /* export: pc of its first instruction */
+   uint64_t lastnext;         /* export: fall-through pc of its last one */
+   uint64_t dropped;          /* export: references ChampSim has no room for */
+   uint64_t icount;           /* import: first instruction of the chunk */
+   uint64_t count;            /* import: instructions of the chunk */
+   uint32_t rawsize;          /* import: bytes of records packed into out */
+   std::vector<uint8_t> in;   /* import: the foreign records */
+   std::vector<uint8_t> out;
+} CVT_JOB;
+
+typedef struct
+{
+   pthread_t thread;
+   TRACE_IMPORT import;
+   TRACE_ENCODER enc;
+   std::vector<uint32_t> table;
+   TRACE_READER reader;
+   TRACE_DECODER dec;
+} CVT_WORKER;
+
+typedef bool (*CVT_FUN)(CVT_WORKER *worker, CVT_JOB *job);
+typedef bool (*CVT_WRITE)(CVT_JOB *job);
+
+static uint32_t CvtThreads = 0;
+static uint32_t CvtFormat = TRACE_FORMAT_NATIVE;
+static CVT_FUN CvtWork = NULL;
+static CVT_WORKER *CvtWorkers = NULL;
+static CVT_JOB *CvtJobs = NULL;
+static uint32_t CvtSlots = 0;
+static uint64_t CvtQueued = 0;   /* jobs queued so far */
+static uint64_t CvtTaken = 0;    /* jobs taken by the workers */
+static bool CvtClosed = false;
+static pthread_mutex_t CvtLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t CvtCond = PTHREAD_COND_INITIALIZER;
+
+static void *CvtRun(void *arg)
+{
+    CVT_WORKER *worker = (CVT_WORKER*)arg;
+    pthread_mutex_lock(&CvtLock);
+    for (;;)
+    {
+        while (CvtTaken == CvtQueued && !CvtClosed) pthread_cond_wait(&CvtCond, &CvtLock);
+        if (CvtTaken == CvtQueued) break;
+        CVT_JOB *job = &CvtJobs[CvtTaken++ % CvtSlots];
+        pthread_mutex_unlock(&CvtLock);
+        job->ok = CvtWork(worker, job);
+        pthread_mutex_lock(&CvtLock);
+        job->state = CVT_DONE;
+        pthread_cond_broadcast(&CvtCond);
+    }
+    pthread_mutex_unlock(&CvtLock);
+    return NULL;
+}
+
+/* CvtStart - start the workers, reading binary through trace to export */
+static void CvtStart(CVT_FUN work, const char *binary, const TRACE_READER *trace)
+{
+    if (!CvtThreads) CvtThreads = (uint32_t)std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    CvtWork = work;
+    CvtSlots = 2 * CvtThreads;
+    CvtJobs = new CVT_JOB[CvtSlots];
+    CvtWorkers = new CVT_WORKER[CvtThreads];
+    for (uint32_t i = 0; i < CvtSlots; i++) CvtJobs[i].state = CVT_FREE;
+    for (uint32_t i = 0; i < CvtThreads; i++)
+    {
+        CVT_WORKER &worker = CvtWorkers[i];
+        if (trace) worker.reader.Open(binary, *trace);
+        else
+        {
+            worker.import.Format = CvtFormat;
+            worker.enc.Init(TRACE_IMPORT::Output(CvtFormat));
+            worker.table.resize(1 << TRACE_LZ_HASHBITS);
+        }
+        pthread_create(&worker.thread, NULL, CvtRun, &worker);
+    }
+}
+
+/* CvtRetire - wait for a queued job and write it */
+static bool CvtRetire(CVT_JOB *job, CVT_WRITE write)
+{
+    pthread_mutex_lock(&CvtLock);
+    while (job->state != CVT_DONE) pthread_cond_wait(&CvtCond, &CvtLock);
+    pthread_mutex_unlock(&CvtLock);
+    job->state = CVT_FREE;
+    return job->ok && write(job);
+}
+
+/* CvtNext - the job of the next chunk, the one it held written first */
+static CVT_JOB *CvtNext(CVT_WRITE write, bool *ok)
+{
+    CVT_JOB *job = &CvtJobs[CvtQueued % CvtSlots];
+    if (job->state != CVT_FREE) *ok = CvtRetire(job, write) && *ok;
+    return job;
+}
+
+static void CvtQueue(CVT_JOB *job)
+{
+    pthread_mutex_lock(&CvtLock);
+    job->state = CVT_QUEUED;
+    CvtQueued++;
+    pthread_cond_broadcast(&CvtCond);
+    pthread_mutex_unlock(&CvtLock);
+}
+
+/* CvtStop - write the jobs still queued and stop the workers */
+static bool CvtStop(CVT_WRITE write)
+{
+    bool ok = true;
+    for (uint64_t k = CvtQueued > CvtSlots ? CvtQueued - CvtSlots : 0; k < CvtQueued; k++)
+        ok = CvtRetire(&CvtJobs[k % CvtSlots], write) && ok;
+
+    pthread_mutex_lock(&CvtLock);
+    CvtClosed = true;
+    pthread_cond_broadcast(&CvtCond);
+    pthread_mutex_unlock(&CvtLock);
+    for (uint32_t i = 0; i < CvtThreads; i++) pthread_join(CvtWorkers[i].thread, NULL);
+    delete [] CvtWorkers;
+    delete [] CvtJobs;
+    return ok;
+}
+
+/* FormatOf - the foreign format of a name, -1 if unknown */
+static int FormatOf(const char *name)
+{
+    if (!strcmp(name, "champsim")) return TRACE_FORMAT_CHAMPSIM;
+    if (!strcmp(name, "pcea")) return TRACE_FORMAT_PCEA;
+    return -1;
+}
+
+/* ===================================================================== */
+/* Foreign To Binary */
+/* ===================================================================== */
+static TRACE_WRITER CvtWriter;
+
+/* ImportWork - encode and pack the foreign records of a chunk */
+static bool ImportWork(CVT_WORKER *worker, CVT_JOB *job)
+{
+    worker->import.Encode(&job->in[0], (uint32_t)job->in.size(), &worker->enc);
+    job->rawsize = worker->enc.Size();
+    job->out.resize(TracePackBound(job->rawsize));
+    uint32_t packed = TracePack(worker->enc.Buf, job->rawsize, &job->out[0], &worker->table[0]);
+    if (packed >= job->rawsize)
+    {
+        memcpy(&job->out[0], worker->enc.Buf, job->rawsize);
+        packed = job->rawsize;
+    }
+    job->out.resize(packed);
+    return true;
+}
+
+static bool ImportWrite(CVT_JOB *job)
+{
+    return CvtWriter.Write(0, &job->out[0], job->rawsize, (uint32_t)job->out.size(), job->icount, job->count);
+}
+
+static int Import(const char *foreign, const char *binary)
+{
+    FILE *in = strcmp(foreign, "-") ? fopen(foreign, "rb") : stdin;
+    if (!in) { fprintf(stderr, "tracecvt: can not open %s\n", foreign); return 1; }
+    if (!CvtWriter.Open(binary, TRACE_IMPORT::Output(CvtFormat))) { fprintf(stderr, "tracecvt: can not create %s\n", binary); return 1; }
+
+    CvtStart(ImportWork, NULL, NULL);
+    TRACE_SPLITTER split(in, CvtFormat);
+    const uint8_t *data;
+    uint32_t size;
+    uint64_t count, icount = 0;
+    bool ok = true;
+    int rc;
+    while ((rc = split.Next(&data, &size, &count)) > 0)
+    {
+        CVT_JOB *job = CvtNext(ImportWrite, &ok);
+        job->in.assign(data, data + size);
+        job->icount = icount;
+        job->count = count;
+        icount += count;
+        CvtQueue(job);
+    }
+    ok = CvtStop(ImportWrite) && ok;
+    if (in != stdin) fclose(in);
+    if (rc < 0) fprintf(stderr, "tracecvt: can not read %s, or it has lines longer than %u bytes\n", foreign, TRACE_FOREIGN_LINE);
+    ok = CvtWriter.Close() && ok;
+    if (!ok) fprintf(stderr, "tracecvt: can not write %s\n", binary);
+    if (!ok || rc < 0) return 1;
+
+    fprintf(stderr, "tracecvt: %llu instructions, %llu malformed lines skipped, %llu bytes packed into %llu\n",
+            (unsigned long long)icount, (unsigned long long)split.Import.Malformed,
+            (unsigned long long)CvtWriter.RawBytes, (unsigned long long)CvtWriter.PackedBytes);
+    return 0;
+}
+
+/* ===================================================================== */
+/* Binary To Foreign */
+/* ===================================================================== */
+/// ChampSim records carry the branches the front end simulates. the trace
+/// does not tell them, an instruction the next one of its thread does not
+/// follow is a taken branch, written as a direct jump, that is a write of
+/// the instruction pointer. branches not taken are not marked.
+static FILE *CvtOut = NULL;
+static uint64_t CvtInstructions = 0;
+static uint64_t CvtDropped = 0;
+/* the last ChampSim record written, held until the next pc of its thread */
+static CHAMPSIM_INSTR CvtLast;
+static bool CvtLastHeld = false;
+static uint32_t CvtLastTid = 0;
+static uint64_t CvtLastNext = 0;
+
+/* ChampSimBranch - mark a record a taken branch if next does not follow */
+static void ChampSimBranch(CHAMPSIM_INSTR *r, uint64_t fallthrough, uint64_t next)
+{
+    if (next == fallthrough) return;
+    r->is_branch = r->branch_taken = 1;
+    r->destination_registers[0] = CHAMPSIM_REG_IP;
+}
+
+static void ChampSimAppend(std::vector<uint8_t> &out, const CHAMPSIM_INSTR &r)
+{
+    const uint8_t *p = (const uint8_t*)&r;
+    out.insert(out.end(), p, p + sizeof(r));
+}
+
+/* ExportWork - decode a chunk and write its instructions as foreign records */
+static bool ExportWork(CVT_WORKER *worker, CVT_JOB *job)
+{
+    TRACE_INS ins;
+    int rc;
+    job->out.clear();
+    job->dropped = 0;
+    job->count = 0;
+    if (!worker->reader.In || !worker->reader.Load(job->chunk, &worker->dec)) return false;
+
+    if (CvtFormat == TRACE_FORMAT_PCEA)
+    {
+        char line[64];
+        while ((rc = worker->dec.Next(&ins)) > 0)
+        {
+            int n;
+            job->count++;
+            /* the bare line keeps the iterations of a rep string apart */
+            n = snprintf(line, sizeof(line), "0x%llx %u\n", (unsigned long long)ins.pc, ins.size);
+            job->out.insert(job->out.end(), line, line + n);
+            for (uint32_t i = 0; i < ins.nrefs; i++)
+            {
+                n = snprintf(line, sizeof(line), "0x%llx 0x%llx %c %u\n", (unsigned long long)ins.pc, 
+                             (unsigned long long)ins.refs[i].addr, ins.refs[i].type == TRACE_REF_WRITE ? 'W' : 'R', 
+                             ins.refs[i].size);
+                job->out.insert(job->out.end(), line, line + n);
+            }
+        }
+        return rc == 0;
+    }
+
+    CHAMPSIM_INSTR r;
+    while ((rc = worker->dec.Next(&ins)) > 0)
+    {
+        if (!job->count++) job->firstpc = ins.pc;
+        else
+        {
+            ChampSimBranch(&r, job->lastnext, ins.pc);
+            ChampSimAppend(job->out, r);
+        }
+        memset(&r, 0, sizeof(r));
+        r.ip = ins.pc;
+        uint32_t loads = 0, stores = 0;
+        for (uint32_t i = 0; i < ins.nrefs; i++)
+        {
+            if (ins.refs[i].type == TRACE_REF_WRITE && stores < CHAMPSIM_DESTINATIONS) r.destination_memory[stores++] = ins.refs[i].addr;
+            else if (ins.refs[i].type == TRACE_REF_READ && loads < CHAMPSIM_SOURCES) r.source_memory[loads++] = ins.refs[i].addr;
+            else job->dropped++;
+        }
+        job->lastnext = ins.pc + ins.size;
+    }
+    /* the branch of the last one is up to the next chunk of the thread */
+    if (job->count) ChampSimAppend(job->out, r);
+    return rc == 0;
+}
+
+static bool ExportWrite(CVT_JOB *job)
+{
+    CvtInstructions += job->count;
+    CvtDropped += job->dropped;
+    if (CvtFormat == TRACE_FORMAT_PCEA) return fwrite(job->out.data(), 1, job->out.size(), CvtOut) == job->out.size();
+    if (job->out.empty()) return true;
+
+    if (CvtLastHeld)
+    {
+        if (CvtLastTid == job->tid) ChampSimBranch(&CvtLast, CvtLastNext, job->firstpc);
+        if (fwrite(&CvtLast, sizeof(CvtLast), 1, CvtOut) != 1) return false;
+    }
+    const size_t n = job->out.size() - sizeof(CvtLast);
+    memcpy(&CvtLast, &job->out[n], sizeof(CvtLast));
+    CvtLastHeld = true;
+    CvtLastTid = job->tid;
+    CvtLastNext = job->lastnext;
+    return fwrite(job->out.data(), 1, n, CvtOut) == n;
+}
+
+static int Export(const char *binary, const char *foreign, int64_t tid)
+{
+    TRACE_READER trace;
+    if (!trace.Open(binary)) { fprintf(stderr, "tracecvt: %s is not a trace\n", binary); return 1; }
+    if (trace.Header.flags & TRACE_FILTERED) { fprintf(stderr, "tracecvt: %s is filtered, it has no instructions to export\n", binary); return 1; }
+    CvtOut = strcmp(foreign, "-") ? fopen(foreign, "wb") : stdout;
+    if (!CvtOut) { fprintf(stderr, "tracecvt: can not create %s\n", foreign); return 1; }
+
+    CvtStart(ExportWork, binary, &trace);
+    bool ok = true;
+    for (uint32_t c = 0; c < trace.Chunks(); c++)
+    {
+        if (tid >= 0 && trace.Index[c].tid != tid) continue;
+        CVT_JOB *job = CvtNext(ExportWrite, &ok);
+        job->chunk = c;
+        job->tid = trace.Index[c].tid;
+        CvtQueue(job);
+    }
+    ok = CvtStop(ExportWrite) && ok;
+    if (CvtLastHeld) ok = fwrite(&CvtLast, sizeof(CvtLast), 1, CvtOut) == 1 && ok;
+    ok = (CvtOut == stdout ? fflush(CvtOut) : fclose(CvtOut)) == 0 && ok;
+    if (!ok) { fprintf(stderr, "tracecvt: can not convert %s into %s\n", binary, foreign); return 1; }
+
+    fprintf(stderr, "tracecvt: %llu instructions, %llu references left out\n",
+            (unsigned long long)CvtInstructions, (unsigned long long)CvtDropped);
+    return 0;
+}
+
+static int Usage()
+{
+    fprintf(stderr, "usage: tracecvt [-chunk bytes] <text> <binary>   convert a text trace\n"
+                    "       tracecvt -d <binary> [tid [icount]]       print a binary trace as text\n"
+                    "       tracecvt -i <binary>                      print the chunk index\n"
+                    "       tracecvt [-threads n] -import champsim|pcea <foreign> <binary>\n"
+                    "       tracecvt [-threads n] -export champsim|pcea <binary> <foreign> [tid]\n");
+    return 2;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && !strcmp(argv[1], "-threads"))
+    {
+        CvtThreads = (uint32_t)strtoul(argv[2], NULL, 0);
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc >= 5 && (!strcmp(argv[1], "-import") || !strcmp(argv[1], "-export")))
+    {
+        const int format = FormatOf(argv[2]);
+        if (format < 0) return Usage();
+        CvtFormat = (uint32_t)format;
+        if (!strcmp(argv[1], "-import")) return argc == 5 ? Import(argv[3], argv[4]) : Usage();
+        if (argc > 6) return Usage();
+        return Export(argv[3], argv[4], argc > 5 ? atoll(argv[5]) : -1);
+    }
+    if (argc >= 3 && !strcmp(argv[1], "-d"))
+    {
+        if (argc > 5) return Usage();
+        return Print(argv[2], argc > 3 ? atoll(argv[3]) : -1, argc > 4 ? strtoull(argv[4], NULL, 10) : 0);
+    }
+    if (argc == 3 && !strcmp(argv[1], "-i")) return PrintIndex(argv[2]);
+
+    uint32_t chunksize = TRACE_CHUNK_SIZE;
+    if (argc == 5 && !strcmp(argv[1], "-chunk"))
+    {
+        chunksize = (uint32_t)strtoul(argv[2], NULL, 0);
+        if (chunksize < TRACE_ENCODER::RecordMax(TRACE_REFS_MAX)) return Usage();
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 3) return Usage();
+    return Convert(argv[1], argv[2], chunksize);
+}
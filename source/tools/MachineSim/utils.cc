@@ -18,6 +18,13 @@ string mydecstr(UINT64 v, UINT32 w)
     return str;
 }
 
+VOID* AlignedAlloc(size_t size, size_t align)
+{
+    VOID *ptr = NULL;
+    if (posix_memalign(&ptr, align, size)) return NULL;
+    return ptr;
+}
+
 BOOL IsPowerOfTwo(UINT64 n)
 {
     return ((n & (n - 1)) == 0);
@@ -121,22 +128,44 @@ bool AddrSpaceMapParser::GetNextRegion(UINT64 &start, UINT64 &end, UINT64 &perm)
     return true;
 }
 
+UINT64 SIMGLOBALS::get_global_icount() const
+{
+    UINT64 sum = 0;
+    for (THREADID tid=0; tid<MAX_CACHE_THREAD; ++tid) sum += get_thread_icount(tid)->icount;
+    return sum;
+}
+
+UINT64 SIMGLOBALS::get_global_icount(SimInsCount::INSTYPE type) const
+{
+    UINT64 sum = 0;
+    for (THREADID tid=0; tid<MAX_CACHE_THREAD; ++tid) sum += get_thread_icount(tid)->type[type];
+    return sum;
+}
+
+UINT64 SIMGLOBALS::get_global_bblcount() const
+{
+    UINT64 sum = 0;
+    for (THREADID tid=0; tid<MAX_CACHE_THREAD; ++tid) sum += get_thread_icount(tid)->bblcount;
+    return sum;
+}
+
 std::string SIMGLOBALS::StatsInstructionCountLongAll()
 {
     std::string out;
-    out += "Load	" + mydecstr(FetchCount, 8);
+    out += "Instruction	" + mydecstr(get_global_icount(), 8);
+    out += "\n";
+    out += "Load	" + mydecstr(get_global_icount(SimInsCount::INS_LOAD), 8);
     out += "\n";
-    out += "Store	" + mydecstr(StoreCount, 8);
+    out += "Store	" + mydecstr(get_global_icount(SimInsCount::INS_STORE), 8);
     out += "\n";
-    out += "Branch	" + mydecstr(BranchCount, 8);
+    out += "Branch	" + mydecstr(get_global_icount(SimInsCount::INS_BRANCH), 8);
     out += "\n";
-    out += "Call	" + mydecstr(CallCount, 8);
+    out += "Call	" + mydecstr(get_global_icount(SimInsCount::INS_CALL), 8);
     out += "\n";
-    out += "Return	" + mydecstr(ReturnCount, 8);
+    out += "Return	" + mydecstr(get_global_icount(SimInsCount::INS_RET), 8);
     out += "\n";
-    out += "BasicBlock	" + mydecstr(BasicBlockCount, 8);
+    out += "BasicBlock	" + mydecstr(get_global_bblcount(), 8);
     out += "\n";
 
     return out;
 }
-
@@ -12,6 +12,7 @@
 #include <cassert>
 #include <cstdarg>
 #include <sstream>
+#include <new>
 
 #define ABSTRACT_CLASS    =0
 #define CACHESIM_MAX(a,b) (a>=b) ? a : b
@@ -25,6 +26,7 @@
 #define MEGA              (KILO*KILO)
 #define GIGA              (KILO*MEGA)
 #define MAX_CACHE_THREAD  (128) 
+#define CACHELINE_SIZE    (64)
 #define GETPAGE(addr)     (addr >> PAGEBITS)
 #define GETBLOCK(addr)    (addr >> BLOCKBITS)
 #define GETSUBBLOCK(addr) ((addr & (PAGESIZE-1)) >> BLOCKBITS)
@@ -45,6 +47,7 @@ string StringInt(int number);
 string StringDouble(double number);
 string StringHex(int number);
 string mydecstr(UINT64 v, UINT32 w);
+VOID*  AlignedAlloc(size_t size, size_t align);
 
 /* ===================================================================== */
 /* initialization and finalization prototypes. */
@@ -57,6 +60,19 @@ VOID MachineSimBasicBlockModuleInit();
 VOID MachineSimBasicBlockModuleFini();
 VOID MachineSimCacheTLBModuleInit();
 VOID MachineSimCacheTLBModuleFini();
+VOID MachineSimWorkerModuleInit();
+VOID MachineSimWorkerModuleFini();
+VOID MachineSimSamplingModuleInit();
+VOID MachineSimSamplingModuleFini();
+VOID MachineSimTraceModuleInit();
+VOID MachineSimTraceModuleFini();
+VOID MachineSimSweepModuleInit();
+VOID MachineSimSweepModuleFini();
+/// the internal threads finish their work and exit before the fini above,
+/// with the vm unlocked so that they may still call into pin.
+VOID MachineSimWorkerModuleExit();
+VOID MachineSimTraceModuleExit();
+VOID MachineSimSweepModuleExit();
 
 /* ===================================================================== */
 /* instrumentation function declarations. */
@@ -64,8 +80,123 @@ VOID MachineSimCacheTLBModuleFini();
 VOID ImageInstrument(IMG img, VOID *v);
 VOID RoutineInstrument(RTN rtn, VOID *);
 VOID InstructionInstrument(INS ins, VOID *v);
-VOID SimpleInstructionCount(INS ins, VOID *v);
 VOID TraceInstrument(TRACE trace, VOID *v);
+VOID GenerateSimulationTrace(INS ins, VOID *v);
+
+/* ===================================================================== */
+/* buffered memory reference records. */
+/* ===================================================================== */
+/// @ MEMREF - a compact memory reference. with -membuf the instrumentation
+/// @ only writes these into a per-thread pin buffer and the whole buffer is
+/// @ run through the cache hierarchy when it fills up.
+typedef enum
+{
+   MEMREF_IFETCH=0,
+   MEMREF_LOAD,
+   MEMREF_STORE
+} MEMREF_TYPE;
+
+typedef struct
+{
+   ADDRINT pc;     /* address of the instruction */
+   ADDRINT ea;     /* effective address, pc for instruction fetches */
+   UINT32  size;   /* size of the access in bytes */
+   UINT32  type;   /* one of MEMREF_TYPE */
+} MEMREF;
+
+/// @ MemRefBufferDrain - run num buffered references of thread tid 
+/// @ through the cache hierarchy.
+VOID MemRefBufferDrain(const MEMREF *ref, UINT64 num, THREADID tid);
+
+/// @ CacheL2Ref - run a reference that missed in the L1 filter caches of a
+/// @ filtered trace through the L2 and L3, type 0 for a load, 1 for a store.
+VOID CacheL2Ref(ADDRINT iaddr, ADDRINT addr, UINT32 size, UINT32 type, THREADID tid);
+
+/// @ the set sharded replay runs the cache and the tlb side of a reference
+/// @ on different threads, type is one of MEMREF_TYPE. CacheShardable tells
+/// @ whether every level can be split by set, CacheShareThread lets thread
+/// @ tid use the private caches and tlbs of owner. see caches.cc.
+VOID CacheSideRef(ADDRINT iaddr, ADDRINT addr, UINT32 size, UINT32 type, THREADID tid);
+VOID TlbSideRef(ADDRINT addr, UINT32 type, THREADID tid);
+BOOL CacheShardable(UINT32 *lineshift, UINT32 *setbits, UINT32 *tlbsets);
+VOID CacheShareThread(THREADID tid, THREADID owner);
+
+/* ===================================================================== */
+/* simulation worker pool. */
+/* ===================================================================== */
+/// @ with -simthreads the application threads only hand their full memory
+/// @ reference buffers over to a pool of pin internal threads, which run
+/// @ the private caches and tlbs of the threads they own. the shared L3 is 
+/// @ run by a merge thread, which applies the L3 accesses of every buffer 
+/// @ in the order the application threads filled the buffers.
+VOID *MachineSimWorkerPush(BUFFER_ID id, VOID *buf, UINT64 num, THREADID tid);
+
+/// @ hooks of the cache module for the worker pool. when deferred, L3 
+/// @ accesses and the back-invalidations caused by L3 evictions are handed
+/// @ to the given routines instead of being simulated on the spot. an L3 
+/// @ eviction back-invalidates the private caches of every thread that 
+/// @ used the L3. without a routine for them they are all evicted on the 
+/// @ spot, by default the other threads apply them on their next access.
+typedef VOID (*UL3_DEFER_ROUTINE)(ADDRINT iaddr, ADDRINT addr, UINT32 size, UINT32 type, THREADID tid);
+typedef VOID (*EVICT_DEFER_ROUTINE)(ADDRINT addr, THREADID tid);
+VOID CacheDeferUl3(UL3_DEFER_ROUTINE access, EVICT_DEFER_ROUTINE evict);
+VOID CacheUl3Access(ADDRINT iaddr, ADDRINT addr, UINT32 size, UINT32 type, THREADID tid);
+VOID CacheUl3EvictPrev(ADDRINT addr, THREADID tid);
+
+/* ===================================================================== */
+/* configuration sweep. */
+/* ===================================================================== */
+/// @ with -sweep every full memory reference buffer is also simulated by
+/// @ the hierarchy of every other configuration, each on a thread of its 
+/// @ own, and every hierarchy gets a report of its own. SweepPush hands a
+/// @ buffer to the sweep threads, see sweep.cc.
+struct CACHE_HIERARCHY;
+CACHE_HIERARCHY *CacheHierarchyNew(const ParseXML *config);
+UINT32 CacheHierarchyCounters();
+VOID CacheHierarchyRefs(const CACHE_HIERARCHY *h, const MEMREF *ref, UINT64 num, BOOL filtered, THREADID tid);
+VOID CacheHierarchyReport(const CACHE_HIERARCHY *h, const string &name, const string &config);
+VOID CacheHierarchyDelete(CACHE_HIERARCHY *h);
+VOID SweepPush(const MEMREF *ref, UINT64 num, BOOL filtered, THREADID tid);
+
+/* ===================================================================== */
+/* periodic sampling. */
+/* ===================================================================== */
+/// @ CacheLevelCounts - the accesses and misses counted so far by the
+/// @ L1 icache, L1 dcache, L2, L3, micro itlb, micro dtlb, L1 itlb, L1 dtlb
+/// @ and L2 tlb, in this order. 0 for a missing level. returns a mask
+/// @ of the levels that are there.
+enum { CACHE_COUNTED_LEVELS = 9 };
+UINT32 CacheLevelCounts(UINT64 *accesses, UINT64 *misses);
+
+/// @ CacheCheckpointAt - save the -ckptsave checkpoint once the instruction
+/// @ count reaches -ckptat, threads is the number of threads that ran so far
+/// @ and simulate their caches on threads of their own.
+VOID CacheCheckpointAt(UINT64 icount, UINT32 threads);
+
+/// @ the time segmented replay simulates every segment of the trace in a
+/// @ process of its own and adds up their counters. CacheCounters copies the
+/// @ counters of the first threads threads and the L3 banks, CacheStateHash
+/// @ tells whether two runs reached the same state. see caches.cc.
+VOID   CacheStateSave(const string &name, UINT64 icount);
+VOID   CacheStateLoad(const string &name);
+UINT64 CacheStateHash();
+UINT32 CacheCounters(UINT64 *counts, UINT32 threads);
+VOID   CacheCountersAdd(const UINT64 *counts, UINT32 threads);
+
+/* ===================================================================== */
+/* same line filter. */
+/* ===================================================================== */
+/// @ with -l1filter an instruction fetch or a data access to the L1 line
+/// @ the thread accessed last is counted as a hit by an inlined IF call
+/// @ and only the other accesses run the simulation in the THEN call.
+/// @ it is on by default and turns itself off unless the L1 and first TLB
+/// @ policies keep their state on such a hit, the same reports come out
+/// @ either way. the set sharded replay never filters.
+BOOL InsFetchFilter(UINT32 *shift);
+BOOL DataRefFilter(UINT32 *shift);
+ADDRINT PIN_FAST_ANALYSIS_CALL InsFetchNewLine(ADDRINT addr, UINT32 shift, THREADID tid);
+ADDRINT PIN_FAST_ANALYSIS_CALL DataRefNewLine(ADDRINT addr, UINT32 size, UINT32 shift, UINT32 type, THREADID tid);
+VOID LineFilterReset();
 
 /// @ forward class declaration.
 class SIMLOWLEVEL;
@@ -359,11 +490,25 @@ public:
 };
 
 
-/// SIMSTATS - simulation global stats.
+/// SIMSTATS - simulation global stats. every thread owns a fixed-size block
+/// of counters indexed by its THREADID. a counter is claimed once at init
+/// time and is the same slot in every block, so counting is a plain increment
+/// into cache lines only the counting thread touches. readers sum the blocks.
 class SIMSTATS
 {
+public:
+    /// number of counters in the block of every thread. a hierarchy claims
+    /// up to 144 of them, 216 with -opt, and every -sweep configuration adds
+    /// a hierarchy, see CacheHierarchyCounters.
+    enum { MAX_COUNTERS = 4096 };
+    /// a claimed counter, i.e. the index of the counter in every block.
+    typedef UINT32 COUNTER;
 private:
-    SIMSTATS() : instcount(0) {}
+    SIMSTATS() : blocks(0), claimed(0)
+    {
+        blocks = (UINT64*) AlignedAlloc(sizeof(UINT64)*MAX_COUNTERS*MAX_CACHE_THREAD, CACHELINE_SIZE);
+        memset(blocks, 0, sizeof(UINT64)*MAX_COUNTERS*MAX_CACHE_THREAD);
+    }
     /// dont forget to declare these two. want to make sure they
     /// are unaccessable otherwise one may accidently get copies of
     /// singleton appearing.
@@ -371,13 +516,46 @@ private:
     void operator=(SIMSTATS const&);  // don't implement
 
 private:
-    UINT64 instcount;    /// global simulated instruction count.
+    UINT64  *blocks;     /// MAX_CACHE_THREAD blocks of MAX_COUNTERS counters.
+    COUNTER  claimed;    /// number of counters claimed so far.
 public:
-    inline UINT64  get_instcount() const     { return instcount; }
-    inline void    set_instcount(UINT64 val) { instcount = val;  }
-    inline UINT64* get_instcountaddr()       { return &instcount;}
+    virtual ~SIMSTATS() { free(blocks); }
 
-    /// get_singleton - only one atomic ops object is needed.
+    /// claim - claim num consecutive counters. claims start on a cache line 
+    /// boundary so a claimed range can be overlaid with a padded structure.
+    COUNTER claim(UINT32 num)
+    {
+        COUNTER first = claimed;
+        claimed += claimed_size(num);
+        ASSERTX(claimed <= MAX_COUNTERS);
+        return first;
+    }
+    /// claimed_size - the counters a claim of num counters takes up.
+    static UINT32 claimed_size(UINT32 num)
+    {
+        const UINT32 line = CACHELINE_SIZE/sizeof(UINT64);
+        return ((num + line - 1) / line) * line;
+    }
+
+    inline UINT64* get_block(THREADID tid) const            { return blocks + tid*MAX_COUNTERS;               }
+    inline COUNTER get_claimed() const                      { return claimed;                                 }
+    inline UINT64  get(THREADID tid, COUNTER c) const       { return blocks[tid*MAX_COUNTERS+c];              }
+    inline VOID    inc(THREADID tid, COUNTER c)             { ++ blocks[tid*MAX_COUNTERS+c];                  }
+    inline VOID    add(THREADID tid, COUNTER c, UINT64 val) { blocks[tid*MAX_COUNTERS+c] += val;              }
+    /// fold - move the counters of thread from into the block of thread to.
+    inline VOID    fold(THREADID from, THREADID to)
+    {
+        for (COUNTER c=0; c<claimed; ++c) { blocks[to*MAX_COUNTERS+c] += blocks[from*MAX_COUNTERS+c]; }
+        memset(get_block(from), 0, sizeof(UINT64)*MAX_COUNTERS);
+    }
+    inline UINT64  sum(COUNTER c) const
+    {
+        UINT64 total = 0;
+        for (THREADID tid=0; tid<MAX_CACHE_THREAD; ++tid) total += blocks[tid*MAX_COUNTERS+c];
+        return total;
+    }
+
+    /// get_singleton - only one stats object is needed.
     static SIMSTATS* get_singleton()
     {
         static SIMSTATS *at = new SIMSTATS;
@@ -392,11 +570,25 @@ public:
     enum
     {
         WAIT_INSTRUCTION=1,
-        WAIT_WORKER_THREAD=2
+        WAIT_WORKER_THREAD=2,
+        WAIT_SAMPLING=3
     };
 private:
     UINT64 simulate;
-    SIMPARAMS() : simulate(0) {}
+    /// functional warming: the caches are simulated but nothing is counted.
+    BOOL warming;
+    /// fast-forward: nothing is instrumented while simulation is off, the
+    /// code is re-instrumented whenever simulation is switched on or off.
+    BOOL toggling;
+    SIMPARAMS() : simulate(0), warming(false), toggling(false) {}
+    /// toggle - simulation switched on or off, drop the instrumented code
+    /// and the last lines of the same line filter.
+    inline VOID toggle(UINT64 was) 
+    { 
+        if (!was == !simulate) return;
+        LineFilterReset();
+        if (toggling) PIN_RemoveInstrumentation(); 
+    }
     /// dont forget to declare these two. want to make sure they
     /// are unaccessable otherwise one may accidently get copies of
     /// singleton appearing.
@@ -406,8 +598,14 @@ private:
 public:
     virtual ~SIMPARAMS() {}
     inline BOOL dosim()           { return simulate == 0;    }
-    inline VOID setwait(int wait) { simulate |= (1)<<wait;   }
-    inline VOID clrwait(int wait) { simulate &= ~((1)<<wait);}
+    /// instrument - whether analysis calls go into the code compiled now.
+    /// without toggling the code is never re-instrumented, so it needs them.
+    inline BOOL instrument()      { return dosim() || !toggling; }
+    inline VOID setwait(int wait) { UINT64 was = simulate; simulate |= (1)<<wait; toggle(was);    }
+    inline VOID clrwait(int wait) { UINT64 was = simulate; simulate &= ~((1)<<wait); toggle(was); }
+    inline VOID settoggle(BOOL on){ toggling = on;           }
+    inline BOOL dostats()         { return !warming;         }
+    inline VOID setwarm(BOOL warm){ warming = warm;          }
     /// get_singleton - only one atomic ops object is needed.
     static SIMPARAMS* get_singleton()
     {
@@ -419,13 +617,19 @@ public:
 /// SIMLOCKS - simulation locks.
 class SIMLOCK
 {
+public:
+    enum { MAX_L3_BANKS = 1024 };
 private:
-    /// provide exclusive access to L3 cache.
-    PIN_MUTEX CacheSimMutex;
-    SIMLOCK()
+    /// one lock per bank of L3 sets, padded to a cache line so that threads
+    /// working on different banks do not bounce lines.
+    typedef struct
     {
-        PIN_MutexInit(&CacheSimMutex);
-    }
+        PIN_MUTEX mutex;
+        UINT8 pad[CACHELINE_SIZE - sizeof(PIN_MUTEX) % CACHELINE_SIZE];
+    } BANKLOCK;
+    BANKLOCK *L3Banks;
+    UINT32 L3BankMask;
+    SIMLOCK() : L3Banks(NULL), L3BankMask(0) {}
     /// dont forget to declare these two. want to make sure they
     /// are unaccessable otherwise one may accidently get copies of
     /// singleton appearing.
@@ -433,9 +637,25 @@ private:
     void operator=(SIMLOCK const&);  // don't implement
 
 public:
-    virtual ~SIMLOCK() {}
-    inline void lock_l3_cache(unsigned tid)  { PIN_MutexLock(&CacheSimMutex);   }
-    inline void unlock_l3_cache(unsigned tid){ PIN_MutexUnlock(&CacheSimMutex); }
+    virtual ~SIMLOCK() 
+    {
+        for (UINT32 i=0; L3Banks && i<=L3BankMask; i++) PIN_MutexFini(&L3Banks[i].mutex);
+        free(L3Banks);
+    }
+    /// split the L3 sets into banks, rounded down to a power of 2.
+    void init_l3_banks(UINT32 banks)
+    {
+        banks = std::max<UINT32>(1, std::min<UINT32>(banks, MAX_L3_BANKS));
+        while (banks & (banks-1)) banks &= banks-1;
+        L3Banks = (BANKLOCK*) AlignedAlloc(sizeof(BANKLOCK)*banks, CACHELINE_SIZE);
+        for (UINT32 i=0; i<banks; i++) PIN_MutexInit(&L3Banks[i].mutex);
+        L3BankMask = banks-1;
+    }
+    /// the L3 set at setindex belongs to bank setindex % banks.
+    inline UINT32 get_l3_bank(UINT32 setindex) const { return setindex & L3BankMask;  }
+    inline UINT32 get_l3_banks() const               { return L3BankMask + 1;         }
+    inline void lock_l3_bank(UINT32 bank)            { PIN_MutexLock(&L3Banks[bank].mutex);   }
+    inline void unlock_l3_bank(UINT32 bank)          { PIN_MutexUnlock(&L3Banks[bank].mutex); }
     static SIMLOCK* get_singleton()
     {
         static SIMLOCK *at = new SIMLOCK;
@@ -443,35 +663,137 @@ public:
     }
 };
 
-/// SIMLOCKS - simulation locks.
-class SIMGLOBALS
+/// SIMRING - lock free single producer single consumer ring of N entries.
+/// the producer only writes tail and the consumer only writes head, they
+/// live on different cache lines.
+template <class T, UINT32 N> class SIMRING
+{
+private:
+    volatile UINT64 head __attribute__ ((aligned (CACHELINE_SIZE)));
+    volatile UINT64 tail __attribute__ ((aligned (CACHELINE_SIZE)));
+    T entries[N] __attribute__ ((aligned (CACHELINE_SIZE)));
+public:
+    SIMRING() : head(0), tail(0) {}
+    /// producer side, false when the ring is full.
+    BOOL push(const T &entry)
+    {
+        const UINT64 t = tail;
+        if (t - __atomic_load_n(&head, __ATOMIC_ACQUIRE) == N) return false;
+        entries[t % N] = entry;
+        __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+    /// consumer side, false when the ring is empty.
+    BOOL pop(T &entry)
+    {
+        const UINT64 h = head;
+        if (h == __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) return false;
+        entry = entries[h % N];
+        __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+    BOOL empty() const { return head == __atomic_load_n(&tail, __ATOMIC_ACQUIRE); }
+};
+
+/// SimRingsNew/SimRingsDelete - an array of n objects holding SIMRINGs, on
+/// cache line aligned memory so that the rings keep their lines.
+template <class T> T *SimRingsNew(UINT32 n)
+{
+    T *rings = (T*) AlignedAlloc(sizeof(T)*n, CACHELINE_SIZE);
+    for (UINT32 i=0; i<n; i++) new (&rings[i]) T;
+    return rings;
+}
+template <class T> VOID SimRingsDelete(T *rings, UINT32 n)
+{
+    for (UINT32 i=0; rings && i<n; i++) rings[i].~T();
+    free(rings);
+}
+
+/// SIMPOLLER - an internal thread consuming SIMRINGs. it calls Poll until
+/// Exit, Poll runs the work queued so far and returns whether there was
+/// any, the thread sleeps when there was none. the work is all queued 
+/// before Exit is called, the thread finishes it and exits.
+class SIMPOLLER
+{
+public:
+    typedef BOOL (*POLL_ROUTINE)(VOID *arg);
+private:
+    POLL_ROUTINE Poll;
+    VOID *Arg;
+    volatile BOOL Exiting;
+    PIN_THREAD_UID Uid;
+    static VOID Run(VOID *self)
+    {
+        SIMPOLLER *poller = static_cast<SIMPOLLER*>(self);
+        for (;;)
+        {
+            const BOOL exiting = __atomic_load_n(&poller->Exiting, __ATOMIC_ACQUIRE);
+            if (poller->Poll(poller->Arg)) continue;
+            if (exiting) break;
+            PIN_Sleep(1);
+        }
+        PIN_ExitThread(0);
+    }
+public:
+    SIMPOLLER() : Poll(NULL), Arg(NULL), Exiting(false) {}
+    /// Start - spawn the thread, false if pin could not.
+    BOOL Start(POLL_ROUTINE poll, VOID *arg)
+    {
+        Poll = poll;
+        Arg = arg;
+        return PIN_SpawnInternalThread(Run, this, 0, &Uid) != INVALID_THREADID;
+    }
+    /// Exit - let the thread finish the queued work and wait for it, from 
+    /// an unlocked fini.
+    VOID Exit()
+    {
+        __atomic_store_n(&Exiting, true, __ATOMIC_RELEASE);
+        PIN_WaitForThreadTermination(Uid, PIN_INFINITE_TIMEOUT, NULL);
+    }
+};
+
+/// @ SimInsCount - per-thread instruction counts. every thread owns one
+/// @ slot in its SIMSTATS block, so counting never bounces a line between
+/// @ cores. the slots are only summed up when the counts are reported.
+class SimInsCount 
 {
 public:
-   typedef enum {
+   typedef enum 
+   {
       INS_LOAD=0,
       INS_STORE,
       INS_BRANCH,
       INS_CALL,
-      INS_RET
-   }  INSTYPE;
-private:
-    // Global instruction count.
-    UINT64 InstCount;
-    UINT64 FetchCount;
-    UINT64 StoreCount;
-    UINT64 BranchCount;
-    UINT64 CallCount;
-    UINT64 ReturnCount;
-    UINT64 BasicBlockCount;
-
+      INS_RET,
+      INS_TYPE_NUM
+   } INSTYPE;
+   /// counts of a single basicblock, computed once at instrumentation time.
+   typedef struct
+   {
+      UINT32 icount;
+      UINT32 type[INS_TYPE_NUM];
+   } BBLCOUNT;
+public:
+   UINT64 icount;              /// instructions executed by the thread.
+   UINT64 bblcount;            /// basicblocks executed by the thread.
+   UINT64 nextcheck;           /// icount at which the global count is checked.
+   UINT64 type[INS_TYPE_NUM];  /// instructions executed by type.
 public:
-    VOID IncInst(void)      { simatom->atom_uint64_inc((UINT64*)&InstCount);        }
-    VOID IncFetch(void)     { simatom->atom_uint64_inc((UINT64*)&FetchCount);       }
-    VOID IncStore(void)     { simatom->atom_uint64_inc((UINT64*)&StoreCount);       }
-    VOID IncBranch(void)    { simatom->atom_uint64_inc((UINT64*)&BranchCount);      }
-    VOID IncCall(void)      { simatom->atom_uint64_inc((UINT64*)&CallCount);        }
-    VOID IncReturn(void)    { simatom->atom_uint64_inc((UINT64*)&ReturnCount);      }
-    VOID IncBasicBlock(void){ simatom->atom_uint64_inc((UINT64*)&BasicBlockCount);  }
+   inline VOID Add(const BBLCOUNT *bbl)
+   {
+      icount += bbl->icount;
+      ++ bblcount;
+      for (INT32 i=0; i<INS_TYPE_NUM; ++i) type[i] += bbl->type[i];
+   }
+} __attribute__ ((aligned (CACHELINE_SIZE)));
+
+/// SIMLOCKS - simulation locks.
+class SIMGLOBALS
+{
+private:
+    // Per-thread instruction counts, claimed from the stats blocks.
+    SIMSTATS *simstats;
+    SIMSTATS::COUNTER InsCounters;
 private:
     // Global time.
     struct timespec *tinit;
@@ -483,8 +805,10 @@ private:
     // used to do atomic operations.
     SIMLOWLEVEL *simatom;
 private:
-    SIMGLOBALS() : InstCount(0), FetchCount(0), StoreCount(0), BranchCount(0), CallCount(0), ReturnCount(0)
+    SIMGLOBALS()
     {
+       simstats = SIMSTATS::get_singleton();
+       InsCounters = simstats->claim(sizeof(SimInsCount)/sizeof(UINT64));
        tinit = new struct timespec;
        tfini = new struct timespec;
        *tfini = *tinit = { 0, 0 };
@@ -518,8 +842,13 @@ public:
     SIMLOG*          get_global_simlog() const  { return simlog;      }
     SIMLOCK*         get_global_simlock()const  { return simlock;     }
     SIMLOWLEVEL*     get_global_simlowl()const  { return simatom;     }
-    UINT64           get_global_icount() const  { return InstCount;   }
-    UINT64           add_global_icount()        { return simatom->atom_uint64_inc((UINT64*)&InstCount); }
+    SimInsCount*     get_thread_icount(THREADID tid) const 
+    { 
+        return reinterpret_cast<SimInsCount*>(simstats->get_block(tid) + InsCounters);
+    }
+    UINT64           get_global_icount() const;
+    UINT64           get_global_icount(SimInsCount::INSTYPE type) const;
+    UINT64           get_global_bblcount() const;
     std::string      StatsInstructionCountLongAll();
 };
 
@@ -534,9 +863,32 @@ private:
 
     /// miscellaneous simulation options.
     BOOL SIM_TraceRecord;
+    string SIM_TraceFile;
+    UINT32 SIM_TraceChunk;
+    UINT32 SIM_TraceBuffers;
+    UINT32 SIM_TraceWrite;
+    BOOL SIM_TraceDrop;
+    UINT32 SIM_TraceFilter;
+    UINT32 SIM_TraceFilterAssoc;
+    UINT32 SIM_TraceFilterLine;
     BOOL SIM_DetailPageStats;
     BOOL SIM_EnableInsCount;
     BOOL SIM_EnableMemSimul;
+    BOOL SIM_EnableMemBuffer;
+    UINT32 SIM_MemBufferPages;
+    UINT32 SIM_L3Banks;
+    UINT32 SIM_SimThreads;
+    BOOL SIM_StackDist;
+    BOOL SIM_Opt;
+    UINT32 SIM_OptWindow;
+    UINT32 SIM_L3Sample;
+    UINT64 SIM_SampleSkip;
+    BOOL SIM_L1Filter;
+    string SIM_CkptSave;
+    string SIM_CkptLoad;
+    UINT64 SIM_CkptAt;
+    std::vector<string> SIM_Sweep;
+    BOOL SIM_L3SampleHash;
     UINT32 SIM_WaitWorkerCount;
     UINT64 SIM_MaxSimInstCount;
 
@@ -548,9 +900,29 @@ private:
     void reset_all()
     {
         SIM_TraceRecord     = false;
+        SIM_TraceChunk      = 1 << 20;
+        SIM_TraceBuffers    = 3;
+        SIM_TraceWrite      = 4 << 20;
+        SIM_TraceDrop       = false;
+        SIM_TraceFilter     = 0;
+        SIM_TraceFilterAssoc = 8;
+        SIM_TraceFilterLine = 64;
         SIM_DetailPageStats = false;
         SIM_EnableInsCount = false;
         SIM_EnableMemSimul = false;
+        SIM_EnableMemBuffer = false;
+        SIM_MemBufferPages = 256;
+        SIM_L3Banks = 64;
+        SIM_SimThreads = 0;
+        SIM_StackDist = false;
+        SIM_Opt = false;
+        SIM_OptWindow = 8;
+        SIM_L3Sample = 1;
+        SIM_SampleSkip = 0;
+        SIM_L1Filter = true;
+        SIM_CkptAt = 0;
+        SIM_Sweep.clear();
+        SIM_L3SampleHash = false;
         SIM_WaitWorkerCount = 0;
         SIM_MaxSimInstCount = ULLONG_MAX;
     }
@@ -584,6 +956,22 @@ public:
     inline VOID get_detailpagestats(BOOL val)   { SIM_DetailPageStats = val;    }        
     inline BOOL get_tracerecord()               { return SIM_TraceRecord;       }        
     inline VOID set_tracerecord(BOOL val)       { SIM_TraceRecord = val;        }        
+    inline string get_tracefile() const         { return SIM_TraceFile;         }
+    inline VOID set_tracefile(string val)       { SIM_TraceFile = val;          }
+    inline UINT32 get_tracechunk() const        { return SIM_TraceChunk;        }
+    inline VOID set_tracechunk(UINT32 val)      { SIM_TraceChunk = val;         }
+    inline UINT32 get_tracebuffers() const      { return SIM_TraceBuffers;      }
+    inline VOID set_tracebuffers(UINT32 val)    { SIM_TraceBuffers = val;       }
+    inline UINT32 get_tracewrite() const        { return SIM_TraceWrite;        }
+    inline VOID set_tracewrite(UINT32 val)      { SIM_TraceWrite = val;         }
+    inline BOOL get_tracedrop() const           { return SIM_TraceDrop;         }
+    inline VOID set_tracedrop(BOOL val)         { SIM_TraceDrop = val;          }
+    inline UINT32 get_tracefilter() const       { return SIM_TraceFilter;       }
+    inline VOID set_tracefilter(UINT32 val)     { SIM_TraceFilter = val;        }
+    inline UINT32 get_tracefilter_assoc() const { return SIM_TraceFilterAssoc;  }
+    inline VOID set_tracefilter_assoc(UINT32 val){ SIM_TraceFilterAssoc = val;  }
+    inline UINT32 get_tracefilter_line() const  { return SIM_TraceFilterLine;   }
+    inline VOID set_tracefilter_line(UINT32 val){ SIM_TraceFilterLine = val;    }
     inline string get_replacepolicy() const     { return SIM_ReplacePolicy;     }
     inline VOID set_replacepolicy(string val)   { SIM_ReplacePolicy = val;      }
     inline VOID set_workercount(UINT32 val)     { SIM_WaitWorkerCount = val;    }
@@ -594,6 +982,36 @@ public:
     inline VOID set_ins_count(BOOL val)         { SIM_EnableInsCount = val;     }
     inline BOOL get_mem_simul(void) const       { return SIM_EnableMemSimul;    }
     inline VOID set_mem_simul(BOOL val)         { SIM_EnableMemSimul = val;     }
+    inline BOOL get_mem_buffer(void) const      { return SIM_EnableMemBuffer;   }
+    inline VOID set_mem_buffer(BOOL val)        { SIM_EnableMemBuffer = val;    }
+    inline UINT32 get_mem_buffer_pages() const  { return SIM_MemBufferPages;    }
+    inline VOID set_mem_buffer_pages(UINT32 val){ SIM_MemBufferPages = val;     }
+    inline UINT32 get_l3_banks() const          { return SIM_L3Banks;           }
+    inline VOID set_l3_banks(UINT32 val)        { SIM_L3Banks = val;            }
+    inline UINT32 get_sim_threads() const       { return SIM_SimThreads;        }
+    inline VOID set_sim_threads(UINT32 val)     { SIM_SimThreads = val;         }
+    inline BOOL get_stackdist() const           { return SIM_StackDist;         }
+    inline VOID set_stackdist(BOOL val)         { SIM_StackDist = val;          }
+    inline BOOL get_opt() const                 { return SIM_Opt;               }
+    inline VOID set_opt(BOOL val)               { SIM_Opt = val;                }
+    inline UINT32 get_opt_window() const        { return SIM_OptWindow;         }
+    inline VOID set_opt_window(UINT32 val)      { SIM_OptWindow = val ? val : 1; }
+    inline UINT32 get_l3_sample() const         { return SIM_L3Sample;          }
+    inline UINT64 get_sample_skip() const       { return SIM_SampleSkip;        }
+    inline VOID set_sample_skip(UINT64 val)     { SIM_SampleSkip = val;         }
+    inline BOOL get_l1_filter() const           { return SIM_L1Filter;          }
+    inline VOID set_l1_filter(BOOL val)         { SIM_L1Filter = val;           }
+    inline string get_ckpt_save() const         { return SIM_CkptSave;          }
+    inline VOID set_ckpt_save(string val)       { SIM_CkptSave = val;           }
+    inline string get_ckpt_load() const         { return SIM_CkptLoad;          }
+    inline VOID set_ckpt_load(string val)       { SIM_CkptLoad = val;           }
+    inline UINT64 get_ckpt_at() const           { return SIM_CkptAt;            }
+    inline VOID set_ckpt_at(UINT64 val)         { SIM_CkptAt = val;             }
+    inline const std::vector<string> &get_sweep() const { return SIM_Sweep;     }
+    inline VOID add_sweep(string val)           { SIM_Sweep.push_back(val);     }
+    inline VOID set_l3_sample(UINT32 val)       { SIM_L3Sample = val ? val : 1; }
+    inline BOOL get_l3_sample_hash() const      { return SIM_L3SampleHash;      }
+    inline VOID set_l3_sample_hash(BOOL val)    { SIM_L3SampleHash = val;       }
 
     //// get_singleton - return the only simulation option in the program.
     static SIMOPTS* get_singleton()
@@ -603,33 +1021,5 @@ public:
     }
 };
 
-/// @ SimInsCount - keep instruction counts.
-class SimInsCount 
-{
-public:
-   typedef enum 
-   {
-      INS_LOAD=0,
-      INS_STORE,
-      INS_BRANCH,
-      INS_CALL,
-      INS_RET
-   } INSTYPE;
-private:
-   UINT64 load;
-   UINT64 store;
-   UINT64 branch;
-   UINT64 call;
-   UINT64 ret;
-public:
-   SimInsCount() : load(0), store(0), branch(0), call(0), ret(0) {}
-   VOID IncLoad(void)   { ++ load;   }
-   VOID IncStore(void)  { ++ store;  }
-   VOID IncBranch(void) { ++ branch; }
-   VOID IncCall(void)   { ++ call;   }
-   VOID IncRet(void)    { ++ ret;    }
-   std::string StatsLongAll(); 
-};
-
 
 #endif
@@ -0,0 +1,276 @@
+/*BEGIN_LEGAL
+Intel Open Source License
+
+Copyright (c) 2002-2011 Intel CorpORAtion. All rights reserved.
+
+Written by Xin Tong, University of Toronto.
+
+Redistribution and use in source and binary fORMs, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary fORM must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel CorpORAtion nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+
+/* ===================================================================== */
+/* This file contains the simulation worker pool of the PIN tool         */
+/* ===================================================================== */
+
+#include "pin.H"
+#include "utils.hh"
+#include <map>
+#include <new>
+#include <vector>
+
+/* ===================================================================== */
+/* Globals variables */
+/* ===================================================================== */
+/// WORKER_BATCH - a full buffer of an application thread and its ticket, 
+/// the place of the buffer in the order the application filled them.
+typedef struct
+{
+   MEMREF *buf;
+   UINT64  num;
+   UINT64  ticket;
+} WORKER_BATCH;
+
+/// WORKER_L3REF - an L3 access deferred to the merge thread.
+typedef struct
+{
+   ADDRINT iaddr;
+   ADDRINT addr;
+   UINT32  size;
+   UINT32  type;
+} WORKER_L3REF;
+typedef std::vector<WORKER_L3REF> WORKER_L3BATCH;
+
+/// WORKER_THREAD - the state of an application thread in the worker pool.
+/// application thread tid is owned by worker tid % workers, which is the 
+/// only one to ever touch the private caches and tlbs of tid.
+class WORKER_THREAD
+{
+public:
+   enum { RING_SIZE = 16 };
+   // full buffers, the application thread produces and the worker consumes.
+   SIMRING<WORKER_BATCH, RING_SIZE> Full;
+   // simulated buffers the application thread can fill again.
+   SIMRING<MEMREF*, 2*RING_SIZE> Free;
+   // L3 accesses of the buffer being simulated, only used by the worker.
+   WORKER_L3BATCH *L3Refs;
+   // back-invalidations from L3 evictions, queued by the merge thread.
+   PIN_MUTEX InvalLock;
+   std::vector<ADDRINT> Inval;
+   volatile BOOL HasInval;
+public:
+   WORKER_THREAD() : L3Refs(NULL), HasInval(false) { PIN_MutexInit(&InvalLock); }
+   ~WORKER_THREAD() { PIN_MutexFini(&InvalLock); }
+};
+
+LOCALVAR WORKER_THREAD *WorkerThreads = NULL;
+LOCALVAR SIMPOLLER *WorkerPollers = NULL;
+LOCALVAR SIMPOLLER MergePoller;
+LOCALVAR BUFFER_ID WorkerBufferId = BUFFER_ID_INVALID;
+LOCALVAR volatile UINT64 WorkerTicket = 0;
+/// the tickets the merge thread is done with, and how many buffers may be
+/// simulated by the workers and still wait for it.
+LOCALVAR volatile UINT64 WorkerMerged = 0;
+LOCALCONST UINT64 WORKER_MERGE_BACKLOG = 64;
+
+/// the L3 batches waiting to be merged, by ticket.
+LOCALVAR PIN_MUTEX MergeLock;
+LOCALVAR std::map<UINT64, std::pair<THREADID, WORKER_L3BATCH*> > MergePending;
+
+/* ===================================================================== */
+/* Cache Module Hooks */
+/* ===================================================================== */
+/* WorkerDeferUl3 - record an L3 access of the buffer being simulated */
+LOCALFUN VOID WorkerDeferUl3(ADDRINT iaddr, ADDRINT addr, UINT32 size, UINT32 type, THREADID tid)
+{
+    WORKER_L3REF ref = { iaddr, addr, size, type };
+    ASSERTX(WorkerThreads[tid].L3Refs);
+    WorkerThreads[tid].L3Refs->push_back(ref);
+}
+
+/* WorkerDeferEvict - queue a back-invalidation for the owner of tid, */
+/* one for every thread that used the L3                              */
+LOCALFUN VOID WorkerDeferEvict(ADDRINT addr, THREADID tid)
+{
+    WORKER_THREAD &thread = WorkerThreads[tid];
+    PIN_MutexLock(&thread.InvalLock);
+    thread.Inval.push_back(addr);
+    thread.HasInval = true;
+    PIN_MutexUnlock(&thread.InvalLock);
+}
+
+/* WorkerInvalidate - apply the queued back-invalidations of tid */
+LOCALFUN VOID WorkerInvalidate(WORKER_THREAD &thread, THREADID tid)
+{
+    if (!thread.HasInval) return;
+    std::vector<ADDRINT> inval;
+    PIN_MutexLock(&thread.InvalLock);
+    inval.swap(thread.Inval);
+    thread.HasInval = false;
+    PIN_MutexUnlock(&thread.InvalLock);
+    for (UINT32 i=0; i<inval.size(); i++) CacheUl3EvictPrev(inval[i], tid);
+}
+
+/* ===================================================================== */
+/* Application Side */
+/* ===================================================================== */
+/* MachineSimWorkerPush - hand a full buffer to the worker of tid and 
+   return the buffer to fill next */
+VOID *MachineSimWorkerPush(BUFFER_ID id, VOID *buf, UINT64 num, THREADID tid)
+{
+    ASSERTX(tid < MAX_CACHE_THREAD);
+    WORKER_THREAD &thread = WorkerThreads[tid];
+    WorkerBufferId = id;
+
+    // the merge thread is behind, the L3 accesses of the workers pile up.
+    while (WorkerTicket - __atomic_load_n(&WorkerMerged, __ATOMIC_ACQUIRE) >= WORKER_MERGE_BACKLOG) PIN_Yield();
+    WORKER_BATCH batch = { static_cast<MEMREF*>(buf), num, 
+                           __atomic_fetch_add(&WorkerTicket, 1, __ATOMIC_RELAXED) };
+    // the worker is behind, wait for it.
+    while (!thread.Full.push(batch)) PIN_Yield();
+
+    MEMREF *next = NULL;
+    if (!thread.Free.pop(next)) next = static_cast<MEMREF*>(PIN_AllocateBuffer(id));
+    return next;
+}
+
+/* ===================================================================== */
+/* Worker Side */
+/* ===================================================================== */
+/* WorkerPoll - simulate the buffers of the application threads owned by 
+   the worker */
+LOCALFUN BOOL WorkerPoll(VOID *arg)
+{
+    const UINT32 self = (UINT32)(ADDRINT) arg;
+    const UINT32 workers = SimOpts->get_sim_threads();
+
+    BOOL busy = false;
+    for (THREADID tid = self; tid < MAX_CACHE_THREAD; tid += workers)
+    {
+        WORKER_THREAD &thread = WorkerThreads[tid];
+        WORKER_BATCH batch;
+        WorkerInvalidate(thread, tid);
+        while (thread.Full.pop(batch))
+        {
+            busy = true;
+            thread.L3Refs = new WORKER_L3BATCH;
+            MemRefBufferDrain(batch.buf, batch.num, tid);
+
+            PIN_MutexLock(&MergeLock);
+            MergePending[batch.ticket] = std::make_pair(tid, thread.L3Refs);
+            PIN_MutexUnlock(&MergeLock);
+
+            thread.L3Refs = NULL;
+            thread.Free.push(batch.buf);
+            WorkerInvalidate(thread, tid);
+        }
+    }
+    return busy;
+}
+
+/* MergePoll - run the L3 accesses of the next buffer through the shared 
+   L3 in ticket order, so the L3 sees the same interleaving of the threads
+   whatever the workers are doing */
+LOCALFUN BOOL MergePoll(VOID *arg)
+{
+    std::pair<THREADID, WORKER_L3BATCH*> merge(0, NULL);
+    const UINT64 next = WorkerMerged;
+
+    PIN_MutexLock(&MergeLock);
+    std::map<UINT64, std::pair<THREADID, WORKER_L3BATCH*> >::iterator I = MergePending.find(next);
+    if (I != MergePending.end()) 
+    {
+        merge = I->second;
+        MergePending.erase(I);
+    }
+    PIN_MutexUnlock(&MergeLock);
+    if (!merge.second) return false;
+
+    const WORKER_L3BATCH &refs = *merge.second;
+    for (UINT32 i=0; i<refs.size(); i++)
+    {
+        CacheUl3Access(refs[i].iaddr, refs[i].addr, refs[i].size, refs[i].type, merge.first);
+    }
+    delete merge.second;
+    __atomic_store_n(&WorkerMerged, next + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* ===================================================================== */
+/* Module initialization and finialization functions */
+/* ===================================================================== */
+VOID MachineSimWorkerModuleInit()
+{
+    const UINT32 workers = SimOpts->get_sim_threads();
+    if (!workers) return;
+
+    WorkerThreads = SimRingsNew<WORKER_THREAD>(MAX_CACHE_THREAD);
+    WorkerPollers = new SIMPOLLER[workers];
+    PIN_MutexInit(&MergeLock);
+    CacheDeferUl3(WorkerDeferUl3, WorkerDeferEvict);
+
+    for (UINT32 i=0; i<workers; i++)
+    {
+        if (!WorkerPollers[i].Start(WorkerPoll, (VOID*)(ADDRINT) i))
+        {
+            MACHINESIM_PRINT("Error: could not spawn simulation worker %d\n", i);
+            PIN_ExitProcess(1);
+        }
+    }
+    if (!MergePoller.Start(MergePoll, NULL))
+    {
+        MACHINESIM_PRINT("Error: could not spawn the L3 merge thread\n");
+        PIN_ExitProcess(1);
+    }
+}
+
+VOID MachineSimWorkerModuleExit()
+{
+    const UINT32 workers = SimOpts->get_sim_threads();
+    if (!workers) return;
+
+    // the application threads are gone, let the pool finish the buffers.
+    // once the workers are done every ticket waits for the merge thread.
+    for (UINT32 i=0; i<workers; i++) WorkerPollers[i].Exit();
+    MergePoller.Exit();
+}
+
+VOID MachineSimWorkerModuleFini()
+{
+    const UINT32 workers = SimOpts->get_sim_threads();
+    if (!workers) return;
+
+    // apply the last back-invalidations and free the buffers.
+    for (THREADID tid = 0; tid < MAX_CACHE_THREAD; tid++) 
+    {
+        MEMREF *buf = NULL;
+        WorkerInvalidate(WorkerThreads[tid], tid);
+        while (WorkerThreads[tid].Free.pop(buf)) PIN_DeallocateBuffer(WorkerBufferId, buf);
+    }
+    CacheDeferUl3(NULL, NULL);
+    PIN_MutexFini(&MergeLock);
+    SimRingsDelete(WorkerThreads, MAX_CACHE_THREAD); WorkerThreads = NULL;
+    delete [] WorkerPollers; WorkerPollers = NULL;
+}